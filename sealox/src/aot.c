@@ -0,0 +1,711 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aot.h"
+#include "compiler.h"
+#include "memory.h"
+#include "class.h"
+
+typedef struct {
+    ObjFunc** fns;
+    int count;
+    int capacity;
+} FnList;
+
+/*
+ * State of the C function of one Lox function. Every value on the VM
+ * stack of the frame is a C variable vN, where N is the stack depth,
+ * unless the slot is captured by a closure.
+ */
+typedef struct {
+    FILE* out;
+    ObjFunc* fn;
+    // stack depth before each op, -1 within operands
+    int* depths;
+    bool* targets;
+    bool captured[UINT8_COUNT];
+    bool has_captured;
+    int max_depth;
+} FnCtx;
+
+/*
+ * Functions are listed children first, so that the loader can create
+ * them before the constants that refer to them.
+ */
+static void collect_fns(FnList* list, ObjFunc* fn) {
+    for (int i = 0; i < fn->ops.constants.count; i++) {
+        Val val = fn->ops.constants.vals[i];
+        if (IS_FUNC(val)) {
+            collect_fns(list, UNWRAP_FUNC(val));
+        }
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+        list->fns = (ObjFunc**)realloc(list->fns, sizeof(ObjFunc*) * list->capacity);
+    }
+    list->fns[list->count++] = fn;
+}
+
+static int fn_id(FnList* list, ObjFunc* fn) {
+    for (int i = 0; i < list->count; i++) {
+        if (list->fns[i] == fn) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint16_t read16(uint8_t* op) {
+    return (uint16_t)((op[0] << 8) | op[1]);
+}
+
+static void mark_target(FnCtx* ctx, int target, int depth) {
+    ctx->targets[target] = true;
+    ctx->depths[target] = depth;
+}
+
+/*
+ * Find the stack depth before every op. The compiler only emits
+ * structured control flow, so the depth at an op doesn't depend on how
+ * it is reached. Code that follows a jump or a return is only reachable
+ * through a jump, which then has recorded the depth.
+ */
+static void analyze(FnCtx* ctx) {
+    Ops* ops = &ctx->fn->ops;
+    for (int i = 0; i < ops->count; i++) {
+        ctx->depths[i] = -1;
+        ctx->targets[i] = false;
+    }
+
+    int depth = ctx->fn->arity + 1;
+    ctx->max_depth = depth;
+    bool reachable = true;
+    for (int pos = 0; pos < ops->count; pos += op_length(ops, pos)) {
+        if (!reachable && ctx->depths[pos] >= 0) {
+            depth = ctx->depths[pos];
+        }
+        ctx->depths[pos] = depth;
+        reachable = true;
+
+        uint8_t* op = ops->ops + pos;
+        int next = pos + op_length(ops, pos);
+        switch (*op) {
+            case OP_CONST:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_GLOBAL:
+            case OP_GET_LOCAL:
+            case OP_GET_UPVALUE:
+            case OP_CLASS:
+                depth++;
+                break;
+            case OP_POP:
+            case OP_CLOSE_UPVALUE:
+            case OP_INHERIT:
+            case OP_METHOD:
+            case OP_SET_PROPERTY:
+            case OP_GET_SUPER:
+            case OP_PRINT:
+            case OP_DEFINE_GLOBAL:
+            case OP_ADD:
+            case OP_ADD_NUM:
+            case OP_ADD_STR:
+            case OP_SUBTRACT:
+            case OP_SUBTRACT_NUM:
+            case OP_MULTIPLY:
+            case OP_MULTIPLY_NUM:
+            case OP_DIVIDE:
+            case OP_DIVIDE_NUM:
+            case OP_EQUAL:
+            case OP_LESS:
+            case OP_LESS_NUM:
+            case OP_GREATER:
+            case OP_GREATER_NUM:
+                depth--;
+                break;
+            case OP_RETURN:
+                depth--;
+                reachable = false;
+                break;
+            case OP_JMP_IF_FALSE:
+                mark_target(ctx, next + read16(op + 1), depth);
+                break;
+            case OP_JMP:
+                mark_target(ctx, next + read16(op + 1), depth);
+                reachable = false;
+                break;
+            case OP_LOOP:
+                ctx->targets[next - read16(op + 1)] = true;
+                reachable = false;
+                break;
+            case OP_CALL:
+                depth -= op[1];
+                break;
+            case OP_INVOKE:
+                depth -= op[2];
+                break;
+            case OP_ARRAY:
+                depth -= op[1] - 1;
+                break;
+            case OP_GET_INDEX:
+                depth--;
+                break;
+            case OP_SET_INDEX:
+                depth -= 2;
+                break;
+            case OP_SUPER_INVOKE:
+                // the superclass is popped as well
+                depth -= op[2] + 1;
+                break;
+            case OP_CLOSURE: {
+                ObjFunc* fn = UNWRAP_FUNC(ops->constants.vals[op[1]]);
+                for (int i = 0; i < fn->upvalue_count; i++) {
+                    if (op[2 + 2 * i]) {
+                        ctx->captured[op[3 + 2 * i]] = true;
+                        ctx->has_captured = true;
+                    }
+                }
+                depth++;
+                break;
+            }
+            default:
+                break;
+        }
+        if (depth > ctx->max_depth) {
+            ctx->max_depth = depth;
+        }
+    }
+}
+
+static bool in_memory(FnCtx* ctx, int i) {
+    // slot 0 holds the callee, which is never needed in a variable
+    return i == 0 || (i < UINT8_COUNT && ctx->captured[i]);
+}
+
+// name of the stack slot, in one of a few rotating buffers
+static const char* slot(FnCtx* ctx, int i) {
+    static char bufs[4][24];
+    static int i_buf = 0;
+    char* buf = bufs[i_buf++ % 4];
+    if (in_memory(ctx, i)) {
+        snprintf(buf, sizeof(bufs[0]), "slots[%d]", i);
+    } else {
+        snprintf(buf, sizeof(bufs[0]), "v%d", i);
+    }
+    return buf;
+}
+
+/*
+ * Write the stack back to the VM before calling into the runtime.
+ */
+static void emit_sync(FnCtx* ctx, int depth, int next) {
+    for (int i = 0; i < depth; i++) {
+        if (!in_memory(ctx, i)) {
+            fprintf(ctx->out, "    slots[%d] = v%d;\n", i, i);
+        }
+    }
+    fprintf(ctx->out, "    vm->top = slots + %d;\n", depth);
+    fprintf(ctx->out, "    frame->pc = ops + %d;\n", next);
+}
+
+static void emit_reload(FnCtx* ctx, int i) {
+    if (!in_memory(ctx, i)) {
+        fprintf(ctx->out, "    v%d = slots[%d];\n", i, i);
+    }
+}
+
+static void emit_err(FnCtx* ctx, int next, const char* msg) {
+    fprintf(ctx->out, "        frame->pc = ops + %d;\n", next);
+    fprintf(ctx->out, "        run_err(vm, \"%s\");\n", msg);
+    fprintf(ctx->out, "        return false;\n");
+}
+
+static void emit_num_op(FnCtx* ctx, int depth, int next, const char* mk_val, const char* o) {
+    const char* a = slot(ctx, depth - 2);
+    const char* b = slot(ctx, depth - 1);
+    fprintf(ctx->out, "    if (!IS_NUM(%s) || !IS_NUM(%s)) {\n", a, b);
+    emit_err(ctx, next, "Operands must be numbers");
+    fprintf(ctx->out, "    }\n");
+    fprintf(ctx->out, "    %s = %s(UNWRAP_NUM(%s) %s UNWRAP_NUM(%s));\n", a, mk_val, a, o, b);
+}
+
+static void emit_add(FnCtx* ctx, int depth, int next) {
+    const char* a = slot(ctx, depth - 2);
+    const char* b = slot(ctx, depth - 1);
+    fprintf(ctx->out, "    if (IS_NUM(%s) && IS_NUM(%s)) {\n", a, b);
+    fprintf(ctx->out, "        %s = MK_NUM_VAL(UNWRAP_NUM(%s) + UNWRAP_NUM(%s));\n", a, a, b);
+    fprintf(ctx->out, "    } else if (IS_STR(%s) && IS_STR(%s)) {\n", a, b);
+    emit_sync(ctx, depth, next);
+    fprintf(ctx->out, "    concat(vm);\n");
+    emit_reload(ctx, depth - 2);
+    fprintf(ctx->out, "    } else {\n");
+    emit_err(ctx, next, "Operands must be numbers");
+    fprintf(ctx->out, "    }\n");
+}
+
+/*
+ * Field access with the inline cache of the site, and the runtime as the
+ * slow path. The instance is at depth - 1 for gets, below the value for
+ * sets.
+ */
+static void emit_prop(FnCtx* ctx, uint8_t* op, int depth, int next) {
+    bool is_set = *op == OP_SET_PROPERTY;
+    const char* inst = slot(ctx, depth - (is_set ? 2 : 1));
+    FILE* out = ctx->out;
+    fprintf(out, "    if (IS_INSTANCE(%s) && UNWRAP_INSTANCE(%s)->shape == props[%d].shape && props[%d].slot != -1) {\n",
+            inst, inst, read16(op + 2), read16(op + 2));
+    if (is_set) {
+        const char* val = slot(ctx, depth - 1);
+        fprintf(out, "        GC_BARRIER(vm, UNWRAP_OBJ(%s), %s);\n", inst, val);
+        fprintf(out, "        UNWRAP_INSTANCE(%s)->fields[props[%d].slot] = %s;\n", inst, read16(op + 2), val);
+        fprintf(out, "        %s = %s;\n", inst, val);
+    } else {
+        fprintf(out, "        %s = UNWRAP_INSTANCE(%s)->fields[props[%d].slot];\n", inst, inst, read16(op + 2));
+    }
+    fprintf(out, "    } else {\n");
+    emit_sync(ctx, depth, next);
+    fprintf(out, "    if (!%s(vm, UNWRAP_STR(k[%d]), &props[%d])) return false;\n",
+            is_set ? "set_property" : "get_property", op[1], read16(op + 2));
+    emit_reload(ctx, depth - (is_set ? 2 : 1));
+    fprintf(out, "    }\n");
+}
+
+static void emit_op(FnCtx* ctx, int pos) {
+    Ops* ops = &ctx->fn->ops;
+    uint8_t* op = ops->ops + pos;
+    int next = pos + op_length(ops, pos);
+    int depth = ctx->depths[pos];
+    FILE* out = ctx->out;
+
+    if (ctx->targets[pos]) {
+        fprintf(out, "L%d:;\n", pos);
+    }
+    switch (*op) {
+        case OP_CONST:
+            fprintf(out, "    %s = k[%d];\n", slot(ctx, depth), op[1]);
+            break;
+        case OP_NIL:
+            fprintf(out, "    %s = MK_NIL_VAL;\n", slot(ctx, depth));
+            break;
+        case OP_TRUE:
+            fprintf(out, "    %s = MK_BOOL_VAL(true);\n", slot(ctx, depth));
+            break;
+        case OP_FALSE:
+            fprintf(out, "    %s = MK_BOOL_VAL(false);\n", slot(ctx, depth));
+            break;
+        case OP_POP:
+            break;
+        case OP_RETURN:
+            if (ctx->has_captured) {
+                fprintf(out, "    close_upvalues(vm, slots);\n");
+            }
+            fprintf(out, "    slots[0] = %s;\n", slot(ctx, depth - 1));
+            fprintf(out, "    vm->top = slots + 1;\n");
+            fprintf(out, "    vm->frame_count--;\n");
+            fprintf(out, "    return true;\n");
+            break;
+        case OP_NEGATE: {
+            const char* a = slot(ctx, depth - 1);
+            fprintf(out, "    if (!IS_NUM(%s)) {\n", a);
+            emit_err(ctx, next, "Operand must be a number");
+            fprintf(out, "    }\n");
+            fprintf(out, "    %s = MK_NUM_VAL(-UNWRAP_NUM(%s));\n", a, a);
+            break;
+        }
+        case OP_NOT: {
+            const char* a = slot(ctx, depth - 1);
+            fprintf(out, "    %s = MK_BOOL_VAL(is_falsey(%s));\n", a, a);
+            break;
+        }
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_STR:
+            emit_add(ctx, depth, next);
+            break;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:
+            emit_num_op(ctx, depth, next, "MK_NUM_VAL", "-");
+            break;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:
+            emit_num_op(ctx, depth, next, "MK_NUM_VAL", "*");
+            break;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM:
+            emit_num_op(ctx, depth, next, "MK_NUM_VAL", "/");
+            break;
+        case OP_LESS:
+        case OP_LESS_NUM:
+            emit_num_op(ctx, depth, next, "MK_BOOL_VAL", "<");
+            break;
+        case OP_GREATER:
+        case OP_GREATER_NUM:
+            emit_num_op(ctx, depth, next, "MK_BOOL_VAL", ">");
+            break;
+        case OP_EQUAL: {
+            const char* a = slot(ctx, depth - 2);
+            const char* b = slot(ctx, depth - 1);
+            fprintf(out, "    %s = MK_BOOL_VAL(are_equal(%s, %s));\n", a, a, b);
+            break;
+        }
+        case OP_PRINT:
+            fprintf(out, "    print_line(vm, %s);\n", slot(ctx, depth - 1));
+            break;
+        case OP_DEFINE_GLOBAL:
+            fprintf(out, "    GC_BARRIER_ROOT(vm, %s);\n", slot(ctx, depth - 1));
+            fprintf(out, "    dict_put(&vm->globals, UNWRAP_STR(k[%d]), %s);\n", op[1], slot(ctx, depth - 1));
+            break;
+        case OP_GET_GLOBAL:
+            // the runtime reports the error
+            fprintf(out, "    if (!dict_get(&vm->globals, UNWRAP_STR(k[%d]), &%s)) {\n", op[1], slot(ctx, depth));
+            emit_sync(ctx, depth, next);
+            fprintf(out, "        get_global(vm, UNWRAP_STR(k[%d]));\n", op[1]);
+            fprintf(out, "        return false;\n");
+            fprintf(out, "    }\n");
+            break;
+        case OP_SET_GLOBAL:
+            fprintf(out, "    if (!dict_has(&vm->globals, UNWRAP_STR(k[%d]))) {\n", op[1]);
+            emit_sync(ctx, depth, next);
+            fprintf(out, "        set_global(vm, UNWRAP_STR(k[%d]));\n", op[1]);
+            fprintf(out, "        return false;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "    GC_BARRIER_ROOT(vm, %s);\n", slot(ctx, depth - 1));
+            fprintf(out, "    dict_put(&vm->globals, UNWRAP_STR(k[%d]), %s);\n", op[1], slot(ctx, depth - 1));
+            break;
+        case OP_GET_LOCAL:
+            fprintf(out, "    %s = %s;\n", slot(ctx, depth), slot(ctx, op[1]));
+            break;
+        case OP_SET_LOCAL:
+            fprintf(out, "    %s = %s;\n", slot(ctx, op[1]), slot(ctx, depth - 1));
+            break;
+        case OP_GET_UPVALUE:
+            fprintf(out, "    %s = *frame->closure->upvalues[%d]->slot;\n", slot(ctx, depth), op[1]);
+            break;
+        case OP_SET_UPVALUE:
+            fprintf(out, "    GC_BARRIER(vm, frame->closure->upvalues[%d], %s);\n", op[1], slot(ctx, depth - 1));
+            fprintf(out, "    *frame->closure->upvalues[%d]->slot = %s;\n", op[1], slot(ctx, depth - 1));
+            break;
+        case OP_JMP_IF_FALSE:
+            fprintf(out, "    if (is_falsey(%s)) goto L%d;\n", slot(ctx, depth - 1), next + read16(op + 1));
+            break;
+        case OP_JMP:
+            fprintf(out, "    goto L%d;\n", next + read16(op + 1));
+            break;
+        case OP_LOOP:
+            fprintf(out, "    goto L%d;\n", next - read16(op + 1));
+            break;
+        case OP_CALL: {
+            int argc = op[1];
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    if (!aot_call(vm, &caches[%d], %d)) return false;\n", read16(op + 2), argc);
+            emit_reload(ctx, depth - argc - 1);
+            break;
+        }
+        case OP_CLOSURE:
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    push_closure(vm, frame, UNWRAP_FUNC(k[%d]), ops + %d);\n", op[1], pos + 2);
+            emit_reload(ctx, depth);
+            break;
+        case OP_CLOSE_UPVALUE:
+            // captured locals are always on the VM stack
+            fprintf(out, "    close_upvalues(vm, slots + %d);\n", depth - 1);
+            break;
+        case OP_CLASS:
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    push_val(vm, MK_OBJ_VAL((Obj*)create_class(vm, UNWRAP_STR(k[%d]))));\n", op[1]);
+            emit_reload(ctx, depth);
+            break;
+        case OP_INHERIT:
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    if (!inherit(vm)) return false;\n");
+            break;
+        case OP_METHOD:
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    define_method(vm, UNWRAP_STR(k[%d]));\n", op[1]);
+            break;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            emit_prop(ctx, op, depth, next);
+            break;
+        case OP_INVOKE: {
+            int argc = op[2];
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    if (!aot_invoke(vm, UNWRAP_STR(k[%d]), %d, &props[%d])) return false;\n",
+                    op[1], argc, read16(op + 3));
+            emit_reload(ctx, depth - argc - 1);
+            break;
+        }
+        case OP_GET_SUPER:
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    if (!get_super(vm, UNWRAP_STR(k[%d]))) return false;\n", op[1]);
+            emit_reload(ctx, depth - 2);
+            break;
+        case OP_ARRAY:
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    make_array(vm, %d);\n", op[1]);
+            emit_reload(ctx, depth - op[1]);
+            break;
+        case OP_GET_INDEX: {
+            const char* arr = slot(ctx, depth - 2);
+            fprintf(out, "    if (!array_get(%s, %s, &%s)) {\n", arr, slot(ctx, depth - 1), arr);
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    if (!get_index(vm)) return false;\n");
+            emit_reload(ctx, depth - 2);
+            fprintf(out, "    }\n");
+            break;
+        }
+        case OP_SET_INDEX: {
+            const char* arr = slot(ctx, depth - 3);
+            const char* val = slot(ctx, depth - 1);
+            fprintf(out, "    if (array_set(%s, %s, %s)) {\n", arr, slot(ctx, depth - 2), val);
+            fprintf(out, "        GC_BARRIER(vm, UNWRAP_OBJ(%s), %s);\n", arr, val);
+            fprintf(out, "        %s = %s;\n", arr, val);
+            fprintf(out, "    } else {\n");
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    if (!set_index(vm)) return false;\n");
+            emit_reload(ctx, depth - 3);
+            fprintf(out, "    }\n");
+            break;
+        }
+        case OP_SUPER_INVOKE: {
+            int argc = op[2];
+            emit_sync(ctx, depth, next);
+            fprintf(out, "    if (!aot_super_invoke(vm, UNWRAP_STR(k[%d]), %d)) return false;\n", op[1], argc);
+            emit_reload(ctx, depth - argc - 2);
+            break;
+        }
+        default:
+            fprintf(out, "    // unknown op %d\n", *op);
+            break;
+    }
+}
+
+static void emit_fn(FILE* out, FnList* list, int id) {
+    ObjFunc* fn = list->fns[id];
+    FnCtx ctx;
+    ctx.out = out;
+    ctx.fn = fn;
+    ctx.depths = (int*)malloc(sizeof(int) * (fn->ops.count + 1));
+    ctx.targets = (bool*)malloc(sizeof(bool) * (fn->ops.count + 1));
+    memset(ctx.captured, 0, sizeof(ctx.captured));
+    ctx.has_captured = false;
+    analyze(&ctx);
+
+    fprintf(out, "// %s\n", fn->name != NULL ? fn->name->chars : "<script>");
+    fprintf(out, "static bool fn_%d(VmState* vm) {\n", id);
+    fprintf(out, "    CallFrame* frame = &vm->frames[vm->frame_count - 1];\n");
+    fprintf(out, "    Val* slots = frame->slots;\n");
+    fprintf(out, "    uint8_t* ops = frame->closure->fn->ops.ops;\n");
+    fprintf(out, "    Val* k = frame->closure->fn->ops.constants.vals;\n");
+    fprintf(out, "    CallCache* caches = frame->closure->fn->ops.call_caches;\n");
+    fprintf(out, "    PropCache* props = frame->closure->fn->ops.prop_caches;\n");
+    fprintf(out, "    (void)ops; (void)k; (void)caches; (void)props;\n");
+    for (int i = 0; i < ctx.max_depth; i++) {
+        if (in_memory(&ctx, i)) {
+            continue;
+        }
+        if (i <= fn->arity) {
+            fprintf(out, "    Val v%d = slots[%d];\n", i, i);
+        } else {
+            fprintf(out, "    Val v%d = MK_NIL_VAL;\n", i);
+        }
+    }
+
+    for (int pos = 0; pos < fn->ops.count; pos += op_length(&fn->ops, pos)) {
+        emit_op(&ctx, pos);
+    }
+    fprintf(out, "}\n\n");
+
+    free(ctx.depths);
+    free(ctx.targets);
+}
+
+static void emit_bytes(FILE* out, const char* type, const char* name, int id, Ops* ops, bool lines) {
+    fprintf(out, "static const %s %s_%d[] = {", type, name, id);
+    for (int i = 0; i < ops->count; i++) {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", lines ? ops->lines[i] : ops->ops[i]);
+    }
+    fprintf(out, "\n};\n");
+}
+
+static void emit_str(FILE* out, const char* chars, int length) {
+    fputc('"', out);
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        if (c == '"' || c == '\\' || c == '?') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7F) {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emit_const(FILE* out, FnList* list, int id, Val val) {
+    fprintf(out, "    aot_const(vm, f%d, ", id);
+    if (IS_NUM(val)) {
+        double num = UNWRAP_NUM(val);
+        if (isinf(num)) {
+            fprintf(out, "MK_NUM_VAL(%sINFINITY)", num < 0 ? "-" : "");
+        } else if (isnan(num)) {
+            fprintf(out, "MK_NUM_VAL(NAN)");
+        } else {
+            // hex floats are exact
+            fprintf(out, "MK_NUM_VAL(%a)", num);
+        }
+    } else if (IS_STR(val)) {
+        ObjStr* str = UNWRAP_STR(val);
+        fprintf(out, "MK_OBJ_VAL((Obj*)cp_str(vm, ");
+        emit_str(out, str->chars, str->length);
+        fprintf(out, ", %d))", str->length);
+    } else if (IS_FUNC(val)) {
+        fprintf(out, "MK_OBJ_VAL((Obj*)f%d)", fn_id(list, UNWRAP_FUNC(val)));
+    } else if (IS_BOOL(val)) {
+        fprintf(out, "MK_BOOL_VAL(%s)", UNWRAP_BOOL(val) ? "true" : "false");
+    } else {
+        fprintf(out, "MK_NIL_VAL");
+    }
+    fprintf(out, ");\n");
+}
+
+static void emit_loader(FILE* out, FnList* list) {
+    fprintf(out, "static ObjFunc* load(VmState* vm) {\n");
+    for (int id = 0; id < list->count; id++) {
+        ObjFunc* fn = list->fns[id];
+        fprintf(out, "    ObjFunc* f%d = aot_func(vm, ", id);
+        if (fn->name != NULL) {
+            emit_str(out, fn->name->chars, fn->name->length);
+        } else {
+            fprintf(out, "NULL");
+        }
+        fprintf(out, ", %d, %d, fn_%d, ops_%d, lines_%d, %d, %d, %d);\n",
+                fn->arity, fn->upvalue_count, id, id, id, fn->ops.count,
+                fn->ops.call_cache_count, fn->ops.prop_cache_count);
+        for (int i = 0; i < fn->ops.constants.count; i++) {
+            emit_const(out, list, id, fn->ops.constants.vals[i]);
+        }
+    }
+    fprintf(out, "    return f%d;\n", list->count - 1);
+    fprintf(out, "}\n\n");
+}
+
+bool emit_c(VmState* vm, const char* program, FILE* out) {
+    ObjFunc* script = compile(vm, program);
+    if (script == NULL) {
+        return false;
+    }
+
+    FnList list = { NULL, 0, 0 };
+    collect_fns(&list, script);
+
+    fprintf(out, "// Generated by sealox --emit-c, link with libsealox\n");
+    fprintf(out, "#include <math.h>\n");
+    fprintf(out, "#include \"sealox.h\"\n");
+    fprintf(out, "#include \"aot.h\"\n");
+    fprintf(out, "#include \"class.h\"\n\n");
+    for (int id = 0; id < list.count; id++) {
+        fprintf(out, "static bool fn_%d(VmState* vm);\n", id);
+    }
+    fprintf(out, "\n");
+    for (int id = 0; id < list.count; id++) {
+        emit_bytes(out, "uint8_t", "ops", id, &list.fns[id]->ops, false);
+        emit_bytes(out, "int", "lines", id, &list.fns[id]->ops, true);
+    }
+    fprintf(out, "\n");
+    for (int id = 0; id < list.count; id++) {
+        emit_fn(out, &list, id);
+    }
+    emit_loader(out, &list);
+    fprintf(out, "int main() {\n");
+    fprintf(out, "    return aot_main(load);\n");
+    fprintf(out, "}\n");
+
+    free(list.fns);
+    return true;
+}
+
+ObjFunc* aot_func(VmState* vm, const char* name, int arity, int upvalue_count, AotFn code,
+                  const uint8_t* ops, const int* lines, int count, int call_sites, int prop_sites) {
+    ObjFunc* fn = create_func(vm);
+    // the locals of the loader are not roots, so the function stays on the
+    // stack until the loader is done
+    push_val(vm, MK_OBJ_VAL((Obj*)fn));
+    fn->arity = arity;
+    fn->upvalue_count = upvalue_count;
+    fn->aot = code;
+    if (name != NULL) {
+        fn->name = cp_str(vm, name, (int)strlen(name));
+        GC_BARRIER_OBJ(vm, fn, fn->name);
+    }
+    for (int i = 0; i < count; i++) {
+        append_op(&fn->ops, ops[i], lines[i]);
+    }
+    for (int i = 0; i < call_sites; i++) {
+        append_call_cache(&fn->ops);
+    }
+    for (int i = 0; i < prop_sites; i++) {
+        append_prop_cache(&fn->ops);
+    }
+    return fn;
+}
+
+void aot_const(VmState* vm, ObjFunc* fn, Val val) {
+    // the function may have been traced or tenured already
+    GC_BARRIER(vm, fn, val);
+    append_const(&fn->ops, val);
+}
+
+/*
+ * Run the frame that a call pushed, if any.
+ */
+static bool finish_call(VmState* vm, int frame_count) {
+    if (vm->frame_count == frame_count) {
+        // natives are already done
+        return true;
+    }
+
+    ObjFunc* fn = vm->frames[vm->frame_count - 1].closure->fn;
+    if (fn->aot == NULL) {
+        run_err(vm, "Function '%s' was not compiled ahead of time", fn->name != NULL ? fn->name->chars : "script");
+        return false;
+    }
+    return fn->aot(vm);
+}
+
+bool aot_call(VmState* vm, CallCache* cache, int argc) {
+    int frame_count = vm->frame_count;
+    return call_cached(vm, cache, argc) && finish_call(vm, frame_count);
+}
+
+bool aot_invoke(VmState* vm, ObjStr* name, int argc, PropCache* cache) {
+    int frame_count = vm->frame_count;
+    return invoke(vm, name, argc, cache) && finish_call(vm, frame_count);
+}
+
+bool aot_super_invoke(VmState* vm, ObjStr* name, int argc) {
+    int frame_count = vm->frame_count;
+    return super_invoke(vm, name, argc) && finish_call(vm, frame_count);
+}
+
+int aot_main(AotLoad load) {
+    VmState* vm = create_vm();
+    // the bytecode is only kept for error reports
+    vm->jit_mode = JIT_OFF;
+
+    Val* base = vm->top;
+    ObjFunc* fn = load(vm);
+    vm->top = base;
+    push_val(vm, MK_OBJ_VAL((Obj*)fn));
+    ObjClosure* closure = create_closure(vm, fn);
+    pop_val(vm);
+
+    IntrResult result = call_fn(vm, MK_OBJ_VAL((Obj*)closure), 0, NULL, NULL);
+    if (result == INTR_OK && !run_loop(vm)) {
+        result = INTR_RUN_ERR;
+    }
+    destroy_vm(vm);
+    return result == INTR_OK ? 0 : 1;
+}
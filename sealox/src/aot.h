@@ -0,0 +1,55 @@
+#ifndef aot_h
+#define aot_h
+
+#include <stdio.h>
+#include "common.h"
+#include "vm.h"
+
+/*
+ * Ahead of time compilation to C. Every function of a script becomes a C
+ * function, with the values of the VM stack in C variables. The values
+ * are only written back to the VM stack where the runtime needs them,
+ * i.e. for calls, closures and errors. Locals captured by closures always
+ * stay on the VM stack.
+ *
+ * The emitted translation unit has its own main and links against
+ * libsealox:
+ *
+ *   sealox --emit-c script.lox > script.c
+ *   gcc -O2 script.c -Isrc bin/libsealox.a -pthread -lm -o script
+ */
+
+typedef bool (*AotFn)(VmState* vm);
+// creates the functions of the script and returns the top level one
+typedef ObjFunc* (*AotLoad)(VmState* vm);
+
+/*
+ * Compile the program and write it to out as C. Returns false on
+ * compile errors.
+ */
+bool emit_c(VmState* vm, const char* program, FILE* out);
+
+/*
+ * Runtime of the emitted code.
+ */
+
+/*
+ * A function with the original ops, which provide the lines for errors.
+ * It is left on the VM stack, until aot_main drops the functions once
+ * the script function refers to all of them.
+ */
+ObjFunc* aot_func(VmState* vm, const char* name, int arity, int upvalue_count, AotFn code,
+                  const uint8_t* ops, const int* lines, int count, int call_sites, int prop_sites);
+// add a constant to a function of the loader
+void aot_const(VmState* vm, ObjFunc* fn, Val val);
+/*
+ * Call the callee below the arguments. Compiled callees run to their
+ * return, so the result is on top of the stack when this returns true.
+ */
+bool aot_call(VmState* vm, CallCache* cache, int argc);
+// the same for method calls
+bool aot_invoke(VmState* vm, ObjStr* name, int argc, PropCache* cache);
+bool aot_super_invoke(VmState* vm, ObjStr* name, int argc);
+int aot_main(AotLoad load);
+
+#endif
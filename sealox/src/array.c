@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "map.h"
+#include "memory.h"
+#include "vm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+double f64_sum(const double* a, int n) {
+    int i = 0;
+    double sum = 0;
+#ifdef __SSE2__
+    // two accumulators hide the latency of the adds
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+double f64_dot(const double* a, const double* b, int n) {
+    int i = 0;
+    double sum = 0;
+#ifdef __SSE2__
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+void f64_scale(double* a, int n, double k) {
+    int i = 0;
+#ifdef __SSE2__
+    __m128d factor = _mm_set1_pd(k);
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    }
+#endif
+    for (; i < n; i++) {
+        a[i] *= k;
+    }
+}
+
+void f64_axpy(double alpha, const double* x, double* y, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    __m128d factor = _mm_set1_pd(alpha);
+    for (; i + 2 <= n; i += 2) {
+        __m128d prod = _mm_mul_pd(_mm_loadu_pd(x + i), factor);
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), prod));
+    }
+#endif
+    for (; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+/*
+ * Like minpd and maxpd, a NaN in a only wins if it is the first element.
+ */
+double f64_min(const double* a, int n) {
+    int i = 1;
+    double min = a[0];
+#ifdef __SSE2__
+    __m128d acc = _mm_set1_pd(a[0]);
+    for (; i + 2 <= n; i += 2) {
+        acc = _mm_min_pd(_mm_loadu_pd(a + i), acc);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+#endif
+    for (; i < n; i++) {
+        min = a[i] < min ? a[i] : min;
+    }
+    return min;
+}
+
+double f64_max(const double* a, int n) {
+    int i = 1;
+    double max = a[0];
+#ifdef __SSE2__
+    __m128d acc = _mm_set1_pd(a[0]);
+    for (; i + 2 <= n; i += 2) {
+        acc = _mm_max_pd(_mm_loadu_pd(a + i), acc);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+#endif
+    for (; i < n; i++) {
+        max = a[i] > max ? a[i] : max;
+    }
+    return max;
+}
+
+/*
+ * Doubles as unsigned keys that sort in the same order. Negative numbers
+ * get all bits flipped, positive ones only the sign bit.
+ */
+static inline uint64_t sort_key(double num) {
+    uint64_t bits;
+    memcpy(&bits, &num, sizeof(bits));
+    return bits & (1ull << 63) ? ~bits : bits | (1ull << 63);
+}
+
+static inline double from_sort_key(uint64_t key) {
+    uint64_t bits = key & (1ull << 63) ? key & ~(1ull << 63) : ~key;
+    double num;
+    memcpy(&num, &bits, sizeof(num));
+    return num;
+}
+
+/*
+ * LSD radix sort with one byte per pass. Passes where all keys share the
+ * byte are skipped. Short arrays use insertion sort.
+ */
+void f64_sort(double* a, int n) {
+    if (n < 2) {
+        return;
+    }
+    uint64_t* keys = (uint64_t*)malloc(sizeof(uint64_t) * n * 2);
+    uint64_t* tmp = keys + n;
+    for (int i = 0; i < n; i++) {
+        keys[i] = sort_key(a[i]);
+    }
+
+    if (n < 64) {
+        for (int i = 1; i < n; i++) {
+            uint64_t key = keys[i];
+            int j = i - 1;
+            for (; j >= 0 && keys[j] > key; j--) {
+                keys[j + 1] = keys[j];
+            }
+            keys[j + 1] = key;
+        }
+    } else {
+        static const int passes = sizeof(uint64_t);
+        int (*counts)[256] = calloc(passes, sizeof(*counts));
+        for (int i = 0; i < n; i++) {
+            for (int p = 0; p < passes; p++) {
+                counts[p][(keys[i] >> (8 * p)) & 0xFF]++;
+            }
+        }
+        for (int p = 0; p < passes; p++) {
+            int* count = counts[p];
+            if (count[(keys[0] >> (8 * p)) & 0xFF] == n) {
+                continue;
+            }
+            int offset = 0;
+            for (int d = 0; d < 256; d++) {
+                int c = count[d];
+                count[d] = offset;
+                offset += c;
+            }
+            for (int i = 0; i < n; i++) {
+                tmp[count[(keys[i] >> (8 * p)) & 0xFF]++] = keys[i];
+            }
+            uint64_t* swap = keys;
+            keys = tmp;
+            tmp = swap;
+        }
+        free(counts);
+    }
+
+    for (int i = 0; i < n; i++) {
+        a[i] = from_sort_key(keys[i]);
+    }
+    // the buffer starts at whichever half came first
+    free(keys < tmp ? keys : tmp);
+}
+
+static ObjFloatArray* float_arg(VmState* vm, Val val) {
+    if (!IS_FLOAT_ARRAY(val)) {
+        native_err(vm, "Expected a Float64Array");
+        return NULL;
+    }
+    return UNWRAP_FLOAT_ARRAY(val);
+}
+
+static bool num_arg(VmState* vm, Val val) {
+    if (!IS_NUM(val)) {
+        native_err(vm, "Expected a number");
+        return false;
+    }
+    return true;
+}
+
+static Val len_native(VmState* vm, int argc, Val* args) {
+    if (IS_ARRAY(args[0])) {
+        return MK_NUM_VAL(UNWRAP_ARRAY(args[0])->vals.count);
+    }
+    if (IS_FLOAT_ARRAY(args[0])) {
+        return MK_NUM_VAL(UNWRAP_FLOAT_ARRAY(args[0])->count);
+    }
+    if (IS_MAP(args[0])) {
+        return MK_NUM_VAL(UNWRAP_MAP(args[0])->dict.size);
+    }
+    if (IS_STR(args[0])) {
+        return MK_NUM_VAL(UNWRAP_STR(args[0])->length);
+    }
+    native_err(vm, "Expected an array, a map or a string");
+    return MK_NIL_VAL;
+}
+
+static Val push_native(VmState* vm, int argc, Val* args) {
+    if (!IS_ARRAY(args[0])) {
+        native_err(vm, "Can only push to arrays");
+        return MK_NIL_VAL;
+    }
+    Vals* vals = &UNWRAP_ARRAY(args[0])->vals;
+    GC_BARRIER(vm, UNWRAP_OBJ(args[0]), args[1]);
+    append_val(vals, args[1]);
+    return MK_NUM_VAL(vals->count);
+}
+
+static Val pop_native(VmState* vm, int argc, Val* args) {
+    if (!IS_ARRAY(args[0])) {
+        native_err(vm, "Can only pop from arrays");
+        return MK_NIL_VAL;
+    }
+    Vals* vals = &UNWRAP_ARRAY(args[0])->vals;
+    if (vals->count == 0) {
+        native_err(vm, "Can't pop from an empty array");
+        return MK_NIL_VAL;
+    }
+    return vals->vals[--vals->count];
+}
+
+/*
+ * Float64Array(n) is n zeros, Float64Array(array) copies the numbers of
+ * the array.
+ */
+static Val float_array_native(VmState* vm, int argc, Val* args) {
+    if (IS_ARRAY(args[0])) {
+        Vals* vals = &UNWRAP_ARRAY(args[0])->vals;
+        for (int i = 0; i < vals->count; i++) {
+            if (!IS_NUM(vals->vals[i])) {
+                native_err(vm, "Float64Array elements must be numbers");
+                return MK_NIL_VAL;
+            }
+        }
+        ObjFloatArray* array = create_float_array(vm, vals->count);
+        for (int i = 0; i < vals->count; i++) {
+            array->data[i] = UNWRAP_NUM(vals->vals[i]);
+        }
+        return MK_OBJ_VAL((Obj*)array);
+    }
+
+    int count;
+    if (!valid_index(args[0], INT32_MAX, &count)) {
+        native_err(vm, "Expected a length or an array");
+        return MK_NIL_VAL;
+    }
+    return MK_OBJ_VAL((Obj*)create_float_array(vm, count));
+}
+
+static Val sum_native(VmState* vm, int argc, Val* args) {
+    ObjFloatArray* a = float_arg(vm, args[0]);
+    if (a == NULL) {
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(f64_sum(a->data, a->count));
+}
+
+static Val dot_native(VmState* vm, int argc, Val* args) {
+    ObjFloatArray* a = float_arg(vm, args[0]);
+    ObjFloatArray* b = a == NULL ? NULL : float_arg(vm, args[1]);
+    if (b == NULL) {
+        return MK_NIL_VAL;
+    }
+    if (a->count != b->count) {
+        native_err(vm, "Arrays must have the same length, but got %d and %d", a->count, b->count);
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(f64_dot(a->data, b->data, a->count));
+}
+
+static Val scale_native(VmState* vm, int argc, Val* args) {
+    ObjFloatArray* a = float_arg(vm, args[0]);
+    if (a == NULL || !num_arg(vm, args[1])) {
+        return MK_NIL_VAL;
+    }
+    f64_scale(a->data, a->count, UNWRAP_NUM(args[1]));
+    return args[0];
+}
+
+static Val axpy_native(VmState* vm, int argc, Val* args) {
+    if (!num_arg(vm, args[0])) {
+        return MK_NIL_VAL;
+    }
+    ObjFloatArray* x = float_arg(vm, args[1]);
+    ObjFloatArray* y = x == NULL ? NULL : float_arg(vm, args[2]);
+    if (y == NULL) {
+        return MK_NIL_VAL;
+    }
+    if (x->count != y->count) {
+        native_err(vm, "Arrays must have the same length, but got %d and %d", x->count, y->count);
+        return MK_NIL_VAL;
+    }
+    f64_axpy(UNWRAP_NUM(args[0]), x->data, y->data, x->count);
+    return args[2];
+}
+
+static ObjFloatArray* non_empty_arg(VmState* vm, Val val) {
+    ObjFloatArray* a = float_arg(vm, val);
+    if (a != NULL && a->count == 0) {
+        native_err(vm, "Expected a non-empty Float64Array");
+        return NULL;
+    }
+    return a;
+}
+
+static Val min_native(VmState* vm, int argc, Val* args) {
+    ObjFloatArray* a = non_empty_arg(vm, args[0]);
+    if (a == NULL) {
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(f64_min(a->data, a->count));
+}
+
+static Val max_native(VmState* vm, int argc, Val* args) {
+    ObjFloatArray* a = non_empty_arg(vm, args[0]);
+    if (a == NULL) {
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(f64_max(a->data, a->count));
+}
+
+static Val sort_native(VmState* vm, int argc, Val* args) {
+    ObjFloatArray* a = float_arg(vm, args[0]);
+    if (a == NULL) {
+        return MK_NIL_VAL;
+    }
+    f64_sort(a->data, a->count);
+    return args[0];
+}
+
+void define_array_natives(VmState* vm) {
+    define_native(vm, "len", 1, len_native);
+    define_native(vm, "push", 2, push_native);
+    define_native(vm, "pop", 1, pop_native);
+    define_native(vm, "Float64Array", 1, float_array_native);
+    define_native(vm, "sum", 1, sum_native);
+    define_native(vm, "dot", 2, dot_native);
+    define_native(vm, "scale", 2, scale_native);
+    define_native(vm, "axpy", 3, axpy_native);
+    define_native(vm, "min", 1, min_native);
+    define_native(vm, "max", 1, max_native);
+    define_native(vm, "sort", 1, sort_native);
+}
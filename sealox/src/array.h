@@ -0,0 +1,102 @@
+#ifndef array_h
+#define array_h
+
+#include "common.h"
+#include "ops.h"
+
+/*
+ * Arrays are growable vectors of values. Float64Arrays have a fixed
+ * length and store raw doubles, so that the bulk natives can run over
+ * them without unwrapping values.
+ */
+typedef struct {
+    Obj obj;
+    Vals vals;
+} ObjArray;
+
+typedef struct {
+    Obj obj;
+    int count;
+    double* data;
+} ObjFloatArray;
+
+#define IS_ARRAY(v) is_obj_type(v, OBJ_ARRAY)
+#define UNWRAP_ARRAY(v) ((ObjArray*)(UNWRAP_OBJ(v)))
+
+#define IS_FLOAT_ARRAY(v) is_obj_type(v, OBJ_FLOAT_ARRAY)
+#define UNWRAP_FLOAT_ARRAY(v) ((ObjFloatArray*)(UNWRAP_OBJ(v)))
+
+// an integral number in [0, count)
+static inline bool valid_index(Val idx, int count, int* i) {
+    if (!IS_NUM(idx)) {
+        return false;
+    }
+    double num = UNWRAP_NUM(idx);
+    if (!(num >= 0 && num < count) || (double)(int)num != num) {
+        return false;
+    }
+    *i = (int)num;
+    return true;
+}
+
+/*
+ * Fast paths of indexing, shared by the interpreter and the compiled
+ * code. They return false for anything that needs a runtime error.
+ */
+static inline bool array_get(Val arr, Val idx, Val* out) {
+    int i;
+    if (IS_ARRAY(arr)) {
+        ObjArray* array = UNWRAP_ARRAY(arr);
+        if (valid_index(idx, array->vals.count, &i)) {
+            *out = array->vals.vals[i];
+            return true;
+        }
+    } else if (IS_FLOAT_ARRAY(arr)) {
+        ObjFloatArray* array = UNWRAP_FLOAT_ARRAY(arr);
+        if (valid_index(idx, array->count, &i)) {
+            *out = MK_NUM_VAL(array->data[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool array_set(Val arr, Val idx, Val val) {
+    int i;
+    if (IS_ARRAY(arr)) {
+        ObjArray* array = UNWRAP_ARRAY(arr);
+        if (valid_index(idx, array->vals.count, &i)) {
+            array->vals.vals[i] = val;
+            return true;
+        }
+    } else if (IS_FLOAT_ARRAY(arr) && IS_NUM(val)) {
+        ObjFloatArray* array = UNWRAP_FLOAT_ARRAY(arr);
+        if (valid_index(idx, array->count, &i)) {
+            array->data[i] = UNWRAP_NUM(val);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Bulk kernels over raw doubles. They use SSE2 where available, so sums
+ * are added up in a different order than a plain loop would.
+ */
+double f64_sum(const double* a, int n);
+double f64_dot(const double* a, const double* b, int n);
+void f64_scale(double* a, int n, double k);
+// y += alpha * x
+void f64_axpy(double alpha, const double* x, double* y, int n);
+// n must be at least 1
+double f64_min(const double* a, int n);
+double f64_max(const double* a, int n);
+void f64_sort(double* a, int n);
+
+/*
+ * len, push, pop, Float64Array and the bulk natives. len also takes maps
+ * and strings.
+ */
+void define_array_natives(VmState* vm);
+
+#endif
@@ -0,0 +1,37 @@
+#include "class.h"
+#include "memory.h"
+#include "vm.h"
+
+int shape_find(ObjShape* shape, ObjStr* name) {
+    Val slot;
+    if (!dict_get(&shape->slots, name, &slot)) {
+        return -1;
+    }
+    return (int)UNWRAP_NUM(slot);
+}
+
+ObjShape* shape_add(VmState* vm, ObjShape* shape, ObjStr* name) {
+    Val next;
+    if (dict_get(&shape->transitions, name, &next)) {
+        return (ObjShape*)UNWRAP_OBJ(next);
+    }
+
+    ObjShape* child = create_shape(vm, shape->klass);
+    GC_BARRIER_OBJ(vm, shape, name);
+    GC_BARRIER_OBJ(vm, shape, child);
+    child->field_count = shape->field_count + 1;
+    dict_add_all(&shape->slots, &child->slots);
+    dict_put(&child->slots, name, MK_NUM_VAL(shape->field_count));
+    dict_put(&shape->transitions, name, MK_OBJ_VAL((Obj*)child));
+    return child;
+}
+
+void add_field(ObjInstance* inst, ObjShape* shape, Val val) {
+    int slot = shape->field_count - 1;
+    if (slot >= inst->capacity) {
+        inst->capacity = CALC_CAP(inst->capacity);
+        inst->fields = REALLOC_ARR(Val, inst->fields, inst->capacity);
+    }
+    inst->fields[slot] = val;
+    inst->shape = shape;
+}
@@ -0,0 +1,73 @@
+#ifndef class_h
+#define class_h
+
+#include "common.h"
+#include "ops.h"
+#include "dict.h"
+
+/*
+ * Hidden classes. Instances that got the same fields in the same order
+ * share a shape, which maps field names to indexes in the flat field
+ * array of the instance. Adding a field moves the instance to a child
+ * shape, and the transitions make sure that the children are shared.
+ *
+ * Every class has its own root shape, so a shape also identifies the
+ * class, and with it the methods.
+ */
+typedef struct ObjShape {
+    Obj obj;
+    struct ObjClass* klass;
+    int field_count;
+    // field name -> index
+    Dict slots;
+    // field name -> shape with the field added
+    Dict transitions;
+} ObjShape;
+
+typedef struct ObjClass {
+    Obj obj;
+    ObjStr* name;
+    Dict methods;
+    // the init method, if any
+    ObjClosure* init;
+    ObjShape* shape;
+} ObjClass;
+
+typedef struct {
+    Obj obj;
+    ObjClass* klass;
+    ObjShape* shape;
+    Val* fields;
+    int capacity;
+} ObjInstance;
+
+typedef struct {
+    Obj obj;
+    Val receiver;
+    ObjClosure* method;
+} ObjBoundMethod;
+
+#define IS_CLASS(v) is_obj_type(v, OBJ_CLASS)
+#define UNWRAP_CLASS(v) ((ObjClass*)(UNWRAP_OBJ(v)))
+
+#define IS_INSTANCE(v) is_obj_type(v, OBJ_INSTANCE)
+#define UNWRAP_INSTANCE(v) ((ObjInstance*)(UNWRAP_OBJ(v)))
+
+#define IS_BOUND_METHOD(v) is_obj_type(v, OBJ_BOUND_METHOD)
+#define UNWRAP_BOUND_METHOD(v) ((ObjBoundMethod*)(UNWRAP_OBJ(v)))
+
+/*
+ * Index of the field in instances of the shape, or -1.
+ */
+int shape_find(ObjShape* shape, ObjStr* name);
+/*
+ * The shape after adding the field.
+ */
+ObjShape* shape_add(VmState* vm, ObjShape* shape, ObjStr* name);
+/*
+ * Move the instance to the shape, which has one more field than the
+ * current one, and store the value of the new field.
+ */
+void add_field(ObjInstance* inst, ObjShape* shape, Val val);
+
+#endif
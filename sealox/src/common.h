@@ -6,9 +6,6 @@
 #include <stdint.h>
 #include <stdio.h>
 
-#define DEBUG_VM
-#define DEBUG_COMP
-
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #endif
@@ -5,6 +5,8 @@
 #include "compiler.h"
 #include "scanner.h"
 #include "memory.h"
+#include "vm.h"
+#include "num.h"
 #ifdef DEBUG_COMP
 #include "dev.h"
 #endif
@@ -12,10 +14,14 @@
 typedef struct {
     Token name;
     int depth;    
+    // captured locals are moved off the stack when they go out of scope
+    bool is_captured;
 } Local;
 
 typedef enum {
     FN_FUNC,
+    FN_INIT,
+    FN_METHOD,
     FN_SCRIPT,
 } FuncType;
 
@@ -34,16 +40,23 @@ typedef struct Compiler {
     struct Compiler* enclosing;
 } Compiler;
 
+typedef struct ClassCompiler {
+    struct ClassCompiler* enclosing;
+    bool has_super;
+} ClassCompiler;
+
 typedef struct {
     Token curr;
     Token prev;
     bool err;
     bool panic;
+    Scanner scanner;
+    Compiler* comp;
+    // innermost class being compiled, if any
+    ClassCompiler* klass;
+    VmState* vm;
 } Parser;
 
-Parser parser;
-Compiler* comp = NULL;
-
 typedef enum {
     P_NONE,
     P_ASSIGN,
@@ -58,7 +71,7 @@ typedef enum {
     P_PRIMARY
 } Prec;
 
-typedef void (*Pfn)();
+typedef void (*Pfn)(Parser* parser, bool can_assign);
 
 typedef struct {
     Pfn prefix;
@@ -66,115 +79,126 @@ typedef struct {
     Prec prec;
 } Rule;
 
-static void parse_expr();
-static void parse_expr_stmt();
-static void parse_var_decl();
+static void parse_expr(Parser* parser);
+static void parse_expr_stmt(Parser* parser);
+static void parse_var_decl(Parser* parser);
 static Rule* rule_of(TokenType type);
-static void parse_prec(Prec prec);
-static void parse_decl();
-static void parse_stmt();
+static void parse_prec(Parser* parser, Prec prec);
+static void parse_decl(Parser* parser);
+static void parse_stmt(Parser* parser);
 static bool id_equal(Token* first, Token* second);
-static void mark_initialized();
+static void mark_initialized(Parser* parser);
 
-void init_comp(Compiler* compiler, FuncType fn_type) {
+static void init_comp(Parser* parser, Compiler* compiler, FuncType fn_type) {
     compiler->local_count = 0;
     compiler->scope_depth = 0;
     compiler->fn = NULL;
-    compiler->fn = create_func();
+    compiler->fn = create_func(parser->vm);
     compiler->fn_type = fn_type;
-    compiler->enclosing = comp;
-    comp = compiler;
+    compiler->enclosing = parser->comp;
+    parser->comp = compiler;
+    parser->vm->compiler = compiler;
     if (fn_type != FN_SCRIPT) {
-        comp->fn->name = cp_str(parser.prev.start,  parser.prev.length);
+        parser->comp->fn->name = cp_str(parser->vm, parser->prev.start,  parser->prev.length);
+        GC_BARRIER_OBJ(parser->vm, parser->comp->fn, parser->comp->fn->name);
     }
 
-    Local* local = &comp->locals[comp->local_count++];
+    // slot 0 holds the callee, or the receiver in methods
+    Local* local = &parser->comp->locals[parser->comp->local_count++];
     local->depth = 0;
-    local->name.start = "";
-    local->name.length = 0;
+    local->is_captured = false;
+    if (fn_type == FN_METHOD || fn_type == FN_INIT) {
+        local->name.start = "this";
+        local->name.length = 4;
+    } else {
+        local->name.start = "";
+        local->name.length = 0;
+    }
 }
 
-void err_at(Token* token, const char* msg) {
-    if (parser.panic) {
+static void err_at(Parser* parser, Token* token, const char* msg) {
+    if (parser->panic) {
         return;
     }
-    parser.panic = true;
-    fprintf(stderr, "[line %d] Error", token->line);
+    parser->panic = true;
+    fprintf(parser->vm->err, "[line %d] Error", token->line);
     switch(token->type) {
         case TOKEN_EOF:
-            fprintf(stderr, " at end");
+            fprintf(parser->vm->err, " at end");
             break;
         case TOKEN_ERROR:
             break;
         default:
-            fprintf(stderr, " at '%.*s'", token->length, token->start);
+            fprintf(parser->vm->err, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", msg);
-    parser.err = true;
+    fprintf(parser->vm->err, ": %s\n", msg);
+    parser->err = true;
 }
 
-void err(const char* msg) {
-    err_at(&parser.prev, msg); 
+static void err(Parser* parser, const char* msg) {
+    err_at(parser, &parser->prev, msg); 
 }
 
-void err_curr(const char* msg) {
-    err_at(&parser.curr, msg); 
+static void err_curr(Parser* parser, const char* msg) {
+    err_at(parser, &parser->curr, msg); 
 }
 
-void advance() {
-    parser.prev = parser.curr;
+static void advance(Parser* parser) {
+    parser->prev = parser->curr;
 
     while(true) {
-        parser.curr = scan_token();
-        if (parser.curr.type != TOKEN_ERROR) {
+        parser->vm->phase = PHASE_SCAN;
+        parser->curr = scan_token(&parser->scanner);
+        parser->vm->phase = PHASE_COMPILE;
+        if (parser->curr.type != TOKEN_ERROR) {
             break;
         }
 
-        err_curr(parser.curr.start);
+        err_curr(parser, parser->curr.start);
     }
 }
 
-void consume(TokenType type, char* msg) {
-    if (parser.curr.type == type) {
-        advance();
+static void consume(Parser* parser, TokenType type, char* msg) {
+    if (parser->curr.type == type) {
+        advance(parser);
         return;
     }
 
-    err_curr(msg);
+    err_curr(parser, msg);
 }
 
-static bool match(TokenType type) {
-    if (parser.curr.type == type) {
-        advance();
+static bool match(Parser* parser, TokenType type) {
+    if (parser->curr.type == type) {
+        advance(parser);
         return true;
     }
 
     return false;
 }
 
-static bool check(TokenType type) {
-    return parser.curr.type == type;
+static bool check(Parser* parser, TokenType type) {
+    return parser->curr.type == type;
 }
 
-Ops* curr_ops() {
-    return &comp->fn->ops; 
+static Ops* curr_ops(Parser* parser) {
+    return &parser->comp->fn->ops; 
 }
 
 /*
  * If a statement is broken, we avoid cascading errors
  * by aborting it and searching for a new statement.
  */
-static void synch() {
-    parser.panic = true;
+static void synch(Parser* parser) {
+    parser->panic = true;
 
-    while (!check(TOKEN_EOF)) {
+    while (!check(parser, TOKEN_EOF)) {
         // end of statement boundary
-        if (parser.prev.type == TOKEN_SEMICOLON) {
+        if (parser->prev.type == TOKEN_SEMICOLON) {
             return;
         }
         // beginning of statement boundary
-        switch (parser.curr.type) {
+        switch (parser->curr.type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
@@ -188,389 +212,412 @@ static void synch() {
                 break;
         }
 
-        advance();
+        advance(parser);
     }
 }
 
 
-void emit(uint8_t byte) {
-    append_op(curr_ops(), byte, parser.prev.line);
+static void emit(Parser* parser, uint8_t byte) {
+    append_op(curr_ops(parser), byte, parser->prev.line);
 }
 
-void emit2(uint8_t b1, uint8_t b2) {
-    emit(b1);
-    emit(b2);
+static void emit2(Parser* parser, uint8_t b1, uint8_t b2) {
+    emit(parser, b1);
+    emit(parser, b2);
+}
+
+static void emit_ret(Parser* parser) {
+    // initializers always return this
+    if (parser->comp->fn_type == FN_INIT) {
+        emit2(parser, OP_GET_LOCAL, 0);
+    } else {
+        emit(parser, OP_NIL);
+    }
+    emit(parser, OP_RETURN);
 }
 
-void emit_ret() {
-    emit2(OP_NIL, OP_RETURN);
+static void emit_cache(Parser* parser, int i_cache) {
+    // the upper 8 bits are emitted first
+    emit2(parser, (i_cache >> 8) & 0xFF, i_cache & 0xFF);
 }
 
-ObjFunc* end_comp() {
-    emit_ret();
-    ObjFunc* fn = comp->fn;
+static ObjFunc* end_comp(Parser* parser) {
+    emit_ret(parser);
+    ObjFunc* fn = parser->comp->fn;
 #ifdef DEBUG_COMP
-    if (parser.err) {
-        disas_ops(curr_ops(), fn->name != NULL ? fn->name->chars : "<script>");
+    if (parser->err) {
+        disas_ops(curr_ops(parser), fn->name != NULL ? fn->name->chars : "<script>");
     }
 #endif
 
-    comp = comp->enclosing;
+    parser->comp = parser->comp->enclosing;
+    parser->vm->compiler = parser->comp;
     return fn;
 }
 
-uint8_t mk_const(Val val) {
-    int i_const = append_const(curr_ops(), val);
+static uint8_t mk_const(Parser* parser, Val val) {
+    // the function may have been traced or tenured already
+    GC_BARRIER(parser->vm, parser->comp->fn, val);
+    int i_const = append_const(curr_ops(parser), val);
     if (i_const > UINT8_MAX) {
-        err("Too many constants");
+        err(parser, "Too many constants");
         return 0;
     }
 
     return (uint8_t)i_const;
 }
 
-void emit_const(Val val) {
-    emit2(OP_CONST, mk_const(val));
+static void emit_const(Parser* parser, Val val) {
+    emit2(parser, OP_CONST, mk_const(parser, val));
 }
 
-void parse_num() {
-    double val = strtod(parser.prev.start, NULL); 
-    emit_const(MK_NUM_VAL(val));
+static void parse_num(Parser* parser, bool can_assign) {
+    double val;
+    // the scanner only makes tokens of digits with an optional fraction
+    str_to_num(parser->prev.start, parser->prev.length, &val);
+    emit_const(parser, MK_NUM_VAL(val));
 }
 
-void parse_bool() {
-    switch(parser.prev.type) {
+static void parse_bool(Parser* parser, bool can_assign) {
+    switch(parser->prev.type) {
         case TOKEN_TRUE:
-            emit(OP_TRUE);
+            emit(parser, OP_TRUE);
             break;
         case TOKEN_FALSE:
-            emit(OP_FALSE);
+            emit(parser, OP_FALSE);
             break;
         default:
             break;
     }
 }
 
-void parse_nil() {
-    emit(OP_NIL);
+static void parse_nil(Parser* parser, bool can_assign) {
+    emit(parser, OP_NIL);
 }
 
-static void parse_prec(Prec prec) {
-    advance();
-    Pfn fn = rule_of(parser.prev.type)->prefix;
+static void parse_prec(Parser* parser, Prec prec) {
+    advance(parser);
+    Pfn fn = rule_of(parser->prev.type)->prefix;
     if (fn == NULL) {
-       err("Unknown expression"); 
+       err(parser, "Unknown expression"); 
        return;
     }
 
     bool can_assign = prec <= P_ASSIGN;
-    fn(can_assign);
+    fn(parser, can_assign);
 
-    while (prec <= rule_of(parser.curr.type)->prec) {
-        advance();
-        Pfn ifn = rule_of(parser.prev.type)->infix;
-        ifn();
+    while (prec <= rule_of(parser->curr.type)->prec) {
+        advance(parser);
+        Pfn ifn = rule_of(parser->prev.type)->infix;
+        ifn(parser, can_assign);
     }
 
-    if (can_assign && match(TOKEN_EQUAL)) {
-        err("Invalid assignment target");
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        err(parser, "Invalid assignment target");
     }
 
 }
 
-static void parse_expr() {
-    parse_prec(P_ASSIGN);  
+static void parse_expr(Parser* parser) {
+    parse_prec(parser, P_ASSIGN);  
 }
 
-void parse_group() {
-    parse_expr();
-    consume(TOKEN_PAREN_END, "Expected ')'");
+static void parse_group(Parser* parser, bool can_assign) {
+    parse_expr(parser);
+    consume(parser, TOKEN_PAREN_END, "Expected ')'");
 }
 
-void parse_unary() {
-    TokenType type = parser.prev.type;
+static void parse_unary(Parser* parser, bool can_assign) {
+    TokenType type = parser->prev.type;
 
-    parse_prec(P_UNARY);
+    parse_prec(parser, P_UNARY);
 
     switch(type) {
         case TOKEN_MINUS:
-            emit(OP_NEGATE);
+            emit(parser, OP_NEGATE);
             break;
         case TOKEN_BANG:
-            emit(OP_NOT);
+            emit(parser, OP_NOT);
             break;
         default:
             break;
     }
 }
 
-void parse_binary() {
-    TokenType op = parser.prev.type;
+static void parse_binary(Parser* parser, bool can_assign) {
+    TokenType op = parser->prev.type;
     Rule* rule = rule_of(op);
-    parse_prec((Prec)(rule->prec + 1)); // left-associative
+    parse_prec(parser, (Prec)(rule->prec + 1)); // left-associative
 
     switch (op) {
         case TOKEN_PLUS:
-            emit(OP_ADD);
+            emit(parser, OP_ADD);
             break;
         case TOKEN_MINUS:
-            emit(OP_SUBTRACT);
+            emit(parser, OP_SUBTRACT);
             break;
         case TOKEN_STAR:
-            emit(OP_MULTIPLY);
+            emit(parser, OP_MULTIPLY);
             break;
         case TOKEN_SLASH:
-            emit(OP_DIVIDE);
+            emit(parser, OP_DIVIDE);
             break;
         case TOKEN_EQUAL_EQUAL:
-            emit(OP_EQUAL);
+            emit(parser, OP_EQUAL);
             break;
         case TOKEN_BANG_EQUAL:
             // a != b -> !(a == b)
-            emit2(OP_EQUAL, OP_NOT);
+            emit2(parser, OP_EQUAL, OP_NOT);
             break;
         case TOKEN_LESS:
-            emit(OP_LESS);
+            emit(parser, OP_LESS);
             break;
         case TOKEN_LESS_EQUAL:
             // a <= b -> !(a > b)
-            emit2(OP_GREATER, OP_NOT);
+            emit2(parser, OP_GREATER, OP_NOT);
             break;
         case TOKEN_GREATER:
-            emit(OP_GREATER);
+            emit(parser, OP_GREATER);
             break;
         case TOKEN_GREATER_EQUAL:
             // a >= b -> !(a < b)
-            emit2(OP_LESS, OP_NOT);
+            emit2(parser, OP_LESS, OP_NOT);
             break;
         default:
             break;
     }
 }
 
-void parse_str() {
-    emit_const(MK_OBJ_VAL((Obj*)cp_str(parser.prev.start + 1, parser.prev.length - 2)));
+static void parse_str(Parser* parser, bool can_assign) {
+    emit_const(parser, MK_OBJ_VAL((Obj*)cp_str(parser->vm, parser->prev.start + 1, parser->prev.length - 2)));
 }
 
-void parse_print() {
-    parse_expr(); 
-    consume(TOKEN_SEMICOLON, "Expected ';' at the end of print statement");
-    emit(OP_PRINT);
+static void parse_print(Parser* parser) {
+    parse_expr(parser); 
+    consume(parser, TOKEN_SEMICOLON, "Expected ';' at the end of print statement");
+    emit(parser, OP_PRINT);
 }
 
-static void begin_scope() {
-    comp->scope_depth++;    
+static void begin_scope(Parser* parser) {
+    parser->comp->scope_depth++;    
 }
 
-static void end_scope() {
-   comp->scope_depth--; 
+static void end_scope(Parser* parser) {
+   parser->comp->scope_depth--; 
 
    // clear local variables from the ended scope
-   while (comp->local_count > 0 &&
-           comp->locals[comp->local_count - 1].depth >
-            comp->scope_depth) {
-        emit(OP_POP);
-        comp->local_count--;
+   while (parser->comp->local_count > 0 &&
+           parser->comp->locals[parser->comp->local_count - 1].depth >
+            parser->comp->scope_depth) {
+        if (parser->comp->locals[parser->comp->local_count - 1].is_captured) {
+            emit(parser, OP_CLOSE_UPVALUE);
+        } else {
+            emit(parser, OP_POP);
+        }
+        parser->comp->local_count--;
    }
 }
 
-static void parse_block() {
-    while(!check(TOKEN_CURLY_END) && !check(TOKEN_EOF)) {
-        parse_decl();
+static void parse_block(Parser* parser) {
+    while(!check(parser, TOKEN_CURLY_END) && !check(parser, TOKEN_EOF)) {
+        parse_decl(parser);
     }
 
-    consume(TOKEN_CURLY_END, "Expected '}' at the end of block");
+    consume(parser, TOKEN_CURLY_END, "Expected '}' at the end of block");
 }
 
 /*
  * Emit a preliminary instruction, since we need to parse the statement
  * before we know where to jump.
  */
-static int emit_jmp(uint8_t op) {
-    emit(op);
+static int emit_jmp(Parser* parser, uint8_t op) {
+    emit(parser, op);
     // placeholders
-    emit2(0xFF, 0xFF);
+    emit2(parser, 0xFF, 0xFF);
     // index of first placeholder byte
-    return curr_ops()->count - 2;
+    return curr_ops(parser)->count - 2;
 }
 
-static void patch_jmp(int i_jmp_val) {
+static void patch_jmp(Parser* parser, int i_jmp_val) {
     /*
      * Subtract i_jmp_val to get distance from the start of the jump value
      * to the end of block. Subtract another 2 to only get the block length.
      */
-    int jmp_dist = curr_ops()->count - i_jmp_val - 2; 
+    int jmp_dist = curr_ops(parser)->count - i_jmp_val - 2; 
 
     if (jmp_dist > UINT16_MAX) {
-        err("Uh oh, you can't jump that far in a condition. 16-bit numbers are used for the jump destination. Sorry.");
+        err(parser, "Uh oh, you can't jump that far in a condition. 16-bit numbers are used for the jump destination. Sorry.");
     }
 
     // the upper 8 bits are emitted first
-    curr_ops()->ops[i_jmp_val] = (jmp_dist >> 8) & 0xFF;
-    curr_ops()->ops[i_jmp_val + 1] = jmp_dist & 0xFF;
+    curr_ops(parser)->ops[i_jmp_val] = (jmp_dist >> 8) & 0xFF;
+    curr_ops(parser)->ops[i_jmp_val + 1] = jmp_dist & 0xFF;
 }
 
-static void parse_if() {
-    consume(TOKEN_PAREN_START, "Expected '(' before if condition");
-    parse_expr();
-    consume(TOKEN_PAREN_END, "Expected ')' after if condition");
+static void parse_if(Parser* parser) {
+    consume(parser, TOKEN_PAREN_START, "Expected '(' before if condition");
+    parse_expr(parser);
+    consume(parser, TOKEN_PAREN_END, "Expected ')' after if condition");
 
-    int if_jmp = emit_jmp(OP_JMP_IF_FALSE);
-    emit(OP_POP); // pop condition at beginning of if
-    parse_stmt();
+    int if_jmp = emit_jmp(parser, OP_JMP_IF_FALSE);
+    emit(parser, OP_POP); // pop condition at beginning of if
+    parse_stmt(parser);
 
     // add a jump at the end of the if block to skip the else block
-    int else_jmp = emit_jmp(OP_JMP);
+    int else_jmp = emit_jmp(parser, OP_JMP);
 
-    patch_jmp(if_jmp);
-    emit(OP_POP); // pop condition at beginning of else, since we jumped past the other pop
+    patch_jmp(parser, if_jmp);
+    emit(parser, OP_POP); // pop condition at beginning of else, since we jumped past the other pop
 
-    if (match(TOKEN_ELSE)) {
-        parse_stmt();
+    if (match(parser, TOKEN_ELSE)) {
+        parse_stmt(parser);
     }
-    patch_jmp(else_jmp);
+    patch_jmp(parser, else_jmp);
 }
 
-static void emit_loop(int loop_start) {
-      emit(OP_LOOP);
+static void emit_loop(Parser* parser, int loop_start) {
+      emit(parser, OP_LOOP);
 
-      int offset = curr_ops()->count - loop_start + 2;
+      int offset = curr_ops(parser)->count - loop_start + 2;
       if (offset > UINT16_MAX) {
-        err("Uh oh, you can't have such a large while loop body. 16-bit numbers are used for the jump destination. Sorry.");
+        err(parser, "Uh oh, you can't have such a large while loop body. 16-bit numbers are used for the jump destination. Sorry.");
       }
 
-      emit2((offset >> 8) & 0xFF, offset & 0xFF);
+      emit2(parser, (offset >> 8) & 0xFF, offset & 0xFF);
 }
 
-static void parse_while() {
-    int loop_start = curr_ops()->count;
-    consume(TOKEN_PAREN_START, "Expected '(' before while condition"); 
-    parse_expr();
-    consume(TOKEN_PAREN_END, "Expected ')' after while condition"); 
-
-    int exit_jmp = emit_jmp(OP_JMP_IF_FALSE);
-    emit(OP_POP);
-    parse_stmt();
-    emit_loop(loop_start);
-    patch_jmp(exit_jmp);
-    emit(OP_POP);
+static void parse_while(Parser* parser) {
+    int loop_start = curr_ops(parser)->count;
+    consume(parser, TOKEN_PAREN_START, "Expected '(' before while condition"); 
+    parse_expr(parser);
+    consume(parser, TOKEN_PAREN_END, "Expected ')' after while condition"); 
+
+    int exit_jmp = emit_jmp(parser, OP_JMP_IF_FALSE);
+    emit(parser, OP_POP);
+    parse_stmt(parser);
+    emit_loop(parser, loop_start);
+    patch_jmp(parser, exit_jmp);
+    emit(parser, OP_POP);
 }
 
-static void parse_for() {
+static void parse_for(Parser* parser) {
     // make sure initializer variable is in a dedicated scope
-    begin_scope();
-    consume(TOKEN_PAREN_START, "Expected '(' before for constructs");
+    begin_scope(parser);
+    consume(parser, TOKEN_PAREN_START, "Expected '(' before for constructs");
 
     // optional initializer
-    if (match(TOKEN_SEMICOLON)) {
+    if (match(parser, TOKEN_SEMICOLON)) {
         // no initializer
-    } else if (match(TOKEN_VAR)) {
-       parse_var_decl(); 
+    } else if (match(parser, TOKEN_VAR)) {
+       parse_var_decl(parser); 
     } else {
-       parse_expr_stmt(); 
+       parse_expr_stmt(parser); 
     }
 
-    int loop_start = curr_ops()->count;
+    int loop_start = curr_ops(parser)->count;
     // optional loop condition
     int exit_jmp = -1;
-    if (!match(TOKEN_SEMICOLON)) {
-        parse_expr(); 
-        consume(TOKEN_SEMICOLON, "Expected ';' after for condition");
-        exit_jmp = emit_jmp(OP_JMP_IF_FALSE);
-        emit(OP_POP); // pop condition before entering for block
+    if (!match(parser, TOKEN_SEMICOLON)) {
+        parse_expr(parser); 
+        consume(parser, TOKEN_SEMICOLON, "Expected ';' after for condition");
+        exit_jmp = emit_jmp(parser, OP_JMP_IF_FALSE);
+        emit(parser, OP_POP); // pop condition before entering for block
     }
 
     // optional increment
-    if (!match(TOKEN_PAREN_END)) {
+    if (!match(parser, TOKEN_PAREN_END)) {
         /*
          * Use jumps in order to execute the increment
          * after the for loop body.
          */
-        int body_jmp = emit_jmp(OP_JMP); // jump to skip increment
-        int inc_start = curr_ops()->count;
+        int body_jmp = emit_jmp(parser, OP_JMP); // jump to skip increment
+        int inc_start = curr_ops(parser)->count;
         // Consume increment. No semicolon, but otherwise like an expression statement
-        parse_expr();
-        emit(OP_POP);
-        consume(TOKEN_PAREN_END, "Expected ')' after for constructs");
+        parse_expr(parser);
+        emit(parser, OP_POP);
+        consume(parser, TOKEN_PAREN_END, "Expected ')' after for constructs");
 
-        emit_loop(loop_start); // jump back to the condition
+        emit_loop(parser, loop_start); // jump back to the condition
         loop_start = inc_start; // after loop body, jump to increment
-        patch_jmp(body_jmp);
+        patch_jmp(parser, body_jmp);
     }
 
-    parse_stmt();
-    emit_loop(loop_start); 
+    parse_stmt(parser);
+    emit_loop(parser, loop_start); 
     // check for optional condition exit
     if (exit_jmp != -1) {
-        patch_jmp(exit_jmp);
-        emit(OP_POP); // pop condition when leaving for block
+        patch_jmp(parser, exit_jmp);
+        emit(parser, OP_POP); // pop condition when leaving for block
     }
-    end_scope();
+    end_scope(parser);
 }
 
-static void parse_expr_stmt() {
-    parse_expr();
-    consume(TOKEN_SEMICOLON, "Expected ';' at the end of statement");
-    emit(OP_POP);
+static void parse_expr_stmt(Parser* parser) {
+    parse_expr(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expected ';' at the end of statement");
+    emit(parser, OP_POP);
 }
 
-static void parse_ret() {
-    if (comp->fn_type == FN_SCRIPT) {
-        err("Can't return from top level code. Lol");
+static void parse_ret(Parser* parser) {
+    if (parser->comp->fn_type == FN_SCRIPT) {
+        err(parser, "Can't return from top level code. Lol");
     }
 
-    if (match(TOKEN_SEMICOLON)) {
-        emit_ret();
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emit_ret(parser);
     } else {
-        parse_expr();
-        consume(TOKEN_SEMICOLON, "Expected ';' after return");
-        emit(OP_RETURN);
-    }
-}
-
-void parse_stmt() {
-    if (match(TOKEN_PRINT)) {
-        parse_print();
-    } else if(match(TOKEN_IF)) {
-        parse_if();
-    } else if(match(TOKEN_RETURN)) {
-        parse_ret();
-    } else if(match(TOKEN_WHILE)) {
-        parse_while();
-    } else if(match(TOKEN_FOR)) {
-        parse_for();
-    } else if (match(TOKEN_CURLY_START)) {
-        begin_scope();
-        parse_block();
-        end_scope();
+        if (parser->comp->fn_type == FN_INIT) {
+            err(parser, "Can't return a value from an initializer");
+        }
+        parse_expr(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expected ';' after return");
+        emit(parser, OP_RETURN);
+    }
+}
+
+static void parse_stmt(Parser* parser) {
+    if (match(parser, TOKEN_PRINT)) {
+        parse_print(parser);
+    } else if(match(parser, TOKEN_IF)) {
+        parse_if(parser);
+    } else if(match(parser, TOKEN_RETURN)) {
+        parse_ret(parser);
+    } else if(match(parser, TOKEN_WHILE)) {
+        parse_while(parser);
+    } else if(match(parser, TOKEN_FOR)) {
+        parse_for(parser);
+    } else if (match(parser, TOKEN_CURLY_START)) {
+        begin_scope(parser);
+        parse_block(parser);
+        end_scope(parser);
     } else {
-        parse_expr_stmt();
+        parse_expr_stmt(parser);
     }
 }
 
-void define_var(uint8_t i_val) {
+static void define_var(Parser* parser, uint8_t i_val) {
     /*
      * No define is necessary for local variables,
      * as they are stored directly on the VM stack.
      */
-    if (comp->scope_depth > 0) {
-        mark_initialized();
+    if (parser->comp->scope_depth > 0) {
+        mark_initialized(parser);
         return;
     }
 
-    emit2(OP_DEFINE_GLOBAL, i_val); 
+    emit2(parser, OP_DEFINE_GLOBAL, i_val); 
 }
 
-uint8_t identifier_constant(Token* token) {
-    return mk_const(MK_OBJ_VAL((Obj*)cp_str(token->start, token->length)));
+static uint8_t identifier_constant(Parser* parser, Token* token) {
+    return mk_const(parser, MK_OBJ_VAL((Obj*)cp_str(parser->vm, token->start, token->length)));
 }
 
-static int resolve_local(Compiler* compiler, Token* token) {
+static int resolve_local(Parser* parser, Compiler* compiler, Token* token) {
     for (int i = compiler->local_count - 1; i >= 0; i--) {
         Local* local = &compiler->locals[i];
         if (id_equal(&local->name, token)) {
             if (local->depth == -1) {
-                err("Can't read local variable in its own initializer");
+                err(parser, "Can't read local variable in its own initializer");
             }
             return i;
         }
@@ -578,7 +625,7 @@ static int resolve_local(Compiler* compiler, Token* token) {
     return -1;
 }
 
-static int add_upvalue(Compiler* compiler, uint8_t local_index, bool is_local) {
+static int add_upvalue(Parser* parser, Compiler* compiler, uint8_t local_index, bool is_local) {
     int upvalue_count = compiler->fn->upvalue_count;
 
     // prevent creating multiple upvalues for the same variable
@@ -590,7 +637,7 @@ static int add_upvalue(Compiler* compiler, uint8_t local_index, bool is_local) {
     }
 
     if (upvalue_count >= UINT8_COUNT) {
-        err("Too many variables were captured by closures. At most 255 upvalues are allowd.");
+        err(parser, "Too many variables were captured by closures. At most 255 upvalues are allowd.");
         return 0;
     }
 
@@ -599,73 +646,75 @@ static int add_upvalue(Compiler* compiler, uint8_t local_index, bool is_local) {
     return compiler->fn->upvalue_count++;
 }
 
-static int resolve_upvalue(Compiler* compiler, Token* token) {
+static int resolve_upvalue(Parser* parser, Compiler* compiler, Token* token) {
     if (compiler->enclosing == NULL) {
         return -1;
     }
 
-    int local = resolve_local(compiler, token);
+    int local = resolve_local(parser, compiler->enclosing, token);
     if (local != -1) {
-        return add_upvalue(compiler, (uint8_t)local, true);
+        compiler->enclosing->locals[local].is_captured = true;
+        return add_upvalue(parser, compiler, (uint8_t)local, true);
     }
 
     // resolve recursively
-    int upvalue = resolve_upvalue(compiler->enclosing, token);
+    int upvalue = resolve_upvalue(parser, compiler->enclosing, token);
     if (upvalue != -1) {
-        return add_upvalue(compiler, (uint8_t)upvalue, false);
+        return add_upvalue(parser, compiler, (uint8_t)upvalue, false);
     }
 
     return -1;
 }
 
-void parse_named_var(Token* token, bool can_assign) {
+static void parse_named_var(Parser* parser, Token* token, bool can_assign) {
     uint8_t get_op;
     uint8_t set_op;
 
-    int i_val = resolve_local(comp, token);
+    int i_val = resolve_local(parser, parser->comp, token);
     if (i_val != -1) {
         get_op = OP_GET_LOCAL;
         set_op = OP_SET_LOCAL;
-    } else if ((i_val = resolve_upvalue(comp, token)) != -1) {
+    } else if ((i_val = resolve_upvalue(parser, parser->comp, token)) != -1) {
         get_op = OP_GET_UPVALUE;
         set_op = OP_SET_UPVALUE;
     } else {
-        i_val = identifier_constant(token);
+        i_val = identifier_constant(parser, token);
         get_op = OP_GET_GLOBAL;
         set_op = OP_SET_GLOBAL;
     }
 
-    if (can_assign && match(TOKEN_EQUAL)) {
-        parse_expr();
-        emit2(set_op, (uint8_t)i_val);
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        parse_expr(parser);
+        emit2(parser, set_op, (uint8_t)i_val);
     } else {
-        emit2(get_op, (uint8_t)i_val);
+        emit2(parser, get_op, (uint8_t)i_val);
     }
 }
 
-void parse_var_val(bool can_assign) {
-    parse_named_var(&parser.prev, can_assign);
+static void parse_var_val(Parser* parser, bool can_assign) {
+    parse_named_var(parser, &parser->prev, can_assign);
 }
 
-static void mark_initialized() {
-    if (comp->scope_depth == 0) {
+static void mark_initialized(Parser* parser) {
+    if (parser->comp->scope_depth == 0) {
         return;
     }
-    comp->locals[comp->local_count - 1].depth = comp->scope_depth;
+    parser->comp->locals[parser->comp->local_count - 1].depth = parser->comp->scope_depth;
 }
 
-static void add_local(Token token) {
-    if (comp->local_count == UINT8_COUNT) {
-        err("Too many local variables");
+static void add_local(Parser* parser, Token token) {
+    if (parser->comp->local_count == UINT8_COUNT) {
+        err(parser, "Too many local variables");
         return;
     }
 
-    Local* local = &comp->locals[comp->local_count++];
+    Local* local = &parser->comp->locals[parser->comp->local_count++];
     local->name = token;
     /* Mark as declared, but not initialized.
      * This is to avoid var a = a;
      */
     local->depth = -1;
+    local->is_captured = false;
 }
 
 static bool id_equal(Token* first, Token* second) {
@@ -673,179 +722,356 @@ static bool id_equal(Token* first, Token* second) {
         memcmp(first->start, second->start, first->length) == 0;
 }
 
-static void declare_var() {
+static void declare_var(Parser* parser) {
     // global variables are late bound
-    if (comp->scope_depth == 0) {
+    if (parser->comp->scope_depth == 0) {
         return;
     }
 
-    Token* name = &parser.prev;
+    Token* name = &parser->prev;
 
     // look for conflicting variable names
-    for (int i = comp->local_count - 1; i >= 0; i--) {
-        Local* local = &comp->locals[i];
-        if (local->depth != -1 && local->depth < comp->scope_depth) {
+    for (int i = parser->comp->local_count - 1; i >= 0; i--) {
+        Local* local = &parser->comp->locals[i];
+        if (local->depth != -1 && local->depth < parser->comp->scope_depth) {
             break; 
         }
 
         if (id_equal(name, &local->name)) {
-            err("Variable already exists in this scope");
+            err(parser, "Variable already exists in this scope");
         }
     }
 
-    add_local(*name);
+    add_local(parser, *name);
 }
 
-uint8_t parse_var(char* str) {
-    consume(TOKEN_IDENTIFIER, str);
+static uint8_t parse_var(Parser* parser, char* str) {
+    consume(parser, TOKEN_IDENTIFIER, str);
 
-    declare_var();
+    declare_var(parser);
     /*
      * Local variables are not looked up by name at runtime,
      * so we don't emit a named constant.
      */
-    if (comp->scope_depth > 0) {
+    if (parser->comp->scope_depth > 0) {
         return 0;
     }
     
-    return identifier_constant(&parser.prev);
+    return identifier_constant(parser, &parser->prev);
 }
 
-static void parse_var_decl() {
-    uint8_t global = parse_var("Expected a variable name");
+static void parse_var_decl(Parser* parser) {
+    uint8_t global = parse_var(parser, "Expected a variable name");
 
-    if (match(TOKEN_EQUAL)) {
-        parse_expr(); 
+    if (match(parser, TOKEN_EQUAL)) {
+        parse_expr(parser); 
     } else {
-        emit(OP_NIL); 
+        emit(parser, OP_NIL); 
     }
 
-    consume(TOKEN_SEMICOLON, "Expected ';' at the end of variable declaration");
-    define_var(global);
+    consume(parser, TOKEN_SEMICOLON, "Expected ';' at the end of variable declaration");
+    define_var(parser, global);
 }
 
-static void parse_fun(FuncType fn_type) {
+static void parse_fun(Parser* parser, FuncType fn_type) {
     Compiler compiler;
-    init_comp(&compiler, fn_type);
-    begin_scope();
+    init_comp(parser, &compiler, fn_type);
+    begin_scope(parser);
 
-    consume(TOKEN_PAREN_START, "Expected '(' after function name");
-    if (!check(TOKEN_PAREN_END)) {
+    consume(parser, TOKEN_PAREN_START, "Expected '(' after function name");
+    if (!check(parser, TOKEN_PAREN_END)) {
         do {
-            comp->fn->arity++;
-            if (comp->fn->arity > 255) {
-                err("Too many function arguments. Max 255 are supported. Sorry..");
+            parser->comp->fn->arity++;
+            if (parser->comp->fn->arity > 255) {
+                err(parser, "Too many function arguments. Max 255 are supported. Sorry..");
             }
-            uint8_t c = parse_var("Expected a parameter name");
-            define_var(c);
-        } while(match(TOKEN_COMMA));
+            uint8_t c = parse_var(parser, "Expected a parameter name");
+            define_var(parser, c);
+        } while(match(parser, TOKEN_COMMA));
     }
-    consume(TOKEN_PAREN_END, "Expected ')' after function parameters");
-    consume(TOKEN_CURLY_START, "Expected '{' before function body");
-    parse_block();
+    consume(parser, TOKEN_PAREN_END, "Expected ')' after function parameters");
+    consume(parser, TOKEN_CURLY_START, "Expected '{' before function body");
+    parse_block(parser);
 
-    ObjFunc* fn = end_comp();
-    emit2(OP_CLOSURE, mk_const(MK_OBJ_VAL((Obj*)fn)));
+    ObjFunc* fn = end_comp(parser);
+    emit2(parser, OP_CLOSURE, mk_const(parser, MK_OBJ_VAL((Obj*)fn)));
 
     // variable sized encoding for all of the upvalues
     for (int i = 0; i < fn->upvalue_count; i++) {
-        emit(comp->upvalues[i].is_local ? 1 : 0);
-        emit(comp->upvalues[i].index);
+        emit(parser, compiler.upvalues[i].is_local ? 1 : 0);
+        emit(parser, compiler.upvalues[i].index);
+    }
+}
+
+static void parse_fun_decl(Parser* parser) {
+    uint8_t global = parse_var(parser, "Expected function name");
+    mark_initialized(parser);
+    parse_fun(parser, FN_FUNC);
+    define_var(parser, global);
+}
+
+static void parse_method(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expected a method name");
+    uint8_t name = identifier_constant(parser, &parser->prev);
+    FuncType fn_type = FN_METHOD;
+    if (parser->prev.length == 4 && memcmp(parser->prev.start, "init", 4) == 0) {
+        fn_type = FN_INIT;
     }
+    parse_fun(parser, fn_type);
+    emit2(parser, OP_METHOD, name);
 }
 
-static void parse_fun_decl() {
-    uint8_t global = parse_var("Expected function name");
-    mark_initialized();
-    parse_fun(FN_FUNC);
-    define_var(global);
+static Token synthetic_token(const char* text) {
+    Token token;
+    token.type = TOKEN_IDENTIFIER;
+    token.start = text;
+    token.length = (int)strlen(text);
+    token.line = 0;
+    return token;
+}
+
+static void parse_class_decl(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expected a class name");
+    Token class_name = parser->prev;
+    uint8_t name = identifier_constant(parser, &parser->prev);
+    declare_var(parser);
+
+    emit2(parser, OP_CLASS, name);
+    define_var(parser, name);
+
+    ClassCompiler class_comp;
+    class_comp.has_super = false;
+    class_comp.enclosing = parser->klass;
+    parser->klass = &class_comp;
+
+    if (match(parser, TOKEN_LESS)) {
+        consume(parser, TOKEN_IDENTIFIER, "Expected a superclass name");
+        parse_var_val(parser, false);
+        if (id_equal(&class_name, &parser->prev)) {
+            err(parser, "A class can't inherit from itself");
+        }
+
+        // methods capture the superclass as the local super
+        begin_scope(parser);
+        add_local(parser, synthetic_token("super"));
+        define_var(parser, 0);
+
+        parse_named_var(parser, &class_name, false);
+        emit(parser, OP_INHERIT);
+        class_comp.has_super = true;
+    }
+
+    // the class stays on the stack while the methods are added
+    parse_named_var(parser, &class_name, false);
+    consume(parser, TOKEN_CURLY_START, "Expected '{' before class body");
+    while (!check(parser, TOKEN_CURLY_END) && !check(parser, TOKEN_EOF)) {
+        parse_method(parser);
+    }
+    consume(parser, TOKEN_CURLY_END, "Expected '}' after class body");
+    emit(parser, OP_POP);
+
+    if (class_comp.has_super) {
+        end_scope(parser);
+    }
+    parser->klass = parser->klass->enclosing;
 }
 
-void parse_decl() {
-    if (match(TOKEN_VAR)) {
-        parse_var_decl();
-    } else if(match(TOKEN_FUN)) {
-        parse_fun_decl();
+static void parse_decl(Parser* parser) {
+    if (match(parser, TOKEN_CLASS)) {
+        parse_class_decl(parser);
+    } else if (match(parser, TOKEN_VAR)) {
+        parse_var_decl(parser);
+    } else if(match(parser, TOKEN_FUN)) {
+        parse_fun_decl(parser);
     } else {
-        parse_stmt();
+        parse_stmt(parser);
     }
 
-    if (parser.panic) {
-        synch();
+    if (parser->panic) {
+        synch(parser);
     }
 }
 
-static void parse_and() {
+static void parse_and(Parser* parser, bool can_assign) {
     // skip right operand if left operand is false
-    int jmp = emit_jmp(OP_JMP_IF_FALSE); 
-    emit(OP_POP);
-    parse_prec(P_AND);
-    patch_jmp(jmp);
+    int jmp = emit_jmp(parser, OP_JMP_IF_FALSE); 
+    emit(parser, OP_POP);
+    parse_prec(parser, P_AND);
+    patch_jmp(parser, jmp);
 }
 
-static void parse_or() {
+static void parse_or(Parser* parser, bool can_assign) {
     /*
      * Skip right operand if left operand is true.
      *
      * Instead of having a dedicated JMP_IF_TRUE, two jumps are combined to get that behavior.
      */
-    int false_jmp = emit_jmp(OP_JMP_IF_FALSE);
-    int true_jmp = emit_jmp(OP_JMP);
+    int false_jmp = emit_jmp(parser, OP_JMP_IF_FALSE);
+    int true_jmp = emit_jmp(parser, OP_JMP);
 
-    patch_jmp(false_jmp);
+    patch_jmp(parser, false_jmp);
     /*
      * If the left operand was false, then we pop it and let the
      * whole expression evaluate to the right operand.
      */
-    emit(OP_POP);
+    emit(parser, OP_POP);
     
-    parse_prec(P_OR);
+    parse_prec(parser, P_OR);
 
-    patch_jmp(true_jmp);
+    patch_jmp(parser, true_jmp);
 }
 
-static uint8_t parse_arglist() {
-    uint8_t argc;
-    if (!check(TOKEN_PAREN_END)) {
+static uint8_t parse_arglist(Parser* parser) {
+    int argc = 0;
+    if (!check(parser, TOKEN_PAREN_END)) {
         do {
-            parse_expr();
+            parse_expr(parser);
             argc++;
             if (argc > 255) {
-                err("Too many function arguments. Max 255 are supported. Sorry..");
+                err(parser, "Too many function arguments. Max 255 are supported. Sorry..");
+            }
+        } while(match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_PAREN_END, "Expected ')' after function call arguments");
+    return (uint8_t)argc;
+}
+
+static void parse_call(Parser* parser, bool can_assign) {
+    uint8_t argc = parse_arglist(parser);
+    int i_cache = append_call_cache(curr_ops(parser));
+    if (i_cache > UINT16_MAX) {
+        err(parser, "Too many calls in one function. At most 65536 are supported. Sorry.");
+    }
+
+    emit2(parser, OP_CALL, argc);
+    emit_cache(parser, i_cache);
+}
+
+static int mk_prop_cache(Parser* parser) {
+    int i_cache = append_prop_cache(curr_ops(parser));
+    if (i_cache > UINT16_MAX) {
+        err(parser, "Too many property accesses in one function. At most 65536 are supported. Sorry.");
+    }
+    return i_cache;
+}
+
+static void parse_array(Parser* parser, bool can_assign) {
+    int count = 0;
+    if (!check(parser, TOKEN_SQUARE_END)) {
+        do {
+            parse_expr(parser);
+            count++;
+            if (count > 255) {
+                err(parser, "Too many elements in an array literal. Max 255 are supported. Sorry..");
             }
-        } while(match(TOKEN_COMMA));
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_SQUARE_END, "Expected ']' after array elements");
+    emit2(parser, OP_ARRAY, (uint8_t)count);
+}
+
+static void parse_index(Parser* parser, bool can_assign) {
+    parse_expr(parser);
+    consume(parser, TOKEN_SQUARE_END, "Expected ']' after index");
+
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        parse_expr(parser);
+        emit(parser, OP_SET_INDEX);
+    } else {
+        emit(parser, OP_GET_INDEX);
+    }
+}
+
+static void parse_dot(Parser* parser, bool can_assign) {
+    consume(parser, TOKEN_IDENTIFIER, "Expected a property name after '.'");
+    uint8_t name = identifier_constant(parser, &parser->prev);
+
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        parse_expr(parser);
+        emit2(parser, OP_SET_PROPERTY, name);
+        emit_cache(parser, mk_prop_cache(parser));
+    } else if (match(parser, TOKEN_PAREN_START)) {
+        // a method call without the bound method in between
+        uint8_t argc = parse_arglist(parser);
+        emit2(parser, OP_INVOKE, name);
+        emit(parser, argc);
+        emit_cache(parser, mk_prop_cache(parser));
+    } else {
+        emit2(parser, OP_GET_PROPERTY, name);
+        emit_cache(parser, mk_prop_cache(parser));
     }
-    consume(TOKEN_PAREN_END, "Expected ')' after function call arguments");
-    return argc;
 }
 
-static void parse_call() {
-    uint8_t argc = parse_arglist();
-    emit2(OP_CALL, argc);
+static void parse_this(Parser* parser, bool can_assign) {
+    if (parser->klass == NULL) {
+        err(parser, "Can't use 'this' outside of a class");
+        return;
+    }
+    // this is a local that can't be assigned
+    parse_var_val(parser, false);
 }
 
-ObjFunc* compile(const char* program) {
-    init_scanner(program); 
+static void parse_super(Parser* parser, bool can_assign) {
+    if (parser->klass == NULL) {
+        err(parser, "Can't use 'super' outside of a class");
+    } else if (!parser->klass->has_super) {
+        err(parser, "Can't use 'super' in a class without a superclass");
+    }
 
-    Compiler compiler;
-    init_comp(&compiler, FN_SCRIPT);
+    consume(parser, TOKEN_DOT, "Expected '.' after 'super'");
+    consume(parser, TOKEN_IDENTIFIER, "Expected a superclass method name");
+    uint8_t name = identifier_constant(parser, &parser->prev);
+
+    Token this_token = synthetic_token("this");
+    Token super_token = synthetic_token("super");
+    parse_named_var(parser, &this_token, false);
+    if (match(parser, TOKEN_PAREN_START)) {
+        uint8_t argc = parse_arglist(parser);
+        parse_named_var(parser, &super_token, false);
+        emit2(parser, OP_SUPER_INVOKE, name);
+        emit(parser, argc);
+    } else {
+        parse_named_var(parser, &super_token, false);
+        emit2(parser, OP_GET_SUPER, name);
+    }
+}
 
+ObjFunc* compile(VmState* vm, const char* program) {
+    VmPhase phase = vm->phase;
+    vm->phase = PHASE_COMPILE;
+    Parser parser;
+    parser.vm = vm;
+    parser.comp = NULL;
+    parser.klass = NULL;
     parser.err = false;
     parser.panic = false;
+    init_scanner(&parser.scanner, program); 
+
+    Compiler compiler;
+    init_comp(&parser, &compiler, FN_SCRIPT);
 
-    advance();
+    advance(&parser);
 
-    while (!match(TOKEN_EOF)) {
-        parse_decl();
+    while (!match(&parser, TOKEN_EOF)) {
+        parse_decl(&parser);
     }
 
-    consume(TOKEN_EOF, "Expected EOF");
-    ObjFunc* fn = end_comp();
+    consume(&parser, TOKEN_EOF, "Expected EOF");
+    ObjFunc* fn = end_comp(&parser);
+    vm->phase = phase;
     return parser.err ? NULL : fn;
 }
 
+void mark_compiler_roots(VmState* vm) {
+    for (Compiler* comp = vm->compiler; comp != NULL; comp = comp->enclosing) {
+        if (comp->fn != NULL) {
+            gc_shade(vm, (Obj*)comp->fn);
+        }
+    }
+}
+
 // mapping from tokens to rules
-Rule rules[] = {
+static Rule rules[] = {
     [TOKEN_NUMBER]          = {parse_num, NULL, P_NONE},
     [TOKEN_STRING]          = {parse_str, NULL, P_NONE},
     [TOKEN_TRUE]            = {parse_bool, NULL, P_NONE},
@@ -866,6 +1092,8 @@ Rule rules[] = {
     [TOKEN_PAREN_END]       = {NULL, NULL, P_NONE},
     [TOKEN_CURLY_START]     = {NULL, NULL, P_NONE},
     [TOKEN_CURLY_END]       = {NULL, NULL, P_NONE},
+    [TOKEN_SQUARE_START]    = {parse_array, parse_index, P_CALL},
+    [TOKEN_SQUARE_END]      = {NULL, NULL, P_NONE},
     [TOKEN_AND]             = {NULL, parse_and, P_AND},
     [TOKEN_OR]              = {NULL, parse_or, P_OR},
     [TOKEN_NIL]             = {parse_nil, NULL, P_NONE},
@@ -873,17 +1101,17 @@ Rule rules[] = {
     [TOKEN_FUN]             = {NULL, NULL, P_NONE},
     [TOKEN_CLASS]           = {NULL, NULL, P_NONE},
     [TOKEN_PRINT]           = {NULL, NULL, P_NONE},
-    [TOKEN_THIS]            = {NULL, NULL, P_NONE},
-    [TOKEN_SUPER]           = {NULL, NULL, P_NONE},
+    [TOKEN_THIS]            = {parse_this, NULL, P_NONE},
+    [TOKEN_SUPER]           = {parse_super, NULL, P_NONE},
     [TOKEN_FOR]             = {NULL, NULL, P_NONE},
     [TOKEN_IF]              = {NULL, NULL, P_NONE},
     [TOKEN_ELSE]            = {NULL, NULL, P_NONE},
     [TOKEN_WHILE]           = {NULL, NULL, P_NONE},
     [TOKEN_RETURN]          = {NULL, NULL, P_NONE},
-    [TOKEN_IDENTIFIER]      = {(void *)parse_var_val, NULL, P_NONE},
+    [TOKEN_IDENTIFIER]      = {parse_var_val, NULL, P_NONE},
     [TOKEN_SEMICOLON]       = {NULL, NULL, P_NONE},
     [TOKEN_COMMA]           = {NULL, NULL, P_NONE},
-    [TOKEN_DOT]             = {NULL, NULL, P_NONE},
+    [TOKEN_DOT]             = {NULL, parse_dot, P_CALL},
     [TOKEN_ERROR]           = {NULL, NULL, P_NONE},
     [TOKEN_EOF]             = {NULL, NULL, P_NONE},
 };
@@ -3,6 +3,8 @@
 
 #include "ops.h"
 
-ObjFunc* compile(const char* program);
+ObjFunc* compile(VmState* vm, const char* program);
+// shade the functions that are still being compiled
+void mark_compiler_roots(VmState* vm);
 
 #endif
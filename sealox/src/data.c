@@ -0,0 +1,596 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "data.h"
+#include "array.h"
+#include "io.h"
+#include "map.h"
+#include "memory.h"
+#include "num.h"
+#include "vm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Both parsers run in two stages, like simdjson. The first classifies
+ * the input 64 bytes at a time into bit masks with a bit per byte, and
+ * turns them into the offsets of the structural chars, the ones outside
+ * of quotes that delimit values. The second walks the offsets and builds
+ * the values, so the bytes in between are only looked at by the first.
+ */
+
+// blocks of 64 bytes indexed at a time
+#define INDEX_BLOCKS 64
+#define JSON_MAX_DEPTH 512
+// longer numbers and literals are garbage
+#define JSON_MAX_SCALAR 1024
+
+typedef struct {
+#ifdef __SSE2__
+    __m128i chunks[4];
+#else
+    const char* bytes;
+#endif
+} Block;
+
+static inline void load_block(Block* block, const char* at) {
+#ifdef __SSE2__
+    for (int i = 0; i < 4; i++) {
+        block->chunks[i] = _mm_loadu_si128((const __m128i*)(at + 16 * i));
+    }
+#else
+    block->bytes = at;
+#endif
+}
+
+// bit i is set if byte i of the block is one of the count chars
+static inline uint64_t match(const Block* block, const char* chars, int count) {
+    uint64_t mask = 0;
+#ifdef __SSE2__
+    for (int i = 0; i < 4; i++) {
+        __m128i hits = _mm_cmpeq_epi8(block->chunks[i], _mm_set1_epi8(chars[0]));
+        for (int j = 1; j < count; j++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block->chunks[i], _mm_set1_epi8(chars[j])));
+        }
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(hits) << (16 * i);
+    }
+#else
+    for (int i = 0; i < 64; i++) {
+        for (int j = 0; j < count; j++) {
+            mask |= (uint64_t)(block->bytes[i] == chars[j]) << i;
+        }
+    }
+#endif
+    return mask;
+}
+
+// bit i is the xor of the bits up to i, which turns quotes into spans
+static inline uint64_t prefix_xor(uint64_t bits) {
+    for (int shift = 1; shift < 64; shift *= 2) {
+        bits ^= bits << shift;
+    }
+    return bits;
+}
+
+typedef struct {
+    const char* data;
+    size_t size;
+    bool json;
+    // offset of the next block to classify
+    size_t block;
+    // all bits set if the last block ended in quotes
+    uint64_t in_quotes;
+    // the scalar bytes of the last block
+    uint64_t prev_scalar;
+    // the first byte of the block is escaped by a backslash
+    bool escape_next;
+
+    size_t offsets[INDEX_BLOCKS * 64];
+    int count;
+    int pos;
+} Index;
+
+static void init_index(Index* index, const char* data, size_t size, bool json) {
+    index->data = data;
+    index->size = size;
+    index->json = json;
+    index->block = 0;
+    index->in_quotes = 0;
+    index->prev_scalar = 0;
+    index->escape_next = false;
+    index->count = 0;
+    index->pos = 0;
+}
+
+// the bytes escaped by the backslashes, which are rare enough for a loop
+static uint64_t find_escaped(uint64_t backslash, bool* escape_next) {
+    uint64_t escaped = 0;
+    bool escape = *escape_next;
+    for (int i = 0; i < 64; i++) {
+        if (escape) {
+            escaped |= (uint64_t)1 << i;
+            escape = false;
+        } else if (backslash & ((uint64_t)1 << i)) {
+            escape = true;
+        }
+    }
+    *escape_next = escape;
+    return escaped;
+}
+
+/*
+ * JSON structurals are the operators, all quotes, so that a string ends
+ * at the offset after its start, and the first byte of every scalar. For
+ * CSV they are the commas and newlines, where "" inside quotes toggles
+ * the quote span twice and so needs no special case.
+ */
+static void index_block(Index* index, const char* at, size_t base) {
+    Block block;
+    load_block(&block, at);
+    uint64_t quote = match(&block, "\"", 1);
+    uint64_t structural;
+    if (index->json) {
+        uint64_t backslash = match(&block, "\\", 1);
+        if (backslash != 0 || index->escape_next) {
+            quote &= ~find_escaped(backslash, &index->escape_next);
+        }
+        uint64_t in_quotes = prefix_xor(quote) ^ index->in_quotes;
+        index->in_quotes = (uint64_t)((int64_t)in_quotes >> 63);
+
+        uint64_t ops = match(&block, "{}[]:,", 6);
+        uint64_t space = match(&block, " \t\n\r", 4);
+        uint64_t scalar = ~(ops | space | quote | in_quotes);
+        uint64_t starts = scalar & ~((scalar << 1) | (index->prev_scalar >> 63));
+        index->prev_scalar = scalar;
+        structural = (ops & ~in_quotes) | quote | starts;
+    } else {
+        uint64_t in_quotes = prefix_xor(quote) ^ index->in_quotes;
+        index->in_quotes = (uint64_t)((int64_t)in_quotes >> 63);
+        structural = match(&block, ",\n", 2) & ~in_quotes;
+    }
+
+    while (structural != 0) {
+        index->offsets[index->count++] = base + __builtin_ctzll(structural);
+        structural &= structural - 1;
+    }
+}
+
+static bool refill(Index* index) {
+    index->count = 0;
+    index->pos = 0;
+    while (index->count == 0 && index->block < index->size) {
+        for (int i = 0; i < INDEX_BLOCKS && index->block < index->size; i++) {
+            size_t base = index->block;
+            if (index->size - base >= 64) {
+                index_block(index, index->data + base, base);
+            } else {
+                // padded with spaces, which are never structural
+                char tail[64];
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, index->data + base, index->size - base);
+                index_block(index, tail, base);
+            }
+            index->block += 64;
+        }
+    }
+    return index->count > 0;
+}
+
+// offset of the next structural char, or the size of the input at the end
+static inline size_t next_offset(Index* index) {
+    if (index->pos == index->count && !refill(index)) {
+        return index->size;
+    }
+    return index->offsets[index->pos++];
+}
+
+typedef struct {
+    VmState* vm;
+    Index index;
+    const char* data;
+    size_t size;
+    int depth;
+    bool failed;
+} Parser;
+
+static void fail(Parser* p, size_t at, const char* what) {
+    if (!p->failed) {
+        native_err(p->vm, "Invalid %s at byte %zu: %s", p->index.json ? "JSON" : "CSV", at, what);
+        p->failed = true;
+    }
+}
+
+static Val str_val(Parser* p, size_t at, const char* chars, size_t length) {
+    if (length > INT32_MAX) {
+        fail(p, at, "string is too long");
+        return MK_NIL_VAL;
+    }
+    return MK_OBJ_VAL((Obj*)cp_str(p->vm, chars, (int)length));
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// the code unit of the \uXXXX at s, or -1
+static long read_u_escape(const char* s, const char* end) {
+    if (end - s < 6 || s[0] != '\\' || s[1] != 'u') {
+        return -1;
+    }
+    long unit = 0;
+    for (int i = 2; i < 6; i++) {
+        int digit = hex_digit(s[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        unit = unit * 16 + digit;
+    }
+    return unit;
+}
+
+static char* put_utf8(char* out, long cp) {
+    if (cp < 0x80) {
+        *out++ = (char)cp;
+    } else if (cp < 0x800) {
+        *out++ = (char)(0xC0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *out++ = (char)(0xE0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+// escapes never get longer once decoded, so out has room for length bytes
+static char* unescape_json(const char* s, size_t length, char* out) {
+    const char* end = s + length;
+    while (s < end) {
+        if (*s != '\\') {
+            *out++ = *s++;
+            continue;
+        }
+        if (s + 1 == end) {
+            return NULL;
+        }
+        switch (s[1]) {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                long cp = read_u_escape(s, end);
+                if (cp < 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+                    return NULL;
+                }
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    long low = read_u_escape(s + 6, end);
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        return NULL;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    s += 6;
+                }
+                out = put_utf8(out, cp);
+                s += 6;
+                continue;
+            }
+            default:
+                return NULL;
+        }
+        s += 2;
+    }
+    return out;
+}
+
+// the string that starts with the quote at at
+static Val json_string(Parser* p, size_t at) {
+    size_t close = next_offset(&p->index);
+    if (close >= p->size) {
+        fail(p, at, "unterminated string");
+        return MK_NIL_VAL;
+    }
+    const char* chars = p->data + at + 1;
+    size_t length = close - at - 1;
+    if (memchr(chars, '\\', length) == NULL) {
+        return str_val(p, at, chars, length);
+    }
+    char* buf = REALLOC_ARR(char, NULL, length);
+    char* end = unescape_json(chars, length, buf);
+    Val str = MK_NIL_VAL;
+    if (end == NULL) {
+        fail(p, at, "invalid escape");
+    } else {
+        str = str_val(p, at, buf, end - buf);
+    }
+    free(buf);
+    return str;
+}
+
+/*
+ * JSON numbers are stricter than those of str_to_num, they have no leading
+ * zeros and digits on both sides of the point. The rest is left to it.
+ */
+static bool is_json_num(const char* p, const char* end) {
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9' || (*p == '0' && p + 1 < end && p[1] >= '0' && p[1] <= '9')) {
+        return false;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        p++;
+    }
+    return p == end || *p != '.' || (p + 1 < end && p[1] >= '0' && p[1] <= '9');
+}
+
+// a number or literal, which ends at the next structural
+static Val json_scalar(Parser* p, size_t at, size_t end) {
+    while (end > at && (p->data[end - 1] == ' ' || p->data[end - 1] == '\t'
+                        || p->data[end - 1] == '\n' || p->data[end - 1] == '\r')) {
+        end--;
+    }
+    const char* chars = p->data + at;
+    size_t length = end - at;
+    double num;
+    if (length == 4 && memcmp(chars, "true", 4) == 0) {
+        return MK_BOOL_VAL(true);
+    } else if (length == 5 && memcmp(chars, "false", 5) == 0) {
+        return MK_BOOL_VAL(false);
+    } else if (length == 4 && memcmp(chars, "null", 4) == 0) {
+        return MK_NIL_VAL;
+    } else if (length <= JSON_MAX_SCALAR && is_json_num(chars, chars + length)
+               && str_to_num(chars, (int)length, &num)) {
+        return MK_NUM_VAL(num);
+    }
+    fail(p, at, "expected a value");
+    return MK_NIL_VAL;
+}
+
+/*
+ * Containers keep themselves and their pending keys on the stack while
+ * their elements are allocated, which bounds the nesting.
+ */
+static bool enter(Parser* p, size_t at) {
+    if (p->depth == JSON_MAX_DEPTH || p->vm->top + 2 > p->vm->stack + p->vm->max_frames * UINT8_COUNT) {
+        fail(p, at, "nested too deeply");
+        return false;
+    }
+    p->depth++;
+    return true;
+}
+
+static Val json_value(Parser* p, size_t at, size_t* next);
+
+static Val json_array(Parser* p, size_t at) {
+    if (!enter(p, at)) {
+        return MK_NIL_VAL;
+    }
+    ObjArray* array = create_array(p->vm);
+    push_val(p->vm, MK_OBJ_VAL((Obj*)array));
+    size_t tok = next_offset(&p->index);
+    if (tok >= p->size || p->data[tok] != ']') {
+        for (;;) {
+            Val val = json_value(p, tok, &tok);
+            if (p->failed) {
+                break;
+            }
+            GC_BARRIER(p->vm, (Obj*)array, val);
+            append_val(&array->vals, val);
+            if (tok < p->size && p->data[tok] == ',') {
+                tok = next_offset(&p->index);
+            } else if (tok < p->size && p->data[tok] == ']') {
+                break;
+            } else {
+                fail(p, tok, "expected ',' or ']'");
+                break;
+            }
+        }
+    }
+    pop_val(p->vm);
+    p->depth--;
+    return MK_OBJ_VAL((Obj*)array);
+}
+
+static Val json_object(Parser* p, size_t at) {
+    if (!enter(p, at)) {
+        return MK_NIL_VAL;
+    }
+    ObjMap* map = create_map(p->vm);
+    push_val(p->vm, MK_OBJ_VAL((Obj*)map));
+    size_t tok = next_offset(&p->index);
+    if (tok >= p->size || p->data[tok] != '}') {
+        for (;;) {
+            if (tok >= p->size || p->data[tok] != '"') {
+                fail(p, tok, "expected a key");
+                break;
+            }
+            Val key = json_string(p, tok);
+            if (p->failed) {
+                break;
+            }
+            push_val(p->vm, key);
+            tok = next_offset(&p->index);
+            if (tok >= p->size || p->data[tok] != ':') {
+                fail(p, tok, "expected ':'");
+                pop_val(p->vm);
+                break;
+            }
+            Val val = json_value(p, next_offset(&p->index), &tok);
+            pop_val(p->vm);
+            if (p->failed) {
+                break;
+            }
+            GC_BARRIER(p->vm, (Obj*)map, key);
+            GC_BARRIER(p->vm, (Obj*)map, val);
+            vdict_put(&map->dict, key, val);
+            if (tok < p->size && p->data[tok] == ',') {
+                tok = next_offset(&p->index);
+            } else if (tok < p->size && p->data[tok] == '}') {
+                break;
+            } else {
+                fail(p, tok, "expected ',' or '}'");
+                break;
+            }
+        }
+    }
+    pop_val(p->vm);
+    p->depth--;
+    return MK_OBJ_VAL((Obj*)map);
+}
+
+// the value at at, and in next the offset of the structural after it
+static Val json_value(Parser* p, size_t at, size_t* next) {
+    if (at >= p->size) {
+        fail(p, at, "expected a value");
+        return MK_NIL_VAL;
+    }
+    Val val;
+    switch (p->data[at]) {
+        case '[':
+            val = json_array(p, at);
+            break;
+        case '{':
+            val = json_object(p, at);
+            break;
+        case '"':
+            val = json_string(p, at);
+            break;
+        default: {
+            size_t end = next_offset(&p->index);
+            *next = end;
+            return json_scalar(p, at, end);
+        }
+    }
+    *next = next_offset(&p->index);
+    return val;
+}
+
+static Val json_parse_native(VmState* vm, int argc, Val* args) {
+    if (!IS_STR(args[0])) {
+        native_err(vm, "Expected a string to parse");
+        return MK_NIL_VAL;
+    }
+    ObjStr* str = UNWRAP_STR(args[0]);
+    Parser p = {.vm = vm, .data = str->chars, .size = str->length, .depth = 0, .failed = false};
+    init_index(&p.index, str->chars, str->length, true);
+
+    size_t next;
+    Val val = json_value(&p, next_offset(&p.index), &next);
+    if (!p.failed && next < p.size) {
+        fail(&p, next, "unexpected data after the value");
+    }
+    return p.failed ? MK_NIL_VAL : val;
+}
+
+// the field [start, end), where a row ends at end if last
+static Val csv_field(Parser* p, size_t start, size_t end, bool last) {
+    if (last && end > start && p->data[end - 1] == '\r') {
+        end--;
+    }
+    const char* chars = p->data + start;
+    size_t length = end - start;
+    if (length == 0 || chars[0] != '"') {
+        double num;
+        if (length > 0 && length <= INT32_MAX && str_to_num(chars, (int)length, &num)) {
+            return MK_NUM_VAL(num);
+        }
+        return str_val(p, start, chars, length);
+    }
+
+    if (length < 2 || chars[length - 1] != '"') {
+        fail(p, start, "unterminated quotes");
+        return MK_NIL_VAL;
+    }
+    chars++;
+    length -= 2;
+    if (memchr(chars, '"', length) == NULL) {
+        return str_val(p, start, chars, length);
+    }
+    // "" stands for a quote
+    char* buf = REALLOC_ARR(char, NULL, length);
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        buf[count++] = chars[i];
+        if (chars[i] == '"') {
+            i++;
+        }
+    }
+    Val str = str_val(p, start, buf, count);
+    free(buf);
+    return str;
+}
+
+static bool blank_line(Parser* p, size_t start, size_t end) {
+    return end == start || (end == start + 1 && p->data[start] == '\r');
+}
+
+static Val csv_rows_native(VmState* vm, int argc, Val* args) {
+    char* data;
+    size_t size;
+    if (!map_file(vm, args[0], &data, &size)) {
+        return MK_NIL_VAL;
+    }
+    Parser p = {.vm = vm, .data = data, .size = size, .depth = 0, .failed = false};
+    init_index(&p.index, data, size, false);
+
+    ObjArray* rows = create_array(vm);
+    push_val(vm, MK_OBJ_VAL((Obj*)rows));
+    ObjArray* row = NULL;
+    size_t start = 0;
+    // a row is open until its newline, even if a trailing comma ends the file
+    while (start < size || row != NULL) {
+        size_t sep = next_offset(&p.index);
+        bool last = sep >= size || data[sep] == '\n';
+        if (row == NULL && last && blank_line(&p, start, sep)) {
+            start = sep + 1;
+            continue;
+        }
+        if (row == NULL) {
+            row = create_array(vm);
+            GC_BARRIER(vm, (Obj*)rows, MK_OBJ_VAL((Obj*)row));
+            append_val(&rows->vals, MK_OBJ_VAL((Obj*)row));
+        }
+        Val field = csv_field(&p, start, sep, last);
+        if (p.failed) {
+            break;
+        }
+        GC_BARRIER(vm, (Obj*)row, field);
+        append_val(&row->vals, field);
+        if (last) {
+            row = NULL;
+        }
+        start = sep + 1;
+    }
+    pop_val(vm);
+    if (data != NULL) {
+        munmap(data, size);
+    }
+    return p.failed ? MK_NIL_VAL : MK_OBJ_VAL((Obj*)rows);
+}
+
+void define_data_natives(VmState* vm) {
+    define_native(vm, "json_parse", 1, json_parse_native);
+    define_native(vm, "csv_rows", 1, csv_rows_native);
+}
@@ -0,0 +1,16 @@
+#ifndef data_h
+#define data_h
+
+#include "common.h"
+#include "ops.h"
+
+/*
+ * json_parse(str) and csv_rows(path), which turn structured data into
+ * values. JSON objects become maps and arrays arrays, and strings,
+ * including the keys, are interned. csv_rows returns an array with an
+ * array of fields per row, where blank lines are skipped. Fields that are
+ * numbers become numbers unless they are quoted, the others strings.
+ */
+void define_data_natives(VmState* vm);
+
+#endif
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include "dev.h"
 #include "ops.h"
+#include "class.h"
+#include "array.h"
+#include "map.h"
+#include "num.h"
 
 #define PRINT_LINE_INFO(p) \
     printf("%04d %4d ", p, ops->lines[p])
@@ -27,6 +31,12 @@ int disas_const(const char* name, int pos, Ops* ops) {
     return pos + 2;
 }
 
+// an op with a slot as its operand
+static int disas_slot(const char* name, int pos, Ops* ops) {
+    printf("%-16s (slot %d)\n", name, ops->ops[pos + 1]);
+    return pos + 2;
+}
+
 static int disas_jmp(const char* name, int pos, Ops* ops) {
     uint8_t offset_upper = ops->ops[pos + 1];
     uint8_t offset_lower = ops->ops[pos + 2];
@@ -43,59 +53,190 @@ static int disas_jmp(const char* name, int pos, Ops* ops) {
     return pos + 3;
 }
 
-static void print_fn(ObjFunc* fn) {
+static int disas_call(Ops* ops, int pos) {
+    uint8_t argc = ops->ops[pos + 1];
+    uint16_t i_cache = (uint16_t)((ops->ops[pos + 2] << 8) | ops->ops[pos + 3]);
+    printf("%-16s (args %d, cache %d)\n", "OP_CALL", argc, i_cache);
+    return pos + 4;
+}
+
+static void print_num(Sink* out, double num) {
+    char buf[NUM_BUF_SIZE];
+    sink_write(out, buf, num_to_str(num, buf));
+}
+
+static void print_str(Sink* out, ObjStr* str) {
+    sink_write(out, str->chars, str->length);
+}
+
+static void print_fn(Sink* out, ObjFunc* fn) {
     if (fn->name == NULL) {
-        printf("<script>");
+        SINK_LIT(out, "<script>");
     } else {
-        printf("<fn %s>", fn->name->chars);
+        SINK_LIT(out, "<fn ");
+        print_str(out, fn->name);
+        sink_putc(out, '>');
+    }
+}
+
+static void print_array(Sink* out, Val val) {
+    Obj* self = UNWRAP_OBJ(val);
+    int count = IS_ARRAY(val) ? UNWRAP_ARRAY(val)->vals.count : UNWRAP_FLOAT_ARRAY(val)->count;
+    SINK_LIT(out, "[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            SINK_LIT(out, ", ");
+        }
+        if (IS_FLOAT_ARRAY(val)) {
+            print_num(out, UNWRAP_FLOAT_ARRAY(val)->data[i]);
+            continue;
+        }
+        Val elem = UNWRAP_ARRAY(val)->vals.vals[i];
+        if (IS_OBJ(elem) && UNWRAP_OBJ(elem) == self) {
+            // don't recurse into the array itself
+            SINK_LIT(out, "[...]");
+        } else {
+            write_val(out, elem);
+        }
+    }
+    SINK_LIT(out, "]");
+}
+
+static void print_map(Sink* out, Val val) {
+    ValDict* dict = &UNWRAP_MAP(val)->dict;
+    bool first = true;
+    SINK_LIT(out, "{");
+    for (int i = 0; i < dict->capacity; i++) {
+        ValDictEntry* entry = &dict->entries[i];
+        if (!entry->live) {
+            continue;
+        }
+        if (!first) {
+            SINK_LIT(out, ", ");
+        }
+        first = false;
+        write_val(out, entry->key);
+        SINK_LIT(out, ": ");
+        if (IS_OBJ(entry->val) && UNWRAP_OBJ(entry->val) == UNWRAP_OBJ(val)) {
+            // don't recurse into the map itself
+            SINK_LIT(out, "{...}");
+        } else {
+            write_val(out, entry->val);
+        }
     }
+    SINK_LIT(out, "}");
 }
 
-void print_obj(Val val) {
+static void print_obj(Sink* out, Val val) {
     switch(OBJ_TYPE(val)) {
         case OBJ_STR: {
-            char* chars = UNWRAP_STR_CHARS(val);
-            printf("%s", chars); 
+            print_str(out, UNWRAP_STR(val));
             break;
         }
         case OBJ_FUNC: {
             ObjFunc* fn = UNWRAP_FUNC(val);
-            print_fn(fn);
+            print_fn(out, fn);
             break;
         }
         case OBJ_NATIVE: {
-            printf("<native fn>");
+            SINK_LIT(out, "<native fn>");
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = UNWRAP_CLOSURE(val);
-            print_fn(closure->fn);
+            print_fn(out, closure->fn);
             break;
         }
         case OBJ_UPVALUE: {
-            printf("upvalue");
+            SINK_LIT(out, "upvalue");
+            break;
+        }
+        case OBJ_CLASS: {
+            print_str(out, UNWRAP_CLASS(val)->name);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            print_str(out, UNWRAP_INSTANCE(val)->klass->name);
+            SINK_LIT(out, " instance");
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            print_fn(out, UNWRAP_BOUND_METHOD(val)->method->fn);
             break;
         }
+        case OBJ_SHAPE: {
+            SINK_LIT(out, "shape");
+            break;
+        }
+        case OBJ_ARRAY:
+        case OBJ_FLOAT_ARRAY:
+            print_array(out, val);
+            break;
+        case OBJ_MAP:
+            print_map(out, val);
+            break;
+        case OBJ_LINES:
+            SINK_LIT(out, "<lines>");
+            break;
+        case OBJ_FIBER:
+            SINK_LIT(out, "<fiber>");
+            break;
         default:
-            printf("<unknown obj>"); 
+            SINK_LIT(out, "<unknown obj>"); 
             break;
     }
 }
 
-void print_val(Val val) {
+void write_val(Sink* out, Val val) {
     if (IS_NUM(val)) {
-        printf("%g", UNWRAP_NUM(val));
+        print_num(out, UNWRAP_NUM(val));
     } else if(IS_BOOL(val)) {
-        printf("%s", UNWRAP_BOOL(val) ? "true" : "false");
+        if (UNWRAP_BOOL(val)) {
+            SINK_LIT(out, "true");
+        } else {
+            SINK_LIT(out, "false");
+        }
     } else if(IS_NIL(val)) {
-        printf("nil");
+        SINK_LIT(out, "nil");
     } else if(IS_OBJ(val)) {
-        print_obj(val);    
+        print_obj(out, val);    
     } else {
-        printf("<unknown val>");
+        SINK_LIT(out, "<unknown val>");
     }
 }
 
+void fprint_val(FILE* out, Val val) {
+    char buf[256];
+    Sink sink = { .kind = SINK_FILE, .file = out, .fd = -1, .buf = buf, .capacity = sizeof(buf) };
+    write_val(&sink, val);
+    sink_flush(&sink);
+}
+
+void print_val(Val val) {
+    fprint_val(stdout, val);
+}
+
+static int disas_prop(const char* name, Ops* ops, int pos) {
+    uint8_t i_constant = ops->ops[pos + 1];
+    uint16_t i_cache = (uint16_t)((ops->ops[pos + 2] << 8) | ops->ops[pos + 3]);
+    printf("%-16s %4d '%s' (cache %d)\n", name, i_constant,
+            UNWRAP_STR_CHARS(ops->constants.vals[i_constant]), i_cache);
+    return pos + 4;
+}
+
+static int disas_invoke(const char* name, Ops* ops, int pos, bool cached) {
+    uint8_t i_constant = ops->ops[pos + 1];
+    uint8_t argc = ops->ops[pos + 2];
+    printf("%-16s %4d '%s' (args %d", name, i_constant,
+            UNWRAP_STR_CHARS(ops->constants.vals[i_constant]), argc);
+    if (!cached) {
+        printf(")\n");
+        return pos + 3;
+    }
+    printf(", cache %d)\n", (uint16_t)((ops->ops[pos + 3] << 8) | ops->ops[pos + 4]));
+    return pos + 5;
+}
+
 static int disas_closure(Ops* ops, int pos) {
     pos++;
     uint8_t constant = ops->ops[pos++];
@@ -114,6 +255,60 @@ static int disas_closure(Ops* ops, int pos) {
     return pos;
 }
 
+static const char* op_names[OP_COUNT] = {
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CONST] = "OP_CONST",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NOT] = "OP_NOT",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_POP] = "OP_POP",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_JMP_IF_FALSE] = "OP_JMP_IF_FALSE",
+    [OP_JMP] = "OP_JMP",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_CALL] = "OP_CALL",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_CLASS] = "OP_CLASS",
+    [OP_INHERIT] = "OP_INHERIT",
+    [OP_METHOD] = "OP_METHOD",
+    [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+    [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_GET_SUPER] = "OP_GET_SUPER",
+    [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+    [OP_ARRAY] = "OP_ARRAY",
+    [OP_GET_INDEX] = "OP_GET_INDEX",
+    [OP_SET_INDEX] = "OP_SET_INDEX",
+    [OP_ADD_NUM] = "OP_ADD_NUM",
+    [OP_ADD_STR] = "OP_ADD_STR",
+    [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+    [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+    [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+    [OP_LESS_NUM] = "OP_LESS_NUM",
+    [OP_GREATER_NUM] = "OP_GREATER_NUM",
+};
+
+const char* op_name(uint8_t op) {
+    return op < OP_COUNT ? op_names[op] : "OP_UNKNOWN";
+}
+
 int disas_op_at(Ops* ops, int pos) {
     PRINT_LINE_INFO(pos);
 
@@ -194,11 +389,75 @@ int disas_op_at(Ops* ops, int pos) {
             next_pos = disas_simple("OP_LOOP", pos);
             break;
         case OP_CALL:
-            next_pos = disas_simple("OP_CALL", pos);
+            next_pos = disas_call(ops, pos);
             break;
         case OP_CLOSURE:
             next_pos = disas_closure(ops, pos);
             break;
+        case OP_GET_UPVALUE:
+            next_pos = disas_slot("OP_GET_UPVALUE", pos, ops);
+            break;
+        case OP_SET_UPVALUE:
+            next_pos = disas_slot("OP_SET_UPVALUE", pos, ops);
+            break;
+        case OP_CLOSE_UPVALUE:
+            next_pos = disas_simple("OP_CLOSE_UPVALUE", pos);
+            break;
+        case OP_CLASS:
+            next_pos = disas_const("OP_CLASS", pos, ops);
+            break;
+        case OP_INHERIT:
+            next_pos = disas_simple("OP_INHERIT", pos);
+            break;
+        case OP_METHOD:
+            next_pos = disas_const("OP_METHOD", pos, ops);
+            break;
+        case OP_GET_PROPERTY:
+            next_pos = disas_prop("OP_GET_PROPERTY", ops, pos);
+            break;
+        case OP_SET_PROPERTY:
+            next_pos = disas_prop("OP_SET_PROPERTY", ops, pos);
+            break;
+        case OP_INVOKE:
+            next_pos = disas_invoke("OP_INVOKE", ops, pos, true);
+            break;
+        case OP_GET_SUPER:
+            next_pos = disas_const("OP_GET_SUPER", pos, ops);
+            break;
+        case OP_SUPER_INVOKE:
+            next_pos = disas_invoke("OP_SUPER_INVOKE", ops, pos, false);
+            break;
+        case OP_ARRAY:
+            printf("%-16s (count %d)\n", "OP_ARRAY", ops->ops[pos + 1]);
+            next_pos = pos + 2;
+            break;
+        case OP_GET_INDEX:
+            next_pos = disas_simple("OP_GET_INDEX", pos);
+            break;
+        case OP_SET_INDEX:
+            next_pos = disas_simple("OP_SET_INDEX", pos);
+            break;
+        case OP_ADD_NUM:
+            next_pos = disas_simple("OP_ADD_NUM", pos);
+            break;
+        case OP_ADD_STR:
+            next_pos = disas_simple("OP_ADD_STR", pos);
+            break;
+        case OP_SUBTRACT_NUM:
+            next_pos = disas_simple("OP_SUBTRACT_NUM", pos);
+            break;
+        case OP_MULTIPLY_NUM:
+            next_pos = disas_simple("OP_MULTIPLY_NUM", pos);
+            break;
+        case OP_DIVIDE_NUM:
+            next_pos = disas_simple("OP_DIVIDE_NUM", pos);
+            break;
+        case OP_LESS_NUM:
+            next_pos = disas_simple("OP_LESS_NUM", pos);
+            break;
+        case OP_GREATER_NUM:
+            next_pos = disas_simple("OP_GREATER_NUM", pos);
+            break;
         default:
             printf("Unknown op code %d\n", op);
             next_pos++;
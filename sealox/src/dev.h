@@ -1,10 +1,15 @@
 #ifndef dev_h
 #define dev_h
 
+#include <stdio.h>
 #include "ops.h"
+#include "sink.h"
 
 void disas_ops(Ops* ops, const char* name);
 int disas_op_at(Ops* ops, int pos);
+const char* op_name(uint8_t op);
 void print_val(Val val);
+void fprint_val(FILE* out, Val val);
+void write_val(Sink* out, Val val);
 
 #endif
@@ -1,9 +1,12 @@
 #include <string.h>
+#include <math.h>
 #include "dict.h"
 #include "memory.h"
 
 // null key and not tombstone
 #define IS_EMPTY_SLOT(target) (target->key == NULL && !IS_BOOL(target->val))
+#define DICT_MAX_LOAD 0.75
+#define DICT_MIN_LOAD 0.25
 
 DictEntry* dict_find_entry(Dict* dict, ObjStr* key) {
     int cap = dict->capacity;
@@ -47,34 +50,62 @@ DictEntry* dict_find_insertion_slot(Dict* dict, ObjStr* key) {
     return NULL;
 }
 
-void dict_grow(Dict* dict) {
-    int cap = CALC_CAP(dict->capacity);
-    DictEntry* new_entries = REALLOC_ARR(DictEntry, dict->entries, cap);
+static void dict_resize(Dict* dict, int cap) {
+    DictEntry* new_entries = REALLOC_ARR(DictEntry, NULL, cap);
     for (int i = 0; i < cap; i++) {
         new_entries[i].key = NULL;
         new_entries[i].val = MK_NIL_VAL;
     }
 
+    DictEntry* old_entries = dict->entries;
+    int old_cap = dict->capacity;
+    dict->entries = new_entries;
+    dict->capacity = cap;
+
+    // re-insert live entries, which also drops the tombstones
     dict->count = 0;
-    for (int i = 0; i < dict->capacity; i++) {
-        DictEntry* entry = &dict->entries[i];
+    for (int i = 0; i < old_cap; i++) {
+        DictEntry* entry = &old_entries[i];
         if (entry->key == NULL) {
             continue;
         }
 
-        DictEntry* dest = dict_find_entry(dict, entry->key);
+        DictEntry* dest = dict_find_insertion_slot(dict, entry->key);
         dest->key = entry->key;
         dest->val = entry->val;
         dict->count++;
     }
+    dict->size = dict->count;
 
-    free(dict->entries);
-    dict->entries = new_entries;
-    dict->capacity = cap;
+    free(old_entries);
+}
+
+void dict_grow(Dict* dict) {
+    // a dict full of tombstones is rebuilt at the same capacity
+    if (dict->size + 1 <= dict->capacity * DICT_MAX_LOAD / 2) {
+        dict_resize(dict, dict->capacity);
+        return;
+    }
+    int cap = CALC_CAP(dict->capacity);
+    dict_resize(dict, cap);
+}
+
+bool dict_shrink(Dict* dict) {
+    if (dict->capacity <= DEFAULT_CAP || dict->size >= dict->capacity * DICT_MIN_LOAD) {
+        return false;
+    }
+    // half full, so that it doesn't grow again right away
+    int cap = DEFAULT_CAP;
+    while (dict->size > cap * DICT_MAX_LOAD / 2) {
+        cap *= 2;
+    }
+    dict_resize(dict, cap);
+    return true;
 }
 
 void dict_init(Dict* dict) {
     dict->count = 0;
+    dict->size = 0;
     dict->capacity = 0;
     dict->entries = NULL;
 }
@@ -96,7 +127,7 @@ bool dict_get(Dict* dict, ObjStr* key, Val* val) {
 }
 
 bool dict_put(Dict* dict, ObjStr* key, Val val) {
-    if (dict->count + 1 > dict->capacity) {
+    if (dict->count + 1 > dict->capacity * DICT_MAX_LOAD) {
         dict_grow(dict);
     }
 
@@ -105,9 +136,15 @@ bool dict_put(Dict* dict, ObjStr* key, Val val) {
         return false;
     }
 
+    // tombstones are already counted
+    if (IS_EMPTY_SLOT(match)) {
+        dict->count++;
+    }
+    if (match->key == NULL) {
+        dict->size++;
+    }
     match->key = key;
     match->val = val;
-    dict->count++;
 
     return true;
 }
@@ -122,6 +159,7 @@ bool dict_del(Dict* dict, ObjStr* key) {
     // create tombstone
     match->key = NULL;
     match->val = MK_BOOL_VAL(true);
+    dict->size--;
 
     return true;
 }
@@ -131,6 +169,27 @@ bool dict_has(Dict* dict, ObjStr* key) {
     return match != NULL;
 }
 
+/*
+ * Remove all entries, but keep the capacity for reuse.
+ */
+void dict_clear(Dict* dict) {
+    for (int i = 0; i < dict->capacity; i++) {
+        dict->entries[i].key = NULL;
+        dict->entries[i].val = MK_NIL_VAL;
+    }
+    dict->count = 0;
+    dict->size = 0;
+}
+
+void dict_add_all(Dict* from, Dict* to) {
+    for (int i = 0; i < from->capacity; i++) {
+        DictEntry* entry = &from->entries[i];
+        if (entry->key != NULL) {
+            dict_put(to, entry->key, entry->val);
+        }
+    }
+}
+
 ObjStr* dict_get_str(Dict* dict, const char* start, int length, uint32_t hash) {
     int cap = dict->capacity;
     if (cap == 0) {
@@ -145,7 +204,9 @@ ObjStr* dict_get_str(Dict* dict, const char* start, int length, uint32_t hash) {
             return NULL;
         }
 
-        if (target->key->hash == hash 
+        if (target->key != NULL
+                && target->key->hash == hash
+                && target->key->length == length
                 && memcmp(target->key->chars, start, length) == 0) {
             return target->key;
         }
@@ -154,3 +215,185 @@ ObjStr* dict_get_str(Dict* dict, const char* start, int length, uint32_t hash) {
     }
     return NULL;
 }
+
+bool is_hashable(Val key) {
+    if (IS_NUM(key)) {
+        return !isnan(UNWRAP_NUM(key));
+    }
+    return !IS_OBJ(key) || IS_STR(key);
+}
+
+static uint32_t hash_val(Val key) {
+    switch (key.type) {
+        case VAL_NUM: {
+            // 0 and -0 are equal, so they need the same hash
+            double num = UNWRAP_NUM(key) == 0 ? 0 : UNWRAP_NUM(key);
+            uint64_t bits;
+            memcpy(&bits, &num, sizeof(bits));
+            // finalizer of MurmurHash3
+            bits ^= bits >> 33;
+            bits *= 0xff51afd7ed558ccdull;
+            bits ^= bits >> 33;
+            bits *= 0xc4ceb9fe1a85ec53ull;
+            bits ^= bits >> 33;
+            return (uint32_t)bits;
+        }
+        case VAL_BOOL:
+            return UNWRAP_BOOL(key) ? 0x9e3779b9u : 0x7f4a7c15u;
+        case VAL_NIL:
+            return 0x165667b1u;
+        default:
+            return str_hash(UNWRAP_STR(key));
+    }
+}
+
+static inline bool keys_equal(Val a, Val b) {
+    if (a.type != b.type) {
+        return false;
+    }
+    if (IS_OBJ(a)) {
+        // interned strings are equal by reference
+        if (UNWRAP_OBJ(a) == UNWRAP_OBJ(b)) {
+            return true;
+        }
+        ObjStr* a_str = UNWRAP_STR(a);
+        ObjStr* b_str = UNWRAP_STR(b);
+        return a_str->length == b_str->length
+            && memcmp(a_str->chars, b_str->chars, a_str->length) == 0;
+    }
+    if (IS_NUM(a)) {
+        return UNWRAP_NUM(a) == UNWRAP_NUM(b);
+    }
+    return IS_NIL(a) || UNWRAP_BOOL(a) == UNWRAP_BOOL(b);
+}
+
+/*
+ * The live entry of the key, or else the slot to insert it into, which
+ * is the first tombstone on the way if there is one. The capacity is a
+ * power of two.
+ */
+static ValDictEntry* vdict_find(ValDictEntry* entries, int cap, Val key, uint32_t hash) {
+    uint32_t mask = (uint32_t)cap - 1;
+    ValDictEntry* tombstone = NULL;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        ValDictEntry* entry = &entries[i];
+        if (entry->live) {
+            if (entry->hash == hash && keys_equal(entry->key, key)) {
+                return entry;
+            }
+        } else if (!IS_BOOL(entry->val)) {
+            return tombstone != NULL ? tombstone : entry;
+        } else if (tombstone == NULL) {
+            tombstone = entry;
+        }
+    }
+}
+
+static void vdict_resize(ValDict* dict, int cap) {
+    ValDictEntry* entries = REALLOC_ARR(ValDictEntry, NULL, cap);
+    for (int i = 0; i < cap; i++) {
+        entries[i].live = false;
+        entries[i].val = MK_NIL_VAL;
+    }
+
+    // re-insert live entries, which also drops the tombstones
+    for (int i = 0; i < dict->capacity; i++) {
+        ValDictEntry* entry = &dict->entries[i];
+        if (entry->live) {
+            *vdict_find(entries, cap, entry->key, entry->hash) = *entry;
+        }
+    }
+    free(dict->entries);
+    dict->entries = entries;
+    dict->capacity = cap;
+    dict->count = dict->size;
+}
+
+static void vdict_grow(ValDict* dict) {
+    // a dict full of tombstones is rebuilt at the same capacity
+    if (dict->size + 1 <= dict->capacity * DICT_MAX_LOAD / 2) {
+        vdict_resize(dict, dict->capacity);
+        return;
+    }
+    int cap = CALC_CAP(dict->capacity);
+    vdict_resize(dict, cap);
+}
+
+static void vdict_shrink(ValDict* dict) {
+    if (dict->capacity <= DEFAULT_CAP || dict->size >= dict->capacity * DICT_MIN_LOAD) {
+        return;
+    }
+    // half full, as in dict_shrink
+    int cap = DEFAULT_CAP;
+    while (dict->size > cap * DICT_MAX_LOAD / 2) {
+        cap *= 2;
+    }
+    // so that deletes near the bound don't rebuild it each time
+    if (cap < dict->capacity) {
+        vdict_resize(dict, cap);
+    }
+}
+
+void vdict_init(ValDict* dict) {
+    dict->count = 0;
+    dict->size = 0;
+    dict->capacity = 0;
+    dict->entries = NULL;
+}
+
+void vdict_free(ValDict* dict) {
+    free(dict->entries);
+    vdict_init(dict);
+}
+
+bool vdict_get(ValDict* dict, Val key, Val* val) {
+    if (dict->size == 0) {
+        return false;
+    }
+    ValDictEntry* entry = vdict_find(dict->entries, dict->capacity, key, hash_val(key));
+    if (!entry->live) {
+        return false;
+    }
+    *val = entry->val;
+    return true;
+}
+
+bool vdict_put(ValDict* dict, Val key, Val val) {
+    if (dict->count + 1 > dict->capacity * DICT_MAX_LOAD) {
+        vdict_grow(dict);
+    }
+
+    uint32_t hash = hash_val(key);
+    ValDictEntry* entry = vdict_find(dict->entries, dict->capacity, key, hash);
+    bool is_new = !entry->live;
+    if (is_new) {
+        // reused tombstones are already counted
+        if (!IS_BOOL(entry->val)) {
+            dict->count++;
+        }
+        dict->size++;
+        entry->key = key;
+        entry->hash = hash;
+        entry->live = true;
+    }
+    entry->val = val;
+    return is_new;
+}
+
+bool vdict_del(ValDict* dict, Val key) {
+    if (dict->size == 0) {
+        return false;
+    }
+    ValDictEntry* entry = vdict_find(dict->entries, dict->capacity, key, hash_val(key));
+    if (!entry->live) {
+        return false;
+    }
+
+    // create tombstone
+    entry->live = false;
+    entry->key = MK_NIL_VAL;
+    entry->val = MK_BOOL_VAL(true);
+    dict->size--;
+    vdict_shrink(dict);
+    return true;
+}
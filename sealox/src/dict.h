@@ -10,7 +10,9 @@ typedef struct {
 } DictEntry;
 
 typedef struct {
+    // live entries and tombstones
     int count;
+    int size;
     int capacity;
     DictEntry* entries;
 } Dict;
@@ -21,10 +23,46 @@ bool dict_get(Dict* dict, ObjStr* key, Val* val);
 bool dict_put(Dict* dict, ObjStr* key, Val val);
 bool dict_del(Dict* dict, ObjStr* key);
 bool dict_has(Dict* dict, ObjStr* key);
+void dict_clear(Dict* dict);
+void dict_add_all(Dict* from, Dict* to);
+/*
+ * Shrink the dict once its load has dropped below DICT_MIN_LOAD, which
+ * also drops the tombstones. Returns true if it did.
+ */
+bool dict_shrink(Dict* dict);
 
 /*
  * Look by up a string key by its value. This is to support string interning.
  */
 ObjStr* dict_get_str(Dict* dict, const char* start, int length, uint32_t hash);
 
+/*
+ * A dict with any hashable value as the key, i.e. numbers except NaN,
+ * booleans, nil and strings. Since nil is a valid key, slots have an
+ * explicit live flag. Tombstones are dead slots with a true val.
+ */
+typedef struct {
+    Val key;
+    Val val;
+    uint32_t hash;
+    bool live;
+} ValDictEntry;
+
+typedef struct {
+    // live entries and tombstones
+    int count;
+    int size;
+    int capacity;
+    ValDictEntry* entries;
+} ValDict;
+
+bool is_hashable(Val key);
+void vdict_init(ValDict* dict);
+void vdict_free(ValDict* dict);
+bool vdict_get(ValDict* dict, Val key, Val* val);
+// returns true if the key is new
+bool vdict_put(ValDict* dict, Val key, Val val);
+// shrinks the dict once its load has dropped below DICT_MIN_LOAD
+bool vdict_del(ValDict* dict, Val key);
+
 #endif
@@ -0,0 +1,261 @@
+#include <stdatomic.h>
+#include "fiber.h"
+#include "memory.h"
+#include "vm.h"
+
+static void enqueue(VmState* vm, ObjFiber* fiber) {
+    fiber->queued = true;
+    fiber->next = NULL;
+    if (vm->run_queue_tail == NULL) {
+        vm->run_queue = fiber;
+    } else {
+        vm->run_queue_tail->next = fiber;
+    }
+    vm->run_queue_tail = fiber;
+}
+
+static ObjFiber* dequeue(VmState* vm) {
+    ObjFiber* fiber = vm->run_queue;
+    if (fiber == NULL) {
+        return NULL;
+    }
+    vm->run_queue = fiber->next;
+    if (vm->run_queue == NULL) {
+        vm->run_queue_tail = NULL;
+    }
+    fiber->queued = false;
+    fiber->next = NULL;
+    return fiber;
+}
+
+static void save(VmState* vm) {
+    ObjFiber* fiber = vm->fiber;
+    fiber->top = vm->top;
+    fiber->frame_count = vm->frame_count;
+    fiber->open_upvalues = vm->open_upvalues;
+    // its stack changed without barriers while it ran
+    gc_retrace(vm, (Obj*)fiber);
+}
+
+/*
+ * Run on fiber from now on. A fiber that stopped in yield or resume gets
+ * val as the result of that call.
+ *
+ * A profiler's signal may read the frames at any point in between, so
+ * they are emptied before the swap and refilled after it.
+ */
+static void load(VmState* vm, ObjFiber* fiber, Val val) {
+    bool in_call = fiber->state == FIBER_SUSPENDED || fiber->state == FIBER_WAITING;
+    vm->frame_count = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+    vm->fiber = fiber;
+    vm->stack = fiber->stack;
+    vm->top = fiber->top;
+    vm->frames = fiber->frames;
+    atomic_signal_fence(memory_order_seq_cst);
+    vm->frame_count = fiber->frame_count;
+    vm->max_frames = fiber->max_frames;
+    vm->open_upvalues = fiber->open_upvalues;
+    fiber->state = FIBER_RUNNING;
+    if (in_call) {
+        vm->top[-1] = val;
+    }
+}
+
+/*
+ * Give the memory of the stack back early, the fiber may stay reachable.
+ * Only once another fiber is loaded, the VM points into it until then.
+ */
+static void end_fiber(ObjFiber* fiber) {
+    free(fiber->stack);
+    free(fiber->frames);
+    fiber->stack = NULL;
+    fiber->top = NULL;
+    fiber->frames = NULL;
+    fiber->frame_count = 0;
+    fiber->open_upvalues = NULL;
+    fiber->resumer = NULL;
+    fiber->state = FIBER_DONE;
+}
+
+void init_fibers(VmState* vm) {
+    // nothing to scan until the root is loaded
+    vm->stack = NULL;
+    vm->top = NULL;
+    vm->frames = NULL;
+    vm->frame_count = 0;
+    vm->open_upvalues = NULL;
+    vm->fiber = NULL;
+    vm->root = NULL;
+    vm->run_queue = NULL;
+    vm->run_queue_tail = NULL;
+    vm->switch_to = NULL;
+    vm->calls = 0;
+    vm->root = create_fiber(vm, MAX_FRAMES);
+    load(vm, vm->root, MK_NIL_VAL);
+}
+
+void switch_fiber(VmState* vm) {
+    ObjFiber* to = vm->switch_to;
+    vm->switch_to = NULL;
+    Val val = vm->top[-1];
+    save(vm);
+    load(vm, to, val);
+}
+
+void finish_fiber(VmState* vm) {
+    ObjFiber* fiber = vm->fiber;
+    Val result = vm->top[-1];
+    ObjFiber* next = fiber->resumer;
+    if (next == NULL) {
+        // nobody waits for the result
+        result = MK_NIL_VAL;
+        next = dequeue(vm);
+    }
+    load(vm, next != NULL ? next : vm->root, result);
+    end_fiber(fiber);
+}
+
+bool run_queued(VmState* vm) {
+    ObjFiber* next = dequeue(vm);
+    if (next == NULL) {
+        return false;
+    }
+    // done until the queue is empty, so that it keeps its result
+    vm->root->state = FIBER_DONE;
+    save(vm);
+    load(vm, next, MK_NIL_VAL);
+    return true;
+}
+
+void reset_fibers(VmState* vm) {
+    vm->switch_to = NULL;
+    while (vm->fiber != vm->root) {
+        ObjFiber* fiber = vm->fiber;
+        ObjFiber* next = fiber->resumer != NULL ? fiber->resumer : vm->root;
+        // keep closures that outlive the fiber working
+        close_upvalues(vm, vm->stack);
+        load(vm, next, MK_NIL_VAL);
+        end_fiber(fiber);
+    }
+    while (dequeue(vm) != NULL) {
+    }
+}
+
+/*
+ * Natives only ask for a switch, which the interpreter or compiled code
+ * that called them then picks up. Natives called from C, or from a native,
+ * are not called from there.
+ */
+static bool can_switch(VmState* vm) {
+    if (vm->calls != 1 || vm->frame_count == 0) {
+        native_err(vm, "Fibers can only switch in functions that are not called by natives");
+        return false;
+    }
+    if (vm->frames[vm->frame_count - 1].closure->fn->aot != NULL) {
+        native_err(vm, "Fibers can't switch in ahead of time compiled code");
+        return false;
+    }
+    return true;
+}
+
+static ObjFiber* new_fiber(VmState* vm, Val fn) {
+    if (!IS_CLOSURE(fn) || UNWRAP_CLOSURE(fn)->fn->arity != 0) {
+        native_err(vm, "Expected a function without parameters");
+        return NULL;
+    }
+    ObjClosure* closure = UNWRAP_CLOSURE(fn);
+    ObjFiber* fiber = create_fiber(vm, FIBER_MAX_FRAMES);
+    // the frame of the call, as if the fiber had called fn
+    *fiber->top++ = fn;
+    CallFrame* frame = &fiber->frames[fiber->frame_count++];
+    frame->closure = closure;
+    frame->pc = closure->fn->ops.ops;
+    frame->slots = fiber->stack;
+    return fiber;
+}
+
+static Val fiber_native(VmState* vm, int argc, Val* args) {
+    ObjFiber* fiber = new_fiber(vm, args[0]);
+    return fiber != NULL ? MK_OBJ_VAL((Obj*)fiber) : MK_NIL_VAL;
+}
+
+static Val spawn_native(VmState* vm, int argc, Val* args) {
+    ObjFiber* fiber = new_fiber(vm, args[0]);
+    if (fiber == NULL) {
+        return MK_NIL_VAL;
+    }
+    enqueue(vm, fiber);
+    return MK_OBJ_VAL((Obj*)fiber);
+}
+
+static Val resume_native(VmState* vm, int argc, Val* args) {
+    if (argc < 1 || argc > 2 || !IS_FIBER(args[0])) {
+        native_err(vm, "Expected a fiber and an optional value to pass");
+        return MK_NIL_VAL;
+    }
+    ObjFiber* fiber = UNWRAP_FIBER(args[0]);
+    if (fiber->state == FIBER_DONE) {
+        native_err(vm, "Cannot resume a fiber that is done");
+        return MK_NIL_VAL;
+    }
+    if (fiber->state == FIBER_RUNNING || fiber->state == FIBER_WAITING) {
+        native_err(vm, "Cannot resume a fiber that is running");
+        return MK_NIL_VAL;
+    }
+    if (fiber->queued) {
+        native_err(vm, "Cannot resume a fiber that is in the run queue");
+        return MK_NIL_VAL;
+    }
+    if (!can_switch(vm)) {
+        return MK_NIL_VAL;
+    }
+
+    GC_BARRIER_OBJ(vm, fiber, vm->fiber);
+    fiber->resumer = vm->fiber;
+    vm->fiber->state = FIBER_WAITING;
+    vm->switch_to = fiber;
+    // a new fiber has nothing to pass it to
+    return argc == 2 ? args[1] : MK_NIL_VAL;
+}
+
+static Val yield_native(VmState* vm, int argc, Val* args) {
+    if (argc > 1) {
+        native_err(vm, "Expected an optional value to pass");
+        return MK_NIL_VAL;
+    }
+    if (!can_switch(vm)) {
+        return MK_NIL_VAL;
+    }
+
+    ObjFiber* fiber = vm->fiber;
+    if (fiber->resumer != NULL) {
+        vm->switch_to = fiber->resumer;
+        fiber->resumer = NULL;
+        fiber->state = FIBER_SUSPENDED;
+        return argc == 1 ? args[0] : MK_NIL_VAL;
+    }
+    // the others in the run queue get their turn first
+    if (vm->run_queue != NULL) {
+        enqueue(vm, fiber);
+        fiber->state = FIBER_SUSPENDED;
+        vm->switch_to = dequeue(vm);
+    }
+    return MK_NIL_VAL;
+}
+
+static Val fiber_done_native(VmState* vm, int argc, Val* args) {
+    if (!IS_FIBER(args[0])) {
+        native_err(vm, "Expected a fiber");
+        return MK_NIL_VAL;
+    }
+    return MK_BOOL_VAL(UNWRAP_FIBER(args[0])->state == FIBER_DONE);
+}
+
+void define_fiber_natives(VmState* vm) {
+    define_native(vm, "Fiber", 1, fiber_native);
+    define_native(vm, "spawn", 1, spawn_native);
+    define_native(vm, "resume", -1, resume_native);
+    define_native(vm, "yield", -1, yield_native);
+    define_native(vm, "fiber_done", 1, fiber_done_native);
+}
@@ -0,0 +1,85 @@
+#ifndef fiber_h
+#define fiber_h
+
+#include "common.h"
+#include "ops.h"
+#include "vm.h"
+
+// call frames of a fiber, the root one has MAX_FRAMES
+#define FIBER_MAX_FRAMES 32
+
+typedef enum {
+    // its function hasn't started yet
+    FIBER_NEW,
+    FIBER_RUNNING,
+    // in yield, until it is resumed or its turn in the run queue comes
+    FIBER_SUSPENDED,
+    // in resume, until the fiber it resumed yields or returns
+    FIBER_WAITING,
+    FIBER_DONE
+} FiberState;
+
+/*
+ * A call stack of its own, i.e. values, frames and open upvalues. The
+ * running fiber's are in the VmState, which a switch saves into the
+ * fiber that stops and loads from the one that goes on. Scripts and calls
+ * from C run on the root fiber.
+ */
+typedef struct ObjFiber {
+    Obj obj;
+    // NULL once the fiber is done
+    Val* stack;
+    Val* top;
+    CallFrame* frames;
+    int frame_count;
+    int max_frames;
+    ObjUpvalue* open_upvalues;
+    FiberState state;
+    // the fiber that resumed this one, NULL if it runs from the run queue
+    struct ObjFiber* resumer;
+    // next one in the run queue
+    struct ObjFiber* next;
+    bool queued;
+} ObjFiber;
+
+#define IS_FIBER(v) is_obj_type(v, OBJ_FIBER)
+#define UNWRAP_FIBER(v) ((ObjFiber*)(UNWRAP_OBJ(v)))
+
+// create the root fiber and run on it
+void init_fibers(VmState* vm);
+/*
+ * Switch to vm->switch_to, which a native asked for. The value on top of
+ * the stack, i.e. the result of the native, becomes the result of the
+ * yield or resume that the other fiber is in.
+ */
+void switch_fiber(VmState* vm);
+/*
+ * The function of the running fiber returned, and its result is on top
+ * of the stack. Go on with the fiber that resumed it, or else the next
+ * one in the run queue, or else the root.
+ */
+void finish_fiber(VmState* vm);
+/*
+ * The root has nothing left to run, so start the next fiber in the run
+ * queue. Returns false if there is none.
+ */
+bool run_queued(VmState* vm);
+// drop the failed fiber and the ones waiting for it, and back to the root
+void reset_fibers(VmState* vm);
+
+/*
+ * Fiber(fn) creates a fiber that calls fn without arguments, and spawn(fn)
+ * creates one and puts it in the run queue. resume(fiber, val) runs the
+ * fiber until it yields or returns, and returns the value it yielded or
+ * returned. yield(val) returns val to the fiber that resumed this one,
+ * and then returns the value of the next resume. If there is none, yield
+ * puts the fiber at the end of the run queue and returns nil once its
+ * turn comes. The queued fibers run before a script or callback returns.
+ * fiber_done(fiber) tells whether the function of the fiber returned.
+ *
+ * Fibers only switch in the interpreter and in compiled code, i.e. not
+ * in functions called by natives and not in ahead of time compiled code.
+ */
+void define_fiber_natives(VmState* vm);
+
+#endif
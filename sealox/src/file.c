@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "file.h"
+
+char* read_file(const char* file_name) {
+    FILE* file = fopen(file_name, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t s = ftell(file);
+    rewind(file);
+
+    char* buffer = (char*)malloc(s + 1);
+    if (buffer == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    size_t b_read = fread(buffer, sizeof(char), s, file);
+    if (b_read < s) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    buffer[b_read] = '\0';
+
+    fclose(file);
+    return buffer;
+}
@@ -0,0 +1,10 @@
+#ifndef file_h
+#define file_h
+
+/*
+ * Read a whole file into a null terminated buffer owned by the caller.
+ * Returns NULL if the file can't be read.
+ */
+char* read_file(const char* file_name);
+
+#endif
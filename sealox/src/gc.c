@@ -0,0 +1,685 @@
+#include <time.h>
+#include "gc.h"
+#include "vm.h"
+#include "memory.h"
+#include "compiler.h"
+#include "profile.h"
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#endif
+
+// how often a slice looks at the clock, in units of work
+#define GC_CLOCK_INTERVAL 64
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void init_gc(Gc* gc) {
+    gc->phase = GC_IDLE;
+    gc->mark = false;
+    gc->gray = NULL;
+    gc->gray_count = 0;
+    gc->gray_capacity = 0;
+    gc->sweep = NULL;
+    gc->live = 0;
+    gc->allocated = 0;
+    gc->threshold = GC_MIN_HEAP;
+    gc->debt = 0;
+    gc->slice_work = GC_SLICE_WORK;
+    gc->slice_ns = 0;
+    gc->young = NULL;
+    gc->young_bytes = 0;
+    gc->nursery_size = GC_NURSERY_SIZE;
+    gc->remembered = NULL;
+    gc->remembered_count = 0;
+    gc->remembered_capacity = 0;
+    gc->blocks = NULL;
+    gc->bump = NULL;
+    gc->limit = NULL;
+    for (int i = 0; i <= GC_CELL_CLASSES; i++) {
+        gc->free_cells[i] = NULL;
+    }
+    gc->cycles = 0;
+    gc->minors = 0;
+    gc->promoted = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        gc->pauses[i] = 0;
+    }
+    gc->pause_count = 0;
+    gc->max_pause_ns = 0;
+    gc->total_pause_ns = 0;
+}
+
+void free_gc(Gc* gc) {
+    free(gc->gray);
+    gc->gray = NULL;
+    gc->gray_count = 0;
+    gc->gray_capacity = 0;
+    free(gc->remembered);
+    gc->remembered = NULL;
+    gc->remembered_count = 0;
+    gc->remembered_capacity = 0;
+
+    while (gc->blocks != NULL) {
+        GcBlock* block = gc->blocks;
+        gc->blocks = block->next;
+        ASAN_UNPOISON_MEMORY_REGION(block, GC_BLOCK_SIZE);
+        free(block);
+    }
+    gc->bump = NULL;
+    gc->limit = NULL;
+    for (int i = 0; i <= GC_CELL_CLASSES; i++) {
+        gc->free_cells[i] = NULL;
+    }
+}
+
+Obj* gc_alloc_cell(VmState* vm, size_t size) {
+    Gc* gc = &vm->gc;
+    int cls = (int)((size + GC_CELL_SIZE - 1) / GC_CELL_SIZE);
+    if (cls > GC_CELL_CLASSES) {
+        Obj* obj = (Obj*)realloc_arr(NULL, size);
+        obj->cell = 0;
+        return obj;
+    }
+
+    size_t cell_size = (size_t)cls * GC_CELL_SIZE;
+    void* cell = gc->free_cells[cls];
+    if (cell != NULL) {
+        ASAN_UNPOISON_MEMORY_REGION(cell, cell_size);
+        gc->free_cells[cls] = *(void**)cell;
+    } else {
+        if (gc->bump + cell_size > gc->limit) {
+            // the rest of the current block is left unused
+            GcBlock* block = (GcBlock*)realloc_arr(NULL, GC_BLOCK_SIZE);
+            block->next = gc->blocks;
+            gc->blocks = block;
+            gc->bump = (char*)block + GC_CELL_SIZE;
+            gc->limit = (char*)block + GC_BLOCK_SIZE;
+            ASAN_POISON_MEMORY_REGION(gc->bump, gc->limit - gc->bump);
+        }
+        cell = gc->bump;
+        gc->bump += cell_size;
+        ASAN_UNPOISON_MEMORY_REGION(cell, cell_size);
+    }
+    Obj* obj = (Obj*)cell;
+    obj->cell = (uint8_t)cls;
+    return obj;
+}
+
+void gc_free_cell(VmState* vm, Obj* obj) {
+    int cls = obj->cell;
+    if (cls == 0) {
+        free(obj);
+        return;
+    }
+    Gc* gc = &vm->gc;
+    *(void**)obj = gc->free_cells[cls];
+    gc->free_cells[cls] = obj;
+    ASAN_POISON_MEMORY_REGION(obj, (size_t)cls * GC_CELL_SIZE);
+}
+
+void gc_shade(VmState* vm, Obj* obj) {
+    Gc* gc = &vm->gc;
+    if (obj->mark == gc->mark) {
+        return;
+    }
+    obj->mark = gc->mark;
+    if (gc->gray_count == gc->gray_capacity) {
+        gc->gray_capacity = CALC_CAP(gc->gray_capacity);
+        gc->gray = REALLOC_ARR(Obj*, gc->gray, gc->gray_capacity);
+    }
+    gc->gray[gc->gray_count++] = obj;
+}
+
+void gc_adopt(VmState* vm, Obj* obj) {
+    Gc* gc = &vm->gc;
+    if (gc->phase == GC_IDLE) {
+        // white until a minor collection reaches it
+        obj->gen = GEN_YOUNG;
+        obj->mark = !gc->mark;
+        obj->next = gc->young;
+        gc->young = obj;
+        return;
+    }
+
+    obj->gen = 0;
+    obj->next = vm->objects;
+    vm->objects = obj;
+    if (gc->phase == GC_MARK) {
+        // traced later, once it is initialized
+        obj->mark = !gc->mark;
+        gc_shade(vm, obj);
+    } else {
+        // already behind the sweep
+        obj->mark = gc->mark;
+    }
+}
+
+void gc_remember(VmState* vm, Obj* obj) {
+    Gc* gc = &vm->gc;
+    obj->gen |= GEN_REMEMBERED;
+    if (gc->remembered_count == gc->remembered_capacity) {
+        gc->remembered_capacity = CALC_CAP(gc->remembered_capacity);
+        gc->remembered = REALLOC_ARR(Obj*, gc->remembered, gc->remembered_capacity);
+    }
+    gc->remembered[gc->remembered_count++] = obj;
+}
+
+void gc_retrace(VmState* vm, Obj* obj) {
+    Gc* gc = &vm->gc;
+    if (gc->phase == GC_MARK) {
+        // gray again, even if it is black already
+        obj->mark = !gc->mark;
+        gc_shade(vm, obj);
+    } else if (gc->phase == GC_IDLE && !(obj->gen & (GEN_YOUNG | GEN_REMEMBERED))) {
+        gc_remember(vm, obj);
+    }
+}
+
+void gc_revive(VmState* vm, ObjStr* str) {
+    // strings have no references, so they are black right away
+    if (vm->gc.phase != GC_IDLE) {
+        str->obj.mark = vm->gc.mark;
+    }
+}
+
+static void mark_val(VmState* vm, Val val) {
+    if (IS_OBJ(val)) {
+        gc_shade(vm, UNWRAP_OBJ(val));
+    }
+}
+
+static void mark_obj(VmState* vm, Obj* obj) {
+    if (obj != NULL) {
+        gc_shade(vm, obj);
+    }
+}
+
+static int mark_vals(VmState* vm, Val* vals, int count) {
+    for (int i = 0; i < count; i++) {
+        mark_val(vm, vals[i]);
+    }
+    return count;
+}
+
+static int mark_dict(VmState* vm, Dict* dict) {
+    for (int i = 0; i < dict->capacity; i++) {
+        DictEntry* entry = &dict->entries[i];
+        if (entry->key != NULL) {
+            gc_shade(vm, (Obj*)entry->key);
+            mark_val(vm, entry->val);
+        }
+    }
+    return dict->capacity;
+}
+
+/*
+ * Trace the references of a gray object, which makes it black. Returns
+ * the work done.
+ */
+static int blacken(VmState* vm, Obj* obj) {
+    switch (obj->type) {
+        case OBJ_STR:
+            mark_obj(vm, ((ObjStr*)obj)->owner);
+            return 1;
+        case OBJ_NATIVE:
+        case OBJ_FLOAT_ARRAY:
+        case OBJ_LINES:
+            return 1;
+        case OBJ_FUNC: {
+            ObjFunc* fn = (ObjFunc*)obj;
+            mark_obj(vm, (Obj*)fn->name);
+            int work = mark_vals(vm, fn->ops.constants.vals, fn->ops.constants.count);
+            for (int i = 0; i < fn->ops.call_cache_count; i++) {
+                mark_obj(vm, (Obj*)fn->ops.call_caches[i].closure);
+                mark_obj(vm, (Obj*)fn->ops.call_caches[i].native);
+            }
+            for (int i = 0; i < fn->ops.prop_cache_count; i++) {
+                PropCache* cache = &fn->ops.prop_caches[i];
+                mark_obj(vm, (Obj*)cache->shape);
+                mark_obj(vm, (Obj*)cache->next_shape);
+                mark_obj(vm, (Obj*)cache->method);
+            }
+            return 1 + work + fn->ops.call_cache_count + fn->ops.prop_cache_count;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)obj;
+            gc_shade(vm, (Obj*)closure->fn);
+            for (int i = 0; i < closure->upvalue_count; i++) {
+                mark_obj(vm, (Obj*)closure->upvalues[i]);
+            }
+            return 1 + closure->upvalue_count;
+        }
+        case OBJ_UPVALUE:
+            // open upvalues hold nil here, their value is on the stack
+            mark_val(vm, ((ObjUpvalue*)obj)->closed);
+            return 1;
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)obj;
+            gc_shade(vm, (Obj*)klass->name);
+            mark_obj(vm, (Obj*)klass->init);
+            mark_obj(vm, (Obj*)klass->shape);
+            return 1 + mark_dict(vm, &klass->methods);
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* inst = (ObjInstance*)obj;
+            gc_shade(vm, (Obj*)inst->klass);
+            gc_shade(vm, (Obj*)inst->shape);
+            return 1 + mark_vals(vm, inst->fields, inst->shape->field_count);
+        }
+        case OBJ_BOUND_METHOD: {
+            ObjBoundMethod* bound = (ObjBoundMethod*)obj;
+            mark_val(vm, bound->receiver);
+            gc_shade(vm, (Obj*)bound->method);
+            return 1;
+        }
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)obj;
+            gc_shade(vm, (Obj*)shape->klass);
+            return 1 + mark_dict(vm, &shape->slots) + mark_dict(vm, &shape->transitions);
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)obj;
+            return 1 + mark_vals(vm, array->vals.vals, array->vals.count);
+        }
+        case OBJ_MAP: {
+            ValDict* dict = &((ObjMap*)obj)->dict;
+            for (int i = 0; i < dict->capacity; i++) {
+                ValDictEntry* entry = &dict->entries[i];
+                if (entry->live) {
+                    mark_val(vm, entry->key);
+                    mark_val(vm, entry->val);
+                }
+            }
+            return 1 + dict->capacity;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)obj;
+            mark_obj(vm, (Obj*)fiber->resumer);
+            if (fiber == vm->fiber || fiber->stack == NULL) {
+                // the running one is a root, and a done one holds nothing
+                return 1;
+            }
+            int work = mark_vals(vm, fiber->stack, (int)(fiber->top - fiber->stack));
+            for (int i = 0; i < fiber->frame_count; i++) {
+                gc_shade(vm, (Obj*)fiber->frames[i].closure);
+            }
+            for (ObjUpvalue* upvalue = fiber->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+                gc_shade(vm, (Obj*)upvalue);
+                work++;
+            }
+            return 1 + work + fiber->frame_count;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Estimated size of an object, including the arrays it owns.
+ */
+static size_t obj_size(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_STR:
+            if (((ObjStr*)obj)->owner != NULL) {
+                return sizeof(ObjStr);
+            }
+            return sizeof(ObjStr) + ((ObjStr*)obj)->length + 1;
+        case OBJ_FUNC: {
+            Ops* ops = &((ObjFunc*)obj)->ops;
+            return sizeof(ObjFunc) + ops->capacity * (sizeof(uint8_t) + sizeof(int))
+                + ops->constants.capacity * sizeof(Val)
+                + ops->call_cache_capacity * sizeof(CallCache)
+                + ops->prop_cache_capacity * sizeof(PropCache);
+        }
+        case OBJ_NATIVE:
+            return sizeof(ObjNative);
+        case OBJ_CLOSURE:
+            return sizeof(ObjClosure) + ((ObjClosure*)obj)->upvalue_count * sizeof(ObjUpvalue*);
+        case OBJ_UPVALUE:
+            return sizeof(ObjUpvalue);
+        case OBJ_CLASS:
+            return sizeof(ObjClass) + ((ObjClass*)obj)->methods.capacity * sizeof(DictEntry);
+        case OBJ_INSTANCE:
+            return sizeof(ObjInstance) + ((ObjInstance*)obj)->capacity * sizeof(Val);
+        case OBJ_BOUND_METHOD:
+            return sizeof(ObjBoundMethod);
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)obj;
+            return sizeof(ObjShape)
+                + (shape->slots.capacity + shape->transitions.capacity) * sizeof(DictEntry);
+        }
+        case OBJ_ARRAY:
+            return sizeof(ObjArray) + ((ObjArray*)obj)->vals.capacity * sizeof(Val);
+        case OBJ_FLOAT_ARRAY:
+            return sizeof(ObjFloatArray) + ((ObjFloatArray*)obj)->count * sizeof(double);
+        case OBJ_MAP:
+            return sizeof(ObjMap) + ((ObjMap*)obj)->dict.capacity * sizeof(ValDictEntry);
+        case OBJ_LINES:
+            return sizeof(ObjLines);
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)obj;
+            if (fiber->stack == NULL) {
+                return sizeof(ObjFiber);
+            }
+            return sizeof(ObjFiber) + fiber->max_frames * (UINT8_COUNT * sizeof(Val) + sizeof(CallFrame));
+        }
+    }
+    return sizeof(Obj);
+}
+
+/*
+ * The roots that are not guarded by write barriers. They are marked at
+ * the start of a cycle and once more before sweeping.
+ */
+static void mark_unguarded_roots(VmState* vm) {
+    for (Val* slot = vm->stack; slot < vm->top; slot++) {
+        mark_val(vm, *slot);
+    }
+    for (int i = 0; i < vm->frame_count; i++) {
+        gc_shade(vm, (Obj*)vm->frames[i].closure);
+    }
+    for (ObjUpvalue* upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+        gc_shade(vm, (Obj*)upvalue);
+    }
+    mark_obj(vm, (Obj*)vm->fiber);
+    for (ObjFiber* fiber = vm->run_queue; fiber != NULL; fiber = fiber->next) {
+        gc_shade(vm, (Obj*)fiber);
+    }
+    for (Program* prog = vm->programs; prog != NULL; prog = prog->next) {
+        gc_shade(vm, (Obj*)prog->closure);
+    }
+    for (int fd = 0; fd < vm->loop.capacity; fd++) {
+        mark_val(vm, vm->loop.watchers[fd].on_read);
+        mark_val(vm, vm->loop.watchers[fd].on_write);
+    }
+    mark_compiler_roots(vm);
+    mark_profile_roots(vm);
+}
+
+static void mark_roots(VmState* vm) {
+    mark_unguarded_roots(vm);
+    // stores into these go through barriers
+    mark_dict(vm, &vm->globals);
+    mark_dict(vm, &vm->base_globals);
+    mark_obj(vm, (Obj*)vm->init_str);
+    mark_obj(vm, (Obj*)vm->root);
+}
+
+static void begin_cycle(VmState* vm) {
+    Gc* gc = &vm->gc;
+    gc->phase = GC_MARK;
+    // everything is white now
+    gc->mark = !gc->mark;
+    gc->debt = 0;
+    mark_roots(vm);
+}
+
+static int drain_gray(VmState* vm, int budget) {
+    Gc* gc = &vm->gc;
+    int work = 0;
+    while (gc->gray_count > 0 && work < budget) {
+        work += blacken(vm, gc->gray[--gc->gray_count]);
+    }
+    return work;
+}
+
+/*
+ * The atomic end of marking. Once the roots are black again, every
+ * white object is garbage.
+ */
+static void finish_mark(VmState* vm) {
+    mark_unguarded_roots(vm);
+    drain_gray(vm, INT32_MAX);
+
+    vm->gc.phase = GC_SWEEP;
+    vm->gc.sweep = &vm->objects;
+    // objects allocated from here on are behind the sweep
+    vm->gc.live = 0;
+    vm->gc.allocated = 0;
+}
+
+static void finish_sweep(VmState* vm) {
+    Gc* gc = &vm->gc;
+    // the swept strings left the intern table
+    dict_shrink(&vm->strings);
+    gc->phase = GC_IDLE;
+    gc->sweep = NULL;
+    gc->cycles++;
+    gc->threshold = gc->live * GC_HEAP_GROWTH;
+    if (gc->threshold < GC_MIN_HEAP) {
+        gc->threshold = GC_MIN_HEAP;
+    }
+}
+
+static int sweep(VmState* vm, int budget) {
+    Gc* gc = &vm->gc;
+    int work = 0;
+    while (*gc->sweep != NULL && work < budget) {
+        Obj* obj = *gc->sweep;
+        work++;
+        if (obj->mark == gc->mark) {
+            gc->live += obj_size(obj);
+            gc->sweep = &obj->next;
+            continue;
+        }
+        *gc->sweep = obj->next;
+        if (obj->type == OBJ_STR && ((ObjStr*)obj)->interned) {
+            // the intern table doesn't keep strings alive
+            dict_del(&vm->strings, (ObjStr*)obj);
+        }
+        free_object(vm, obj);
+    }
+    if (*gc->sweep == NULL) {
+        finish_sweep(vm);
+    }
+    return work;
+}
+
+static void record_pause(Gc* gc, uint64_t ns) {
+    int bucket = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+    if (bucket >= GC_PAUSE_BUCKETS) {
+        bucket = GC_PAUSE_BUCKETS - 1;
+    }
+    gc->pauses[bucket]++;
+    gc->pause_count++;
+    gc->total_pause_ns += ns;
+    if (ns > gc->max_pause_ns) {
+        gc->max_pause_ns = ns;
+    }
+}
+
+/*
+ * Do up to budget work of the current cycle, or less if the slice runs
+ * out of time. A single object is always traced as a whole.
+ */
+static void run_slice(VmState* vm, int budget) {
+    Gc* gc = &vm->gc;
+    uint64_t start = now_ns();
+    int work = 0;
+    while (gc->phase != GC_IDLE && work < budget) {
+        int chunk = budget - work < GC_CLOCK_INTERVAL ? budget - work : GC_CLOCK_INTERVAL;
+        if (gc->phase == GC_MARK) {
+            if (gc->gray_count == 0) {
+                finish_mark(vm);
+            } else {
+                work += drain_gray(vm, chunk);
+            }
+        } else {
+            work += sweep(vm, chunk);
+        }
+        if (gc->slice_ns > 0 && now_ns() - start >= (uint64_t)gc->slice_ns) {
+            break;
+        }
+    }
+    record_pause(gc, now_ns() - start);
+}
+
+void gc_minor(VmState* vm) {
+    Gc* gc = &vm->gc;
+    if (gc->phase != GC_IDLE) {
+        return;
+    }
+    uint64_t start = now_ns();
+
+    // old objects already have the mark, so only young ones turn gray
+    mark_roots(vm);
+    for (int i = 0; i < gc->remembered_count; i++) {
+        Obj* obj = gc->remembered[i];
+        obj->gen &= ~GEN_REMEMBERED;
+        blacken(vm, obj);
+    }
+    gc->remembered_count = 0;
+    drain_gray(vm, INT32_MAX);
+
+    size_t promoted = 0;
+    Obj* obj = gc->young;
+    while (obj != NULL) {
+        Obj* next = obj->next;
+        if (obj->mark == gc->mark) {
+            obj->gen = 0;
+            obj->next = vm->objects;
+            vm->objects = obj;
+            promoted += obj_size(obj);
+        } else {
+            if (obj->type == OBJ_STR && ((ObjStr*)obj)->interned) {
+                dict_del(&vm->strings, (ObjStr*)obj);
+            }
+            free_object(vm, obj);
+        }
+        obj = next;
+    }
+    gc->young = NULL;
+    gc->young_bytes = 0;
+    dict_shrink(&vm->strings);
+    // the old generation grows by what was promoted
+    gc->allocated += promoted;
+    gc->promoted += promoted;
+    gc->minors++;
+    record_pause(gc, now_ns() - start);
+}
+
+static void start_cycle(VmState* vm) {
+    gc_minor(vm);
+    uint64_t start = now_ns();
+    begin_cycle(vm);
+    record_pause(&vm->gc, now_ns() - start);
+}
+
+void gc_alloc_step(VmState* vm, size_t size) {
+    Gc* gc = &vm->gc;
+#ifdef DEBUG_STRESS_GC
+    // every allocation runs a minor collection or moves a cycle on
+    gc->allocated += size;
+    if (gc->phase == GC_IDLE) {
+        gc_minor(vm);
+        if (gc->minors % 8 == 0) {
+            start_cycle(vm);
+        }
+    } else {
+        run_slice(vm, 16);
+    }
+    return;
+#endif
+    if (gc->phase == GC_IDLE) {
+        gc->young_bytes += size;
+        if (gc->young_bytes >= gc->nursery_size) {
+            gc_minor(vm);
+        }
+        if (gc->live + gc->allocated >= gc->threshold) {
+            start_cycle(vm);
+        }
+        return;
+    }
+    gc->allocated += size;
+    gc->debt += size;
+    if (gc->debt >= GC_SLICE_BYTES) {
+        gc->debt = 0;
+        run_slice(vm, gc->slice_work);
+    }
+}
+
+void gc_collect(VmState* vm) {
+    while (vm->gc.phase != GC_IDLE) {
+        run_slice(vm, INT32_MAX);
+    }
+    start_cycle(vm);
+    while (vm->gc.phase != GC_IDLE) {
+        run_slice(vm, INT32_MAX);
+    }
+}
+
+void gc_abort(VmState* vm) {
+    Gc* gc = &vm->gc;
+    gc->phase = GC_IDLE;
+    gc->gray_count = 0;
+    gc->sweep = NULL;
+    gc->debt = 0;
+
+    while (gc->young != NULL) {
+        Obj* obj = gc->young;
+        gc->young = obj->next;
+        obj->gen = 0;
+        obj->next = vm->objects;
+        vm->objects = obj;
+    }
+    gc->young_bytes = 0;
+    for (int i = 0; i < gc->remembered_count; i++) {
+        gc->remembered[i]->gen &= ~GEN_REMEMBERED;
+    }
+    gc->remembered_count = 0;
+    // white for the next cycle
+    for (Obj* obj = vm->objects; obj != NULL; obj = obj->next) {
+        obj->mark = gc->mark;
+    }
+}
+
+uint64_t gc_pause_percentile(VmState* vm, double p) {
+    Gc* gc = &vm->gc;
+    if (gc->pause_count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(p * (double)gc->pause_count);
+    uint64_t seen = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        seen += gc->pauses[i];
+        if (seen > target || seen == gc->pause_count) {
+            uint64_t bound = 2ull << i;
+            return bound < gc->max_pause_ns ? bound : gc->max_pause_ns;
+        }
+    }
+    return gc->max_pause_ns;
+}
+
+void print_gc_stats(VmState* vm, FILE* out) {
+    Gc* gc = &vm->gc;
+    fprintf(out, "gc: %llu cycles, %llu minor collections, %llu bytes promoted\n",
+            (unsigned long long)gc->cycles, (unsigned long long)gc->minors,
+            (unsigned long long)gc->promoted);
+    size_t string_bytes = 0;
+    for (int i = 0; i < vm->strings.capacity; i++) {
+        ObjStr* str = vm->strings.entries[i].key;
+        if (str != NULL) {
+            string_bytes += sizeof(ObjStr) + str->length + 1;
+        }
+    }
+    fprintf(out, "gc: %d interned strings of %zu bytes, intern table of %d slots and %zu bytes\n",
+            vm->strings.size, string_bytes, vm->strings.capacity,
+            vm->strings.capacity * sizeof(DictEntry));
+    fprintf(out, "gc: %llu pauses, %.3f ms in total, max %.1f us, p50 %.1f us, p99 %.1f us\n",
+            (unsigned long long)gc->pause_count,
+            gc->total_pause_ns / 1e6, gc->max_pause_ns / 1e3,
+            gc_pause_percentile(vm, 0.5) / 1e3, gc_pause_percentile(vm, 0.99) / 1e3);
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (gc->pauses[i] > 0) {
+            fprintf(out, "  %10.1f us - %10.1f us  %llu\n",
+                    (1ull << i) / 1e3, (2ull << i) / 1e3, (unsigned long long)gc->pauses[i]);
+        }
+    }
+}
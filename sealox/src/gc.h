@@ -0,0 +1,208 @@
+#ifndef gc_h
+#define gc_h
+
+#include "common.h"
+#include "ops.h"
+
+/*
+ * Incremental tri-color mark and sweep. A cycle starts once the heap has
+ * grown past a threshold, and then does its work in slices that run on
+ * allocation, so that a script is never stopped for a whole collection.
+ *
+ * Objects whose mark equals the mark of the collector have been reached,
+ * the others are white. The meaning of the mark flips at the start of a
+ * cycle, so the survivors of the previous one never need to be cleared.
+ * Reached objects are gray while they are on the gray stack and black
+ * once their references are traced.
+ *
+ * While marking, black objects must never point to white ones. Stores of
+ * values into the heap go through GC_BARRIER, which shades the stored
+ * value, and new objects start out gray. The stack and the other roots
+ * are not guarded by barriers, they are scanned again at the end of
+ * marking instead.
+ *
+ * Between cycles, new objects are young and kept on a list of their own.
+ * Once the nursery is full, a minor collection marks the young objects
+ * reachable from the roots and from the remembered set, tenures them in
+ * place and frees the rest. Old objects keep the mark of the collector
+ * while it is idle, so marking stops at them. Objects never move, as C
+ * code holds on to them everywhere. Stores of young objects into old ones
+ * put the old one in the remembered set, through the same GC_BARRIER.
+ * A cycle always starts with a minor collection, so there are no young
+ * objects while one runs.
+ *
+ * The intern table holds its strings weakly. Strings leave it when they
+ * are freed, and it shrinks once most of it is empty.
+ *
+ * Objects live in cells of a few size classes, carved out of blocks with
+ * a bump pointer. Freed cells go to a free list per class and are handed
+ * out again before the bump pointer moves on.
+ */
+
+typedef enum {
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP
+} GcPhase;
+
+// a cycle starts once the heap has grown by this factor since the last one
+#define GC_HEAP_GROWTH 2
+#define GC_MIN_HEAP (1024 * 1024)
+// bytes allocated between two slices of a cycle
+#define GC_SLICE_BYTES 4096
+// work of a slice, in references traced or objects swept
+#define GC_SLICE_WORK 1024
+// pause bucket i holds the pauses of [2^i, 2^(i + 1)) ns
+#define GC_PAUSE_BUCKETS 40
+// bytes allocated between two minor collections
+#define GC_NURSERY_SIZE (256 * 1024)
+// cells are multiples of GC_CELL_SIZE, bigger objects are malloced
+#define GC_CELL_SIZE 16
+#define GC_CELL_CLASSES 16
+#define GC_BLOCK_SIZE (64 * 1024)
+
+// allocated since the last minor collection
+#define GEN_YOUNG 1
+// old, and in the remembered set
+#define GEN_REMEMBERED 2
+
+typedef struct GcBlock {
+    struct GcBlock* next;
+} GcBlock;
+
+typedef struct {
+    GcPhase phase;
+    bool mark;
+
+    Obj** gray;
+    int gray_count;
+    int gray_capacity;
+    // link to the next object to sweep
+    Obj** sweep;
+
+    // estimated bytes of the objects that survived the last cycle, and
+    // of the ones allocated since
+    size_t live;
+    size_t allocated;
+    size_t threshold;
+    // bytes allocated since the last slice
+    size_t debt;
+
+    // budget of a slice, the time limit is off if 0
+    int slice_work;
+    long slice_ns;
+
+    Obj* young;
+    // bytes allocated since the last minor collection
+    size_t young_bytes;
+    size_t nursery_size;
+    // old objects that may point to young ones
+    Obj** remembered;
+    int remembered_count;
+    int remembered_capacity;
+
+    GcBlock* blocks;
+    char* bump;
+    char* limit;
+    void* free_cells[GC_CELL_CLASSES + 1];
+
+    uint64_t cycles;
+    uint64_t minors;
+    uint64_t promoted;
+    uint64_t pauses[GC_PAUSE_BUCKETS];
+    uint64_t pause_count;
+    uint64_t max_pause_ns;
+    uint64_t total_pause_ns;
+} Gc;
+
+void init_gc(Gc* gc);
+// the objects must have been freed already
+void free_gc(Gc* gc);
+
+/*
+ * Called by the allocator before an object of the given size is created,
+ * which runs a minor collection, starts a cycle or runs a slice when one
+ * is due. The object itself is not seen by the collector, so it can't be
+ * traced half initialized.
+ */
+void gc_alloc_step(VmState* vm, size_t size);
+/*
+ * Memory for an object of the given size, which is a cell unless the
+ * object is too big. Sets the cell of the object.
+ */
+Obj* gc_alloc_cell(VmState* vm, size_t size);
+void gc_free_cell(VmState* vm, Obj* obj);
+// link an object that was just created and color it
+void gc_adopt(VmState* vm, Obj* obj);
+// mark the object gray unless it has been reached already
+void gc_shade(VmState* vm, Obj* obj);
+// add an old object to the remembered set
+void gc_remember(VmState* vm, Obj* obj);
+/*
+ * For objects that changed without barriers, like the stack of a fiber
+ * while it ran: trace obj once more if it was traced already, or remember
+ * it if it is old.
+ */
+void gc_retrace(VmState* vm, Obj* obj);
+/*
+ * Interned strings are looked up without a reference to them. A hit on a
+ * white string during a cycle marks it, as it is in use again.
+ */
+void gc_revive(VmState* vm, ObjStr* str);
+
+/*
+ * Tenure the young objects that are reachable and free the others. Does
+ * nothing while a cycle runs, as there are no young objects then.
+ */
+void gc_minor(VmState* vm);
+/*
+ * Finish the current cycle, if any, and run a whole one.
+ */
+void gc_collect(VmState* vm);
+/*
+ * Drop the current cycle and tenure every young object, for when the VM
+ * frees its objects itself.
+ */
+void gc_abort(VmState* vm);
+
+/*
+ * Upper bound of the pause in ns below which the fraction p of the
+ * pauses fall, e.g. 0.99 for p99. Pauses are recorded per slice.
+ */
+uint64_t gc_pause_percentile(VmState* vm, double p);
+void print_gc_stats(VmState* vm, FILE* out);
+
+/*
+ * Write barrier of a store of val into obj. Shades the value while
+ * marking, and remembers obj if it is old and the value young.
+ */
+#define GC_BARRIER(vm, obj, val) \
+    do { \
+        if (IS_OBJ(val)) { \
+            GC_BARRIER_OBJ(vm, obj, UNWRAP_OBJ(val)); \
+        } \
+    } while (false)
+
+#define GC_BARRIER_OBJ(vm, obj, o) \
+    do { \
+        Obj* gc_val_ = (Obj*)(o); \
+        if (gc_val_ == NULL) { \
+            break; \
+        } \
+        if ((vm)->gc.phase == GC_MARK) { \
+            gc_shade(vm, gc_val_); \
+        } else if ((gc_val_->gen & GEN_YOUNG) \
+                   && !(((Obj*)(obj))->gen & (GEN_YOUNG | GEN_REMEMBERED))) { \
+            gc_remember(vm, (Obj*)(obj)); \
+        } \
+    } while (false)
+
+// for stores into roots, which minor collections scan in full
+#define GC_BARRIER_ROOT(vm, val) \
+    do { \
+        if ((vm)->gc.phase == GC_MARK && IS_OBJ(val)) { \
+            gc_shade(vm, UNWRAP_OBJ(val)); \
+        } \
+    } while (false)
+
+#endif
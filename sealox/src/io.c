@@ -0,0 +1,102 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "io.h"
+#include "memory.h"
+#include "vm.h"
+
+/*
+ * Pages of a reader are released once it is this far past them, so that
+ * streaming a big file keeps a constant amount of it resident. Lines
+ * that are still referenced fault their pages in again from the file.
+ */
+#define LINES_RELEASE_SIZE (32 * 1024 * 1024)
+
+bool map_file(VmState* vm, Val path_val, char** data, size_t* size) {
+    if (!IS_STR(path_val)) {
+        native_err(vm, "Expected a path");
+        return false;
+    }
+    // the chars of a slice are not null terminated
+    ObjStr* str = UNWRAP_STR(path_val);
+    char* path = REALLOC_ARR(char, NULL, str->length + 1);
+    memcpy(path, str->chars, str->length);
+    path[str->length] = '\0';
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        native_err(vm, "Unable to open file \"%s\": %s", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(path);
+        return false;
+    }
+    *data = NULL;
+    *size = st.st_size;
+    if (*size > 0) {
+        *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*data == MAP_FAILED) {
+            native_err(vm, "Unable to map file \"%s\": %s", path, strerror(errno));
+            close(fd);
+            free(path);
+            return false;
+        }
+        madvise(*data, *size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    free(path);
+    return true;
+}
+
+static Val open_lines_native(VmState* vm, int argc, Val* args) {
+    char* data;
+    size_t size;
+    if (!map_file(vm, args[0], &data, &size)) {
+        return MK_NIL_VAL;
+    }
+    return MK_OBJ_VAL((Obj*)create_lines(vm, data, size));
+}
+
+static void release_read(ObjLines* lines) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end = lines->pos & ~(page - 1);
+    if (end - lines->released >= LINES_RELEASE_SIZE) {
+        madvise(lines->data + lines->released, end - lines->released, MADV_DONTNEED);
+        lines->released = end;
+    }
+}
+
+static Val next_line_native(VmState* vm, int argc, Val* args) {
+    if (!IS_LINES(args[0])) {
+        native_err(vm, "Expected a line reader");
+        return MK_NIL_VAL;
+    }
+    ObjLines* lines = UNWRAP_LINES(args[0]);
+    if (lines->pos >= lines->size) {
+        return MK_NIL_VAL;
+    }
+    const char* start = lines->data + lines->pos;
+    size_t left = lines->size - lines->pos;
+    const char* end = memchr(start, '\n', left);
+    size_t length = end != NULL ? (size_t)(end - start) : left;
+    if (length > INT32_MAX) {
+        native_err(vm, "Line is too long");
+        return MK_NIL_VAL;
+    }
+    lines->pos += length + (end != NULL);
+    if (length > 0 && start[length - 1] == '\r') {
+        length--;
+    }
+    release_read(lines);
+    return MK_OBJ_VAL((Obj*)view_str(vm, (Obj*)lines, start, (int)length));
+}
+
+void define_io_natives(VmState* vm) {
+    define_native(vm, "open_lines", 1, open_lines_native);
+    define_native(vm, "next_line", 1, next_line_native);
+}
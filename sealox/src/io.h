@@ -0,0 +1,40 @@
+#ifndef io_h
+#define io_h
+
+#include <stddef.h>
+#include "common.h"
+#include "ops.h"
+
+/*
+ * Line reader over a file that is mapped read only. The lines it hands
+ * out are views of the mapping, so the mapping lives as long as any of
+ * them does.
+ */
+typedef struct {
+    Obj obj;
+    // NULL if the file is empty
+    char* data;
+    size_t size;
+    // start of the next line
+    size_t pos;
+    // the pages before this offset have been given back to the kernel
+    size_t released;
+} ObjLines;
+
+#define IS_LINES(v) is_obj_type(v, OBJ_LINES)
+#define UNWRAP_LINES(v) ((ObjLines*)(UNWRAP_OBJ(v)))
+
+/*
+ * Map the file at path read only for sequential access, data is NULL if
+ * it is empty. Reports the error with native_err and returns false if the
+ * file can't be mapped.
+ */
+bool map_file(VmState* vm, Val path, char** data, size_t* size);
+
+/*
+ * open_lines(path) and next_line(reader), which returns the next line
+ * without its "\n" or "\r\n", or nil at the end of the file.
+ */
+void define_io_natives(VmState* vm);
+
+#endif
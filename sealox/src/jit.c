@@ -0,0 +1,1016 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "vm.h"
+#include "memory.h"
+#include "class.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+/*
+ * The generated code is a straight translation of the ops. Nothing is
+ * kept in registers between ops, except for these:
+ *
+ *   rbx  VmState*
+ *   r12  top of the VM stack
+ *   r13  slots of the frame
+ *   r14  CallFrame*
+ *
+ * Anything that is not a simple stack shuffle or a number op calls back
+ * into the VM. Before such a call the top and the pc are written back,
+ * so that errors, natives and nested calls see a consistent VM.
+ */
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RSI 6
+#define RDI 7
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+#define VAL_SIZE ((int)sizeof(Val))
+#define VAL_UNWRAP ((int)offsetof(Val, unwrap))
+
+// condition codes
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_NP 0xB
+#define CC_G 0xF
+
+struct JitCode {
+    uint8_t* code;
+    size_t size;
+    // native address of every op, NULL within operands
+    void** entries;
+};
+
+typedef int (*JitEntry)(VmState* vm, CallFrame* frame, void* entry);
+
+typedef struct {
+    int at;
+    int target;
+} Fixup;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    // native offset of every op, -1 within operands
+    int* offsets;
+    // jumps to ops, patched once all offsets are known
+    Fixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+
+    int exit;
+    int exit_err;
+    // out of memory, nothing is written from then on and the function
+    // stays interpreted
+    bool failed;
+} Asm;
+
+static void emit(Asm* a, uint8_t byte) {
+    if (a->failed) {
+        return;
+    }
+    if (a->count == a->capacity) {
+        int capacity = a->capacity < 256 ? 256 : a->capacity * 2;
+        uint8_t* code = (uint8_t*)realloc(a->code, capacity);
+        if (code == NULL) {
+            a->failed = true;
+            return;
+        }
+        a->code = code;
+        a->capacity = capacity;
+    }
+    a->code[a->count++] = byte;
+}
+
+static void emit32(Asm* a, uint32_t val) {
+    for (int i = 0; i < 4; i++) {
+        emit(a, (uint8_t)(val >> (8 * i)));
+    }
+}
+
+static void emit64(Asm* a, uint64_t val) {
+    for (int i = 0; i < 8; i++) {
+        emit(a, (uint8_t)(val >> (8 * i)));
+    }
+}
+
+static void emit_rex(Asm* a, bool wide, int reg, int rm) {
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+    if (rex != 0x40) {
+        emit(a, rex);
+    }
+}
+
+static void emit_opcode(Asm* a, int op) {
+    // two byte opcodes are given as 0x0Fxx
+    if (op > 0xFF) {
+        emit(a, (uint8_t)(op >> 8));
+    }
+    emit(a, (uint8_t)op);
+}
+
+/*
+ * op reg, [base + disp]. The prefix is the mandatory prefix of SSE ops.
+ */
+static void emit_mem(Asm* a, uint8_t prefix, bool wide, int op, int reg, int base, int32_t disp) {
+    if (prefix != 0) {
+        emit(a, prefix);
+    }
+    emit_rex(a, wide, reg, base);
+    emit_opcode(a, op);
+    emit(a, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP) {
+        // rsp and r12 as base need a SIB byte
+        emit(a, 0x24);
+    }
+    emit32(a, (uint32_t)disp);
+}
+
+/*
+ * op reg, rm with both as registers.
+ */
+static void emit_reg(Asm* a, uint8_t prefix, bool wide, int op, int reg, int rm) {
+    if (prefix != 0) {
+        emit(a, prefix);
+    }
+    emit_rex(a, wide, reg, rm);
+    emit_opcode(a, op);
+    emit(a, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emit_mov_imm64(Asm* a, int reg, uint64_t imm) {
+    emit_rex(a, true, 0, reg);
+    emit(a, 0xB8 + (reg & 7));
+    emit64(a, imm);
+}
+
+static void emit_mov_imm32(Asm* a, int reg, uint32_t imm) {
+    emit_rex(a, false, 0, reg);
+    emit(a, 0xB8 + (reg & 7));
+    emit32(a, imm);
+}
+
+static void emit_push(Asm* a, int reg) {
+    emit_rex(a, false, 0, reg);
+    emit(a, 0x50 + (reg & 7));
+}
+
+static void emit_pop(Asm* a, int reg) {
+    emit_rex(a, false, 0, reg);
+    emit(a, 0x58 + (reg & 7));
+}
+
+// add / sub r12, n
+static void emit_move_top(Asm* a, int n_vals) {
+    emit_reg(a, 0, true, 0x83, n_vals > 0 ? 0 : 5, R12);
+    emit(a, (uint8_t)(abs(n_vals) * VAL_SIZE));
+}
+
+// copy a value with a 16 byte SSE move
+static void emit_load_val(Asm* a, int base, int32_t disp) {
+    emit_mem(a, 0xF3, false, 0x0F6F, 0, base, disp);
+}
+
+static void emit_store_val(Asm* a, int base, int32_t disp) {
+    emit_mem(a, 0xF3, false, 0x0F7F, 0, base, disp);
+}
+
+static void emit_store_type(Asm* a, int32_t disp, ValType type) {
+    emit_mem(a, 0, false, 0xC7, 0, R12, disp);
+    emit32(a, type);
+}
+
+static void emit_cmp_type(Asm* a, int32_t disp, ValType type) {
+    emit_mem(a, 0, false, 0x83, 7, R12, disp);
+    emit(a, (uint8_t)type);
+}
+
+static void emit_jmp_back(Asm* a, int target) {
+    emit(a, 0xE9);
+    emit32(a, (uint32_t)(target - (a->count + 4)));
+}
+
+static void emit_jcc_back(Asm* a, uint8_t cc, int target) {
+    emit(a, 0x0F);
+    emit(a, 0x80 | cc);
+    emit32(a, (uint32_t)(target - (a->count + 4)));
+}
+
+// forward jumps return the position of their displacement for patch()
+static int emit_jmp_fwd(Asm* a) {
+    emit(a, 0xE9);
+    emit32(a, 0);
+    return a->count - 4;
+}
+
+static int emit_jcc_fwd(Asm* a, uint8_t cc) {
+    emit(a, 0x0F);
+    emit(a, 0x80 | cc);
+    emit32(a, 0);
+    return a->count - 4;
+}
+
+static void patch(Asm* a, int at) {
+    if (a->failed) {
+        return;
+    }
+    uint32_t rel = (uint32_t)(a->count - (at + 4));
+    memcpy(a->code + at, &rel, 4);
+}
+
+static void add_fixup(Asm* a, int at, int target) {
+    if (a->failed) {
+        return;
+    }
+    if (a->fixup_count == a->fixup_capacity) {
+        int capacity = a->fixup_capacity < 8 ? 8 : a->fixup_capacity * 2;
+        Fixup* fixups = (Fixup*)realloc(a->fixups, sizeof(Fixup) * capacity);
+        if (fixups == NULL) {
+            a->failed = true;
+            return;
+        }
+        a->fixups = fixups;
+        a->fixup_capacity = capacity;
+    }
+    a->fixups[a->fixup_count].at = at;
+    a->fixups[a->fixup_count].target = target;
+    a->fixup_count++;
+}
+
+static void emit_jmp_op(Asm* a, int target) {
+    add_fixup(a, emit_jmp_fwd(a), target);
+}
+
+static void emit_jcc_op(Asm* a, uint8_t cc, int target) {
+    add_fixup(a, emit_jcc_fwd(a, cc), target);
+}
+
+/*
+ * Write back the top and the pc of the next op before calling into the VM.
+ */
+static void emit_sync(Asm* a, uint8_t* next_pc) {
+    emit_mem(a, 0, true, 0x89, R12, RBX, offsetof(VmState, top));
+    emit_mov_imm64(a, RAX, (uint64_t)next_pc);
+    emit_mem(a, 0, true, 0x89, RAX, R14, offsetof(CallFrame, pc));
+}
+
+/*
+ * Call a helper with the VM as the first argument. The other arguments
+ * are loaded by the caller. The top is reloaded afterwards.
+ */
+static void emit_call(Asm* a, void* fn) {
+    emit_reg(a, 0, true, 0x89, RBX, RDI);
+    emit_mov_imm64(a, RAX, (uint64_t)fn);
+    emit(a, 0xFF);
+    emit(a, 0xD0);
+    emit_mem(a, 0, true, 0x8B, R12, RBX, offsetof(VmState, top));
+}
+
+// bail out if the helper returned 0
+static void emit_check(Asm* a) {
+    emit(a, 0x85);
+    emit(a, 0xC0);
+    emit_jcc_back(a, CC_E, a->exit_err);
+}
+
+static void emit_exit(Asm* a, uint8_t* pc, JitExit exit) {
+    emit_mov_imm64(a, RAX, (uint64_t)pc);
+    emit_mem(a, 0, true, 0x89, RAX, R14, offsetof(CallFrame, pc));
+    emit_mov_imm32(a, RAX, exit);
+    emit_jmp_back(a, a->exit);
+}
+
+/*
+ * Helpers called from the generated code. They return 0 on an error,
+ * which is already reported, and 1 otherwise.
+ */
+
+static int jit_add(VmState* vm) {
+    if (IS_STR(vm->top[-1]) && IS_STR(vm->top[-2])) {
+        concat(vm);
+        return 1;
+    }
+    run_err(vm, "Operands must be numbers");
+    return 0;
+}
+
+static int jit_operands_err(VmState* vm) {
+    run_err(vm, "Operands must be numbers");
+    return 0;
+}
+
+static int jit_operand_err(VmState* vm) {
+    run_err(vm, "Operand must be a number");
+    return 0;
+}
+
+static int jit_not(VmState* vm) {
+    vm->top[-1] = MK_BOOL_VAL(is_falsey(vm->top[-1]));
+    return 1;
+}
+
+static int jit_equal(VmState* vm) {
+    vm->top--;
+    vm->top[-1] = MK_BOOL_VAL(are_equal(vm->top[-1], vm->top[0]));
+    return 1;
+}
+
+static int jit_print(VmState* vm) {
+    print_line(vm, pop_val(vm));
+    return 1;
+}
+
+static int jit_define_global(VmState* vm, ObjStr* name) {
+    define_global(vm, name);
+    return 1;
+}
+
+static int jit_get_global(VmState* vm, ObjStr* name) {
+    return get_global(vm, name);
+}
+
+static int jit_set_global(VmState* vm, ObjStr* name) {
+    return set_global(vm, name);
+}
+
+// 2 means that a frame was pushed, or that a native switched fibers
+static int jit_call(VmState* vm, CallCache* cache, int argc) {
+    int frame_count = vm->frame_count;
+    ObjFiber* fiber = vm->fiber;
+    if (!call_cached(vm, cache, argc)) {
+        return 0;
+    }
+    return vm->frame_count > frame_count || vm->fiber != fiber ? 2 : 1;
+}
+
+static int jit_closure(VmState* vm, ObjFunc* fn, uint8_t* captures) {
+    push_closure(vm, &vm->frames[vm->frame_count - 1], fn, captures);
+    return 1;
+}
+
+static int jit_close_upvalue(VmState* vm) {
+    close_upvalues(vm, vm->top - 1);
+    vm->top--;
+    return 1;
+}
+
+static int jit_class(VmState* vm, ObjStr* name) {
+    push_val(vm, MK_OBJ_VAL((Obj*)create_class(vm, name)));
+    return 1;
+}
+
+static int jit_inherit(VmState* vm) {
+    return inherit(vm);
+}
+
+static int jit_method(VmState* vm, ObjStr* name) {
+    define_method(vm, name);
+    return 1;
+}
+
+static int jit_get_property(VmState* vm, ObjStr* name, PropCache* cache) {
+    return get_property(vm, name, cache);
+}
+
+static int jit_set_property(VmState* vm, ObjStr* name, PropCache* cache) {
+    return set_property(vm, name, cache);
+}
+
+static int jit_invoke(VmState* vm, ObjStr* name, int argc, PropCache* cache) {
+    int frame_count = vm->frame_count;
+    ObjFiber* fiber = vm->fiber;
+    if (!invoke(vm, name, argc, cache)) {
+        return 0;
+    }
+    return vm->frame_count > frame_count || vm->fiber != fiber ? 2 : 1;
+}
+
+static int jit_array(VmState* vm, int count) {
+    make_array(vm, count);
+    return 1;
+}
+
+static int jit_get_index(VmState* vm) {
+    return get_index(vm);
+}
+
+static int jit_set_index(VmState* vm) {
+    return set_index(vm);
+}
+
+static int jit_field_barrier(VmState* vm) {
+    // the instance is only checked after the barrier
+    if (IS_OBJ(vm->top[-2])) {
+        GC_BARRIER(vm, UNWRAP_OBJ(vm->top[-2]), vm->top[-1]);
+    }
+    return 1;
+}
+
+static int jit_upvalue_barrier(VmState* vm, int slot) {
+    ObjClosure* closure = vm->frames[vm->frame_count - 1].closure;
+    GC_BARRIER(vm, closure->upvalues[slot], vm->top[-1]);
+    return 1;
+}
+
+static int jit_get_super(VmState* vm, ObjStr* name) {
+    return get_super(vm, name);
+}
+
+static int jit_super_invoke(VmState* vm, ObjStr* name, int argc) {
+    int frame_count = vm->frame_count;
+    ObjFiber* fiber = vm->fiber;
+    if (!super_invoke(vm, name, argc)) {
+        return 0;
+    }
+    return vm->frame_count > frame_count || vm->fiber != fiber ? 2 : 1;
+}
+
+static void emit_prologue(Asm* a) {
+    // five pushes keep the stack 16 byte aligned for calls
+    emit_push(a, RBX);
+    emit_push(a, R12);
+    emit_push(a, R13);
+    emit_push(a, R14);
+    emit_push(a, R15);
+    emit_reg(a, 0, true, 0x89, RDI, RBX);
+    emit_reg(a, 0, true, 0x89, RSI, R14);
+    emit_mem(a, 0, true, 0x8B, R12, RBX, offsetof(VmState, top));
+    emit_mem(a, 0, true, 0x8B, R13, R14, offsetof(CallFrame, slots));
+    // jmp rdx, i.e. to the entry of the current op
+    emit(a, 0xFF);
+    emit(a, 0xE2);
+
+    a->exit_err = a->count;
+    // xor eax, eax
+    emit(a, 0x31);
+    emit(a, 0xC0);
+
+    a->exit = a->count;
+    emit_mem(a, 0, true, 0x89, R12, RBX, offsetof(VmState, top));
+    emit_pop(a, R15);
+    emit_pop(a, R14);
+    emit_pop(a, R13);
+    emit_pop(a, R12);
+    emit_pop(a, RBX);
+    emit(a, 0xC3);
+}
+
+/*
+ * Number fast path of a binary op. Jumps to the returned positions
+ * need to be patched to the slow path.
+ */
+static void emit_num_guard(Asm* a, int slow[2]) {
+    emit_cmp_type(a, -VAL_SIZE, VAL_NUM);
+    slow[0] = emit_jcc_fwd(a, CC_NE);
+    emit_cmp_type(a, -2 * VAL_SIZE, VAL_NUM);
+    slow[1] = emit_jcc_fwd(a, CC_NE);
+}
+
+static void emit_arith(Asm* a, int sse_op, void* slow_fn, uint8_t* next_pc) {
+    int slow[2];
+    emit_num_guard(a, slow);
+    emit_mem(a, 0xF2, false, 0x0F10, 0, R12, -2 * VAL_SIZE + VAL_UNWRAP);
+    emit_mem(a, 0xF2, false, sse_op, 0, R12, -VAL_SIZE + VAL_UNWRAP);
+    emit_mem(a, 0xF2, false, 0x0F11, 0, R12, -2 * VAL_SIZE + VAL_UNWRAP);
+    emit_move_top(a, -1);
+    int done = emit_jmp_fwd(a);
+
+    patch(a, slow[0]);
+    patch(a, slow[1]);
+    emit_sync(a, next_pc);
+    emit_call(a, slow_fn);
+    emit_check(a);
+    patch(a, done);
+}
+
+/*
+ * Leaves the result of the comparison in al. Greater is a > b, less
+ * is b > a, so that unordered operands compare false.
+ */
+static void emit_compare(Asm* a, OpCode op, uint8_t* next_pc) {
+    int slow[2];
+    emit_num_guard(a, slow);
+    int lhs = op == OP_LESS ? -VAL_SIZE : -2 * VAL_SIZE;
+    int rhs = op == OP_LESS ? -2 * VAL_SIZE : -VAL_SIZE;
+    emit_mem(a, 0xF2, false, 0x0F10, 0, R12, lhs + VAL_UNWRAP);
+    emit_mem(a, 0x66, false, 0x0F2E, 0, R12, rhs + VAL_UNWRAP);
+    if (op == OP_EQUAL) {
+        // sete al; setnp cl; and al, cl
+        emit_reg(a, 0, false, 0x0F90 | CC_E, 0, RAX);
+        emit_reg(a, 0, false, 0x0F90 | CC_NP, 0, RCX);
+        emit_reg(a, 0, false, 0x20, RCX, RAX);
+    } else {
+        emit_reg(a, 0, false, 0x0F90 | CC_A, 0, RAX);
+    }
+    // movzx eax, al
+    emit_reg(a, 0, false, 0x0FB6, RAX, RAX);
+    emit_store_type(a, -2 * VAL_SIZE, VAL_BOOL);
+    emit_mem(a, 0, true, 0x89, RAX, R12, -2 * VAL_SIZE + VAL_UNWRAP);
+    emit_move_top(a, -1);
+    int done = emit_jmp_fwd(a);
+
+    patch(a, slow[0]);
+    patch(a, slow[1]);
+    emit_sync(a, next_pc);
+    emit_call(a, op == OP_EQUAL ? (void*)jit_equal : (void*)jit_operands_err);
+    emit_check(a);
+    patch(a, done);
+}
+
+static void emit_push_bool(Asm* a, ValType type, bool val) {
+    emit_store_type(a, 0, type);
+    // mov qword [r12 + 8], imm32
+    emit_mem(a, 0, true, 0xC7, 0, R12, VAL_UNWRAP);
+    emit32(a, val ? 1 : 0);
+    emit_move_top(a, 1);
+}
+
+/*
+ * After a call helper, leave for the callee if it pushed a frame. The
+ * pc is already past the call.
+ */
+static void emit_call_exit(Asm* a) {
+    emit_check(a);
+    // cmp eax, 2
+    emit_reg(a, 0, false, 0x83, 7, RAX);
+    emit(a, 2);
+    int done = emit_jcc_fwd(a, CC_NE);
+    emit_mov_imm32(a, RAX, JIT_EXIT_CALL);
+    emit_jmp_back(a, a->exit);
+    patch(a, done);
+}
+
+/*
+ * Inline cache guard of a field access on the instance at disp from the
+ * top. Leaves the address of the field in rax, or jumps to the returned
+ * positions, which need to be patched to the slow path.
+ */
+static void emit_field_guard(Asm* a, int32_t disp, PropCache* cache, int slow[4]) {
+    emit_cmp_type(a, disp, VAL_OBJ);
+    slow[0] = emit_jcc_fwd(a, CC_NE);
+    emit_mem(a, 0, true, 0x8B, RAX, R12, disp + VAL_UNWRAP);
+    // cmp dword [rax + type], OBJ_INSTANCE
+    emit_mem(a, 0, false, 0x83, 7, RAX, offsetof(Obj, type));
+    emit(a, OBJ_INSTANCE);
+    slow[1] = emit_jcc_fwd(a, CC_NE);
+    emit_mov_imm64(a, RDX, (uint64_t)cache);
+    emit_mem(a, 0, true, 0x8B, RCX, RAX, offsetof(ObjInstance, shape));
+    emit_mem(a, 0, true, 0x3B, RCX, RDX, offsetof(PropCache, shape));
+    slow[2] = emit_jcc_fwd(a, CC_NE);
+    // movsxd rcx, [rdx + slot], a method if -1
+    emit_mem(a, 0, true, 0x63, RCX, RDX, offsetof(PropCache, slot));
+    emit_reg(a, 0, true, 0x83, 7, RCX);
+    emit(a, 0xFF);
+    slow[3] = emit_jcc_fwd(a, CC_E);
+    // rax = fields + slot * 16
+    emit_reg(a, 0, true, 0xC1, 4, RCX);
+    emit(a, 4);
+    emit_mem(a, 0, true, 0x8B, RAX, RAX, offsetof(ObjInstance, fields));
+    emit_reg(a, 0, true, 0x01, RCX, RAX);
+}
+
+/*
+ * Write barrier of the value on top of the stack, which is about to be
+ * stored into the heap. Only calls out to the helper while the collector
+ * is marking, or if the value is young, and the helper checks the object
+ * stored into.
+ */
+static void emit_barrier(Asm* a, uint8_t* next_pc, void* helper, int arg) {
+    // cmp dword [rbx + phase], GC_MARK
+    emit_mem(a, 0, false, 0x83, 7, RBX, offsetof(VmState, gc.phase));
+    emit(a, GC_MARK);
+    int marking = emit_jcc_fwd(a, CC_E);
+    emit_cmp_type(a, -VAL_SIZE, VAL_OBJ);
+    int not_obj = emit_jcc_fwd(a, CC_NE);
+    emit_mem(a, 0, true, 0x8B, RAX, R12, -VAL_SIZE + VAL_UNWRAP);
+    // test byte [rax + gen], GEN_YOUNG
+    emit_mem(a, 0, false, 0xF6, 0, RAX, offsetof(Obj, gen));
+    emit(a, GEN_YOUNG);
+    int old = emit_jcc_fwd(a, CC_E);
+    patch(a, marking);
+    emit_sync(a, next_pc);
+    emit_mov_imm32(a, RSI, (uint32_t)arg);
+    emit_call(a, helper);
+    patch(a, not_obj);
+    patch(a, old);
+}
+
+static void emit_prop(Asm* a, ObjStr* name, PropCache* cache, void* slow_fn, uint8_t* next_pc) {
+    bool is_set = slow_fn == (void*)jit_set_property;
+    int slow[4];
+    if (is_set) {
+        emit_barrier(a, next_pc, jit_field_barrier, 0);
+    }
+    emit_field_guard(a, is_set ? -2 * VAL_SIZE : -VAL_SIZE, cache, slow);
+    if (is_set) {
+        // the assigned value replaces the instance
+        emit_load_val(a, R12, -VAL_SIZE);
+        emit_store_val(a, RAX, 0);
+        emit_store_val(a, R12, -2 * VAL_SIZE);
+        emit_move_top(a, -1);
+    } else {
+        emit_load_val(a, RAX, 0);
+        emit_store_val(a, R12, -VAL_SIZE);
+    }
+    int done = emit_jmp_fwd(a);
+
+    for (int i = 0; i < 4; i++) {
+        patch(a, slow[i]);
+    }
+    emit_sync(a, next_pc);
+    emit_mov_imm64(a, RSI, (uint64_t)name);
+    emit_mov_imm64(a, RDX, (uint64_t)cache);
+    emit_call(a, slow_fn);
+    emit_check(a);
+    patch(a, done);
+}
+
+// rax = the slot of the upvalue
+static void emit_load_upvalue(Asm* a, int slot) {
+    emit_mem(a, 0, true, 0x8B, RAX, R14, offsetof(CallFrame, closure));
+    emit_mem(a, 0, true, 0x8B, RAX, RAX, offsetof(ObjClosure, upvalues));
+    emit_mem(a, 0, true, 0x8B, RAX, RAX, slot * (int)sizeof(ObjUpvalue*));
+    emit_mem(a, 0, true, 0x8B, RAX, RAX, offsetof(ObjUpvalue, slot));
+}
+
+static bool emit_op(Asm* a, ObjFunc* fn, int pos) {
+    uint8_t* ops = fn->ops.ops;
+    uint8_t* next_pc = ops + pos + op_length(&fn->ops, pos);
+    int next = (int)(next_pc - ops);
+
+    switch (ops[pos]) {
+        case OP_CONST:
+            emit_mov_imm64(a, RAX, (uint64_t)&fn->ops.constants.vals[ops[pos + 1]]);
+            emit_load_val(a, RAX, 0);
+            emit_store_val(a, R12, 0);
+            emit_move_top(a, 1);
+            break;
+        case OP_NIL:
+            emit_push_bool(a, VAL_NIL, false);
+            break;
+        case OP_TRUE:
+            emit_push_bool(a, VAL_BOOL, true);
+            break;
+        case OP_FALSE:
+            emit_push_bool(a, VAL_BOOL, false);
+            break;
+        case OP_POP:
+            emit_move_top(a, -1);
+            break;
+        case OP_RETURN:
+            emit_exit(a, ops + pos, JIT_EXIT_RETURN);
+            break;
+        case OP_NEGATE: {
+            emit_cmp_type(a, -VAL_SIZE, VAL_NUM);
+            int slow = emit_jcc_fwd(a, CC_NE);
+            // flip the sign bit
+            emit_mov_imm64(a, RAX, 0x8000000000000000ull);
+            emit_mem(a, 0, true, 0x31, RAX, R12, -VAL_SIZE + VAL_UNWRAP);
+            int done = emit_jmp_fwd(a);
+            patch(a, slow);
+            emit_sync(a, next_pc);
+            emit_call(a, jit_operand_err);
+            emit_jmp_back(a, a->exit_err);
+            patch(a, done);
+            break;
+        }
+        case OP_NOT:
+            emit_sync(a, next_pc);
+            emit_call(a, jit_not);
+            break;
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_STR:
+            emit_arith(a, 0x0F58, jit_add, next_pc);
+            break;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:
+            emit_arith(a, 0x0F5C, jit_operands_err, next_pc);
+            break;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:
+            emit_arith(a, 0x0F59, jit_operands_err, next_pc);
+            break;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM:
+            emit_arith(a, 0x0F5E, jit_operands_err, next_pc);
+            break;
+        case OP_EQUAL:
+            emit_compare(a, OP_EQUAL, next_pc);
+            break;
+        case OP_LESS:
+        case OP_LESS_NUM:
+            emit_compare(a, OP_LESS, next_pc);
+            break;
+        case OP_GREATER:
+        case OP_GREATER_NUM:
+            emit_compare(a, OP_GREATER, next_pc);
+            break;
+        case OP_PRINT:
+            emit_sync(a, next_pc);
+            emit_call(a, jit_print);
+            break;
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL: {
+            ObjStr* name = UNWRAP_STR(fn->ops.constants.vals[ops[pos + 1]]);
+            emit_sync(a, next_pc);
+            emit_mov_imm64(a, RSI, (uint64_t)name);
+            if (ops[pos] == OP_DEFINE_GLOBAL) {
+                emit_call(a, jit_define_global);
+            } else {
+                emit_call(a, ops[pos] == OP_GET_GLOBAL ? (void*)jit_get_global : (void*)jit_set_global);
+                emit_check(a);
+            }
+            break;
+        }
+        case OP_GET_LOCAL:
+            emit_load_val(a, R13, ops[pos + 1] * VAL_SIZE);
+            emit_store_val(a, R12, 0);
+            emit_move_top(a, 1);
+            break;
+        case OP_SET_LOCAL:
+            emit_load_val(a, R12, -VAL_SIZE);
+            emit_store_val(a, R13, ops[pos + 1] * VAL_SIZE);
+            break;
+        case OP_GET_UPVALUE:
+            emit_load_upvalue(a, ops[pos + 1]);
+            emit_load_val(a, RAX, 0);
+            emit_store_val(a, R12, 0);
+            emit_move_top(a, 1);
+            break;
+        case OP_SET_UPVALUE:
+            emit_barrier(a, next_pc, jit_upvalue_barrier, ops[pos + 1]);
+            emit_load_upvalue(a, ops[pos + 1]);
+            emit_load_val(a, R12, -VAL_SIZE);
+            emit_store_val(a, RAX, 0);
+            break;
+        case OP_JMP_IF_FALSE: {
+            int target = next + (uint16_t)((ops[pos + 1] << 8) | ops[pos + 2]);
+            // nil or false, the value stays on the stack
+            emit_mem(a, 0, false, 0x8B, RAX, R12, -VAL_SIZE);
+            emit_reg(a, 0, false, 0x83, 7, RAX);
+            emit(a, VAL_NIL);
+            emit_jcc_op(a, CC_E, target);
+            emit_reg(a, 0, false, 0x83, 7, RAX);
+            emit(a, VAL_BOOL);
+            int truthy = emit_jcc_fwd(a, CC_NE);
+            emit_mem(a, 0, false, 0x80, 7, R12, -VAL_SIZE + VAL_UNWRAP);
+            emit(a, 0);
+            emit_jcc_op(a, CC_E, target);
+            patch(a, truthy);
+            break;
+        }
+        case OP_JMP:
+            emit_jmp_op(a, next + (uint16_t)((ops[pos + 1] << 8) | ops[pos + 2]));
+            break;
+        case OP_LOOP: {
+            int target = next - (uint16_t)((ops[pos + 1] << 8) | ops[pos + 2]);
+            // sub qword [rbx + fuel], 1
+            emit_mem(a, 0, true, 0x83, 5, RBX, offsetof(VmState, fuel));
+            emit(a, 1);
+            emit_jcc_op(a, CC_G, target);
+            emit_exit(a, ops + target, JIT_EXIT_FUEL);
+            break;
+        }
+        case OP_CALL: {
+            CallCache* cache = &fn->ops.call_caches[(ops[pos + 2] << 8) | ops[pos + 3]];
+            emit_sync(a, next_pc);
+            emit_mov_imm64(a, RSI, (uint64_t)cache);
+            emit_mov_imm32(a, RDX, ops[pos + 1]);
+            emit_call(a, jit_call);
+            emit_call_exit(a);
+            break;
+        }
+        case OP_CLOSURE: {
+            ObjFunc* inner = UNWRAP_FUNC(fn->ops.constants.vals[ops[pos + 1]]);
+            emit_sync(a, next_pc);
+            emit_mov_imm64(a, RSI, (uint64_t)inner);
+            emit_mov_imm64(a, RDX, (uint64_t)(ops + pos + 2));
+            emit_call(a, jit_closure);
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+            emit_sync(a, next_pc);
+            emit_call(a, jit_close_upvalue);
+            break;
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_GET_SUPER: {
+            ObjStr* name = UNWRAP_STR(fn->ops.constants.vals[ops[pos + 1]]);
+            emit_sync(a, next_pc);
+            emit_mov_imm64(a, RSI, (uint64_t)name);
+            if (ops[pos] == OP_GET_SUPER) {
+                emit_call(a, jit_get_super);
+                emit_check(a);
+            } else {
+                emit_call(a, ops[pos] == OP_CLASS ? (void*)jit_class : (void*)jit_method);
+            }
+            break;
+        }
+        case OP_INHERIT:
+            emit_sync(a, next_pc);
+            emit_call(a, jit_inherit);
+            emit_check(a);
+            break;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY: {
+            ObjStr* name = UNWRAP_STR(fn->ops.constants.vals[ops[pos + 1]]);
+            PropCache* cache = &fn->ops.prop_caches[(ops[pos + 2] << 8) | ops[pos + 3]];
+            emit_prop(a, name, cache,
+                    ops[pos] == OP_GET_PROPERTY ? (void*)jit_get_property : (void*)jit_set_property,
+                    next_pc);
+            break;
+        }
+        case OP_ARRAY:
+            emit_sync(a, next_pc);
+            emit_mov_imm32(a, RSI, ops[pos + 1]);
+            emit_call(a, jit_array);
+            break;
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+            emit_sync(a, next_pc);
+            emit_call(a, ops[pos] == OP_GET_INDEX ? (void*)jit_get_index : (void*)jit_set_index);
+            emit_check(a);
+            break;
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE: {
+            ObjStr* name = UNWRAP_STR(fn->ops.constants.vals[ops[pos + 1]]);
+            emit_sync(a, next_pc);
+            emit_mov_imm64(a, RSI, (uint64_t)name);
+            emit_mov_imm32(a, RDX, ops[pos + 2]);
+            if (ops[pos] == OP_INVOKE) {
+                PropCache* cache = &fn->ops.prop_caches[(ops[pos + 3] << 8) | ops[pos + 4]];
+                emit_mov_imm64(a, RCX, (uint64_t)cache);
+                emit_call(a, jit_invoke);
+            } else {
+                emit_call(a, jit_super_invoke);
+            }
+            emit_call_exit(a);
+            break;
+        }
+        default:
+            return false;
+    }
+    return true;
+}
+
+static void free_asm(Asm* a) {
+    free(a->code);
+    free(a->offsets);
+    free(a->fixups);
+}
+
+bool jit_supported() {
+    return true;
+}
+
+bool jit_compile(VmState* vm, ObjFunc* fn) {
+    if (fn->jit != NULL || fn->jit_failed) {
+        return fn->jit != NULL;
+    }
+
+    Asm a = {0};
+    a.offsets = (int*)malloc(sizeof(int) * fn->ops.count);
+    if (a.offsets == NULL) {
+        fn->jit_failed = true;
+        return false;
+    }
+    for (int i = 0; i < fn->ops.count; i++) {
+        a.offsets[i] = -1;
+    }
+
+    emit_prologue(&a);
+    bool ok = true;
+    for (int pos = 0; pos < fn->ops.count && ok; pos += op_length(&fn->ops, pos)) {
+        a.offsets[pos] = a.count;
+        ok = emit_op(&a, fn, pos);
+    }
+    ok = ok && !a.failed;
+    for (int i = 0; i < a.fixup_count && ok; i++) {
+        Fixup* fixup = &a.fixups[i];
+        int target = fixup->target < fn->ops.count ? a.offsets[fixup->target] : -1;
+        if (target < 0) {
+            ok = false;
+            break;
+        }
+        uint32_t rel = (uint32_t)(target - (fixup->at + 4));
+        memcpy(a.code + fixup->at, &rel, 4);
+    }
+    if (!ok) {
+        free_asm(&a);
+        fn->jit_failed = true;
+        return false;
+    }
+
+    uint8_t* code = mmap(NULL, a.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free_asm(&a);
+        fn->jit_failed = true;
+        return false;
+    }
+    memcpy(code, a.code, a.count);
+    mprotect(code, a.count, PROT_READ | PROT_EXEC);
+
+    JitCode* jit = (JitCode*)malloc(sizeof(JitCode));
+    void** entries = (void**)malloc(sizeof(void*) * fn->ops.count);
+    if (jit == NULL || entries == NULL) {
+        munmap(code, a.count);
+        free(jit);
+        free(entries);
+        free_asm(&a);
+        fn->jit_failed = true;
+        return false;
+    }
+    jit->code = code;
+    jit->size = a.count;
+    jit->entries = entries;
+    for (int i = 0; i < fn->ops.count; i++) {
+        jit->entries[i] = a.offsets[i] < 0 ? NULL : code + a.offsets[i];
+    }
+    fn->jit = jit;
+
+    free_asm(&a);
+    return true;
+}
+
+JitExit jit_enter(VmState* vm, CallFrame* frame) {
+    ObjFunc* fn = frame->closure->fn;
+    void* entry = fn->jit->entries[frame->pc - fn->ops.ops];
+    if (entry == NULL) {
+        return JIT_EXIT_INTERP;
+    }
+    // the pc of the frame is only synced at calls out of the code from here
+    bool in_jit = vm->in_jit;
+    vm->in_jit = true;
+    JitExit exit = (JitExit)((JitEntry)fn->jit->code)(vm, frame, entry);
+    vm->in_jit = in_jit;
+    return exit;
+}
+
+uint8_t* jit_pc_at(ObjFunc* fn, void* native_pc) {
+    JitCode* jit = fn->jit;
+    uint8_t* at = (uint8_t*)native_pc;
+    if (jit == NULL || at < jit->code || at >= jit->code + jit->size) {
+        return NULL;
+    }
+    // the code of the ops is in their order, so the last one that starts before
+    int found = -1;
+    for (int i = 0; i < fn->ops.count; i++) {
+        if (jit->entries[i] == NULL) {
+            continue;
+        }
+        if ((uint8_t*)jit->entries[i] > at) {
+            break;
+        }
+        found = i;
+    }
+    return found < 0 ? NULL : fn->ops.ops + found + 1;
+}
+
+void jit_free(ObjFunc* fn) {
+    if (fn->jit == NULL) {
+        return;
+    }
+    munmap(fn->jit->code, fn->jit->size);
+    free(fn->jit->entries);
+    free(fn->jit);
+    fn->jit = NULL;
+}
+
+#else
+
+bool jit_supported() {
+    return false;
+}
+
+bool jit_compile(VmState* vm, ObjFunc* fn) {
+    fn->jit_failed = true;
+    return false;
+}
+
+JitExit jit_enter(VmState* vm, CallFrame* frame) {
+    return JIT_EXIT_INTERP;
+}
+
+uint8_t* jit_pc_at(ObjFunc* fn, void* native_pc) {
+    return NULL;
+}
+
+void jit_free(ObjFunc* fn) {
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef jit_h
+#define jit_h
+
+#include "common.h"
+#include "ops.h"
+
+/*
+ * Baseline JIT. Hot functions are translated op by op to x86-64 machine
+ * code. The code keeps using the VM stack and call frames, so every op
+ * boundary is a valid place to enter or leave it and the interpreter can
+ * take over at any point.
+ */
+
+// calls and loop iterations before a function is compiled
+#define JIT_THRESHOLD 1000
+
+typedef enum {
+    JIT_OFF,
+    JIT_ON,
+    // compile every function on its first call, mostly for testing
+    JIT_ALWAYS
+} JitMode;
+
+typedef enum {
+    JIT_EXIT_ERR,
+    // the top frame continues in the interpreter at its pc
+    JIT_EXIT_INTERP,
+    // a call pushed a new frame
+    JIT_EXIT_CALL,
+    // the top frame is at its return op
+    JIT_EXIT_RETURN,
+    // the fuel ran out at a backward jump, the pc is at its target
+    JIT_EXIT_FUEL
+} JitExit;
+
+typedef struct JitCode JitCode;
+struct CallFrame;
+
+/*
+ * Whether this build can generate native code at all.
+ */
+bool jit_supported();
+/*
+ * Compile the function. On failure the function is marked so that
+ * it is left to the interpreter.
+ */
+bool jit_compile(VmState* vm, ObjFunc* fn);
+/*
+ * Run the compiled code of the frame's function from the frame's pc.
+ */
+JitExit jit_enter(VmState* vm, struct CallFrame* frame);
+/*
+ * The pc of the op whose code native_pc is in, as a frame has it while
+ * the op runs, or NULL if it isn't in the code of the function.
+ */
+uint8_t* jit_pc_at(ObjFunc* fn, void* native_pc);
+void jit_free(ObjFunc* fn);
+
+#endif
@@ -0,0 +1,167 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "jobs.h"
+#include "vm.h"
+#include "file.h"
+
+typedef enum {
+    JOB_OK,
+    JOB_READ_ERR,
+    JOB_COMP_ERR,
+    JOB_RUN_ERR,
+} JobStatus;
+
+typedef struct {
+    JobStatus status;
+    double ms;
+} JobResult;
+
+typedef struct {
+    const char** files;
+    int n_files;
+    JitMode jit_mode;
+    atomic_int next;
+    JobResult* results;
+    pthread_mutex_t out_lock;
+} JobQueue;
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static JobStatus run_script(VmState* vm, const char* file) {
+    char* program = read_file(file);
+    if (program == NULL) {
+        fprintf(vm->err, "Unable to read file \"%s\"\n", file);
+        return JOB_READ_ERR;
+    }
+
+    IntrResult result = interpret(vm, program);
+    free(program);
+
+    switch (result) {
+        case INTR_COMP_ERR:
+            return JOB_COMP_ERR;
+        case INTR_RUN_ERR:
+            return JOB_RUN_ERR;
+        default:
+            return JOB_OK;
+    }
+}
+
+static void run_job(VmState* vm, JobQueue* queue, int i_job) {
+    char* err_buf = NULL;
+    size_t err_size = 0;
+    vm->err = open_memstream(&err_buf, &err_size);
+
+    double start = now_ms();
+    JobStatus status = run_script(vm, queue->files[i_job]);
+    queue->results[i_job].ms = now_ms() - start;
+    queue->results[i_job].status = status;
+
+    size_t out_size;
+    char* out_buf = sink_take(&vm->sink, &out_size);
+    fclose(vm->err);
+    vm->err = stderr;
+
+    // write the buffered output of the whole script at once
+    pthread_mutex_lock(&queue->out_lock);
+    fwrite(out_buf, 1, out_size, stdout);
+    fflush(stdout);
+    fwrite(err_buf, 1, err_size, stderr);
+    pthread_mutex_unlock(&queue->out_lock);
+
+    free(out_buf);
+    free(err_buf);
+}
+
+static void* worker(void* arg) {
+    JobQueue* queue = (JobQueue*)arg;
+    VmState* vm = create_vm();
+    vm->jit_mode = queue->jit_mode;
+    // the output of a job is kept until it is done
+    sink_free(&vm->sink);
+    sink_init_mem(&vm->sink);
+
+    while (true) {
+        int i_job = atomic_fetch_add(&queue->next, 1);
+        if (i_job >= queue->n_files) {
+            break;
+        }
+        run_job(vm, queue, i_job);
+        reset_vm(vm);
+    }
+
+    destroy_vm(vm);
+    return NULL;
+}
+
+static const char* status_str(JobStatus status) {
+    switch (status) {
+        case JOB_OK:
+            return "ok";
+        case JOB_READ_ERR:
+            return "read error";
+        case JOB_COMP_ERR:
+            return "compile error";
+        case JOB_RUN_ERR:
+            return "runtime error";
+        default:
+            return "unknown";
+    }
+}
+
+static int report(JobQueue* queue, int n_jobs, double wall_ms) {
+    int failed = 0;
+    double total_ms = 0;
+    for (int i = 0; i < queue->n_files; i++) {
+        JobResult* result = &queue->results[i];
+        fprintf(stderr, "%10.3f ms  %-13s %s\n", result->ms, status_str(result->status), queue->files[i]);
+        total_ms += result->ms;
+        if (result->status != JOB_OK) {
+            failed++;
+        }
+    }
+
+    fprintf(stderr, "%d scripts (%d failed) on %d jobs in %.3f ms, %.1f scripts/s, %.3f ms per script\n",
+            queue->n_files, failed, n_jobs, wall_ms,
+            wall_ms > 0 ? queue->n_files / (wall_ms / 1000.0) : 0.0,
+            queue->n_files > 0 ? total_ms / queue->n_files : 0.0);
+    return failed;
+}
+
+bool run_jobs(int n_jobs, JitMode jit_mode, const char** files, int n_files) {
+    if (n_jobs > n_files) {
+        n_jobs = n_files;
+    }
+
+    JobQueue queue;
+    queue.files = files;
+    queue.n_files = n_files;
+    queue.jit_mode = jit_mode;
+    atomic_init(&queue.next, 0);
+    queue.results = (JobResult*)calloc(n_files, sizeof(JobResult));
+    pthread_mutex_init(&queue.out_lock, NULL);
+
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * n_jobs);
+    double start = now_ms();
+    for (int i = 0; i < n_jobs; i++) {
+        pthread_create(&threads[i], NULL, worker, &queue);
+    }
+    for (int i = 0; i < n_jobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double wall_ms = now_ms() - start;
+
+    int failed = report(&queue, n_jobs, wall_ms);
+
+    pthread_mutex_destroy(&queue.out_lock);
+    free(threads);
+    free(queue.results);
+    return failed == 0;
+}
@@ -0,0 +1,16 @@
+#ifndef jobs_h
+#define jobs_h
+
+#include "common.h"
+#include "jit.h"
+
+/*
+ * Run scripts on a pool of worker threads. Each worker owns a VM that
+ * is reset between scripts. Output is buffered per script, so scripts
+ * never interleave. Timing is reported on stderr.
+ *
+ * Returns false if any script failed.
+ */
+bool run_jobs(int n_jobs, JitMode jit_mode, const char** files, int n_files);
+
+#endif
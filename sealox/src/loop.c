@@ -0,0 +1,367 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "loop.h"
+#include "array.h"
+#include "memory.h"
+#include "vm.h"
+
+// events taken from the kernel per epoll_wait
+#define LOOP_EVENTS 64
+// bytes a read_fd reads at most
+#define LOOP_READ_SIZE (64 * 1024)
+
+void init_loop(Loop* loop) {
+    loop->epoll_fd = -1;
+    loop->watchers = NULL;
+    loop->capacity = 0;
+    loop->count = 0;
+}
+
+void free_loop(Loop* loop) {
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    free(loop->watchers);
+    init_loop(loop);
+}
+
+static bool watched(Watcher* watcher) {
+    return !IS_NIL(watcher->on_read) || !IS_NIL(watcher->on_write);
+}
+
+/*
+ * Set the callbacks of fd, nil for none, and tell epoll about the events
+ * they need.
+ */
+static bool watch(VmState* vm, int fd, Val on_read, Val on_write) {
+    Loop* loop = &vm->loop;
+    if (loop->epoll_fd < 0) {
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll_fd < 0) {
+            native_err(vm, "Unable to create the event loop: %s", strerror(errno));
+            return false;
+        }
+    }
+    if (fd >= loop->capacity) {
+        int capacity = loop->capacity < 16 ? 16 : loop->capacity;
+        while (capacity <= fd) {
+            capacity *= 2;
+        }
+        loop->watchers = REALLOC_ARR(Watcher, loop->watchers, capacity);
+        for (int i = loop->capacity; i < capacity; i++) {
+            loop->watchers[i].on_read = MK_NIL_VAL;
+            loop->watchers[i].on_write = MK_NIL_VAL;
+        }
+        loop->capacity = capacity;
+    }
+
+    Watcher* watcher = &loop->watchers[fd];
+    bool was_watched = watched(watcher);
+    struct epoll_event event = {.events = 0, .data.fd = fd};
+    if (!IS_NIL(on_read)) {
+        event.events |= EPOLLIN;
+    }
+    if (!IS_NIL(on_write)) {
+        event.events |= EPOLLOUT;
+    }
+    int op = event.events == 0 ? EPOLL_CTL_DEL : was_watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if ((was_watched || event.events != 0) && epoll_ctl(loop->epoll_fd, op, fd, &event) < 0
+            && op != EPOLL_CTL_DEL) {
+        native_err(vm, "Unable to watch fd %d: %s", fd, strerror(errno));
+        return false;
+    }
+    watcher->on_read = on_read;
+    watcher->on_write = on_write;
+    loop->count += (event.events != 0) - was_watched;
+    return true;
+}
+
+static void unwatch(VmState* vm, int fd) {
+    if (fd < vm->loop.capacity) {
+        watch(vm, fd, MK_NIL_VAL, MK_NIL_VAL);
+    }
+}
+
+void clear_loop(VmState* vm) {
+    for (int fd = 0; fd < vm->loop.capacity && vm->loop.count > 0; fd++) {
+        unwatch(vm, fd);
+    }
+}
+
+// call the callback for the event of fd, if it is still there
+static bool dispatch(VmState* vm, int fd, bool write) {
+    Watcher* watcher = &vm->loop.watchers[fd];
+    Val callback = write ? watcher->on_write : watcher->on_read;
+    if (IS_NIL(callback)) {
+        return true;
+    }
+    Val arg = MK_NUM_VAL(fd);
+    return call_fn(vm, callback, 1, &arg, NULL) == INTR_OK;
+}
+
+bool run_loop(VmState* vm) {
+    Loop* loop = &vm->loop;
+    struct epoll_event events[LOOP_EVENTS];
+    while (loop->count > 0) {
+        int n = epoll_wait(loop->epoll_fd, events, LOOP_EVENTS, -1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            run_err(vm, "Event loop failed: %s", strerror(errno));
+            clear_loop(vm);
+            return false;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            uint32_t ready = events[i].events;
+            // a hang up or error is for whoever reads, or else writes
+            bool closed = (ready & (EPOLLHUP | EPOLLERR)) != 0;
+            bool read = (ready & EPOLLIN) || (closed && !IS_NIL(loop->watchers[fd].on_read));
+            bool write = (ready & EPOLLOUT) || (closed && !read);
+            if ((read && !dispatch(vm, fd, false)) || (write && !dispatch(vm, fd, true))) {
+                // a paused callback goes on with the loop later
+                if (vm->paused == RUN_NONE) {
+                    clear_loop(vm);
+                }
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool fd_arg(VmState* vm, Val val, int* fd) {
+    if (!valid_index(val, INT32_MAX, fd)) {
+        native_err(vm, "Expected a file descriptor");
+        return false;
+    }
+    return true;
+}
+
+static bool callback_arg(Val val) {
+    if (IS_NIL(val)) {
+        return true;
+    }
+    if (!IS_OBJ(val)) {
+        return false;
+    }
+    ObjType type = OBJ_TYPE(val);
+    return type == OBJ_CLOSURE || type == OBJ_NATIVE || type == OBJ_BOUND_METHOD || type == OBJ_CLASS;
+}
+
+static Val on_event(VmState* vm, Val* args, bool write) {
+    int fd;
+    if (!fd_arg(vm, args[0], &fd)) {
+        return MK_NIL_VAL;
+    }
+    if (!callback_arg(args[1])) {
+        native_err(vm, "Expected a function or nil as the callback");
+        return MK_NIL_VAL;
+    }
+    Val on_read = fd < vm->loop.capacity ? vm->loop.watchers[fd].on_read : MK_NIL_VAL;
+    Val on_write = fd < vm->loop.capacity ? vm->loop.watchers[fd].on_write : MK_NIL_VAL;
+    if (write) {
+        on_write = args[1];
+    } else {
+        on_read = args[1];
+    }
+    watch(vm, fd, on_read, on_write);
+    return MK_NIL_VAL;
+}
+
+static Val on_readable_native(VmState* vm, int argc, Val* args) {
+    return on_event(vm, args, false);
+}
+
+static Val on_writable_native(VmState* vm, int argc, Val* args) {
+    return on_event(vm, args, true);
+}
+
+static Val unwatch_native(VmState* vm, int argc, Val* args) {
+    int fd;
+    if (fd_arg(vm, args[0], &fd)) {
+        unwatch(vm, fd);
+    }
+    return MK_NIL_VAL;
+}
+
+static bool set_nonblocking(VmState* vm, int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        native_err(vm, "Unable to make fd %d non-blocking: %s", fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static Val pipe_fds_native(VmState* vm, int argc, Val* args) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        native_err(vm, "Unable to create a pipe: %s", strerror(errno));
+        return MK_NIL_VAL;
+    }
+    if (!set_nonblocking(vm, fds[0]) || !set_nonblocking(vm, fds[1])) {
+        close(fds[0]);
+        close(fds[1]);
+        return MK_NIL_VAL;
+    }
+    ObjArray* array = create_array(vm);
+    append_val(&array->vals, MK_NUM_VAL(fds[0]));
+    append_val(&array->vals, MK_NUM_VAL(fds[1]));
+    return MK_OBJ_VAL((Obj*)array);
+}
+
+static bool unix_addr(VmState* vm, Val path, struct sockaddr_un* addr) {
+    if (!IS_STR(path)) {
+        native_err(vm, "Expected a path");
+        return false;
+    }
+    ObjStr* str = UNWRAP_STR(path);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (str->length >= (int)sizeof(addr->sun_path)) {
+        native_err(vm, "Socket path is longer than %d bytes", (int)sizeof(addr->sun_path) - 1);
+        return false;
+    }
+    memcpy(addr->sun_path, str->chars, str->length);
+    return true;
+}
+
+static Val listen_unix_native(VmState* vm, int argc, Val* args) {
+    struct sockaddr_un addr;
+    if (!unix_addr(vm, args[0], &addr)) {
+        return MK_NIL_VAL;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0
+            || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        native_err(vm, "Unable to listen on \"%s\": %s", addr.sun_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(fd);
+}
+
+static Val connect_unix_native(VmState* vm, int argc, Val* args) {
+    struct sockaddr_un addr;
+    if (!unix_addr(vm, args[0], &addr)) {
+        return MK_NIL_VAL;
+    }
+    // local connects don't wait for the peer, the socket is made
+    // non-blocking after
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        native_err(vm, "Unable to connect to \"%s\": %s", addr.sun_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return MK_NIL_VAL;
+    }
+    if (!set_nonblocking(vm, fd)) {
+        close(fd);
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(fd);
+}
+
+static Val accept_fd_native(VmState* vm, int argc, Val* args) {
+    int fd;
+    if (!fd_arg(vm, args[0], &fd)) {
+        return MK_NIL_VAL;
+    }
+    int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            native_err(vm, "Unable to accept on fd %d: %s", fd, strerror(errno));
+        }
+        return MK_NIL_VAL;
+    }
+    if (!set_nonblocking(vm, conn)) {
+        close(conn);
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(conn);
+}
+
+static Val read_fd_native(VmState* vm, int argc, Val* args) {
+    int fd;
+    if (!fd_arg(vm, args[0], &fd)) {
+        return MK_NIL_VAL;
+    }
+    char* buf = REALLOC_ARR(char, NULL, LOOP_READ_SIZE + 1);
+    ssize_t n;
+    do {
+        n = read(fd, buf, LOOP_READ_SIZE);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        free(buf);
+        if (n == 0) {
+            return MK_NIL_VAL;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return MK_OBJ_VAL((Obj*)cp_str(vm, "", 0));
+        }
+        native_err(vm, "Unable to read fd %d: %s", fd, strerror(errno));
+        return MK_NIL_VAL;
+    }
+    buf = REALLOC_ARR(char, buf, n + 1);
+    buf[n] = '\0';
+    return MK_OBJ_VAL((Obj*)take_str(vm, buf, (int)n));
+}
+
+static Val write_fd_native(VmState* vm, int argc, Val* args) {
+    int fd;
+    if (!fd_arg(vm, args[0], &fd)) {
+        return MK_NIL_VAL;
+    }
+    if (!IS_STR(args[1])) {
+        native_err(vm, "Expected a string to write");
+        return MK_NIL_VAL;
+    }
+    ObjStr* str = UNWRAP_STR(args[1]);
+    ssize_t n;
+    do {
+        n = write(fd, str->chars, str->length);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return MK_NUM_VAL(0);
+        }
+        native_err(vm, "Unable to write fd %d: %s", fd, strerror(errno));
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL((double)n);
+}
+
+static Val close_fd_native(VmState* vm, int argc, Val* args) {
+    int fd;
+    if (!fd_arg(vm, args[0], &fd)) {
+        return MK_NIL_VAL;
+    }
+    unwatch(vm, fd);
+    if (close(fd) < 0) {
+        native_err(vm, "Unable to close fd %d: %s", fd, strerror(errno));
+    }
+    return MK_NIL_VAL;
+}
+
+void define_loop_natives(VmState* vm) {
+    define_native(vm, "on_readable", 2, on_readable_native);
+    define_native(vm, "on_writable", 2, on_writable_native);
+    define_native(vm, "unwatch", 1, unwatch_native);
+    define_native(vm, "pipe_fds", 0, pipe_fds_native);
+    define_native(vm, "listen_unix", 1, listen_unix_native);
+    define_native(vm, "connect_unix", 1, connect_unix_native);
+    define_native(vm, "accept_fd", 1, accept_fd_native);
+    define_native(vm, "read_fd", 1, read_fd_native);
+    define_native(vm, "write_fd", 2, write_fd_native);
+    define_native(vm, "close_fd", 1, close_fd_native);
+}
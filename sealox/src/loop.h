@@ -0,0 +1,53 @@
+#ifndef loop_h
+#define loop_h
+
+#include "common.h"
+#include "ops.h"
+
+/*
+ * Event loop of a VM over epoll. Scripts register callbacks for fds with
+ * on_readable(fd, fn) and on_writable(fd, fn), and once the script has
+ * run, run_program keeps calling fn(fd) whenever the fd is ready until no
+ * callbacks are left. Readiness is level triggered, so a callback that
+ * doesn't drain its fd is called again.
+ */
+typedef struct {
+    // nil if the fd isn't watched for the event
+    Val on_read;
+    Val on_write;
+} Watcher;
+
+typedef struct {
+    // -1 until the first fd is watched
+    int epoll_fd;
+    // indexed by fd, the callbacks are roots of the collector
+    Watcher* watchers;
+    int capacity;
+    // fds with at least one callback
+    int count;
+} Loop;
+
+void init_loop(Loop* loop);
+void free_loop(Loop* loop);
+// drop all callbacks, e.g. after a script failed
+void clear_loop(VmState* vm);
+/*
+ * Dispatch callbacks until none are left. A failing callback is reported
+ * like a failing script and drops the remaining callbacks, and then
+ * false is returned. So it is if a callback paused, but the callbacks
+ * are kept then.
+ */
+bool run_loop(VmState* vm);
+
+/*
+ * on_readable, on_writable and unwatch, plus non-blocking fds to watch:
+ * pipe_fds() returns [read end, write end], listen_unix(path) and
+ * connect_unix(path) open local sockets and accept_fd(fd) accepts a
+ * connection, or returns nil if there is none. read_fd(fd) returns the
+ * bytes that are available, "" if there are none yet and nil at the
+ * end. write_fd(fd, str) returns the number of bytes written. close_fd
+ * unwatches the fd before closing it.
+ */
+void define_loop_natives(VmState* vm);
+
+#endif
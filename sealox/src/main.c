@@ -1,9 +1,16 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "vm.h"
+#include "file.h"
+#include "jobs.h"
+#include "aot.h"
+#include "profile.h"
+#include "perfctr.h"
 
-void repl() {
+void repl(VmState* vm) {
     char line[1024];
 
     while(true) {
@@ -13,56 +20,202 @@ void repl() {
             break;
        }
 
-       interpret(line);
+       interpret(vm, line);
     }
 }
 
-char* read_file(const char* file_name) {
-    FILE* file = fopen(file_name, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "Unable to open file \"%s\"\n", file_name);
+bool run_file(VmState* vm, const char* file) {
+    char* program = read_file(file); 
+    if (program == NULL) {
+        fprintf(stderr, "Unable to read file \"%s\"\n", file);
         exit(1);
     }
+    IntrResult result = interpret(vm, program);
+    free(program);
+    return result == INTR_OK;
+}
 
-    fseek(file, 0L, SEEK_END);
-    size_t s = ftell(file);
-    rewind(file);
-
-    char* buffer = (char*)malloc(s + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\"\n", file_name);
+void emit_file(VmState* vm, const char* file) {
+    char* program = read_file(file); 
+    if (program == NULL) {
+        fprintf(stderr, "Unable to read file \"%s\"\n", file);
         exit(1);
     }
-    size_t b_read = fread(buffer, sizeof(char), s, file);
-    if (b_read < s) {
-        fprintf(stderr, "Unable to read file \"%s\"\n", file_name);
+    bool ok = emit_c(vm, program, stdout);
+    free(program);
+
+    if (!ok) {
         exit(1);
     }
-    buffer[b_read] = '\0';
-
-    fclose(file);
-    return buffer;
 }
 
-void run_file(const char* file) {
-    char* program = read_file(file); 
-    IntrResult result = interpret(program);
-    free(program);
+void usage() {
+    fprintf(stderr, "Usage: sealox [--jit=off|on|always] [--jobs N file...] [--emit-c file] [--gc-stats] [--opstats[=table|json]] [--opstats-cycles] [--discard-output] [--profile=file] [--perf] [file]\n");
+    exit(64);
+}
 
-    if (result != INTR_OK) {
-        exit(1);
+JitMode parse_jit_mode(const char* mode) {
+    if (strcmp(mode, "off") == 0) {
+        return JIT_OFF;
+    }
+    if (!jit_supported()) {
+        fprintf(stderr, "The JIT is not supported on this platform\n");
+        exit(64);
+    }
+    if (strcmp(mode, "on") == 0) {
+        return JIT_ON;
+    }
+    if (strcmp(mode, "always") == 0) {
+        return JIT_ALWAYS;
     }
+    usage();
+    return JIT_OFF;
 }
 
 int main(int argc, const char* argv[]) {
-    init_vm();
+    int n_jobs = 0;
+    JitMode jit_mode = default_jit_mode();
+    bool emit = false;
+    bool gc_stats = false;
+    bool discard_output = false;
+    const char* profile_path = NULL;
+    // NULL, "table" or "json"
+    const char* opstats = NULL;
+    bool opstats_cycles = false;
+    bool jit_set = false;
+    bool perf = false;
+
+    int i_arg = 1;
+    for (; i_arg < argc && strncmp(argv[i_arg], "--", 2) == 0; i_arg++) {
+        if (strcmp(argv[i_arg], "--jobs") == 0 && i_arg + 1 < argc) {
+            n_jobs = atoi(argv[++i_arg]);
+            if (n_jobs < 1) {
+                usage();
+            }
+        } else if (strcmp(argv[i_arg], "--emit-c") == 0) {
+            emit = true;
+        } else if (strcmp(argv[i_arg], "--gc-stats") == 0) {
+            gc_stats = true;
+        } else if (strcmp(argv[i_arg], "--opstats") == 0) {
+            opstats = "table";
+        } else if (strncmp(argv[i_arg], "--opstats=", 10) == 0) {
+            opstats = argv[i_arg] + 10;
+            if (strcmp(opstats, "table") != 0 && strcmp(opstats, "json") != 0) {
+                usage();
+            }
+        } else if (strcmp(argv[i_arg], "--opstats-cycles") == 0) {
+            opstats_cycles = true;
+        } else if (strcmp(argv[i_arg], "--perf") == 0) {
+            perf = true;
+        } else if (strcmp(argv[i_arg], "--discard-output") == 0) {
+            discard_output = true;
+        } else if (strncmp(argv[i_arg], "--profile=", 10) == 0) {
+            profile_path = argv[i_arg] + 10;
+        } else if (strncmp(argv[i_arg], "--jit=", 6) == 0) {
+            jit_mode = parse_jit_mode(argv[i_arg] + 6);
+            jit_set = true;
+        } else {
+            usage();
+        }
+    }
+    int n_files = argc - i_arg;
+
+    if (emit && (n_files != 1 || n_jobs > 0)) {
+        usage();
+    }
+    // the profiler and the counters sample one VM, on the main thread, with the same timer
+    if ((profile_path != NULL || perf) && (emit || n_jobs > 0)) {
+        usage();
+    }
+    if (profile_path != NULL && perf) {
+        usage();
+    }
+    if (opstats_cycles && opstats == NULL) {
+        opstats = "table";
+    }
+    if (opstats != NULL) {
+        if (emit || n_jobs > 0) {
+            usage();
+        }
+        // compiled code doesn't count its ops
+        if (!jit_set) {
+            jit_mode = JIT_OFF;
+        }
+    }
+
+    if (n_jobs > 0) {
+        if (n_files == 0) {
+            usage();
+        }
+        return run_jobs(n_jobs, jit_mode, argv + i_arg, n_files) ? 0 : 1;
+    }
+
+    VmState vm;
+    init_vm(&vm);
+    vm.jit_mode = jit_mode;
+#ifdef DEBUG_VM
+    // the trace goes through stdio, so the output has to as well
+    bool to_fd = false;
+#else
+    bool to_fd = n_files > 0 && !emit;
+#endif
+    if (discard_output) {
+        sink_free(&vm.sink);
+        sink_init_null(&vm.sink);
+    } else if (to_fd) {
+        sink_free(&vm.sink);
+        sink_init_fd(&vm.sink, STDOUT_FILENO);
+    }
+
+    if (opstats != NULL) {
+        start_opstats(&vm, opstats_cycles);
+    }
+
+    FILE* profile_out = NULL;
+    if (profile_path != NULL) {
+        profile_out = fopen(profile_path, "w");
+        if (profile_out == NULL || !start_profile(&vm, PROFILE_HZ)) {
+            fprintf(stderr, "Unable to profile to \"%s\"\n", profile_path);
+            exit(1);
+        }
+    }
 
-    if (argc > 1) {
-        run_file(argv[1]);
+    if (perf && !start_perfctr(&vm, PERFCTR_HZ)) {
+        fprintf(stderr, "Unable to open performance counters: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    bool ok = true;
+    if (emit) {
+        emit_file(&vm, argv[i_arg]);
+    } else if (n_files > 0) {
+        ok = run_file(&vm, argv[i_arg]);
     } else {
-        repl();
+        repl(&vm);
+    }
+
+    if (perf) {
+        stop_perfctr();
+        print_perfctr(&vm, stderr);
+    }
+    if (profile_out != NULL) {
+        stop_profile();
+        if (!write_profile(&vm, profile_out)) {
+            fprintf(stderr, "Unable to write the profile to \"%s\"\n", profile_path);
+            ok = false;
+        }
+        fclose(profile_out);
+    }
+
+    if (gc_stats) {
+        print_gc_stats(&vm, stderr);
+    }
+    if (opstats != NULL && strcmp(opstats, "json") == 0) {
+        write_opstats_json(&vm, stderr);
+    } else if (opstats != NULL) {
+        print_opstats(&vm, stderr);
     }
 
-    free_vm();
-    return 0;
+    free_vm(&vm);
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,67 @@
+#include "map.h"
+#include "array.h"
+#include "memory.h"
+#include "vm.h"
+
+static bool map_args(VmState* vm, Val map, Val key) {
+    if (!IS_MAP(map)) {
+        native_err(vm, "Expected a map");
+        return false;
+    }
+    if (!is_hashable(key)) {
+        native_err(vm, "Map keys must be numbers, strings, booleans or nil");
+        return false;
+    }
+    return true;
+}
+
+static Val map_native(VmState* vm, int argc, Val* args) {
+    return MK_OBJ_VAL((Obj*)create_map(vm));
+}
+
+static Val has_native(VmState* vm, int argc, Val* args) {
+    if (!map_args(vm, args[0], args[1])) {
+        return MK_NIL_VAL;
+    }
+    Val val;
+    return MK_BOOL_VAL(vdict_get(&UNWRAP_MAP(args[0])->dict, args[1], &val));
+}
+
+static Val delete_native(VmState* vm, int argc, Val* args) {
+    if (!map_args(vm, args[0], args[1])) {
+        return MK_NIL_VAL;
+    }
+    return MK_BOOL_VAL(vdict_del(&UNWRAP_MAP(args[0])->dict, args[1]));
+}
+
+static Val entries_of(VmState* vm, Val map, bool keys) {
+    if (!IS_MAP(map)) {
+        native_err(vm, "Expected a map");
+        return MK_NIL_VAL;
+    }
+    ValDict* dict = &UNWRAP_MAP(map)->dict;
+    ObjArray* array = create_array(vm);
+    for (int i = 0; i < dict->capacity; i++) {
+        ValDictEntry* entry = &dict->entries[i];
+        if (entry->live) {
+            append_val(&array->vals, keys ? entry->key : entry->val);
+        }
+    }
+    return MK_OBJ_VAL((Obj*)array);
+}
+
+static Val keys_native(VmState* vm, int argc, Val* args) {
+    return entries_of(vm, args[0], true);
+}
+
+static Val values_native(VmState* vm, int argc, Val* args) {
+    return entries_of(vm, args[0], false);
+}
+
+void define_map_natives(VmState* vm) {
+    define_native(vm, "Map", 0, map_native);
+    define_native(vm, "has", 2, has_native);
+    define_native(vm, "delete", 2, delete_native);
+    define_native(vm, "keys", 1, keys_native);
+    define_native(vm, "values", 1, values_native);
+}
@@ -0,0 +1,26 @@
+#ifndef map_h
+#define map_h
+
+#include "common.h"
+#include "ops.h"
+#include "dict.h"
+
+/*
+ * Hash map of the scripts. m[key] reads and writes entries, where a
+ * missing key reads as nil. The natives cover the rest.
+ */
+typedef struct {
+    Obj obj;
+    ValDict dict;
+} ObjMap;
+
+#define IS_MAP(v) is_obj_type(v, OBJ_MAP)
+#define UNWRAP_MAP(v) ((ObjMap*)(UNWRAP_OBJ(v)))
+
+/*
+ * Map, has, delete, keys and values. keys and values return arrays in
+ * the same, unspecified order.
+ */
+void define_map_natives(VmState* vm);
+
+#endif
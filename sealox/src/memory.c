@@ -1,7 +1,10 @@
 #include <string.h>
+#include <sys/mman.h>
 #include "memory.h"
 #include "vm.h"
 #include "dict.h"
+#include "jit.h"
+#include "profile.h"
 
 void* realloc_arr(void* ptr, size_t new_cap) {
     if (new_cap == 0) {
@@ -15,26 +18,39 @@ void* realloc_arr(void* ptr, size_t new_cap) {
     return new_ptr;
 }
 
-Obj* allocate_obj (size_t size, ObjType type, bool with_gc) {
-    Obj* obj = (Obj*)realloc_arr(NULL, size);
-    obj->type = type;
-
-    if (with_gc) {
-        // append to VM state for garbage collection
-        obj->next = vm.objects;
-        vm.objects = obj;
+/*
+ * The payload is the size of what the object owns besides itself, for
+ * the pacing of the collector.
+ */
+static Obj* allocate_obj(VmState* vm, size_t size, size_t payload, ObjType type) {
+    if (vm == NULL) {
+        Obj* obj = (Obj*)realloc_arr(NULL, size);
+        obj->type = type;
+        obj->mark = false;
+        obj->gen = 0;
+        obj->cell = 0;
+        obj->next = NULL;
+        return obj;
     }
 
+    VmPhase phase = vm->phase;
+    vm->phase = PHASE_ALLOC;
+    gc_alloc_step(vm, size + payload);
+    Obj* obj = gc_alloc_cell(vm, size);
+    obj->type = type;
+    // link to the VM state for garbage collection
+    gc_adopt(vm, obj);
+    vm->phase = phase;
     return obj;
 }
 
-#define ALLOCATE_OBJ(type, otype) \
-    (type*)allocate_obj(sizeof(type), otype, true)
+#define ALLOCATE_OBJ(vm, type, otype) \
+    (type*)allocate_obj(vm, sizeof(type), 0, otype)
 
 #define ALLOCATE_OBJ_NO_GC(type, otype) \
-    (type*)allocate_obj(sizeof(type), otype, false)
+    (type*)allocate_obj(NULL, sizeof(type), 0, otype)
 
-static uint32_t calc_str_hash(const char* start, int length) {
+uint32_t calc_str_hash(const char* start, int length) {
     // FNV-1a
     uint32_t hash = 2166136261u;
     for (int i = 0; i < length; i++) {
@@ -44,113 +60,206 @@ static uint32_t calc_str_hash(const char* start, int length) {
     return hash;
 }
 
-ObjStr* alloc_str(char* start, int length, uint32_t hash) {
-    ObjStr* str = ALLOCATE_OBJ(ObjStr, OBJ_STR);
+static ObjStr* alloc_str(VmState* vm, char* start, int length, uint32_t hash) {
+    ObjStr* str = (ObjStr*)allocate_obj(vm, sizeof(ObjStr), length + 1, OBJ_STR);
     str->length = length;
     str->chars = start;
+    str->owner = NULL;
     str->hash = hash;
-
-    // store for deduplication
-    dict_put(&vm.strings, str, MK_NIL_VAL);
-
+    str->interned = false;
     return str;
 }
 
-ObjStr* take_str(char* start, int length) {
+ObjStr* take_str(VmState* vm, char* start, int length) {
+    return alloc_str(vm, start, length, 0);
+}
+
+ObjStr* cp_str(VmState* vm, const char* start, int length) {
     uint32_t hash = calc_str_hash(start, length);
-    ObjStr* interned = dict_get_str(&vm.strings, start, length, hash);
+    ObjStr* interned = dict_get_str(&vm->strings, start, length, hash);
 
     if (interned != NULL) {
-        free(start);
+        gc_revive(vm, interned);
         return interned;
     }
 
-    return alloc_str(start, length, hash);
+    char* new_str = REALLOC_ARR(char, NULL, length + 1);
+    memcpy(new_str, start, length);
+    new_str[length] = '\0';
+    ObjStr* str = alloc_str(vm, new_str, length, hash);
+    // store for deduplication
+    str->interned = true;
+    dict_put(&vm->strings, str, MK_NIL_VAL);
+    return str;
 }
 
-ObjStr* cp_str(const char* start, int length) {
-    uint32_t hash = calc_str_hash(start, length);
-    ObjStr* interned = dict_get_str(&vm.strings, start, length, hash);
+ObjStr* view_str(VmState* vm, Obj* owner, const char* start, int length) {
+    if (length < STR_SLICE_MIN) {
+        char* chars = REALLOC_ARR(char, NULL, length + 1);
+        memcpy(chars, start, length);
+        chars[length] = '\0';
+        return take_str(vm, chars, length);
+    }
+    ObjStr* view = (ObjStr*)allocate_obj(vm, sizeof(ObjStr), 0, OBJ_STR);
+    view->length = length;
+    view->chars = (char*)start;
+    view->owner = owner;
+    view->hash = 0;
+    view->interned = false;
+    return view;
+}
 
+ObjStr* slice_str(VmState* vm, ObjStr* str, int start, int length) {
+    Obj* owner = str->owner != NULL ? str->owner : (Obj*)str;
+    return view_str(vm, owner, str->chars + start, length);
+}
+
+ObjStr* intern_str(VmState* vm, ObjStr* str) {
+    if (str->interned) {
+        return str;
+    }
+    ObjStr* interned = dict_get_str(&vm->strings, str->chars, str->length, str_hash(str));
     if (interned != NULL) {
+        gc_revive(vm, interned);
         return interned;
     }
-
-    char* new_str = REALLOC_ARR(char, NULL, length + 1);
-    memcpy(new_str, start, length);
-    new_str[length] = '\0';
-    return alloc_str(new_str, length, hash);
+    if (str->owner != NULL) {
+        // the table outlives the owner, so the slice gets chars of its own
+        char* chars = REALLOC_ARR(char, NULL, str->length + 1);
+        memcpy(chars, str->chars, str->length);
+        chars[str->length] = '\0';
+        str->chars = chars;
+        str->owner = NULL;
+    }
+    str->interned = true;
+    dict_put(&vm->strings, str, MK_NIL_VAL);
+    return str;
 }
 
-void free_object(Obj* obj) {
+void free_object(VmState* vm, Obj* obj) {
     switch(obj->type) {
         case OBJ_STR: {
             ObjStr* str = (ObjStr*)obj;
-            free(str->chars);
-            free(str);
+            if (str->owner == NULL) {
+                free(str->chars);
+            }
             break;                        
         }
         case OBJ_FUNC: {
+            // the name is a string object, so it is freed on its own
             ObjFunc* fn = (ObjFunc*)obj;
-            free(fn->name);
+            jit_free(fn);
             free_ops(&fn->ops);
-            free(fn);
             break;
         }
-        case OBJ_NATIVE: {
-            ObjNative* nat = (ObjNative*)obj;
-            free(nat);
+        case OBJ_NATIVE:
             break;
-        }
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)obj;
             free(closure->upvalues);
-            free(closure);
             break;
         }
-        case OBJ_UPVALUE: {
-            ObjUpvalue* upvalue = (ObjUpvalue*)obj;
-            free(upvalue);
+        case OBJ_UPVALUE:
+            break;
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)obj;
+            dict_free(&klass->methods);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* inst = (ObjInstance*)obj;
+            free(inst->fields);
+            break;
+        }
+        case OBJ_BOUND_METHOD:
+            break;
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)obj;
+            dict_free(&shape->slots);
+            dict_free(&shape->transitions);
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)obj;
+            free_vals(&array->vals);
+            break;
+        }
+        case OBJ_FLOAT_ARRAY: {
+            ObjFloatArray* array = (ObjFloatArray*)obj;
+            free(array->data);
+            break;
+        }
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)obj;
+            vdict_free(&map->dict);
+            break;
+        }
+        case OBJ_LINES: {
+            ObjLines* lines = (ObjLines*)obj;
+            if (lines->data != NULL) {
+                munmap(lines->data, lines->size);
+            }
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)obj;
+            free(fiber->stack);
+            free(fiber->frames);
             break;
         }
     }
+    gc_free_cell(vm, obj);
+}
+
+void free_objects(VmState* vm) {
+    free_objects_until(vm, NULL);
 }
 
-void free_objects() {
-    Obj* obj = vm.objects;
-    while(obj != NULL) {
+void free_objects_until(VmState* vm, Obj* base) {
+    Obj* obj = vm->objects;
+    while(obj != base) {
         Obj* next = obj->next;
-        free_object(obj);
+        free_object(vm, obj);
         obj = next;
     }
+    vm->objects = base;
 }
 
 ObjStr* alloc_str_no_gc(char* start, int length) {
     ObjStr* str = ALLOCATE_OBJ_NO_GC(ObjStr, OBJ_STR);
     str->length = length;
     str->chars = start;
+    str->owner = NULL;
     str->hash = calc_str_hash(start, length);
+    str->interned = false;
 
     return str;
 }
 
-ObjFunc* create_func() {
-    ObjFunc* fn = (ObjFunc*)ALLOCATE_OBJ(ObjFunc, OBJ_FUNC);
+ObjFunc* create_func(VmState* vm) {
+    ObjFunc* fn = (ObjFunc*)ALLOCATE_OBJ(vm, ObjFunc, OBJ_FUNC);
     fn->arity = 0;
     fn->name = NULL;
     fn->upvalue_count = 0;
+    fn->hotness = 0;
+    fn->calls = 0;
+    fn->jit = NULL;
+    fn->jit_failed = false;
+    fn->aot = NULL;
     init_ops(&fn->ops);
+    profile_keep_fn(vm, fn);
     return fn;
 }
 
-ObjNative* create_native_func(NativeFn fn) {
-    ObjNative* nat = (ObjNative*)ALLOCATE_OBJ(ObjNative, OBJ_NATIVE); 
+ObjNative* create_native_func(VmState* vm, NativeFn fn, int arity) {
+    ObjNative* nat = (ObjNative*)ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE); 
     nat->fn = fn;
+    nat->arity = arity;
     return nat;
 }
 
-ObjClosure* create_closure(ObjFunc* fn) {
-    ObjClosure* closure = (ObjClosure*)ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE); 
+ObjClosure* create_closure(VmState* vm, ObjFunc* fn) {
+    ObjClosure* closure = (ObjClosure*)ALLOCATE_OBJ(vm, ObjClosure, OBJ_CLOSURE); 
     closure->fn = fn;
 
     ObjUpvalue** upvalues = REALLOC_ARR(ObjUpvalue*, NULL, fn->upvalue_count);
@@ -163,8 +272,100 @@ ObjClosure* create_closure(ObjFunc* fn) {
     return closure;
 }
 
-ObjUpvalue* create_upvalue(Val* slot) {
-    ObjUpvalue* upvalue = (ObjUpvalue*)ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE); 
+ObjUpvalue* create_upvalue(VmState* vm, Val* slot) {
+    ObjUpvalue* upvalue = (ObjUpvalue*)ALLOCATE_OBJ(vm, ObjUpvalue, OBJ_UPVALUE); 
     upvalue->slot = slot;
+    upvalue->closed = MK_NIL_VAL;
+    upvalue->next = NULL;
     return upvalue;
 }
+
+ObjClass* create_class(VmState* vm, ObjStr* name) {
+    ObjClass* klass = (ObjClass*)ALLOCATE_OBJ(vm, ObjClass, OBJ_CLASS);
+    klass->name = name;
+    klass->init = NULL;
+    klass->shape = NULL;
+    dict_init(&klass->methods);
+
+    // push / pop to make sure GC picks up the class while the shape is allocated
+    push_val(vm, MK_OBJ_VAL((Obj*)klass));
+    klass->shape = create_shape(vm, klass);
+    // the class may have been tenured meanwhile
+    GC_BARRIER_OBJ(vm, klass, klass->shape);
+    pop_val(vm);
+    return klass;
+}
+
+ObjInstance* create_instance(VmState* vm, ObjClass* klass) {
+    ObjInstance* inst = (ObjInstance*)ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
+    inst->klass = klass;
+    inst->shape = klass->shape;
+    inst->fields = NULL;
+    inst->capacity = 0;
+    return inst;
+}
+
+ObjBoundMethod* create_bound_method(VmState* vm, Val receiver, ObjClosure* method) {
+    ObjBoundMethod* bound = (ObjBoundMethod*)ALLOCATE_OBJ(vm, ObjBoundMethod, OBJ_BOUND_METHOD);
+    bound->receiver = receiver;
+    bound->method = method;
+    return bound;
+}
+
+ObjShape* create_shape(VmState* vm, ObjClass* klass) {
+    ObjShape* shape = (ObjShape*)ALLOCATE_OBJ(vm, ObjShape, OBJ_SHAPE);
+    shape->klass = klass;
+    shape->field_count = 0;
+    dict_init(&shape->slots);
+    dict_init(&shape->transitions);
+    return shape;
+}
+
+ObjArray* create_array(VmState* vm) {
+    ObjArray* array = ALLOCATE_OBJ(vm, ObjArray, OBJ_ARRAY);
+    init_vals(&array->vals);
+    return array;
+}
+
+ObjFloatArray* create_float_array(VmState* vm, int count) {
+    ObjFloatArray* array = (ObjFloatArray*)allocate_obj(vm, sizeof(ObjFloatArray),
+                                                        count * sizeof(double), OBJ_FLOAT_ARRAY);
+    array->count = count;
+    array->data = count > 0 ? (double*)calloc(count, sizeof(double)) : NULL;
+    if (count > 0 && array->data == NULL) {
+        exit(1);
+    }
+    return array;
+}
+
+ObjMap* create_map(VmState* vm) {
+    ObjMap* map = ALLOCATE_OBJ(vm, ObjMap, OBJ_MAP);
+    vdict_init(&map->dict);
+    return map;
+}
+
+ObjLines* create_lines(VmState* vm, char* data, size_t size) {
+    ObjLines* lines = ALLOCATE_OBJ(vm, ObjLines, OBJ_LINES);
+    lines->data = data;
+    lines->size = size;
+    lines->pos = 0;
+    lines->released = 0;
+    return lines;
+}
+
+ObjFiber* create_fiber(VmState* vm, int max_frames) {
+    size_t stack_size = (size_t)max_frames * UINT8_COUNT;
+    ObjFiber* fiber = (ObjFiber*)allocate_obj(vm, sizeof(ObjFiber),
+                                              stack_size * sizeof(Val) + max_frames * sizeof(CallFrame), OBJ_FIBER);
+    fiber->stack = REALLOC_ARR(Val, NULL, stack_size);
+    fiber->top = fiber->stack;
+    fiber->frames = REALLOC_ARR(CallFrame, NULL, max_frames);
+    fiber->frame_count = 0;
+    fiber->max_frames = max_frames;
+    fiber->open_upvalues = NULL;
+    fiber->state = FIBER_NEW;
+    fiber->resumer = NULL;
+    fiber->next = NULL;
+    fiber->queued = false;
+    return fiber;
+}
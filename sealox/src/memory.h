@@ -4,6 +4,11 @@
 #include "common.h"
 #include "stdlib.h"
 #include "ops.h"
+#include "class.h"
+#include "array.h"
+#include "map.h"
+#include "io.h"
+#include "fiber.h"
 
 #define DEFAULT_CAP 8
 #define CALC_CAP(cap) \
@@ -14,19 +19,65 @@
 
 void* realloc_arr(void* ptr, size_t new_cap);
 
-ObjStr* take_str(char* start, int length);
-ObjStr* cp_str(const char* start, int length);
+// shorter slices are copied
+#define STR_SLICE_MIN 16
+
+uint32_t calc_str_hash(const char* start, int length);
+
+/*
+ * Runtime strings, e.g. the results of concatenation, are neither hashed
+ * nor interned until something needs it. take_str creates such a string
+ * from chars it takes ownership of, cp_str an interned copy.
+ */
+ObjStr* take_str(VmState* vm, char* start, int length);
+ObjStr* cp_str(VmState* vm, const char* start, int length);
+/*
+ * The chars [start, start + length) of str, which share its bytes unless
+ * the slice is shorter than STR_SLICE_MIN, as copying those is cheaper
+ * than keeping the parent around.
+ */
+ObjStr* slice_str(VmState* vm, ObjStr* str, int start, int length);
+// the same for chars in memory that owner keeps alive
+ObjStr* view_str(VmState* vm, Obj* owner, const char* start, int length);
+// the interned string equal to str, which may be str itself
+ObjStr* intern_str(VmState* vm, ObjStr* str);
+
+static inline uint32_t str_hash(ObjStr* str) {
+    if (str->hash == 0) {
+        str->hash = calc_str_hash(str->chars, str->length);
+    }
+    return str->hash;
+}
 
 /*
  * Primarily for testing. Create a string object without modifying and GC state
  */
 ObjStr* alloc_str_no_gc(char* start, int length);
 
-void free_objects();
+// free a single object, which is no longer on any list of the VM
+void free_object(VmState* vm, Obj* obj);
+void free_objects(VmState* vm);
+/*
+ * Free the objects allocated after base. Objects are prepended to
+ * the VM object list, so base is where the older objects start.
+ */
+void free_objects_until(VmState* vm, Obj* base);
 
-ObjFunc* create_func();
-ObjNative* create_native_func(NativeFn fn);
-ObjClosure* create_closure(ObjFunc* fn);
-ObjUpvalue* create_upvalue(Val* slot);
+ObjFunc* create_func(VmState* vm);
+ObjNative* create_native_func(VmState* vm, NativeFn fn, int arity);
+ObjClosure* create_closure(VmState* vm, ObjFunc* fn);
+ObjUpvalue* create_upvalue(VmState* vm, Val* slot);
+ObjClass* create_class(VmState* vm, ObjStr* name);
+ObjInstance* create_instance(VmState* vm, ObjClass* klass);
+ObjBoundMethod* create_bound_method(VmState* vm, Val receiver, ObjClosure* method);
+ObjShape* create_shape(VmState* vm, ObjClass* klass);
+ObjArray* create_array(VmState* vm);
+// zero filled
+ObjFloatArray* create_float_array(VmState* vm, int count);
+ObjMap* create_map(VmState* vm);
+// takes over the mapping of data, which is NULL if size is 0
+ObjLines* create_lines(VmState* vm, char* data, size_t size);
+// a fiber with room for max_frames frames and nothing on its stack
+ObjFiber* create_fiber(VmState* vm, int max_frames);
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef num_h
+#define num_h
+
+#include "common.h"
+
+// big enough for any output of num_to_str
+#define NUM_BUF_SIZE 32
+
+/*
+ * Format num like printf("%g") in the C locale, i.e. with 6 significant
+ * digits. Small integers are written directly, other normal numbers get
+ * their 6 digits from counted Grisu, and the numbers it can't round for
+ * sure, as well as zeros, subnormals, infinities and NaNs, go through
+ * snprintf. Returns the length.
+ */
+int num_to_str(double num, char* buf);
+/*
+ * Parse [-]digits[.digits][(e|E)[+|-]digits], correctly rounded like
+ * strtod in the C locale. Returns false unless all of the chars form a
+ * number.
+ */
+bool str_to_num(const char* start, int length, double* num);
+
+#endif
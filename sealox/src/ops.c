@@ -6,6 +6,12 @@ void init_ops(Ops* ops) {
     ops->capacity = 0;
     ops->ops = NULL;
     ops->lines = NULL;
+    ops->call_caches = NULL;
+    ops->call_cache_count = 0;
+    ops->call_cache_capacity = 0;
+    ops->prop_caches = NULL;
+    ops->prop_cache_count = 0;
+    ops->prop_cache_capacity = 0;
     init_vals(&ops->constants);
 }
 
@@ -13,6 +19,8 @@ void free_ops(Ops* ops) {
     free(ops->ops);
     free_vals(&ops->constants);
     free(ops->lines);
+    free(ops->call_caches);
+    free(ops->prop_caches);
     init_ops(ops);
 }
 
@@ -53,3 +61,61 @@ int append_const(Ops* ops, Val val) {
     return ops->constants.count - 1;
 }
 
+int op_length(Ops* ops, int pos) {
+    switch (ops->ops[pos]) {
+        case OP_CONST:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_GET_SUPER:
+        case OP_ARRAY:
+            return 2;
+        case OP_SUPER_INVOKE:
+        case OP_JMP_IF_FALSE:
+        case OP_JMP:
+        case OP_LOOP:
+            return 3;
+        case OP_CALL:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return 4;
+        case OP_INVOKE:
+            return 5;
+        case OP_CLOSURE: {
+            // one pair of bytes per captured variable
+            ObjFunc* fn = UNWRAP_FUNC(ops->constants.vals[ops->ops[pos + 1]]);
+            return 2 + 2 * fn->upvalue_count;
+        }
+        default:
+            return 1;
+    }
+}
+
+int append_call_cache(Ops* ops) {
+    if (ops->call_cache_count + 1 > ops->call_cache_capacity) {
+        ops->call_cache_capacity = CALC_CAP(ops->call_cache_capacity);
+        ops->call_caches = REALLOC_ARR(CallCache, ops->call_caches, ops->call_cache_capacity);
+    }
+    ops->call_caches[ops->call_cache_count].closure = NULL;
+    ops->call_caches[ops->call_cache_count].native = NULL;
+    return ops->call_cache_count++;
+}
+
+int append_prop_cache(Ops* ops) {
+    if (ops->prop_cache_count + 1 > ops->prop_cache_capacity) {
+        ops->prop_cache_capacity = CALC_CAP(ops->prop_cache_capacity);
+        ops->prop_caches = REALLOC_ARR(PropCache, ops->prop_caches, ops->prop_cache_capacity);
+    }
+    PropCache* cache = &ops->prop_caches[ops->prop_cache_count];
+    cache->shape = NULL;
+    cache->next_shape = NULL;
+    cache->slot = -1;
+    cache->method = NULL;
+    return ops->prop_cache_count++;
+}
@@ -32,26 +32,73 @@ typedef enum {
     OP_CLOSURE,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
+    OP_CLOSE_UPVALUE,
+    OP_CLASS,
+    OP_INHERIT,
+    OP_METHOD,
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
+    OP_INVOKE,
+    OP_GET_SUPER,
+    OP_SUPER_INVOKE,
+    OP_ARRAY,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    // quickened ops, only written by the VM at runtime
+    OP_ADD_NUM,
+    OP_ADD_STR,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_LESS_NUM,
+    OP_GREATER_NUM,
 } OpCode;
 
+// keep it after the last op
+#define OP_COUNT (OP_GREATER_NUM + 1)
+
 typedef enum {
     OBJ_STR,
     OBJ_FUNC,
     OBJ_NATIVE,
     OBJ_CLOSURE,
     OBJ_UPVALUE,
+    OBJ_CLASS,
+    OBJ_INSTANCE,
+    OBJ_BOUND_METHOD,
+    OBJ_SHAPE,
+    OBJ_ARRAY,
+    OBJ_FLOAT_ARRAY,
+    OBJ_MAP,
+    OBJ_LINES,
+    OBJ_FIBER,
 } ObjType;
 
 typedef struct Obj {
     ObjType type; 
+    // reached by the current cycle if equal to the mark of the collector
+    bool mark;
+    // GEN_* flags of the generational collector
+    uint8_t gen;
+    // size class of the cell holding the object, 0 if it was malloced
+    uint8_t cell;
     struct Obj* next;
 } Obj;
 
-typedef struct {
+/*
+ * The chars of a slice point into the memory of its owner, and are not
+ * null terminated. The owner is a string that is no slice itself, or the
+ * mapped file of a line reader (see io.h).
+ */
+typedef struct ObjStr {
     Obj obj;
     int length;
     char* chars;
+    struct Obj* owner;
+    // 0 until computed, see str_hash
     uint32_t hash;
+    // interned strings are equal only by reference
+    bool interned;
 } ObjStr;
 
 typedef enum {
@@ -108,39 +155,84 @@ typedef struct {
     Val* vals;
 } Vals;
 
+/*
+ * Inline cache of a call site. Remembers the last closure or native
+ * that was called with a matching number of arguments.
+ */
+typedef struct {
+    struct ObjClosure* closure;
+    struct ObjNative* native;
+} CallCache;
+
+/*
+ * Inline cache of a property site, keyed by the shape of the instance.
+ * It remembers the index of a field, or a method if slot is -1. Stores
+ * that add a field also remember the shape after the add.
+ */
+typedef struct {
+    struct ObjShape* shape;
+    struct ObjShape* next_shape;
+    int slot;
+    struct ObjClosure* method;
+} PropCache;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* ops;
     Vals constants;
     int* lines;
+    CallCache* call_caches;
+    int call_cache_count;
+    int call_cache_capacity;
+    PropCache* prop_caches;
+    int prop_cache_count;
+    int prop_cache_capacity;
 } Ops;
 
+typedef struct VmState VmState;
+
 typedef struct {
     Obj obj;
     int arity;
     Ops ops;
     ObjStr* name;
     int upvalue_count;
+    // calls and loop iterations, compiled to native code when hot
+    int hotness;
+    // while the VM counts calls, see opstats.h
+    uint64_t calls;
+    struct JitCode* jit;
+    bool jit_failed;
+    // ahead of time compiled code, see aot.h
+    bool (*aot)(VmState* vm);
 } ObjFunc;
 
+/*
+ * An upvalue points into the VM stack while the variable is in scope.
+ * When it goes out of scope, the value is moved into the upvalue itself.
+ */
 typedef struct ObjUpvalue {
     Obj obj;
     Val* slot;
+    Val closed;
+    // open upvalues of the VM, sorted by stack slot
+    struct ObjUpvalue* next;
 } ObjUpvalue;
 
-typedef struct {
+typedef struct ObjClosure {
     Obj obj;
     ObjFunc* fn;
     ObjUpvalue** upvalues;
     int upvalue_count;
 } ObjClosure;
 
-typedef Val (*NativeFn)(int argc, Val* args);
+typedef Val (*NativeFn)(VmState* vm, int argc, Val* args);
 
-typedef struct {
+typedef struct ObjNative {
     Obj obj;
     NativeFn fn;
+    int arity; // -1 accepts any number of arguments
 } ObjNative;
 
 void init_ops(Ops* ops);
@@ -152,5 +244,11 @@ void free_vals(Vals* vals);
 void append_val(Vals* vals, Val val);
 
 int append_const(Ops* ops, Val val);
+int append_call_cache(Ops* ops);
+int append_prop_cache(Ops* ops);
+/*
+ * Length in bytes of the instruction at pos, including its operands.
+ */
+int op_length(Ops* ops, int pos);
 
 #endif
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "opstats.h"
+#include "vm.h"
+#include "dev.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// functions in the table, the JSON has all
+#define OPSTATS_TABLE_FNS 20
+
+typedef struct {
+    ObjFunc** fns;
+    int count;
+    int capacity;
+} CalledFns;
+
+// time stamp counter where there is one, else ns
+static inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void count_op(OpStats* stats, uint8_t op) {
+    stats->counts[op]++;
+    if (stats->timing) {
+        uint64_t now = read_cycles();
+        if (stats->last_op >= 0) {
+            stats->cycles[stats->last_op] += now - stats->last_cycles;
+        }
+        stats->last_op = op;
+        stats->last_cycles = now;
+    }
+}
+
+static void reset_calls(Obj* obj) {
+    for (; obj != NULL; obj = obj->next) {
+        if (obj->type == OBJ_FUNC) {
+            ((ObjFunc*)obj)->calls = 0;
+        }
+    }
+}
+
+void start_opstats(VmState* vm, bool timing) {
+    if (vm->opstats == NULL) {
+        vm->opstats = (OpStats*)malloc(sizeof(OpStats));
+    }
+    memset(vm->opstats, 0, sizeof(OpStats));
+    vm->opstats->timing = timing;
+    vm->opstats->last_op = -1;
+    reset_calls(vm->objects);
+    reset_calls(vm->gc.young);
+}
+
+void stop_opstats(VmState* vm) {
+    free(vm->opstats);
+    vm->opstats = NULL;
+}
+
+static void collect_called(Obj* obj, CalledFns* called) {
+    for (; obj != NULL; obj = obj->next) {
+        if (obj->type != OBJ_FUNC || ((ObjFunc*)obj)->calls == 0) {
+            continue;
+        }
+        if (called->count == called->capacity) {
+            called->capacity = called->capacity < 64 ? 64 : called->capacity * 2;
+            called->fns = (ObjFunc**)realloc(called->fns, sizeof(ObjFunc*) * called->capacity);
+        }
+        called->fns[called->count++] = (ObjFunc*)obj;
+    }
+}
+
+static int compare_calls(const void* a, const void* b) {
+    uint64_t x = (*(ObjFunc**)a)->calls;
+    uint64_t y = (*(ObjFunc**)b)->calls;
+    return x > y ? -1 : x < y;
+}
+
+// the most called first
+static CalledFns called_fns(VmState* vm) {
+    CalledFns called = {NULL, 0, 0};
+    collect_called(vm->objects, &called);
+    collect_called(vm->gc.young, &called);
+    if (called.count > 0) {
+        qsort(called.fns, called.count, sizeof(ObjFunc*), compare_calls);
+    }
+    return called;
+}
+
+// the most dispatched first
+static void sort_ops(OpStats* stats, int* ops) {
+    for (int i = 0; i < OP_COUNT; i++) {
+        ops[i] = i;
+    }
+    // insertion sort, it's a few dozen
+    for (int i = 1; i < OP_COUNT; i++) {
+        int op = ops[i];
+        int j = i;
+        for (; j > 0 && stats->counts[ops[j - 1]] < stats->counts[op]; j--) {
+            ops[j] = ops[j - 1];
+        }
+        ops[j] = op;
+    }
+}
+
+static const char* fn_name(ObjFunc* fn) {
+    return fn->name != NULL ? fn->name->chars : "script";
+}
+
+static int fn_line(ObjFunc* fn) {
+    return fn->ops.count > 0 ? fn->ops.lines[0] : 0;
+}
+
+void print_opstats(VmState* vm, FILE* out) {
+    OpStats* stats = vm->opstats;
+    if (stats == NULL) {
+        return;
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < OP_COUNT; i++) {
+        total += stats->counts[i];
+    }
+    int ops[OP_COUNT];
+    sort_ops(stats, ops);
+
+    fprintf(out, "opstats: %llu ops\n", (unsigned long long)total);
+    for (int i = 0; i < OP_COUNT && stats->counts[ops[i]] > 0; i++) {
+        uint64_t count = stats->counts[ops[i]];
+        fprintf(out, "  %-18s %12llu %6.2f%%", op_name(ops[i]),
+                (unsigned long long)count, 100.0 * count / total);
+        if (stats->timing) {
+            fprintf(out, " %14llu cycles %8.1f per op",
+                    (unsigned long long)stats->cycles[ops[i]], (double)stats->cycles[ops[i]] / count);
+        }
+        fprintf(out, "\n");
+    }
+
+    CalledFns called = called_fns(vm);
+    uint64_t calls = 0;
+    for (int i = 0; i < called.count; i++) {
+        calls += called.fns[i]->calls;
+    }
+    fprintf(out, "opstats: %llu calls of %d functions\n", (unsigned long long)calls, called.count);
+    for (int i = 0; i < called.count && i < OPSTATS_TABLE_FNS; i++) {
+        ObjFunc* fn = called.fns[i];
+        char name[64];
+        snprintf(name, sizeof(name), "%s:%d", fn_name(fn), fn_line(fn));
+        fprintf(out, "  %-18s %12llu %6.2f%%\n", name,
+                (unsigned long long)fn->calls, 100.0 * fn->calls / calls);
+    }
+    free(called.fns);
+}
+
+void write_opstats_json(VmState* vm, FILE* out) {
+    OpStats* stats = vm->opstats;
+    if (stats == NULL) {
+        return;
+    }
+    int ops[OP_COUNT];
+    sort_ops(stats, ops);
+
+    fprintf(out, "{\"ops\": [");
+    for (int i = 0; i < OP_COUNT && stats->counts[ops[i]] > 0; i++) {
+        fprintf(out, "%s\n  {\"op\": \"%s\", \"count\": %llu", i > 0 ? "," : "", op_name(ops[i]),
+                (unsigned long long)stats->counts[ops[i]]);
+        if (stats->timing) {
+            fprintf(out, ", \"cycles\": %llu", (unsigned long long)stats->cycles[ops[i]]);
+        }
+        fprintf(out, "}");
+    }
+
+    // names are identifiers, nothing to escape
+    CalledFns called = called_fns(vm);
+    fprintf(out, "],\n\"calls\": [");
+    for (int i = 0; i < called.count; i++) {
+        ObjFunc* fn = called.fns[i];
+        fprintf(out, "%s\n  {\"fn\": \"%s\", \"line\": %d, \"calls\": %llu}", i > 0 ? "," : "",
+                fn_name(fn), fn_line(fn), (unsigned long long)fn->calls);
+    }
+    fprintf(out, "]}\n");
+    free(called.fns);
+}
@@ -0,0 +1,33 @@
+#ifndef opstats_h
+#define opstats_h
+
+#include <stdio.h>
+#include "common.h"
+#include "ops.h"
+
+/*
+ * Counts of the ops that the interpreter dispatched, and optionally the
+ * cycles from the dispatch of each op to the next one, i.e. including the
+ * natives it called and the GC work it did. Ops of compiled code are not
+ * counted, so the numbers are only complete with the JIT off. Calls are
+ * counted per function in every mode, in ObjFunc.calls.
+ */
+typedef struct OpStats {
+    uint64_t counts[OP_COUNT];
+    uint64_t cycles[OP_COUNT];
+    bool timing;
+    // the op being timed, -1 at the start of a run
+    int last_op;
+    uint64_t last_cycles;
+} OpStats;
+
+// before each dispatch, out of line so that it costs run() nothing when off
+void count_op(OpStats* stats, uint8_t op);
+// count from now on, from zero
+void start_opstats(VmState* vm, bool timing);
+void stop_opstats(VmState* vm);
+// ops by count, and the most called functions
+void print_opstats(VmState* vm, FILE* out);
+void write_opstats_json(VmState* vm, FILE* out);
+
+#endif
@@ -0,0 +1,318 @@
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "perfctr.h"
+#include "profile.h"
+
+// top frame pcs told apart, the samples of others go to no function
+#define PERFCTR_PCS 4096
+#define PERFCTR_PROBES 16
+// functions in the table
+#define PERFCTR_TABLE_FNS 20
+
+typedef struct {
+    // NULL if the slot is empty
+    uint8_t* pc;
+    uint64_t counts[CTR_COUNT];
+} PcCounts;
+
+typedef struct {
+    ObjFunc* fn;
+    uint64_t counts[CTR_COUNT];
+    // the count the table is sorted by
+    uint64_t key;
+} FnCounts;
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char* name;
+} counters[CTR_COUNT] = {
+    [CTR_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    [CTR_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    [CTR_CACHE_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    [CTR_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+    [CTR_TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "cpu-ns"},
+};
+
+static const char* phase_names[PHASE_COUNT] = {
+    [PHASE_HOST] = "host",
+    [PHASE_SCAN] = "scan",
+    [PHASE_COMPILE] = "compile",
+    [PHASE_RUN] = "run",
+    [PHASE_ALLOC] = "alloc",
+};
+
+static struct {
+    // the VM being counted, NULL while none is
+    VmState* volatile vm;
+    // -1 for the counters that aren't there
+    int fds[CTR_COUNT];
+    int leader;
+    // the counters in the order a read of the group returns them
+    Counter order[CTR_COUNT];
+    int open_count;
+    uint64_t last[CTR_COUNT];
+    uint64_t samples;
+    uint64_t phases[PHASE_COUNT][CTR_COUNT];
+    PcCounts* pcs;
+    // of the pcs that didn't fit
+    uint64_t other[CTR_COUNT];
+    struct sigaction old_action;
+} ctr = {.leader = -1};
+
+static bool has_counter(Counter counter) {
+    for (int i = 0; i < ctr.open_count; i++) {
+        if (ctr.order[i] == counter) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t* pc_counts(uint8_t* pc) {
+    uint32_t i = (uint32_t)(((uintptr_t)pc * 0x9E3779B97F4A7C15ull) >> 40) & (PERFCTR_PCS - 1);
+    for (int probe = 0; probe < PERFCTR_PROBES; probe++) {
+        PcCounts* slot = &ctr.pcs[i];
+        if (slot->pc == pc) {
+            return slot->counts;
+        }
+        if (slot->pc == NULL) {
+            slot->pc = pc;
+            return slot->counts;
+        }
+        i = (i + 1) & (PERFCTR_PCS - 1);
+    }
+    return ctr.other;
+}
+
+static void add_counts(uint64_t* to, uint64_t* counts) {
+    for (int i = 0; i < CTR_COUNT; i++) {
+        to[i] += counts[i];
+    }
+}
+
+static void on_sigprof(int sig) {
+    VmState* vm = ctr.vm;
+    if (vm == NULL) {
+        return;
+    }
+    int saved_errno = errno;
+    uint64_t group[1 + CTR_COUNT];
+    if (read(ctr.leader, group, sizeof(group)) >= (ssize_t)sizeof(uint64_t)) {
+        uint64_t counts[CTR_COUNT] = {0};
+        for (int i = 0; i < (int)group[0] && i < ctr.open_count; i++) {
+            Counter counter = ctr.order[i];
+            counts[counter] = group[1 + i] - ctr.last[counter];
+            ctr.last[counter] = group[1 + i];
+        }
+        // the frame may be half pushed, so only its pc, and a fiber switch
+        // empties the frames while it swaps the array under them
+        VmPhase phase = vm->phase;
+        add_counts(ctr.phases[phase], counts);
+        CallFrame* frames = vm->frames;
+        int frame_count = vm->frame_count;
+        if ((phase == PHASE_RUN || phase == PHASE_ALLOC) && frame_count > 0) {
+            add_counts(pc_counts(frames[frame_count - 1].pc), counts);
+        }
+        ctr.samples++;
+    }
+    errno = saved_errno;
+}
+
+static void close_counters() {
+    for (int i = 0; i < CTR_COUNT; i++) {
+        if (ctr.fds[i] >= 0) {
+            close(ctr.fds[i]);
+        }
+        ctr.fds[i] = -1;
+    }
+    ctr.leader = -1;
+}
+
+bool start_perfctr(VmState* vm, int hz) {
+    if (ctr.vm != NULL || hz <= 0) {
+        errno = EBUSY;
+        return false;
+    }
+    ctr.open_count = 0;
+    ctr.samples = 0;
+    memset(ctr.last, 0, sizeof(ctr.last));
+    memset(ctr.phases, 0, sizeof(ctr.phases));
+    memset(ctr.other, 0, sizeof(ctr.other));
+
+    int err = 0;
+    for (int i = 0; i < CTR_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        // the group starts once it is complete
+        attr.disabled = ctr.leader == -1;
+        ctr.fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, ctr.leader, 0);
+        if (ctr.fds[i] < 0) {
+            err = err != 0 ? err : errno;
+            continue;
+        }
+        if (ctr.leader == -1) {
+            ctr.leader = ctr.fds[i];
+        }
+        ctr.order[ctr.open_count++] = (Counter)i;
+    }
+    if (ctr.leader == -1) {
+        errno = err;
+        return false;
+    }
+
+    free(ctr.pcs);
+    ctr.pcs = (PcCounts*)calloc(PERFCTR_PCS, sizeof(PcCounts));
+    // freed functions would take their pcs along, so none is until the print
+    keep_fns(vm);
+    ctr.vm = vm;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sigprof;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, &ctr.old_action);
+
+    ioctl(ctr.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(ctr.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz > 1000000 ? 1 : 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+    return true;
+}
+
+void stop_perfctr() {
+    if (ctr.vm == NULL) {
+        return;
+    }
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &ctr.old_action, NULL);
+    ctr.vm = NULL;
+    ioctl(ctr.leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    close_counters();
+}
+
+bool perfctr_phase(VmPhase phase, Counter counter, uint64_t* count) {
+    if (!has_counter(counter)) {
+        return false;
+    }
+    *count = ctr.phases[phase][counter];
+    return true;
+}
+
+static int compare_fn_ptrs(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)((FnCounts*)a)->fn;
+    uintptr_t y = (uintptr_t)((FnCounts*)b)->fn;
+    return x < y ? -1 : x > y;
+}
+
+// the most first
+static int compare_fn_keys(const void* a, const void* b) {
+    uint64_t x = ((FnCounts*)a)->key;
+    uint64_t y = ((FnCounts*)b)->key;
+    return x > y ? -1 : x < y;
+}
+
+static bool has_ipc() {
+    return has_counter(CTR_CYCLES) && has_counter(CTR_INSTRUCTIONS);
+}
+
+static void print_header(FILE* out, const char* name) {
+    fprintf(out, "  %-18s", name);
+    for (int i = 0; i < ctr.open_count; i++) {
+        fprintf(out, " %14s", counters[ctr.order[i]].name);
+    }
+    fprintf(out, "%s\n", has_ipc() ? "    IPC" : "");
+}
+
+static void print_row(FILE* out, const char* name, uint64_t* counts) {
+    fprintf(out, "  %-18s", name);
+    for (int i = 0; i < ctr.open_count; i++) {
+        fprintf(out, " %14llu", (unsigned long long)counts[ctr.order[i]]);
+    }
+    if (has_ipc() && counts[CTR_CYCLES] > 0) {
+        fprintf(out, " %6.2f", (double)counts[CTR_INSTRUCTIONS] / counts[CTR_CYCLES]);
+    }
+    fprintf(out, "\n");
+}
+
+// sum the counts of the pcs per function, sorted by the counter
+static int count_fns(VmState* vm, FnCounts* fns, Counter sort_by) {
+    FnIndex index;
+    take_kept_fns(vm, &index);
+    int count = 0;
+    for (int i = 0; i < PERFCTR_PCS; i++) {
+        if (ctr.pcs[i].pc != NULL) {
+            fns[count].fn = find_fn_at(&index, ctr.pcs[i].pc);
+            memcpy(fns[count].counts, ctr.pcs[i].counts, sizeof(fns[count].counts));
+            count++;
+        }
+    }
+    free_fn_index(&index);
+
+    qsort(fns, count, sizeof(FnCounts), compare_fn_ptrs);
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        if (merged > 0 && fns[merged - 1].fn == fns[i].fn) {
+            add_counts(fns[merged - 1].counts, fns[i].counts);
+        } else {
+            fns[merged++] = fns[i];
+        }
+    }
+    for (int i = 0; i < merged; i++) {
+        fns[i].key = fns[i].counts[sort_by];
+    }
+    qsort(fns, merged, sizeof(FnCounts), compare_fn_keys);
+    return merged;
+}
+
+void print_perfctr(VmState* vm, FILE* out) {
+    if (ctr.pcs == NULL) {
+        return;
+    }
+    fprintf(out, "perfctr: %llu samples\n", (unsigned long long)ctr.samples);
+    print_header(out, "phase");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        print_row(out, phase_names[i], ctr.phases[i]);
+    }
+
+    // by the first counter there is
+    Counter sort_by = ctr.order[0];
+    FnCounts* fns = (FnCounts*)malloc(sizeof(FnCounts) * PERFCTR_PCS);
+    int count = count_fns(vm, fns, sort_by);
+    print_header(out, "function");
+    for (int i = 0; i < count && i < PERFCTR_TABLE_FNS; i++) {
+        ObjFunc* fn = fns[i].fn;
+        char name[64];
+        if (fn == NULL) {
+            snprintf(name, sizeof(name), "[unknown]");
+        } else {
+            snprintf(name, sizeof(name), "%s:%d", fn->name != NULL ? fn->name->chars : "script",
+                    fn->ops.lines[0]);
+        }
+        print_row(out, name, fns[i].counts);
+    }
+    if (ctr.other[sort_by] > 0) {
+        print_row(out, "[other]", ctr.other);
+    }
+    free(fns);
+    free(ctr.pcs);
+    ctr.pcs = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef perfctr_h
+#define perfctr_h
+
+#include <stdio.h>
+#include "common.h"
+#include "vm.h"
+
+// samples per second of CPU time, the kernel's tick rate may bound it
+#define PERFCTR_HZ 1000
+
+typedef enum {
+    CTR_CYCLES,
+    CTR_INSTRUCTIONS,
+    CTR_CACHE_MISSES,
+    CTR_BRANCH_MISSES,
+    // CPU time in ns, counted by the kernel where the CPU has no counters
+    CTR_TASK_CLOCK,
+    CTR_COUNT
+} Counter;
+
+/*
+ * Performance counters of the CPU through perf_event_open(2), nothing else
+ * needed. They count user space on the calling thread, as one group. The
+ * SIGPROF handler reads them every 1/hz s of CPU time, and charges what
+ * they counted since to the phase of the VM and to the function of its top
+ * frame. Counters the CPU or the kernel doesn't have are left out, and it
+ * fails with errno if none is left. The profiler takes the same timer, so
+ * only one of the two can run.
+ */
+bool start_perfctr(VmState* vm, int hz);
+void stop_perfctr();
+/*
+ * The counts per phase and for the functions that took the most. The
+ * functions are looked up by pc, as in the profiler, so they are kept
+ * alive from the start until the print. Drops the counts.
+ */
+void print_perfctr(VmState* vm, FILE* out);
+// the counts of a phase so far, false if the counter isn't there
+bool perfctr_phase(VmPhase phase, Counter counter, uint64_t* count);
+
+#endif
@@ -0,0 +1,459 @@
+// for the registers of the interrupted code
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "profile.h"
+#include "memory.h"
+#include "ops.h"
+#include "gc.h"
+#include "jit.h"
+
+// samples the thread of the profiler can fall behind by
+#define PROFILE_RING_SIZE 1024
+// how often the thread empties the ring
+#define PROFILE_DRAIN_NS (10 * 1000 * 1000)
+
+typedef struct {
+    int depth;
+    // the outermost frame first
+    uint8_t* pcs[PROFILE_MAX_DEPTH];
+    // where compiled code was interrupted, NULL outside of it
+    void* native_pc;
+} Sample;
+
+typedef struct {
+    // NULL if the slot is empty
+    uint8_t** pcs;
+    int depth;
+    void* native_pc;
+    uint32_t hash;
+    int count;
+} Stack;
+
+typedef struct {
+    char* frames;
+    int count;
+} Folded;
+
+static struct {
+    // the profiled VM, NULL while none is
+    VmState* volatile vm;
+    Sample* ring;
+    // the handler moves head and the thread tail
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_bool running;
+    pthread_t thread;
+    struct sigaction old_action;
+
+    Stack* stacks;
+    int stack_count;
+    int stack_capacity;
+
+    // the VM whose functions are kept until the profile is written
+    VmState* keeper;
+    FnIndex kept;
+} prof;
+
+static void* interrupted_pc(void* context) {
+#if defined(__x86_64__) && defined(__linux__)
+    return (void*)((ucontext_t*)context)->uc_mcontext.gregs[REG_RIP];
+#else
+    return NULL;
+#endif
+}
+
+static void on_sigprof(int sig, siginfo_t* info, void* context) {
+    VmState* vm = prof.vm;
+    if (vm == NULL) {
+        return;
+    }
+    size_t head = atomic_load_explicit(&prof.head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&prof.tail, memory_order_acquire);
+    if (head - tail == PROFILE_RING_SIZE) {
+        return;
+    }
+
+    // only the pcs, the frames may be half pushed and their closures stale,
+    // a fiber switch empties them while it swaps the array under them
+    Sample* sample = &prof.ring[head % PROFILE_RING_SIZE];
+    CallFrame* frames = vm->frames;
+    int count = vm->frame_count;
+    int from = count > PROFILE_MAX_DEPTH ? count - PROFILE_MAX_DEPTH : 0;
+    for (int i = from; i < count; i++) {
+        sample->pcs[i - from] = frames[i].pc;
+    }
+    sample->depth = count - from;
+    sample->native_pc = vm->in_jit ? interrupted_pc(context) : NULL;
+    atomic_store_explicit(&prof.head, head + 1, memory_order_release);
+}
+
+static uint32_t hash_pc(uint32_t hash, void* at) {
+    uintptr_t pc = (uintptr_t)at;
+    hash ^= (uint32_t)pc ^ (uint32_t)((uint64_t)pc >> 32);
+    return hash * 16777619;
+}
+
+static uint32_t hash_pcs(uint8_t** pcs, int depth, void* native_pc) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        hash = hash_pc(hash, pcs[i]);
+    }
+    return hash_pc(hash, native_pc);
+}
+
+static Stack* find_stack(Stack* stacks, int capacity, uint8_t** pcs, int depth, void* native_pc,
+                         uint32_t hash) {
+    uint32_t i = hash & (capacity - 1);
+    while (true) {
+        Stack* stack = &stacks[i];
+        if (stack->pcs == NULL || (stack->hash == hash && stack->depth == depth
+                && stack->native_pc == native_pc
+                && memcmp(stack->pcs, pcs, sizeof(uint8_t*) * depth) == 0)) {
+            return stack;
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+}
+
+static void grow_stacks() {
+    int capacity = prof.stack_capacity < 64 ? 64 : prof.stack_capacity * 2;
+    Stack* stacks = REALLOC_ARR(Stack, NULL, capacity);
+    memset(stacks, 0, sizeof(Stack) * capacity);
+    for (int i = 0; i < prof.stack_capacity; i++) {
+        Stack* old = &prof.stacks[i];
+        if (old->pcs != NULL) {
+            *find_stack(stacks, capacity, old->pcs, old->depth, old->native_pc, old->hash) = *old;
+        }
+    }
+    free(prof.stacks);
+    prof.stacks = stacks;
+    prof.stack_capacity = capacity;
+}
+
+static void count_sample(Sample* sample) {
+    if ((prof.stack_count + 1) * 4 > prof.stack_capacity * 3) {
+        grow_stacks();
+    }
+    // time outside of any function, e.g. compiling, gets a NULL pc
+    uint8_t** pcs = sample->depth > 0 ? sample->pcs : (uint8_t*[]){NULL};
+    int depth = sample->depth > 0 ? sample->depth : 1;
+    uint32_t hash = hash_pcs(pcs, depth, sample->native_pc);
+    Stack* stack = find_stack(prof.stacks, prof.stack_capacity, pcs, depth, sample->native_pc, hash);
+    if (stack->pcs == NULL) {
+        stack->pcs = REALLOC_ARR(uint8_t*, NULL, depth);
+        memcpy(stack->pcs, pcs, sizeof(uint8_t*) * depth);
+        stack->depth = depth;
+        stack->native_pc = sample->native_pc;
+        stack->hash = hash;
+        stack->count = 0;
+        prof.stack_count++;
+    }
+    stack->count++;
+}
+
+static void drain() {
+    size_t tail = atomic_load_explicit(&prof.tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&prof.head, memory_order_acquire);
+    for (; tail != head; tail++) {
+        count_sample(&prof.ring[tail % PROFILE_RING_SIZE]);
+    }
+    atomic_store_explicit(&prof.tail, tail, memory_order_release);
+}
+
+static void* drain_loop(void* arg) {
+    struct timespec pause = {0, PROFILE_DRAIN_NS};
+    while (atomic_load(&prof.running)) {
+        nanosleep(&pause, NULL);
+        drain();
+    }
+    return NULL;
+}
+
+static void free_stacks() {
+    for (int i = 0; i < prof.stack_capacity; i++) {
+        free(prof.stacks[i].pcs);
+    }
+    free(prof.stacks);
+    prof.stacks = NULL;
+    prof.stack_count = 0;
+    prof.stack_capacity = 0;
+}
+
+bool start_profile(VmState* vm, int hz) {
+    if (prof.vm != NULL || hz <= 0) {
+        return false;
+    }
+    free_stacks();
+    prof.ring = (Sample*)malloc(sizeof(Sample) * PROFILE_RING_SIZE);
+    if (prof.ring == NULL) {
+        return false;
+    }
+    atomic_store(&prof.head, 0);
+    atomic_store(&prof.tail, 0);
+    atomic_store(&prof.running, true);
+
+    // the signal has to interrupt the VM, not the thread
+    sigset_t block;
+    sigset_t old_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+    int err = pthread_create(&prof.thread, NULL, drain_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (err != 0) {
+        free(prof.ring);
+        prof.ring = NULL;
+        return false;
+    }
+
+    // freed functions would take their pcs along, so none is until the write
+    keep_fns(vm);
+
+    prof.vm = vm;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_sigprof;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigaction(SIGPROF, &action, &prof.old_action);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz > 1000000 ? 1 : 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+    return true;
+}
+
+void stop_profile() {
+    if (prof.vm == NULL) {
+        return;
+    }
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &prof.old_action, NULL);
+    prof.vm = NULL;
+
+    atomic_store(&prof.running, false);
+    pthread_join(prof.thread, NULL);
+    drain();
+    free(prof.ring);
+    prof.ring = NULL;
+}
+
+static int compare_fns(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)(*(ObjFunc**)a)->ops.ops;
+    uintptr_t y = (uintptr_t)(*(ObjFunc**)b)->ops.ops;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_folded(const void* a, const void* b) {
+    return strcmp(((Folded*)a)->frames, ((Folded*)b)->frames);
+}
+
+static void add_fn(FnIndex* index, ObjFunc* fn) {
+    if (index->count == index->capacity) {
+        index->capacity = index->capacity < 64 ? 64 : index->capacity * 2;
+        index->fns = REALLOC_ARR(ObjFunc*, index->fns, index->capacity);
+    }
+    index->fns[index->count++] = fn;
+}
+
+// drops the functions without ops, they can't be at any pc
+static void sort_fns(FnIndex* index) {
+    int count = 0;
+    for (int i = 0; i < index->count; i++) {
+        if (index->fns[i]->ops.count > 0) {
+            index->fns[count++] = index->fns[i];
+        }
+    }
+    index->count = count;
+    if (count > 0) {
+        qsort(index->fns, count, sizeof(ObjFunc*), compare_fns);
+    }
+}
+
+void index_fns(VmState* vm, FnIndex* index) {
+    index->fns = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    for (Obj* obj = vm->objects; obj != NULL; obj = obj->next) {
+        if (obj->type == OBJ_FUNC) {
+            add_fn(index, (ObjFunc*)obj);
+        }
+    }
+    for (Obj* obj = vm->gc.young; obj != NULL; obj = obj->next) {
+        if (obj->type == OBJ_FUNC) {
+            add_fn(index, (ObjFunc*)obj);
+        }
+    }
+    sort_fns(index);
+}
+
+ObjFunc* find_fn_at(FnIndex* index, uint8_t* pc) {
+    int lo = 0;
+    int hi = index->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        Ops* ops = &index->fns[mid]->ops;
+        if (pc < ops->ops) {
+            hi = mid - 1;
+        } else if (pc > ops->ops + ops->count) {
+            lo = mid + 1;
+        } else {
+            return index->fns[mid];
+        }
+    }
+    return NULL;
+}
+
+void free_fn_index(FnIndex* index) {
+    free(index->fns);
+    index->fns = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+static void append(char** buf, int* length, int* capacity, const char* chars, int n) {
+    if (*length + n + 1 > *capacity) {
+        *capacity = (*length + n + 1) * 2;
+        *buf = REALLOC_ARR(char, *buf, *capacity);
+    }
+    memcpy(*buf + *length, chars, n);
+    *length += n;
+    (*buf)[*length] = '\0';
+}
+
+static char* fold_stack(Stack* stack, FnIndex* index) {
+    char* buf = NULL;
+    int length = 0;
+    int capacity = 0;
+    append(&buf, &length, &capacity, "", 0);
+    for (int i = 0; i < stack->depth; i++) {
+        if (i > 0) {
+            append(&buf, &length, &capacity, ";", 1);
+        }
+        uint8_t* pc = stack->pcs[i];
+        if (pc == NULL) {
+            append(&buf, &length, &capacity, "[vm]", 4);
+            continue;
+        }
+        ObjFunc* fn = find_fn_at(index, pc);
+        if (fn == NULL) {
+            append(&buf, &length, &capacity, "[unknown]", 9);
+            continue;
+        }
+        int op = (int)(pc - fn->ops.ops) - 1;
+        char frame[64];
+        int n = snprintf(frame, sizeof(frame), ":%d", fn->ops.lines[op < 0 ? 0 : op]);
+        if (fn->name != NULL) {
+            append(&buf, &length, &capacity, fn->name->chars, fn->name->length);
+        } else {
+            append(&buf, &length, &capacity, "script", 6);
+        }
+        append(&buf, &length, &capacity, frame, n);
+    }
+    return buf;
+}
+
+void keep_fns(VmState* vm) {
+    free_fn_index(&prof.kept);
+    index_fns(vm, &prof.kept);
+    prof.keeper = vm;
+}
+
+void take_kept_fns(VmState* vm, FnIndex* index) {
+    if (vm != prof.keeper) {
+        index_fns(vm, index);
+        return;
+    }
+    *index = prof.kept;
+    prof.kept.fns = NULL;
+    prof.kept.count = 0;
+    prof.kept.capacity = 0;
+    prof.keeper = NULL;
+    sort_fns(index);
+}
+
+void profile_keep_fn(VmState* vm, ObjFunc* fn) {
+    if (vm != NULL && vm == prof.keeper) {
+        add_fn(&prof.kept, fn);
+    }
+}
+
+void mark_profile_roots(VmState* vm) {
+    if (vm != prof.keeper) {
+        return;
+    }
+    for (int i = 0; i < prof.kept.count; i++) {
+        gc_shade(vm, (Obj*)prof.kept.fns[i]);
+    }
+}
+
+void drop_profile(VmState* vm) {
+    if (vm != prof.keeper) {
+        return;
+    }
+    if (prof.vm == vm) {
+        stop_profile();
+    }
+    free_stacks();
+    free_fn_index(&prof.kept);
+    prof.keeper = NULL;
+}
+
+/*
+ * The pc of the top frame is stale in compiled code, so take the one of
+ * the op that the code was interrupted in. Calls out of it sync the pc,
+ * so there is none if it was interrupted in one.
+ */
+static void resolve_native_pc(Stack* stack, FnIndex* index) {
+    uint8_t** top = &stack->pcs[stack->depth - 1];
+    ObjFunc* fn = find_fn_at(index, *top);
+    uint8_t* pc = fn != NULL ? jit_pc_at(fn, stack->native_pc) : NULL;
+    if (pc != NULL) {
+        *top = pc;
+    }
+}
+
+bool write_profile(VmState* vm, FILE* out) {
+    FnIndex index;
+    take_kept_fns(vm, &index);
+
+    // stacks of different pcs on the same lines fold into one
+    Folded* folded = REALLOC_ARR(Folded, NULL, (prof.stack_count + 1));
+    int count = 0;
+    for (int i = 0; i < prof.stack_capacity; i++) {
+        Stack* stack = &prof.stacks[i];
+        if (stack->pcs != NULL) {
+            if (stack->native_pc != NULL) {
+                resolve_native_pc(stack, &index);
+            }
+            folded[count].frames = fold_stack(stack, &index);
+            folded[count].count = stack->count;
+            count++;
+        }
+    }
+    qsort(folded, count, sizeof(Folded), compare_folded);
+
+    for (int i = 0; i < count; i++) {
+        int samples = folded[i].count;
+        while (i + 1 < count && strcmp(folded[i].frames, folded[i + 1].frames) == 0) {
+            free(folded[i].frames);
+            samples += folded[++i].count;
+        }
+        fprintf(out, "%s %d\n", folded[i].frames, samples);
+        free(folded[i].frames);
+    }
+    free(folded);
+    free_fn_index(&index);
+    free_stacks();
+    return fflush(out) == 0 && !ferror(out);
+}
@@ -0,0 +1,65 @@
+#ifndef profile_h
+#define profile_h
+
+#include <stdio.h>
+#include "common.h"
+#include "vm.h"
+
+// samples per second of CPU time, the kernel's tick rate may bound it
+#define PROFILE_HZ 1000
+// frames kept per sample, the outermost ones are dropped
+#define PROFILE_MAX_DEPTH 64
+
+/*
+ * Sampling profiler. The SIGPROF handler copies the pcs of the frames of
+ * the VM into a ring buffer, without locks or allocations, and a thread
+ * of the profiler counts the distinct stacks from there. Samples are
+ * dropped while the ring is full. The timer is per process, so only one
+ * VM can be profiled at a time, and it has to run on the thread that
+ * started the profile.
+ *
+ * Compiled code updates the pc of its frame only at calls and exits, so
+ * for the top frame the handler takes the native pc too, which is mapped
+ * back to an op when the profile is written.
+ */
+bool start_profile(VmState* vm, int hz);
+void stop_profile();
+/*
+ * Write the samples of the last profile as folded stacks, i.e. a line
+ * per stack with its frames from the outermost on, separated by ';', and
+ * the number of samples, as flamegraph.pl and similar tools take them.
+ * A frame is the name of the function and its current line, e.g.
+ * "script:12;fib:3 25". Functions are looked up by pc, so from the start
+ * of the profile the VM keeps every function alive until the write,
+ * which has to come before the VM is reset or freed.
+ */
+bool write_profile(VmState* vm, FILE* out);
+
+// the functions of a VM by the address of their ops
+typedef struct {
+    ObjFunc** fns;
+    int count;
+    int capacity;
+} FnIndex;
+
+void index_fns(VmState* vm, FnIndex* index);
+// the function whose ops pc points into, NULL if none does
+ObjFunc* find_fn_at(FnIndex* index, uint8_t* pc);
+void free_fn_index(FnIndex* index);
+
+/*
+ * Keep every function of the VM alive from now on, the ones it creates
+ * too, so that the pcs of samples keep naming them. Only one VM keeps its
+ * functions at a time, as only one can be sampled.
+ */
+void keep_fns(VmState* vm);
+// the kept functions, which are let go, or the live ones if none are kept
+void take_kept_fns(VmState* vm, FnIndex* index);
+// for the VM, a new function to keep
+void profile_keep_fn(VmState* vm, ObjFunc* fn);
+// for the GC, the kept functions are roots
+void mark_profile_roots(VmState* vm);
+// stop and drop the profile of the VM if there is one, as it is reset or freed
+void drop_profile(VmState* vm);
+
+#endif
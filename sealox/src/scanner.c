@@ -3,85 +3,77 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
-
-Scanner scanner;
-
-void init_scanner(const char* program) {
-    scanner.start = program;
-    scanner.current = program;
-    scanner.line = 1;
+void init_scanner(Scanner* scanner, const char* program) {
+    scanner->start = program;
+    scanner->current = program;
+    scanner->line = 1;
 }
 
-bool at_end() {
-    return *scanner.current == '\0'; 
+static bool at_end(Scanner* scanner) {
+    return *scanner->current == '\0'; 
 }
 
-static char advance() {
-    return *scanner.current++;
+static char advance(Scanner* scanner) {
+    return *scanner->current++;
 }
 
-char peek() {
-    return *scanner.current;
+static char peek(Scanner* scanner) {
+    return *scanner->current;
 }
 
-char peek_next() {
-    return at_end() ? '\0' : *(scanner.current + 1);
+static char peek_next(Scanner* scanner) {
+    return at_end(scanner) ? '\0' : *(scanner->current + 1);
 }
 
-bool check(char c) {
-   return peek() == c; 
+static bool check(Scanner* scanner, char c) {
+   return peek(scanner) == c; 
 }
 
-bool match(char c) {
-   if (check(c)) {
-        advance();
+static bool match(Scanner* scanner, char c) {
+   if (check(scanner, c)) {
+        advance(scanner);
         return true;
    }
    return false;
 }
 
-Token mk_token(TokenType type) {
+static Token mk_token(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
 
     return token;
 }
 
-Token mk_err(const char* msg) {
+static Token mk_err(Scanner* scanner, const char* msg) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = msg;
     token.length = (int)strlen(msg);
-    token.line = scanner.line;
+    token.line = scanner->line;
 
     return token;
 }
 
-void skip_whitespace() {
+static void skip_whitespace(Scanner* scanner) {
     while(true) {
-        char c = peek(); 
+        char c = peek(scanner); 
         switch(c) {
             case ' ':
             case '\t':
             case '\r':
-                advance();
+                advance(scanner);
                 break;
             case '\n':
-                scanner.line++;
-                advance();
+                scanner->line++;
+                advance(scanner);
                 break;
             case '/':
-                if (peek_next() == '/') {
-                    while (peek() != '\n' && !at_end()) {
-                        advance(); 
+                if (peek_next(scanner) == '/') {
+                    while (peek(scanner) != '\n' && !at_end(scanner)) {
+                        advance(scanner); 
                     }
                 } else {
                     return;
@@ -94,162 +86,165 @@ void skip_whitespace() {
 
 }
 
-bool is_digit(char c) {
+static bool is_digit(char c) {
     return c >= '0' && c <= '9';
 }
 
-bool is_alpha(char c) {
+static bool is_alpha(char c) {
     return (c >= 'a' && c <= 'z')
         || (c >= 'A' && c <= 'Z')
         || (c == '_');
 }
 
-Token mk_number() {
-    while(is_digit(peek())) {
-        advance();
+static Token mk_number(Scanner* scanner) {
+    while(is_digit(peek(scanner))) {
+        advance(scanner);
     }
-    if (peek() == '.') {
-        advance();
-        while(is_digit(peek())) {
-            advance();
+    if (peek(scanner) == '.') {
+        advance(scanner);
+        while(is_digit(peek(scanner))) {
+            advance(scanner);
         }
     }
-    return mk_token(TOKEN_NUMBER);
+    return mk_token(scanner, TOKEN_NUMBER);
 }
 
-TokenType check_keyword(int start, int length, char* part, TokenType type) {
-    if (scanner.current - scanner.start == start + length 
-            && memcmp(scanner.start + start, part, length) == 0) {
+static TokenType check_keyword(Scanner* scanner, int start, int length, char* part, TokenType type) {
+    if (scanner->current - scanner->start == start + length 
+            && memcmp(scanner->start + start, part, length) == 0) {
         return type; 
     }
     return TOKEN_IDENTIFIER;
 }
 
-TokenType mk_keyword_or_id_type() {
-    switch(scanner.start[0]) {
+static TokenType mk_keyword_or_id_type(Scanner* scanner) {
+    switch(scanner->start[0]) {
         case 'a':
-            return check_keyword(1, 2, "nd", TOKEN_AND);
+            return check_keyword(scanner, 1, 2, "nd", TOKEN_AND);
         case 'o':
-            return check_keyword(1, 1, "r", TOKEN_OR);
+            return check_keyword(scanner, 1, 1, "r", TOKEN_OR);
         case 'n':
-            return check_keyword(1, 2, "il", TOKEN_NIL);
+            return check_keyword(scanner, 1, 2, "il", TOKEN_NIL);
         case 'v':
-            return check_keyword(1, 2, "ar", TOKEN_VAR);
+            return check_keyword(scanner, 1, 2, "ar", TOKEN_VAR);
         case 'f':
-            printf("f\n");
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
                     case 'u':
-                        return check_keyword(2, 1, "n", TOKEN_FUN);
+                        return check_keyword(scanner, 2, 1, "n", TOKEN_FUN);
                     case 'o':
-                        return check_keyword(2, 1, "r", TOKEN_FOR);
+                        return check_keyword(scanner, 2, 1, "r", TOKEN_FOR);
                     case 'a':
-                        return check_keyword(2, 3, "lse", TOKEN_FALSE);
+                        return check_keyword(scanner, 2, 3, "lse", TOKEN_FALSE);
                 }
             }
             break;
         case 'c':
-            return check_keyword(1, 4, "lass", TOKEN_CLASS);
+            return check_keyword(scanner, 1, 4, "lass", TOKEN_CLASS);
         case 'p':
-            return check_keyword(1, 4, "rint", TOKEN_PRINT);
+            return check_keyword(scanner, 1, 4, "rint", TOKEN_PRINT);
         case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
                     case 'h':
-                        return check_keyword(2, 2, "is", TOKEN_THIS);
+                        return check_keyword(scanner, 2, 2, "is", TOKEN_THIS);
                     case 'r':
-                        return check_keyword(2, 2, "ue", TOKEN_TRUE);
+                        return check_keyword(scanner, 2, 2, "ue", TOKEN_TRUE);
                 }
             }
             break;
         case 's':
-            return check_keyword(1, 4, "uper", TOKEN_SUPER);
+            return check_keyword(scanner, 1, 4, "uper", TOKEN_SUPER);
         case 'i':
-            return check_keyword(1, 1, "f", TOKEN_IF);
+            return check_keyword(scanner, 1, 1, "f", TOKEN_IF);
         case 'e':
-            return check_keyword(1, 3, "lse", TOKEN_ELSE);
+            return check_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
         case 'w':
-            return check_keyword(1, 4, "hile", TOKEN_WHILE);
+            return check_keyword(scanner, 1, 4, "hile", TOKEN_WHILE);
         case 'r':
-            return check_keyword(1, 5, "eturn", TOKEN_RETURN);
+            return check_keyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
     }
     return TOKEN_IDENTIFIER;
 }
 
-Token mk_keyword_or_id() {
-    while(is_alpha(peek()) || is_digit(peek())) {
-        advance();
+static Token mk_keyword_or_id(Scanner* scanner) {
+    while(is_alpha(peek(scanner)) || is_digit(peek(scanner))) {
+        advance(scanner);
     }
 
-    return mk_token(mk_keyword_or_id_type());
+    return mk_token(scanner, mk_keyword_or_id_type(scanner));
 }
 
-Token mk_str() {
-    while(peek() != '"' && !at_end()) {
-        advance();
+static Token mk_str(Scanner* scanner) {
+    while(peek(scanner) != '"' && !at_end(scanner)) {
+        advance(scanner);
     }
-    if (peek() != '"') {
-        return mk_err("Unterminated string");
+    if (peek(scanner) != '"') {
+        return mk_err(scanner, "Unterminated string");
     }
-    advance();
-    return mk_token(TOKEN_STRING);
+    advance(scanner);
+    return mk_token(scanner, TOKEN_STRING);
 }
 
-Token scan_token() {
-    skip_whitespace();
-    scanner.start = scanner.current; 
-    if (at_end()) {
-        return mk_token(TOKEN_EOF);
+Token scan_token(Scanner* scanner) {
+    skip_whitespace(scanner);
+    scanner->start = scanner->current; 
+    if (at_end(scanner)) {
+        return mk_token(scanner, TOKEN_EOF);
     }
 
-    char c = advance();
+    char c = advance(scanner);
 
     if (is_digit(c)) {
-        return mk_number();
+        return mk_number(scanner);
     } 
 
     if(is_alpha(c)) {
-        return mk_keyword_or_id();
+        return mk_keyword_or_id(scanner);
     }
 
     switch(c) {
         // single character
         case  '(':
-            return mk_token(TOKEN_PAREN_START);
+            return mk_token(scanner, TOKEN_PAREN_START);
         case ')':
-            return mk_token(TOKEN_PAREN_END);
+            return mk_token(scanner, TOKEN_PAREN_END);
         case  '{':
-            return mk_token(TOKEN_CURLY_START);
+            return mk_token(scanner, TOKEN_CURLY_START);
         case '}':
-            return mk_token(TOKEN_CURLY_END);
+            return mk_token(scanner, TOKEN_CURLY_END);
+        case '[':
+            return mk_token(scanner, TOKEN_SQUARE_START);
+        case ']':
+            return mk_token(scanner, TOKEN_SQUARE_END);
         case '+':
-            return mk_token(TOKEN_PLUS);
+            return mk_token(scanner, TOKEN_PLUS);
         case '-':
-            return mk_token(TOKEN_MINUS);
+            return mk_token(scanner, TOKEN_MINUS);
         case '*':
-            return mk_token(TOKEN_STAR);
+            return mk_token(scanner, TOKEN_STAR);
         case ';':
-            return mk_token(TOKEN_SEMICOLON);
+            return mk_token(scanner, TOKEN_SEMICOLON);
         case ',':
-            return mk_token(TOKEN_COMMA);
+            return mk_token(scanner, TOKEN_COMMA);
         case '.':
-            return mk_token(TOKEN_DOT);
+            return mk_token(scanner, TOKEN_DOT);
         case '/': 
-            return mk_token(TOKEN_SLASH);
+            return mk_token(scanner, TOKEN_SLASH);
         // two characters
         case '!':
-            return mk_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+            return mk_token(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
         case '=':
-            return mk_token(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+            return mk_token(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
         case '<':
-            return mk_token(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            return mk_token(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>':
-            return mk_token(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+            return mk_token(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         case '"':
-            return mk_str();
+            return mk_str(scanner);
     }
 
-   return mk_err("Unexpected character");
+   return mk_err(scanner, "Unexpected character");
 }
 
 #define PRINT_PAD(s) printf("%-20s", s)
@@ -25,6 +25,8 @@ typedef enum {
     TOKEN_PAREN_END,
     TOKEN_CURLY_START,
     TOKEN_CURLY_END,
+    TOKEN_SQUARE_START,
+    TOKEN_SQUARE_END,
     // keywords
     TOKEN_AND,
     TOKEN_OR,
@@ -57,8 +59,14 @@ typedef struct {
     int line;
 } Token;
 
-void init_scanner(const char* program);
-Token scan_token();
+typedef struct {
+    const char* start;
+    const char* current;
+    int line;
+} Scanner;
+
+void init_scanner(Scanner* scanner, const char* program);
+Token scan_token(Scanner* scanner);
 void print_token_type(TokenType type);
 
 #endif
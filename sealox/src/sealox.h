@@ -0,0 +1,24 @@
+#ifndef sealox_h
+#define sealox_h
+
+/*
+ * Public header of libsealox. Typical embedding:
+ *
+ *   VmState* vm = create_vm();
+ *   define_native(vm, "input", 0, input_native);
+ *   Program* prog = compile_program(vm, source);
+ *   run_program(vm, prog); // defines the globals of the script
+ *
+ *   Val args[] = { MK_NUM_VAL(42) };
+ *   Val result;
+ *   if (call_global(vm, "rule", 1, args, &result) == INTR_OK) { ... }
+ *
+ *   destroy_vm(vm);
+ */
+
+#include "common.h"
+#include "ops.h"
+#include "memory.h"
+#include "vm.h"
+
+#endif
@@ -0,0 +1,140 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include "sink.h"
+#include "memory.h"
+
+static void init_sink(Sink* sink, SinkKind kind, size_t capacity) {
+    sink->kind = kind;
+    sink->file = NULL;
+    sink->fd = -1;
+    // never NULL, empty writes copy into it
+    sink->buf = REALLOC_ARR(char, NULL, capacity > 0 ? capacity : 1);
+    sink->count = 0;
+    sink->capacity = capacity;
+    sink->failed = false;
+}
+
+void sink_init_file(Sink* sink, FILE* file) {
+    init_sink(sink, SINK_FILE, SINK_BUF_SIZE);
+    sink->file = file;
+}
+
+void sink_init_fd(Sink* sink, int fd) {
+    init_sink(sink, SINK_FD, SINK_BUF_SIZE);
+    sink->fd = fd;
+}
+
+void sink_init_mem(Sink* sink) {
+    init_sink(sink, SINK_MEM, SINK_BUF_SIZE);
+}
+
+void sink_init_null(Sink* sink) {
+    // no room, so that the inline writes go straight to dropping
+    init_sink(sink, SINK_NULL, 0);
+}
+
+void sink_free(Sink* sink) {
+    sink_flush(sink);
+    free(sink->buf);
+    sink->buf = NULL;
+    sink->count = 0;
+    sink->capacity = 0;
+}
+
+/*
+ * Write all of the vectors, which takes more than one call if the fd
+ * accepts only part of them.
+ */
+static bool write_all(int fd, struct iovec* iov, int n) {
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (n > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+/*
+ * Pass the buffer and then data on, data being NULL if there is none.
+ */
+static void hand_on(Sink* sink, const char* data, size_t size) {
+    if (sink->failed) {
+        sink->count = 0;
+        return;
+    }
+    if (sink->kind == SINK_FD) {
+        // a single call for both, so data is never copied
+        struct iovec iov[2] = {
+            { sink->buf, sink->count },
+            { (void*)data, data != NULL ? size : 0 },
+        };
+        sink->failed = !write_all(sink->fd, iov, 2);
+    } else if (sink->kind == SINK_FILE) {
+        // and through the buffer of stdio too, errors may go to another stream
+        sink->failed = fwrite(sink->buf, 1, sink->count, sink->file) < sink->count
+            || (data != NULL && fwrite(data, 1, size, sink->file) < size)
+            || fflush(sink->file) != 0;
+    }
+    sink->count = 0;
+}
+
+void sink_write_slow(Sink* sink, const char* data, size_t size) {
+    switch (sink->kind) {
+        case SINK_MEM:
+            while (sink->capacity - sink->count < size) {
+                sink->capacity *= 2;
+            }
+            sink->buf = REALLOC_ARR(char, sink->buf, sink->capacity);
+            break;
+        case SINK_NULL:
+            sink->count = 0;
+            return;
+        default:
+            if (size >= sink->capacity / 2) {
+                hand_on(sink, data, size);
+                return;
+            }
+            hand_on(sink, NULL, 0);
+            break;
+    }
+    if (size > 0) {
+        memcpy(sink->buf + sink->count, data, size);
+        sink->count += size;
+    }
+}
+
+bool sink_flush(Sink* sink) {
+    if ((sink->kind == SINK_FILE || sink->kind == SINK_FD) && sink->count > 0) {
+        hand_on(sink, NULL, 0);
+    }
+    return !sink->failed;
+}
+
+char* sink_take(Sink* sink, size_t* size) {
+    if (sink->count == sink->capacity) {
+        sink->capacity++;
+        sink->buf = REALLOC_ARR(char, sink->buf, sink->capacity);
+    }
+    // hand the buffer itself over, the output may be big
+    char* out = sink->buf;
+    out[sink->count] = '\0';
+    *size = sink->count;
+    sink->buf = REALLOC_ARR(char, NULL, SINK_BUF_SIZE);
+    sink->count = 0;
+    sink->capacity = SINK_BUF_SIZE;
+    return out;
+}
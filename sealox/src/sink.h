@@ -0,0 +1,77 @@
+#ifndef sink_h
+#define sink_h
+
+#include <string.h>
+#include "common.h"
+
+/*
+ * Buffered destination of the output of print statements. Writes are
+ * gathered in a buffer and handed on when it is full and at flush
+ * points, i.e. when a script ends or fails, instead of once per value.
+ */
+typedef enum {
+    // a stdio stream, e.g. an open_memstream of the embedder
+    SINK_FILE,
+    // a file descriptor, written with writev and bypassing stdio
+    SINK_FD,
+    // a growing buffer, taken with sink_take
+    SINK_MEM,
+    // drops everything, for benchmarks
+    SINK_NULL
+} SinkKind;
+
+#define SINK_BUF_SIZE (64 * 1024)
+
+typedef struct {
+    SinkKind kind;
+    FILE* file;
+    int fd;
+    char* buf;
+    size_t count;
+    size_t capacity;
+    // set once a write fails, the output is dropped from then on
+    bool failed;
+} Sink;
+
+void sink_init_file(Sink* sink, FILE* file);
+void sink_init_fd(Sink* sink, int fd);
+void sink_init_mem(Sink* sink);
+void sink_init_null(Sink* sink);
+// flushes the sink first
+void sink_free(Sink* sink);
+
+void sink_write_slow(Sink* sink, const char* data, size_t size);
+
+static inline void sink_write(Sink* sink, const char* data, size_t size) {
+    if (sink->capacity - sink->count >= size) {
+        memcpy(sink->buf + sink->count, data, size);
+        sink->count += size;
+    } else {
+        sink_write_slow(sink, data, size);
+    }
+}
+
+static inline void sink_putc(Sink* sink, char c) {
+    if (sink->count < sink->capacity) {
+        sink->buf[sink->count++] = c;
+    } else {
+        sink_write_slow(sink, &c, 1);
+    }
+}
+
+// s must be a string literal
+#define SINK_LIT(sink, s) sink_write(sink, s, sizeof(s) - 1)
+
+/*
+ * Hand the buffered output on to the destination, and flush the stream
+ * of a SINK_FILE. Returns false if the sink failed. Does nothing for
+ * SINK_MEM and SINK_NULL.
+ */
+bool sink_flush(Sink* sink);
+/*
+ * The output of a SINK_MEM since the last take, null terminated and
+ * owned by the caller.
+ */
+char* sink_take(Sink* sink, size_t* size);
+
+#endif
@@ -0,0 +1,189 @@
+#include <string.h>
+#include "str.h"
+#include "array.h"
+#include "io.h"
+#include "memory.h"
+#include "vm.h"
+
+/*
+ * A sub string of a parent at least this big is copied if it is shorter
+ * than 1 / STR_PIN_RATIO of it, so that a small piece of a big input
+ * doesn't keep all of it alive.
+ */
+#define STR_PIN_SIZE (64 * 1024)
+#define STR_PIN_RATIO 8
+
+static ObjStr* str_arg(VmState* vm, Val val, const char* what) {
+    if (!IS_STR(val)) {
+        native_err(vm, "Expected a string as the %s", what);
+        return NULL;
+    }
+    return UNWRAP_STR(val);
+}
+
+// bytes that the slices of str keep alive
+static size_t owned_size(ObjStr* str) {
+    if (str->owner == NULL) {
+        return str->length;
+    }
+    if (str->owner->type == OBJ_LINES) {
+        return ((ObjLines*)str->owner)->size;
+    }
+    return ((ObjStr*)str->owner)->length;
+}
+
+// an integral number in [0, max]
+static bool str_pos(VmState* vm, Val val, int max, int* pos) {
+    if (!valid_index(val, max + 1, pos)) {
+        native_err(vm, "String index must be an integer in [0, %d]", max);
+        return false;
+    }
+    return true;
+}
+
+static int find_in(ObjStr* str, ObjStr* needle, int from) {
+    if (needle->length == 0) {
+        return from;
+    }
+    const char* end = str->chars + str->length - needle->length + 1;
+    const char* at = str->chars + from;
+    while (at < end) {
+        at = memchr(at, needle->chars[0], end - at);
+        if (at == NULL) {
+            break;
+        }
+        if (memcmp(at, needle->chars, needle->length) == 0) {
+            return (int)(at - str->chars);
+        }
+        at++;
+    }
+    return -1;
+}
+
+// sub(s, start, end) is the bytes [start, end) of s
+static Val sub_native(VmState* vm, int argc, Val* args) {
+    ObjStr* str = str_arg(vm, args[0], "first argument");
+    int start;
+    int end;
+    if (str == NULL || !str_pos(vm, args[1], str->length, &start)
+            || !str_pos(vm, args[2], str->length, &end)) {
+        return MK_NIL_VAL;
+    }
+    if (end < start) {
+        native_err(vm, "End %d is before start %d", end, start);
+        return MK_NIL_VAL;
+    }
+    int length = end - start;
+    size_t size = owned_size(str);
+    if (size >= STR_PIN_SIZE && (size_t)length < size / STR_PIN_RATIO) {
+        char* chars = REALLOC_ARR(char, NULL, length + 1);
+        memcpy(chars, str->chars + start, length);
+        chars[length] = '\0';
+        return MK_OBJ_VAL((Obj*)take_str(vm, chars, length));
+    }
+    return MK_OBJ_VAL((Obj*)slice_str(vm, str, start, length));
+}
+
+// find(s, needle) is the index of the first needle in s, or -1
+static Val find_native(VmState* vm, int argc, Val* args) {
+    ObjStr* str = str_arg(vm, args[0], "first argument");
+    ObjStr* needle = str == NULL ? NULL : str_arg(vm, args[1], "needle");
+    if (needle == NULL) {
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL(find_in(str, needle, 0));
+}
+
+/*
+ * split(s, sep) is the array of the pieces of s between the separators.
+ * The pieces cover s together, so they are slices whatever its size.
+ */
+static Val split_native(VmState* vm, int argc, Val* args) {
+    ObjStr* str = str_arg(vm, args[0], "first argument");
+    ObjStr* sep = str == NULL ? NULL : str_arg(vm, args[1], "separator");
+    if (sep == NULL) {
+        return MK_NIL_VAL;
+    }
+    if (sep->length == 0) {
+        native_err(vm, "Separator must not be empty");
+        return MK_NIL_VAL;
+    }
+    ObjArray* array = create_array(vm);
+    // keep the array reachable while the pieces are allocated
+    push_val(vm, MK_OBJ_VAL((Obj*)array));
+    int start = 0;
+    for (;;) {
+        int at = find_in(str, sep, start);
+        int end = at < 0 ? str->length : at;
+        Val piece = MK_OBJ_VAL((Obj*)slice_str(vm, str, start, end - start));
+        GC_BARRIER(vm, (Obj*)array, piece);
+        append_val(&array->vals, piece);
+        if (at < 0) {
+            break;
+        }
+        start = at + sep->length;
+    }
+    pop_val(vm);
+    return MK_OBJ_VAL((Obj*)array);
+}
+
+// byte(s, i) is the byte at index i of s, as a number in [0, 255]
+static Val byte_native(VmState* vm, int argc, Val* args) {
+    ObjStr* str = str_arg(vm, args[0], "first argument");
+    if (str == NULL) {
+        return MK_NIL_VAL;
+    }
+    int i;
+    if (!valid_index(args[1], str->length, &i)) {
+        native_err(vm, "String index must be an integer in [0, %d)", str->length);
+        return MK_NIL_VAL;
+    }
+    return MK_NUM_VAL((uint8_t)str->chars[i]);
+}
+
+// join(array, sep) concatenates the strings of the array
+static Val join_native(VmState* vm, int argc, Val* args) {
+    if (!IS_ARRAY(args[0])) {
+        native_err(vm, "Expected an array of strings");
+        return MK_NIL_VAL;
+    }
+    ObjStr* sep = str_arg(vm, args[1], "separator");
+    if (sep == NULL) {
+        return MK_NIL_VAL;
+    }
+    Vals* vals = &UNWRAP_ARRAY(args[0])->vals;
+    size_t length = 0;
+    for (int i = 0; i < vals->count; i++) {
+        if (!IS_STR(vals->vals[i])) {
+            native_err(vm, "Expected an array of strings");
+            return MK_NIL_VAL;
+        }
+        length += UNWRAP_STR(vals->vals[i])->length + (i > 0 ? sep->length : 0);
+    }
+    if (length > INT32_MAX) {
+        native_err(vm, "Joined string is too long");
+        return MK_NIL_VAL;
+    }
+
+    char* chars = REALLOC_ARR(char, NULL, length + 1);
+    char* at = chars;
+    for (int i = 0; i < vals->count; i++) {
+        if (i > 0) {
+            memcpy(at, sep->chars, sep->length);
+            at += sep->length;
+        }
+        ObjStr* str = UNWRAP_STR(vals->vals[i]);
+        memcpy(at, str->chars, str->length);
+        at += str->length;
+    }
+    *at = '\0';
+    return MK_OBJ_VAL((Obj*)take_str(vm, chars, (int)length));
+}
+
+void define_str_natives(VmState* vm) {
+    define_native(vm, "sub", 3, sub_native);
+    define_native(vm, "find", 2, find_native);
+    define_native(vm, "split", 2, split_native);
+    define_native(vm, "byte", 2, byte_native);
+    define_native(vm, "join", 2, join_native);
+}
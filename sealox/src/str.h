@@ -0,0 +1,14 @@
+#ifndef str_h
+#define str_h
+
+#include "common.h"
+#include "ops.h"
+
+/*
+ * sub, find, split, byte and join. Indices count bytes from 0, and len,
+ * which lives with the array natives, takes strings too. sub and split
+ * return slices that share the bytes of their argument.
+ */
+void define_str_natives(VmState* vm);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <math.h>
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
@@ -7,6 +8,15 @@
 #include "compiler.h"
 #include "ops.h"
 #include "memory.h"
+#include "jit.h"
+#include "class.h"
+#include "array.h"
+#include "map.h"
+#include "str.h"
+#include "io.h"
+#include "data.h"
+#include "fiber.h"
+#include "profile.h"
 
 #define CONSUME_OP() (*frame->pc++)
 #define CONSUME_OP16() \
@@ -14,75 +24,221 @@
 #define CONSUME_CONST() (frame->closure->fn->ops.constants.vals[CONSUME_OP()])
 #define BINARY_OP(mk_val, o) \
     do { \
-        if (!IS_NUM(peek_val(0)) || !IS_NUM(peek_val(1))) { \
-            run_err("Operands must be numbers"); \
+        if (!IS_NUM(peek_val(vm, 0)) || !IS_NUM(peek_val(vm, 1))) { \
+            run_err(vm, "Operands must be numbers"); \
             return INTR_RUN_ERR; \
         } \
-        double b = UNWRAP_NUM(pop_val()); \
-        double a = UNWRAP_NUM(pop_val()); \
-        push_val(mk_val(a o b)); \
+        double b = UNWRAP_NUM(pop_val(vm)); \
+        double a = UNWRAP_NUM(pop_val(vm)); \
+        push_val(vm, mk_val(a o b)); \
     } while(false)
+/*
+ * Quickening. The generic op rewrites itself to the number only op once it
+ * has seen number operands. The number op only guards the operand types and
+ * rewrites itself back to the generic op if they don't match.
+ */
+#define QUICKEN(quick_op) (frame->pc[-1] = (quick_op))
+#define DEOPTIMIZE(generic_op) (frame->pc[-1] = (generic_op), frame->pc--)
+#define BINARY_NUM_OP(generic_op, mk_val, o) \
+    do { \
+        Val b = peek_val(vm, 0); \
+        Val a = peek_val(vm, 1); \
+        if (!IS_NUM(a) || !IS_NUM(b)) { \
+            DEOPTIMIZE(generic_op); \
+            break; \
+        } \
+        vm->top--; \
+        vm->top[-1] = mk_val(UNWRAP_NUM(a) o UNWRAP_NUM(b)); \
+    } while(false)
+/*
+ * Continue in compiled code if the function of the current frame has any.
+ * Compiled code returns here once it reaches something it can't do.
+ */
+#define ENTER_JIT() \
+    do { \
+        if (frame->closure->fn->jit != NULL) { \
+            JitRun jit_res = run_jit(vm, fiber, base); \
+            if (jit_res == JIT_RUN_ERR) { \
+                return INTR_RUN_ERR; \
+            } \
+            if (jit_res == JIT_RUN_DONE) { \
+                return INTR_OK; \
+            } \
+            if (jit_res == JIT_RUN_PAUSED) { \
+                return INTR_PAUSED; \
+            } \
+            frame = &vm->frames[vm->frame_count - 1]; \
+        } \
+    } while(false)
+
+/*
+ * Pause once the fuel is used up. Only the outermost run can, as the C
+ * code of natives can't be paused.
+ */
+#define CAN_PAUSE() (vm->fuel <= 0 && vm->calls == 1)
 
-static void define_native(const char* name, NativeFn fn);
-static Val clock_native(int argc, Val* args);
+typedef enum {
+    JIT_RUN_DONE,
+    JIT_RUN_INTERP,
+    JIT_RUN_ERR,
+    JIT_RUN_PAUSED
+} JitRun;
 
-VmState vm;
+static Val clock_native(VmState* vm, int argc, Val* args);
+static IntrResult run(VmState* vm, int base);
 
-void reset_stack() {
-    vm.top = vm.stack; 
-    vm.frame_count = 0;
+static void reset_stack(VmState* vm) {
+    reset_fibers(vm);
+    vm->paused = RUN_NONE;
+    // keep closures that outlive the stack working
+    close_upvalues(vm, vm->stack);
+    vm->top = vm->stack; 
+    vm->frame_count = 0;
+}
+
+JitMode default_jit_mode() {
+#ifdef DEBUG_VM
+    // compiled code is not traced
+    return JIT_OFF;
+#else
+    return jit_supported() ? JIT_ON : JIT_OFF;
+#endif
 }
 
-void init_vm() {
-    reset_stack();
-    dict_init(&vm.strings);
-    dict_init(&vm.globals);
-    vm.objects = NULL;
+void init_vm(VmState* vm) {
+    init_gc(&vm->gc);
+    init_loop(&vm->loop);
+    vm->compiler = NULL;
+    vm->init_str = NULL;
+    dict_init(&vm->strings);
+    dict_init(&vm->globals);
+    vm->objects = NULL;
+    vm->programs = NULL;
+    vm->base_objects = NULL;
+    dict_init(&vm->base_globals);
+    vm->out = stdout;
+    vm->err = stderr;
+    sink_init_file(&vm->sink, stdout);
+    vm->native_failed = false;
+    vm->native_err_msg[0] = '\0';
+    vm->jit_mode = default_jit_mode();
+    vm->fuel = INT64_MAX;
+    vm->opstats = NULL;
+    vm->phase = PHASE_HOST;
+    vm->in_jit = false;
+    vm->paused = RUN_NONE;
 
-    define_native("clock", clock_native);
+    init_fibers(vm);
+    vm->init_str = cp_str(vm, "init", 4);
+    gc_minor(vm);
+    vm->base_objects = vm->objects;
+    define_native(vm, "clock", 0, clock_native);
+    define_array_natives(vm);
+    define_map_natives(vm);
+    define_str_natives(vm);
+    define_io_natives(vm);
+    define_data_natives(vm);
+    define_loop_natives(vm);
+    define_fiber_natives(vm);
 }
 
-void free_vm() {
-    dict_free(&vm.strings);
-    dict_free(&vm.globals);
-    free_objects();
+void free_vm(VmState* vm) {
+    while (vm->programs != NULL) {
+        free_program(vm, vm->programs);
+    }
+    dict_free(&vm->strings);
+    dict_free(&vm->globals);
+    dict_free(&vm->base_globals);
+    free_loop(&vm->loop);
+    drop_profile(vm);
+    gc_abort(vm);
+    free_objects(vm);
+    free_gc(&vm->gc);
+    sink_free(&vm->sink);
+    stop_opstats(vm);
 }
 
-void push_val(Val val) {
-    *vm.top = val;
-    vm.top++;
+void reset_vm(VmState* vm) {
+    reset_stack(vm);
+    clear_loop(vm);
+    vm->native_failed = false;
+    while (vm->programs != NULL) {
+        free_program(vm, vm->programs);
+    }
+
+    drop_profile(vm);
+    gc_abort(vm);
+    free_objects_until(vm, vm->base_objects);
+
+    // only the strings that survived are kept interned
+    dict_clear(&vm->strings);
+    for (Obj* obj = vm->objects; obj != NULL; obj = obj->next) {
+        if (obj->type == OBJ_STR && ((ObjStr*)obj)->interned) {
+            dict_put(&vm->strings, (ObjStr*)obj, MK_NIL_VAL);
+        }
+    }
+    dict_shrink(&vm->strings);
+
+    dict_clear(&vm->globals);
+    dict_add_all(&vm->base_globals, &vm->globals);
 }
 
-Val pop_val() {
-   vm.top--;
-   return *vm.top;
+VmState* create_vm() {
+    VmState* vm = (VmState*)malloc(sizeof(VmState));
+    if (vm == NULL) {
+        return NULL;
+    }
+    init_vm(vm);
+    return vm;
 }
 
-Val peek_val(int dist) {
-    return vm.top[-(dist + 1)];
+void destroy_vm(VmState* vm) {
+    free_vm(vm);
+    free(vm);
 }
 
-void run_err(const char* format, ...) {
+void push_val(VmState* vm, Val val) {
+    *vm->top = val;
+    vm->top++;
+}
+
+Val pop_val(VmState* vm) {
+   vm->top--;
+   return *vm->top;
+}
+
+static Val peek_val(VmState* vm, int dist) {
+    return vm->top[-(dist + 1)];
+}
+
+void run_err(VmState* vm, const char* format, ...) {
+    // err may be out, and the output comes first
+    sink_flush(&vm->sink);
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
     // stack trace
-    for (int i = vm.frame_count - 1; i >= 0; i--) {
-        CallFrame* frame = &vm.frames[i];
+    for (int i = vm->frame_count - 1; i >= 0; i--) {
+        CallFrame* frame = &vm->frames[i];
         ObjFunc* fn = frame->closure->fn;
         size_t instruction = frame->pc - fn->ops.ops - 1; // -1 because pc is already at the next one
-        fprintf(stderr, "[line %d] in ", fn->ops.lines[instruction]);
+        fprintf(vm->err, "[line %d] in ", fn->ops.lines[instruction]);
         if (fn->name == NULL) {
-            fprintf(stderr, "script\n");
+            fprintf(vm->err, "script\n");
         } else {
-            fprintf(stderr, "%s()\n", fn->name->chars);
+            fprintf(vm->err, "%s()\n", fn->name->chars);
         }
     }
 
-    reset_stack();
+    reset_stack(vm);
+}
+
+void print_line(VmState* vm, Val val) {
+    write_val(&vm->sink, val);
+    sink_putc(&vm->sink, '\n');
 }
 
 bool is_falsey(Val val) {
@@ -102,19 +258,32 @@ bool are_equal(Val a, Val b) {
         case VAL_NUM:
             return UNWRAP_NUM(a) == UNWRAP_NUM(b);
         case VAL_OBJ: {
+            if (!IS_STR(a) || !IS_STR(b)) {
+                return UNWRAP_OBJ(a) == UNWRAP_OBJ(b);
+            }
             ObjStr* a_str = UNWRAP_STR(a);
             ObjStr* b_str = UNWRAP_STR(b);
-            return a_str->length == b_str->length
-                && memcmp(a_str->chars, b_str->chars, a_str->length) == 0;
+            if (a_str == b_str) {
+                return true;
+            }
+            if (a_str->interned && b_str->interned) {
+                return false;
+            }
+            // hashes that were computed already rule out most mismatches
+            if (a_str->length != b_str->length
+                    || (a_str->hash != 0 && b_str->hash != 0 && a_str->hash != b_str->hash)) {
+                return false;
+            }
+            return memcmp(a_str->chars, b_str->chars, a_str->length) == 0;
         }
         default:
             return false;
     }
 }
 
-void concat() {
-    Val b = pop_val();  
-    Val a = pop_val();  
+void concat(VmState* vm) {
+    Val b = pop_val(vm);  
+    Val a = pop_val(vm);  
     ObjStr* a_str = UNWRAP_STR(a);
     ObjStr* b_str = UNWRAP_STR(b);
 
@@ -124,75 +293,603 @@ void concat() {
     memcpy(new_str + a_str->length, b_str->chars, b_str->length);
     new_str[length] = '\0';
 
-    ObjStr* result = take_str(new_str, length);
-    push_val(MK_OBJ_VAL((Obj*)result));
+    ObjStr* result = take_str(vm, new_str, length);
+    push_val(vm, MK_OBJ_VAL((Obj*)result));
 }
 
-static bool call(ObjClosure* closure, int argc) {
-    ObjFunc* fn = closure->fn;
-    if (argc != fn->arity) {
-        run_err("Unexpected number of function call arguments. Expected %d, but received %d", fn->arity, argc);
-        return false;
+/*
+ * Count calls and loop iterations, and compile the function once it is hot.
+ */
+static inline void heat(VmState* vm, ObjFunc* fn) {
+    if (vm->jit_mode == JIT_OFF) {
+        return;
+    }
+    int threshold = vm->jit_mode == JIT_ALWAYS ? 1 : JIT_THRESHOLD;
+    if (fn->hotness < threshold && ++fn->hotness == threshold) {
+        VmPhase phase = vm->phase;
+        vm->phase = PHASE_COMPILE;
+        jit_compile(vm, fn);
+        vm->phase = phase;
+    }
+}
+
+static inline bool push_frame(VmState* vm, ObjClosure* closure, int argc) {
+    heat(vm, closure->fn);
+    vm->fuel--;
+    if (vm->opstats != NULL) {
+        closure->fn->calls++;
     }
-    if (vm.frame_count == MAX_FRAMES) {
-        run_err("Stack overflow. At most %d call frames are allowed. Sorry.", MAX_FRAMES);
+    if (vm->frame_count == vm->max_frames) {
+        run_err(vm, "Stack overflow. At most %d call frames are allowed. Sorry.", vm->max_frames);
         return false;
     }
-    CallFrame* frame = &vm.frames[vm.frame_count++];
+    CallFrame* frame = &vm->frames[vm->frame_count++];
     frame->closure = closure;
-    frame->pc = fn->ops.ops;
-    frame->slots = vm.top - argc - 1;
+    frame->pc = closure->fn->ops.ops;
+    frame->slots = vm->top - argc - 1;
     return true;
 }
 
-static Val clock_native(int argc, Val* args) {
+static bool call(VmState* vm, ObjClosure* closure, int argc) {
+    ObjFunc* fn = closure->fn;
+    if (argc != fn->arity) {
+        run_err(vm, "Unexpected number of function call arguments. Expected %d, but received %d", fn->arity, argc);
+        return false;
+    }
+    return push_frame(vm, closure, argc);
+}
+
+static Val clock_native(VmState* vm, int argc, Val* args) {
     return MK_NUM_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
-static void define_native(const char* name, NativeFn fn) {
+void define_native(VmState* vm, const char* name, int arity, NativeFn fn) {
+    // natives defined before any script state are kept by reset_vm
+    bool at_base = vm->objects == vm->base_objects && vm->gc.young == NULL;
+
     // push / pop to make sure GC picks up the allocated string / function
-    push_val(MK_OBJ_VAL((Obj*)cp_str(name, (int)strlen(name))));
-    push_val(MK_OBJ_VAL((Obj*)create_native_func(fn)));
+    push_val(vm, MK_OBJ_VAL((Obj*)cp_str(vm, name, (int)strlen(name))));
+    push_val(vm, MK_OBJ_VAL((Obj*)create_native_func(vm, fn, arity)));
 
     // declare the native function as a global
-    dict_put(&vm.globals, UNWRAP_STR(vm.stack[0]), vm.stack[1]);
+    dict_put(&vm->globals, UNWRAP_STR(peek_val(vm, 1)), peek_val(vm, 0));
+    if (at_base) {
+        dict_put(&vm->base_globals, UNWRAP_STR(peek_val(vm, 1)), peek_val(vm, 0));
+    }
+
+    pop_val(vm);
+    pop_val(vm);
+    if (at_base) {
+        // tenure them, the base is a point in the list of old objects
+        gc_minor(vm);
+        vm->base_objects = vm->objects;
+    }
+}
 
-    pop_val();
-    pop_val();
+void native_err(VmState* vm, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(vm->native_err_msg, sizeof(vm->native_err_msg), format, args);
+    va_end(args);
+    vm->native_failed = true;
 }
 
-static bool call_val(Val callee, int argc) {
+static inline bool invoke_native(VmState* vm, ObjNative* nat, int argc) {
+    Val result = nat->fn(vm, argc, vm->top - argc);
+    if (vm->native_failed) {
+        vm->native_failed = false;
+        // an empty message means that a nested call already reported the error
+        if (vm->native_err_msg[0] != '\0') {
+            run_err(vm, "%s", vm->native_err_msg);
+        } else {
+            reset_stack(vm);
+        }
+        return false;
+    }
+
+    // pop the arguments and the native itself
+    vm->top -= argc + 1;
+    push_val(vm, result);
+    if (vm->switch_to != NULL) {
+        switch_fiber(vm);
+    }
+    return true;
+}
+
+static bool call_native(VmState* vm, ObjNative* nat, int argc) {
+    if (nat->arity != -1 && argc != nat->arity) {
+        run_err(vm, "Unexpected number of function call arguments. Expected %d, but received %d", nat->arity, argc);
+        return false;
+    }
+    return invoke_native(vm, nat, argc);
+}
+
+static bool call_val(VmState* vm, Val callee, int argc) {
     if (IS_OBJ(callee)) {
         switch(OBJ_TYPE(callee)) {
             case OBJ_CLOSURE:
-                return call(UNWRAP_CLOSURE(callee), argc);
-            case OBJ_NATIVE: {
-                NativeFn fn = UNWRAP_NATIVE_FN(callee)->fn;
-                Val result = fn(argc, vm.top - argc);
-                push_val(result);
+                return call(vm, UNWRAP_CLOSURE(callee), argc);
+            case OBJ_NATIVE:
+                return call_native(vm, UNWRAP_NATIVE_FN(callee), argc);
+            case OBJ_CLASS: {
+                ObjClass* klass = UNWRAP_CLASS(callee);
+                // the instance takes the place of the class as this
+                vm->top[-argc - 1] = MK_OBJ_VAL((Obj*)create_instance(vm, klass));
+                if (klass->init != NULL) {
+                    return call(vm, klass->init, argc);
+                }
+                if (argc != 0) {
+                    run_err(vm, "Unexpected number of function call arguments. Expected 0, but received %d", argc);
+                    return false;
+                }
                 return true;
             }
+            case OBJ_BOUND_METHOD: {
+                ObjBoundMethod* bound = UNWRAP_BOUND_METHOD(callee);
+                vm->top[-argc - 1] = bound->receiver;
+                return call(vm, bound->method, argc);
+            }
             default:
                 break;
         }
     }
-    run_err("Can only call functions and classes");
+    run_err(vm, "Can only call functions and classes");
     return false;
 }
 
-static ObjUpvalue* capture_upvalue(Val* local) {
-    ObjUpvalue* upvalue = create_upvalue(local);
-    return upvalue;
+// the function of the running frame, which holds the inline caches of its ops
+static inline Obj* cache_owner(VmState* vm) {
+    return (Obj*)vm->frames[vm->frame_count - 1].closure->fn;
+}
+
+/*
+ * Call through the inline cache of the call site. A hit means that the
+ * callee was already type and arity checked at this site.
+ */
+bool call_cached(VmState* vm, CallCache* cache, int argc) {
+    Obj* owner = cache_owner(vm);
+    Val callee = peek_val(vm, argc);
+    if (IS_OBJ(callee)) {
+        Obj* obj = UNWRAP_OBJ(callee);
+        if (obj == (Obj*)cache->closure) {
+            return push_frame(vm, cache->closure, argc);
+        }
+        if (obj == (Obj*)cache->native) {
+            return invoke_native(vm, cache->native, argc);
+        }
+    }
+
+    if (!call_val(vm, callee, argc)) {
+        return false;
+    }
+
+    // monomorphic, so a miss replaces the previous callee
+    GC_BARRIER(vm, owner, callee);
+    if (IS_CLOSURE(callee)) {
+        cache->closure = UNWRAP_CLOSURE(callee);
+        cache->native = NULL;
+    } else if (IS_NATIVE(callee)) {
+        cache->closure = NULL;
+        cache->native = UNWRAP_NATIVE_FN(callee);
+    }
+    return true;
+}
+
+static ObjUpvalue* capture_upvalue(VmState* vm, Val* local) {
+    // closures that capture the same variable share the upvalue
+    ObjUpvalue* prev = NULL;
+    ObjUpvalue* upvalue = vm->open_upvalues;
+    while (upvalue != NULL && upvalue->slot > local) {
+        prev = upvalue;
+        upvalue = upvalue->next;
+    }
+    if (upvalue != NULL && upvalue->slot == local) {
+        return upvalue;
+    }
+
+    ObjUpvalue* created = create_upvalue(vm, local);
+    created->next = upvalue;
+    if (prev == NULL) {
+        vm->open_upvalues = created;
+    } else {
+        prev->next = created;
+    }
+    return created;
+}
+
+void close_upvalues(VmState* vm, Val* last) {
+    while (vm->open_upvalues != NULL && vm->open_upvalues->slot >= last) {
+        ObjUpvalue* upvalue = vm->open_upvalues;
+        // the upvalue may be black already, unlike the stack
+        GC_BARRIER(vm, upvalue, *upvalue->slot);
+        upvalue->closed = *upvalue->slot;
+        upvalue->slot = &upvalue->closed;
+        vm->open_upvalues = upvalue->next;
+    }
+}
+
+void push_closure(VmState* vm, CallFrame* frame, ObjFunc* fn, uint8_t* captures) {
+    ObjClosure* closure = create_closure(vm, fn);
+    push_val(vm, MK_OBJ_VAL((Obj*)closure));
+
+    // capture the expected upvalues
+    for (int i = 0; i < fn->upvalue_count; i++) {
+        uint8_t is_local = captures[2 * i];
+        uint8_t index = captures[2 * i + 1];
+        if (is_local) {
+            closure->upvalues[i] = capture_upvalue(vm, frame->slots + index); 
+        } else {
+            closure->upvalues[i] = frame->closure->upvalues[index];
+        }
+        // capturing allocates, so the closure may have been traced or
+        // tenured already
+        GC_BARRIER_OBJ(vm, closure, closure->upvalues[i]);
+    }
+}
+
+void define_global(VmState* vm, ObjStr* name) {
+    GC_BARRIER_ROOT(vm, MK_OBJ_VAL((Obj*)name));
+    GC_BARRIER_ROOT(vm, peek_val(vm, 0));
+    dict_put(&vm->globals, name, pop_val(vm));
+}
+
+bool get_global(VmState* vm, ObjStr* name) {
+    Val val;
+    if (!dict_get(&vm->globals, name, &val)) {
+        run_err(vm, "Unable to read undefined variable '%s'", name->chars);
+        return false;
+    }
+    push_val(vm, val);
+    return true;
+}
+
+bool set_global(VmState* vm, ObjStr* name) {
+    if (!dict_has(&vm->globals, name)) {
+        dict_del(&vm->globals, name);
+        run_err(vm, "Unable to assign to undefined variable '%s'", name->chars);
+        return false;
+    }
+    GC_BARRIER_ROOT(vm, peek_val(vm, 0));
+    dict_put(&vm->globals, name, peek_val(vm, 0));
+    return true;
+}
+
+void define_method(VmState* vm, ObjStr* name) {
+    Val method = peek_val(vm, 0);
+    ObjClass* klass = UNWRAP_CLASS(peek_val(vm, 1));
+    GC_BARRIER_OBJ(vm, klass, name);
+    GC_BARRIER(vm, klass, method);
+    dict_put(&klass->methods, name, method);
+    if (name == vm->init_str) {
+        klass->init = UNWRAP_CLOSURE(method);
+    }
+    pop_val(vm);
+}
+
+bool inherit(VmState* vm) {
+    Val super = peek_val(vm, 1);
+    if (!IS_CLASS(super)) {
+        run_err(vm, "Superclass must be a class");
+        return false;
+    }
+    // copy down, so that lookups never walk the class chain
+    ObjClass* klass = UNWRAP_CLASS(peek_val(vm, 0));
+    // the copied methods are reached through the superclass
+    GC_BARRIER(vm, klass, super);
+    dict_add_all(&UNWRAP_CLASS(super)->methods, &klass->methods);
+    klass->init = UNWRAP_CLASS(super)->init;
+    pop_val(vm);
+    return true;
+}
+
+static bool bind_method(VmState* vm, ObjClass* klass, ObjStr* name) {
+    Val method;
+    if (!dict_get(&klass->methods, name, &method)) {
+        run_err(vm, "Undefined property '%s'", name->chars);
+        return false;
+    }
+    ObjBoundMethod* bound = create_bound_method(vm, peek_val(vm, 0), UNWRAP_CLOSURE(method));
+    vm->top[-1] = MK_OBJ_VAL((Obj*)bound);
+    return true;
+}
+
+bool get_property(VmState* vm, ObjStr* name, PropCache* cache) {
+    if (!IS_INSTANCE(peek_val(vm, 0))) {
+        run_err(vm, "Only instances have properties");
+        return false;
+    }
+    Obj* owner = cache_owner(vm);
+    ObjInstance* inst = UNWRAP_INSTANCE(peek_val(vm, 0));
+    ObjShape* shape = inst->shape;
+    int slot = shape_find(shape, name);
+    GC_BARRIER_OBJ(vm, owner, shape);
+    if (slot != -1) {
+        vm->top[-1] = inst->fields[slot];
+        cache->shape = shape;
+        cache->slot = slot;
+        return true;
+    }
+    if (!bind_method(vm, inst->klass, name)) {
+        return false;
+    }
+    cache->shape = shape;
+    cache->slot = -1;
+    cache->method = UNWRAP_BOUND_METHOD(peek_val(vm, 0))->method;
+    GC_BARRIER_OBJ(vm, owner, cache->method);
+    return true;
+}
+
+bool set_property(VmState* vm, ObjStr* name, PropCache* cache) {
+    if (!IS_INSTANCE(peek_val(vm, 1))) {
+        run_err(vm, "Only instances have fields");
+        return false;
+    }
+    Obj* owner = cache_owner(vm);
+    ObjInstance* inst = UNWRAP_INSTANCE(peek_val(vm, 1));
+    Val val = peek_val(vm, 0);
+    ObjShape* shape = inst->shape;
+    GC_BARRIER(vm, inst, val);
+    GC_BARRIER_OBJ(vm, owner, shape);
+    // a cached transition proves that the field isn't there yet
+    if (cache->shape == shape && cache->next_shape != NULL) {
+        add_field(inst, cache->next_shape, val);
+        GC_BARRIER_OBJ(vm, inst, cache->next_shape);
+        vm->top--;
+        vm->top[-1] = val;
+        return true;
+    }
+    int slot = shape_find(shape, name);
+    if (slot != -1) {
+        inst->fields[slot] = val;
+        cache->shape = shape;
+        cache->slot = slot;
+        cache->next_shape = NULL;
+    } else {
+        ObjShape* next = shape_add(vm, shape, name);
+        add_field(inst, next, val);
+        GC_BARRIER_OBJ(vm, inst, next);
+        GC_BARRIER_OBJ(vm, owner, next);
+        cache->shape = shape;
+        cache->slot = -1;
+        cache->next_shape = next;
+    }
+
+    // the assigned value replaces the instance
+    vm->top--;
+    vm->top[-1] = val;
+    return true;
+}
+
+bool invoke(VmState* vm, ObjStr* name, int argc, PropCache* cache) {
+    Val receiver = peek_val(vm, argc);
+    if (!IS_INSTANCE(receiver)) {
+        run_err(vm, "Only instances have methods");
+        return false;
+    }
+    ObjInstance* inst = UNWRAP_INSTANCE(receiver);
+    Obj* owner = cache_owner(vm);
+    if (inst->shape == cache->shape) {
+        if (cache->slot == -1) {
+            // the arity was checked when the site was cached
+            return push_frame(vm, cache->method, argc);
+        }
+        Val field = inst->fields[cache->slot];
+        vm->top[-argc - 1] = field;
+        return call_val(vm, field, argc);
+    }
+
+    // fields shadow methods
+    int slot = shape_find(inst->shape, name);
+    GC_BARRIER_OBJ(vm, owner, inst->shape);
+    if (slot != -1) {
+        Val field = inst->fields[slot];
+        vm->top[-argc - 1] = field;
+        if (!call_val(vm, field, argc)) {
+            return false;
+        }
+        cache->shape = inst->shape;
+        cache->slot = slot;
+        return true;
+    }
+
+    Val method;
+    if (!dict_get(&inst->klass->methods, name, &method)) {
+        run_err(vm, "Undefined property '%s'", name->chars);
+        return false;
+    }
+    if (!call(vm, UNWRAP_CLOSURE(method), argc)) {
+        return false;
+    }
+    GC_BARRIER(vm, owner, method);
+    cache->shape = inst->shape;
+    cache->slot = -1;
+    cache->method = UNWRAP_CLOSURE(method);
+    return true;
+}
+
+bool get_super(VmState* vm, ObjStr* name) {
+    ObjClass* super = UNWRAP_CLASS(pop_val(vm));
+    return bind_method(vm, super, name);
 }
 
-static IntrResult run() {
-    CallFrame* frame = &vm.frames[vm.frame_count - 1];
+bool super_invoke(VmState* vm, ObjStr* name, int argc) {
+    ObjClass* super = UNWRAP_CLASS(pop_val(vm));
+    Val method;
+    if (!dict_get(&super->methods, name, &method)) {
+        run_err(vm, "Undefined property '%s'", name->chars);
+        return false;
+    }
+    return call(vm, UNWRAP_CLOSURE(method), argc);
+}
+
+void make_array(VmState* vm, int count) {
+    ObjArray* array = create_array(vm);
+    for (int i = 0; i < count; i++) {
+        append_val(&array->vals, vm->top[i - count]);
+    }
+    vm->top -= count;
+    push_val(vm, MK_OBJ_VAL((Obj*)array));
+}
+
+/*
+ * Report why the fast path of indexing failed.
+ */
+static void index_err(VmState* vm, Val arr, Val idx) {
+    if (!IS_ARRAY(arr) && !IS_FLOAT_ARRAY(arr)) {
+        run_err(vm, "Only arrays and maps can be indexed");
+        return;
+    }
+    int count = IS_ARRAY(arr) ? UNWRAP_ARRAY(arr)->vals.count : UNWRAP_FLOAT_ARRAY(arr)->count;
+    if (!IS_NUM(idx) || trunc(UNWRAP_NUM(idx)) != UNWRAP_NUM(idx)) {
+        run_err(vm, "Array index must be an integer");
+        return;
+    }
+    run_err(vm, "Array index %g is out of bounds for length %d", UNWRAP_NUM(idx), count);
+}
+
+bool get_index(VmState* vm) {
+    Val arr = peek_val(vm, 1);
+    Val idx = peek_val(vm, 0);
+    Val val;
+    if (IS_MAP(arr)) {
+        if (!is_hashable(idx)) {
+            run_err(vm, "Map keys must be numbers, strings, booleans or nil");
+            return false;
+        }
+        if (!vdict_get(&UNWRAP_MAP(arr)->dict, idx, &val)) {
+            val = MK_NIL_VAL;
+        }
+    } else if (!array_get(arr, idx, &val)) {
+        index_err(vm, arr, idx);
+        return false;
+    }
+    vm->top--;
+    vm->top[-1] = val;
+    return true;
+}
+
+bool set_index(VmState* vm) {
+    Val arr = peek_val(vm, 2);
+    Val idx = peek_val(vm, 1);
+    Val val = peek_val(vm, 0);
+    if (IS_MAP(arr) && IS_STR(idx)) {
+        // keys are compared by reference first, so they are kept interned
+        idx = MK_OBJ_VAL((Obj*)intern_str(vm, UNWRAP_STR(idx)));
+    }
+    if (IS_OBJ(arr)) {
+        GC_BARRIER(vm, UNWRAP_OBJ(arr), idx);
+        GC_BARRIER(vm, UNWRAP_OBJ(arr), val);
+    }
+    if (IS_MAP(arr)) {
+        if (!is_hashable(idx)) {
+            run_err(vm, "Map keys must be numbers, strings, booleans or nil");
+            return false;
+        }
+        vdict_put(&UNWRAP_MAP(arr)->dict, idx, val);
+    } else if (!array_set(arr, idx, val)) {
+        if (IS_FLOAT_ARRAY(arr) && !IS_NUM(val)) {
+            run_err(vm, "Float64Array elements must be numbers");
+        } else {
+            index_err(vm, arr, idx);
+        }
+        return false;
+    }
+    // the assigned value replaces the array
+    vm->top -= 2;
+    vm->top[-1] = val;
+    return true;
+}
+
+static inline void return_from_frame(VmState* vm) {
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    close_upvalues(vm, frame->slots);
+    Val result = pop_val(vm); 
+    vm->frame_count--;
+    vm->top = frame->slots;
+    push_val(vm, result);
+}
+
+/*
+ * Called after each return. Ends the running fiber once its function
+ * returned, and runs the fibers in the run queue once the outermost run
+ * is done. Returns false once run() is done, i.e. the frame at base of
+ * the fiber it started on returned.
+ */
+static inline bool after_return(VmState* vm, ObjFiber* fiber, int base) {
+    while (vm->frame_count <= base) {
+        if (vm->fiber == fiber && vm->frame_count == base) {
+            if (fiber != vm->root || base != 0 || !run_queued(vm)) {
+                return false;
+            }
+        } else if (vm->frame_count == 0) {
+            finish_fiber(vm);
+        } else {
+            break;
+        }
+    }
+    return true;
+}
+
+/*
+ * Run compiled code for as long as the top frame has any. Calls between
+ * compiled functions go through here, and so do their returns.
+ */
+static JitRun run_jit(VmState* vm, ObjFiber* fiber, int base) {
+    while (true) {
+        CallFrame* frame = &vm->frames[vm->frame_count - 1];
+        if (frame->closure->fn->jit == NULL) {
+            return JIT_RUN_INTERP;
+        }
+        switch (jit_enter(vm, frame)) {
+            case JIT_EXIT_ERR:
+                return JIT_RUN_ERR;
+            case JIT_EXIT_INTERP:
+                return JIT_RUN_INTERP;
+            case JIT_EXIT_CALL:
+                if (CAN_PAUSE()) {
+                    return JIT_RUN_PAUSED;
+                }
+                break;
+            case JIT_EXIT_FUEL:
+                if (vm->calls == 1) {
+                    return JIT_RUN_PAUSED;
+                }
+                break;
+            case JIT_EXIT_RETURN:
+                return_from_frame(vm);
+                if (!after_return(vm, fiber, base)) {
+                    return JIT_RUN_DONE;
+                }
+                break;
+        }
+    }
+}
+
+/*
+ * Run until the frame at index base returns. The returned value
+ * is left on top of the stack in place of the callee. Natives may
+ * switch fibers in between, so the frame is reloaded after calls.
+ */
+static IntrResult run(VmState* vm, int base) {
+    // the outermost run is the one of the root, also when it goes on after a pause
+    ObjFiber* fiber = base == 0 ? vm->root : vm->fiber;
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    if (frame->closure->fn->aot != NULL) {
+        // ahead of time compiled code runs its whole frame, calls included
+        return frame->closure->fn->aot(vm) ? INTR_OK : INTR_RUN_ERR;
+    }
+    OpStats* stats = vm->opstats;
+    if (stats != NULL && base == 0) {
+        // the time between two runs isn't the last op's
+        stats->last_op = -1;
+    }
+    ENTER_JIT();
     bool keep_going = true;
     while(keep_going) {
         uint8_t op;
 #ifdef DEBUG_VM
     printf("        ");
-    for (Val* ptr = vm.stack; ptr < vm.top; ptr++) {
+    for (Val* ptr = vm->stack; ptr < vm->top; ptr++) {
         printf("[");
         print_val(*ptr);
         printf("]");
@@ -200,125 +897,145 @@ static IntrResult run() {
     printf("\n");
     disas_op_at(&frame->closure->fn->ops, (int)(frame->pc - frame->closure->fn->ops.ops));
 #endif
+        if (stats != NULL) {
+            count_op(stats, *frame->pc);
+        }
         switch(op = CONSUME_OP()) {
             case OP_CONST:
-                push_val(CONSUME_CONST());
+                push_val(vm, CONSUME_CONST());
                 break;
             case OP_TRUE:
-                push_val(MK_BOOL_VAL(true));
+                push_val(vm, MK_BOOL_VAL(true));
                 break;
             case OP_FALSE:
-                push_val(MK_BOOL_VAL(false));
+                push_val(vm, MK_BOOL_VAL(false));
                 break;
             case OP_NIL:
-                push_val(MK_NIL_VAL);
+                push_val(vm, MK_NIL_VAL);
                 break;
             case OP_RETURN: {
-                Val result = pop_val(); 
-                vm.frame_count--;
-                if (vm.frame_count == 0) {
-                    pop_val(); // pop main function
+                return_from_frame(vm);
+                if (!after_return(vm, fiber, base)) {
                     return INTR_OK;
                 }
 
-                vm.top = frame->slots;
-                push_val(result);
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->frames[vm->frame_count - 1];
+                ENTER_JIT();
                 break;
             }
             case OP_NEGATE:
-                if (!IS_NUM(peek_val(0))) {
-                   run_err("Operand must be a number"); 
+                if (!IS_NUM(peek_val(vm, 0))) {
+                   run_err(vm, "Operand must be a number"); 
                    return INTR_RUN_ERR;
                 }
-                push_val(MK_NUM_VAL(-UNWRAP_NUM(pop_val())));
+                push_val(vm, MK_NUM_VAL(-UNWRAP_NUM(pop_val(vm))));
                 break;
             case OP_NOT:
-                push_val(MK_BOOL_VAL(is_falsey(pop_val())));
+                push_val(vm, MK_BOOL_VAL(is_falsey(pop_val(vm))));
                 break;
             case OP_ADD: 
-                if (IS_STR(peek_val(0)) && IS_STR(peek_val(1))) {
-                    concat();
+                if (IS_STR(peek_val(vm, 0)) && IS_STR(peek_val(vm, 1))) {
+                    QUICKEN(OP_ADD_STR);
+                    concat(vm);
                 } else {
                     BINARY_OP(MK_NUM_VAL, +);
+                    QUICKEN(OP_ADD_NUM);
                 }
                 break;
+            case OP_ADD_NUM:
+                BINARY_NUM_OP(OP_ADD, MK_NUM_VAL, +);
+                break;
+            case OP_ADD_STR:
+                if (!IS_STR(peek_val(vm, 0)) || !IS_STR(peek_val(vm, 1))) {
+                    DEOPTIMIZE(OP_ADD);
+                    break;
+                }
+                concat(vm);
+                break;
             case OP_SUBTRACT: 
                 BINARY_OP(MK_NUM_VAL, -);
+                QUICKEN(OP_SUBTRACT_NUM);
+                break;
+            case OP_SUBTRACT_NUM:
+                BINARY_NUM_OP(OP_SUBTRACT, MK_NUM_VAL, -);
                 break;
             case OP_MULTIPLY: 
                 BINARY_OP(MK_NUM_VAL, *);
+                QUICKEN(OP_MULTIPLY_NUM);
+                break;
+            case OP_MULTIPLY_NUM:
+                BINARY_NUM_OP(OP_MULTIPLY, MK_NUM_VAL, *);
                 break;
             case OP_DIVIDE: 
                 BINARY_OP(MK_NUM_VAL, /);
+                QUICKEN(OP_DIVIDE_NUM);
+                break;
+            case OP_DIVIDE_NUM:
+                BINARY_NUM_OP(OP_DIVIDE, MK_NUM_VAL, /);
                 break;
             case OP_EQUAL: {
-                Val a = pop_val();
-                Val b = pop_val();
-                push_val(MK_BOOL_VAL(are_equal(a, b)));
+                Val a = pop_val(vm);
+                Val b = pop_val(vm);
+                push_val(vm, MK_BOOL_VAL(are_equal(a, b)));
                 break; 
             }
             case OP_LESS:
                 BINARY_OP(MK_BOOL_VAL, <);
+                QUICKEN(OP_LESS_NUM);
+                break;
+            case OP_LESS_NUM:
+                BINARY_NUM_OP(OP_LESS, MK_BOOL_VAL, <);
                 break;
             case OP_GREATER:
                 BINARY_OP(MK_BOOL_VAL, >);
+                QUICKEN(OP_GREATER_NUM);
+                break;
+            case OP_GREATER_NUM:
+                BINARY_NUM_OP(OP_GREATER, MK_BOOL_VAL, >);
                 break;
             case OP_PRINT:
-                print_val(pop_val());
-                printf("\n");
+                print_line(vm, pop_val(vm));
                 break;
             case OP_POP:
-                pop_val();
+                pop_val(vm);
                 break;
-            case OP_DEFINE_GLOBAL: {
-                ObjStr* name = UNWRAP_STR(CONSUME_CONST());
-                dict_put(&vm.globals, name, pop_val());
+            case OP_DEFINE_GLOBAL:
+                define_global(vm, UNWRAP_STR(CONSUME_CONST()));
                 break;
-            }
-            case OP_GET_GLOBAL: {
-                ObjStr* name = UNWRAP_STR(CONSUME_CONST());
-                Val val;
-                if (!dict_get(&vm.globals, name, &val)) {
-                    run_err("Unable to read undefined variable '%s'", name->chars);
+            case OP_GET_GLOBAL:
+                if (!get_global(vm, UNWRAP_STR(CONSUME_CONST()))) {
                     return INTR_RUN_ERR;
                 }
-                push_val(val);
                 break;
-            }
-            case OP_SET_GLOBAL: {
-                ObjStr* name = UNWRAP_STR(CONSUME_CONST());
-                if (!dict_has(&vm.globals, name)) {
-                    dict_del(&vm.globals, name);
-                    run_err("Unable to assign to undefined variable '%s'", name->chars);
+            case OP_SET_GLOBAL:
+                if (!set_global(vm, UNWRAP_STR(CONSUME_CONST()))) {
                     return INTR_RUN_ERR;
                 }
-                dict_put(&vm.globals, name, peek_val(0));
                 break;
-            }
             case OP_GET_LOCAL: {
                 uint8_t slot = CONSUME_OP();
-                push_val(frame->slots[slot]);
+                push_val(vm, frame->slots[slot]);
                 break;
             }
             case OP_SET_LOCAL: {
                 uint8_t slot = CONSUME_OP();
-                frame->slots[slot] = peek_val(0);
+                frame->slots[slot] = peek_val(vm, 0);
                 break;
             }
             case OP_GET_UPVALUE: {
                 uint8_t slot = CONSUME_OP();
-                push_val(*frame->closure->upvalues[slot]->slot);
+                push_val(vm, *frame->closure->upvalues[slot]->slot);
                 break;
             }
             case OP_SET_UPVALUE: {
                 uint8_t slot = CONSUME_OP();
-                *frame->closure->upvalues[slot]->slot = peek_val(0);
+                GC_BARRIER(vm, frame->closure->upvalues[slot], peek_val(vm, 0));
+                *frame->closure->upvalues[slot]->slot = peek_val(vm, 0);
                 break;
             }
             case OP_JMP_IF_FALSE: {
                 uint16_t offset = CONSUME_OP16();
-                if (is_falsey(peek_val(0))) {
+                if (is_falsey(peek_val(vm, 0))) {
                     frame->pc += offset;
                 }
                 break;
@@ -331,31 +1048,129 @@ static IntrResult run() {
             case OP_LOOP: {
                 uint16_t offset = CONSUME_OP16();
                 frame->pc -= offset;
+                vm->fuel--;
+                if (CAN_PAUSE()) {
+                    return INTR_PAUSED;
+                }
+                heat(vm, frame->closure->fn);
+                ENTER_JIT();
                 break;
             }
             case OP_CALL: {
                 int argc = CONSUME_OP();
-                if (!call_val(peek_val(argc), argc)) {
+                CallCache* cache = &frame->closure->fn->ops.call_caches[CONSUME_OP16()];
+                if (!call_cached(vm, cache, argc)) {
                     return INTR_RUN_ERR;
                 }
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->frames[vm->frame_count - 1];
+                if (CAN_PAUSE()) {
+                    return INTR_PAUSED;
+                }
+                ENTER_JIT();
                 break;
             }
             case OP_CLOSURE: {
                 ObjFunc* fn = UNWRAP_FUNC(CONSUME_CONST());
-                ObjClosure* closure = create_closure(fn);
-                push_val(MK_OBJ_VAL((Obj*)closure));
-
-                // capture the expected upvalues
-                for (int i = 0; i < fn->upvalue_count; i++) {
-                    uint8_t is_local = CONSUME_OP();
-                    uint8_t index = CONSUME_OP();
-                    if (is_local) {
-                        closure->upvalues[i] = capture_upvalue(frame->slots + index); 
+                push_closure(vm, frame, fn, frame->pc);
+                frame->pc += 2 * fn->upvalue_count;
+                break;
+            }
+            case OP_CLOSE_UPVALUE:
+                close_upvalues(vm, vm->top - 1);
+                pop_val(vm);
+                break;
+            case OP_CLASS:
+                push_val(vm, MK_OBJ_VAL((Obj*)create_class(vm, UNWRAP_STR(CONSUME_CONST()))));
+                break;
+            case OP_INHERIT:
+                if (!inherit(vm)) {
+                    return INTR_RUN_ERR;
+                }
+                break;
+            case OP_METHOD:
+                define_method(vm, UNWRAP_STR(CONSUME_CONST()));
+                break;
+            case OP_GET_PROPERTY: {
+                ObjStr* name = UNWRAP_STR(CONSUME_CONST());
+                PropCache* cache = &frame->closure->fn->ops.prop_caches[CONSUME_OP16()];
+                Val receiver = peek_val(vm, 0);
+                // fast path, a field at a known index
+                if (IS_INSTANCE(receiver) && UNWRAP_INSTANCE(receiver)->shape == cache->shape
+                        && cache->slot != -1) {
+                    vm->top[-1] = UNWRAP_INSTANCE(receiver)->fields[cache->slot];
+                    break;
+                }
+                if (!get_property(vm, name, cache)) {
+                    return INTR_RUN_ERR;
+                }
+                break;
+            }
+            case OP_SET_PROPERTY: {
+                ObjStr* name = UNWRAP_STR(CONSUME_CONST());
+                PropCache* cache = &frame->closure->fn->ops.prop_caches[CONSUME_OP16()];
+                Val receiver = peek_val(vm, 1);
+                // fast path, a field at a known index or a known add
+                if (IS_INSTANCE(receiver) && UNWRAP_INSTANCE(receiver)->shape == cache->shape) {
+                    ObjInstance* inst = UNWRAP_INSTANCE(receiver);
+                    Val val = pop_val(vm);
+                    GC_BARRIER(vm, inst, val);
+                    if (cache->slot != -1) {
+                        inst->fields[cache->slot] = val;
                     } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
+                        add_field(inst, cache->next_shape, val);
+                        GC_BARRIER_OBJ(vm, inst, cache->next_shape);
                     }
+                    vm->top[-1] = val;
+                    break;
+                }
+                if (!set_property(vm, name, cache)) {
+                    return INTR_RUN_ERR;
+                }
+                break;
+            }
+            case OP_INVOKE: {
+                ObjStr* name = UNWRAP_STR(CONSUME_CONST());
+                int argc = CONSUME_OP();
+                PropCache* cache = &frame->closure->fn->ops.prop_caches[CONSUME_OP16()];
+                if (!invoke(vm, name, argc, cache)) {
+                    return INTR_RUN_ERR;
                 }
+                frame = &vm->frames[vm->frame_count - 1];
+                if (CAN_PAUSE()) {
+                    return INTR_PAUSED;
+                }
+                ENTER_JIT();
+                break;
+            }
+            case OP_GET_SUPER:
+                if (!get_super(vm, UNWRAP_STR(CONSUME_CONST()))) {
+                    return INTR_RUN_ERR;
+                }
+                break;
+            case OP_ARRAY:
+                make_array(vm, CONSUME_OP());
+                break;
+            case OP_GET_INDEX:
+                if (!get_index(vm)) {
+                    return INTR_RUN_ERR;
+                }
+                break;
+            case OP_SET_INDEX:
+                if (!set_index(vm)) {
+                    return INTR_RUN_ERR;
+                }
+                break;
+            case OP_SUPER_INVOKE: {
+                ObjStr* name = UNWRAP_STR(CONSUME_CONST());
+                int argc = CONSUME_OP();
+                if (!super_invoke(vm, name, argc)) {
+                    return INTR_RUN_ERR;
+                }
+                frame = &vm->frames[vm->frame_count - 1];
+                if (CAN_PAUSE()) {
+                    return INTR_PAUSED;
+                }
+                ENTER_JIT();
                 break;
             }
             default:
@@ -366,17 +1181,161 @@ static IntrResult run() {
     return INTR_OK;
 }
 
-IntrResult interpret(char* program) {
-    ObjFunc* fn = compile(program);
+Program* compile_program(VmState* vm, const char* program) {
+    ObjFunc* fn = compile(vm, program);
     if (fn == NULL) {
-        return INTR_COMP_ERR;
+        return NULL;
     }
 
-    push_val(MK_OBJ_VAL((Obj*)fn));
-    ObjClosure* closure = create_closure(fn);
-    pop_val();
-    push_val(MK_OBJ_VAL((Obj*)closure));
-    call(closure, 0); // call implicit "main"
+    push_val(vm, MK_OBJ_VAL((Obj*)fn));
+    ObjClosure* closure = create_closure(vm, fn);
+    pop_val(vm);
+
+    Program* prog = (Program*)malloc(sizeof(Program));
+    if (prog == NULL) {
+        return NULL;
+    }
+    prog->closure = closure;
+    prog->next = vm->programs;
+    vm->programs = prog;
+    return prog;
+}
+
+void free_program(VmState* vm, Program* prog) {
+    Program** link = &vm->programs;
+    while (*link != NULL && *link != prog) {
+        link = &(*link)->next;
+    }
+    if (*link == prog) {
+        *link = prog->next;
+    }
+    // the closure itself is owned by the VM object list
+    free(prog);
+}
+
+/*
+ * The end of a run of call_fn or continue_run, which left its result on
+ * the stack unless it failed or paused.
+ */
+static IntrResult end_run(VmState* vm, int base, IntrResult res, Val* result) {
+    if (base == 0) {
+        sink_flush(&vm->sink);
+    }
+    if (res == INTR_PAUSED) {
+        vm->paused = RUN_CALL;
+        return res;
+    }
+    if (res != INTR_OK) {
+        if (base > 0) {
+            // called from a native, let it fail without reporting twice
+            native_err(vm, "");
+        }
+        return res;
+    }
+
+    Val ret = pop_val(vm);
+    if (result != NULL) {
+        *result = ret;
+    }
+    return INTR_OK;
+}
+
+IntrResult call_fn(VmState* vm, Val callee, int argc, Val* args, Val* result) {
+    if (vm->paused != RUN_NONE) {
+        run_err(vm, "Unable to call while a run is paused, the paused run is dropped");
+        return INTR_RUN_ERR;
+    }
+    int base = vm->frame_count;
+    if (base == 0 && vm->sink.kind == SINK_FILE) {
+        // the sink is empty between runs, so out may have changed since
+        vm->sink.file = vm->out;
+    }
+    if (vm->top + argc + 1 > vm->stack + vm->max_frames * UINT8_COUNT) {
+        run_err(vm, "Stack overflow. Too many values on the stack.");
+        return INTR_RUN_ERR;
+    }
+
+    push_val(vm, callee);
+    for (int i = 0; i < argc; i++) {
+        push_val(vm, args[i]);
+    }
+
+    VmPhase phase = vm->phase;
+    vm->phase = PHASE_RUN;
+    vm->calls++;
+    if (!call_val(vm, callee, argc)) {
+        vm->calls--;
+        vm->phase = phase;
+        return INTR_RUN_ERR;
+    }
+
+    // closures push a frame that still needs to run, natives are already done
+    IntrResult res = INTR_OK;
+    if (vm->frame_count > base) {
+        res = run(vm, base);
+    }
+    vm->calls--;
+    vm->phase = phase;
+    return end_run(vm, base, res, result);
+}
+
+IntrResult call_global(VmState* vm, const char* name, int argc, Val* args, Val* result) {
+    ObjStr* key = cp_str(vm, name, (int)strlen(name));
+    Val callee;
+    if (!dict_get(&vm->globals, key, &callee)) {
+        run_err(vm, "Unable to call undefined function '%s'", name);
+        return INTR_RUN_ERR;
+    }
+    return call_fn(vm, callee, argc, args, result);
+}
+
+/*
+ * Run the event loop once the script of a program, or a callback of its
+ * loop, is done.
+ */
+static IntrResult finish_program(VmState* vm, IntrResult res) {
+    if (res == INTR_OK && run_loop(vm)) {
+        return INTR_OK;
+    }
+    if (vm->paused != RUN_NONE) {
+        vm->paused = RUN_PROGRAM;
+        return INTR_PAUSED;
+    }
+    clear_loop(vm);
+    return INTR_RUN_ERR;
+}
+
+IntrResult run_program(VmState* vm, Program* prog) {
+    return finish_program(vm, call_fn(vm, MK_OBJ_VAL((Obj*)prog->closure), 0, NULL, NULL));
+}
+
+IntrResult continue_run(VmState* vm, Val* result) {
+    RunKind kind = vm->paused;
+    if (kind == RUN_NONE) {
+        run_err(vm, "No run is paused");
+        return INTR_RUN_ERR;
+    }
+    vm->paused = RUN_NONE;
+    VmPhase phase = vm->phase;
+    vm->phase = PHASE_RUN;
+    vm->calls++;
+    IntrResult res = run(vm, 0);
+    vm->calls--;
+    vm->phase = phase;
+    res = end_run(vm, 0, res, kind == RUN_CALL ? result : NULL);
+    if (kind == RUN_CALL) {
+        return res;
+    }
+    return finish_program(vm, res);
+}
+
+IntrResult interpret(VmState* vm, char* program) {
+    Program* prog = compile_program(vm, program);
+    if (prog == NULL) {
+        return INTR_COMP_ERR;
+    }
 
-    return run();
+    IntrResult result = run_program(vm, prog);
+    free_program(vm, prog);
+    return result;
 }
@@ -5,45 +5,207 @@
 #include "ops.h"
 #include "dev.h"
 #include "dict.h"
+#include "jit.h"
+#include "gc.h"
+#include "loop.h"
+#include "opstats.h"
 
+// call frames of the root fiber, each uses at most UINT8_COUNT slots
 #define MAX_FRAMES 64
-#define STACK_SIZE (MAX_FRAMES * UINT8_COUNT)
 
-typedef struct {
+typedef struct CallFrame {
     ObjClosure* closure;
     uint8_t* pc;
     Val* slots;
 } CallFrame;
 
-typedef struct {
+/*
+ * A compiled script. The handle keeps the top level function alive
+ * so that it can be run many times without recompiling.
+ */
+typedef struct Program {
+    ObjClosure* closure;
+    struct Program* next;
+} Program;
+
+// what a paused run was started by, see continue_run
+typedef enum {
+    RUN_NONE,
+    // call_fn or call_global
+    RUN_CALL,
+    // run_program, whose event loop runs once the script is done
+    RUN_PROGRAM
+} RunKind;
+
+// what the VM is busy with, for the hardware counters, see perfctr.h
+typedef enum {
+    // none of the others, e.g. in the host
+    PHASE_HOST,
+    PHASE_SCAN,
+    // the compiler and the JIT
+    PHASE_COMPILE,
+    PHASE_RUN,
+    // allocating objects, including the GC work that it does
+    PHASE_ALLOC,
+    PHASE_COUNT
+} VmPhase;
+
+struct VmState {
     Ops* ops;
     uint8_t* pc;
 
-    Val stack[STACK_SIZE];
+    // the stack of the running fiber, see fiber.h
+    Val* stack;
     Val* top;
 
     Dict strings;
     Obj* objects;
     Dict globals;
+    ObjUpvalue* open_upvalues;
+    ObjStr* init_str;
 
-    CallFrame frames[MAX_FRAMES];
+    CallFrame* frames;
     int frame_count;
-} VmState;
+    int max_frames;
+
+    struct ObjFiber* fiber;
+    // the fiber of scripts and of calls from C
+    struct ObjFiber* root;
+    // fibers waiting for their turn, in order
+    struct ObjFiber* run_queue;
+    struct ObjFiber* run_queue_tail;
+    // set by a native that switches fibers, done once it returns
+    struct ObjFiber* switch_to;
+    // call_fn calls in progress, fibers only switch in the outermost one
+    int calls;
+
+    /*
+     * Used up by backward jumps and calls. Once it runs out, the outermost
+     * run pauses at the next one and returns INTR_PAUSED, so hosts can
+     * bound how long a script runs. Practically unlimited by default.
+     */
+    int64_t fuel;
+    RunKind paused;
+
+    Program* programs;
+    // innermost function being compiled, its enclosing ones are roots too
+    struct Compiler* compiler;
 
-extern VmState vm;
+    Gc gc;
+
+    // state restored by reset_vm, i.e. the natives
+    Obj* base_objects;
+    Dict base_globals;
+
+    // destinations of print statements and error messages
+    FILE* out;
+    FILE* err;
+    /*
+     * Buffers the output of print statements. It is flushed when a script
+     * ends or fails. A SINK_FILE sink, the default, writes to out.
+     */
+    Sink sink;
+
+    // callbacks of fds, run once the script is done
+    Loop loop;
+
+    bool native_failed;
+    char native_err_msg[256];
+
+    JitMode jit_mode;
+    // NULL unless the ops and calls are counted
+    OpStats* opstats;
+    VmPhase phase;
+    // while compiled code runs, whose frame has a stale pc
+    bool in_jit;
+};
 
 typedef enum {
     INTR_OK,
     INTR_COMP_ERR,
-    INTR_RUN_ERR
+    INTR_RUN_ERR,
+    // out of fuel, the run goes on with continue_run
+    INTR_PAUSED
 } IntrResult;
 
-void init_vm();
-void free_vm();
-IntrResult interpret(char* program);
-IntrResult run_ops(Ops* ops);
+/*
+ * All interpreter state lives in the VmState, so independent VMs
+ * can run side by side, e.g. one per thread.
+ */
+void init_vm(VmState* vm);
+JitMode default_jit_mode();
+void free_vm(VmState* vm);
+VmState* create_vm();
+void destroy_vm(VmState* vm);
+/*
+ * Drop all script state, i.e. programs, globals and objects, but keep
+ * the natives and the allocated tables so that the VM can be reused.
+ */
+void reset_vm(VmState* vm);
+IntrResult interpret(VmState* vm, char* program);
+
+/*
+ * Compile once, run many times. Values returned from calls are owned by
+ * the VM and stay valid as long as they are reachable from the script.
+ */
+Program* compile_program(VmState* vm, const char* program);
+void free_program(VmState* vm, Program* prog);
+IntrResult run_program(VmState* vm, Program* prog);
+IntrResult call_fn(VmState* vm, Val callee, int argc, Val* args, Val* result);
+IntrResult call_global(VmState* vm, const char* name, int argc, Val* args, Val* result);
+/*
+ * Go on with the run that paused once vm->fuel ran out, which may pause
+ * again. A paused call returns its result here. The state of the run is
+ * kept until then, and the VM runs nothing else in between. Functions
+ * called by natives and ahead of time compiled code never pause.
+ */
+IntrResult continue_run(VmState* vm, Val* result);
+
+/*
+ * Register a native function as a global. Pass -1 as the arity to accept
+ * any number of arguments. Natives report errors with native_err and
+ * their return value is then ignored.
+ */
+void define_native(VmState* vm, const char* name, int arity, NativeFn fn);
+void native_err(VmState* vm, const char* format, ...);
+
+void push_val(VmState* vm, Val val);
+Val pop_val(VmState* vm);
 
-void push_val(Val val);
-Val pop();
+/*
+ * Op implementations shared by the interpreter and the JIT. The ones
+ * returning bool have reported a runtime error when they return false.
+ */
+void run_err(VmState* vm, const char* format, ...);
+bool is_falsey(Val val);
+bool are_equal(Val a, Val b);
+void concat(VmState* vm);
+void print_line(VmState* vm, Val val);
+void define_global(VmState* vm, ObjStr* name);
+bool get_global(VmState* vm, ObjStr* name);
+bool set_global(VmState* vm, ObjStr* name);
+bool call_cached(VmState* vm, CallCache* cache, int argc);
+/*
+ * Push a closure of fn. The captures are the (is_local, index) pairs
+ * that follow OP_CLOSURE.
+ */
+void push_closure(VmState* vm, CallFrame* frame, ObjFunc* fn, uint8_t* captures);
+// move the values of the upvalues at or above last off the stack
+void close_upvalues(VmState* vm, Val* last);
+void define_method(VmState* vm, ObjStr* name);
+bool inherit(VmState* vm);
+/*
+ * Property access through the inline cache of the site. invoke and
+ * super_invoke push a frame when the method is a closure.
+ */
+bool get_property(VmState* vm, ObjStr* name, PropCache* cache);
+bool set_property(VmState* vm, ObjStr* name, PropCache* cache);
+bool invoke(VmState* vm, ObjStr* name, int argc, PropCache* cache);
+bool get_super(VmState* vm, ObjStr* name);
+bool super_invoke(VmState* vm, ObjStr* name, int argc);
+// replace the count values on top of the stack with an array of them
+void make_array(VmState* vm, int count);
+bool get_index(VmState* vm);
+bool set_index(VmState* vm);
 
 #endif
@@ -0,0 +1,59 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+#include "../src/aot.h"
+
+static char* emit(const char* program, bool* ok) {
+    char* buf = NULL;
+    size_t size = 0;
+    VmState* vm = create_vm();
+    vm->err = fopen("/dev/null", "w");
+    FILE* out = open_memstream(&buf, &size);
+
+    *ok = emit_c(vm, program, out);
+
+    fclose(out);
+    fclose(vm->err);
+    destroy_vm(vm);
+    return buf;
+}
+
+void test_aot_should_emit_function_per_lox_function() {
+    BEGIN_TEST();
+
+    bool ok;
+    char* c = emit(
+        "fun outer() { var x = 1; fun inner() { return x; } return inner; }\n"
+        "print outer()();\n", &ok);
+    ASSERT(ok, "Expected the script to compile");
+    ASSERT(strstr(c, "static bool fn_0(VmState* vm) {") != NULL, "Expected the inner function");
+    ASSERT(strstr(c, "static bool fn_1(VmState* vm) {") != NULL, "Expected the outer function");
+    ASSERT(strstr(c, "static bool fn_2(VmState* vm) {") != NULL, "Expected the script function");
+    ASSERT(strstr(c, "int main()") != NULL, "Expected a main function");
+    // x is captured, so it stays on the VM stack
+    ASSERT(strstr(c, "slots[1] = k[0];") != NULL, "Expected the captured local in memory");
+
+    free(c);
+    END_TEST();
+}
+
+void test_aot_should_fail_on_compile_errors() {
+    BEGIN_TEST();
+
+    bool ok;
+    char* c = emit("print ;", &ok);
+    ASSERT(!ok, "Expected a compile error");
+
+    free(c);
+    END_TEST();
+}
+
+void run_all_test_aot() {
+    BEGIN_SUITE();
+
+    test_aot_should_emit_function_per_lox_function();
+    test_aot_should_fail_on_compile_errors();
+
+    END_SUITE();
+}
@@ -0,0 +1,186 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+static const char* rules =
+    "fun add(a, b) { return a + b; }\n"
+    "fun greet(name) { return \"hi \" + name; }\n"
+    "fun twice(x) { return double(double(x)); }\n"
+    "fun broken() { return fail(); }\n";
+
+static Val double_native(VmState* vm, int argc, Val* args) {
+    return MK_NUM_VAL(UNWRAP_NUM(args[0]) * 2);
+}
+
+static Val fail_native(VmState* vm, int argc, Val* args) {
+    native_err(vm, "fail was called");
+    return MK_NIL_VAL;
+}
+
+static VmState* setup_vm() {
+    VmState* vm = create_vm();
+    // keep error reports of the failure tests out of the test output
+    vm->err = fopen("/dev/null", "w");
+    define_native(vm, "double", 1, double_native);
+    define_native(vm, "fail", 0, fail_native);
+    return vm;
+}
+
+static void teardown_vm(VmState* vm) {
+    fclose(vm->err);
+    destroy_vm(vm);
+}
+
+void test_api_should_call_global_many_times() {
+    BEGIN_TEST();
+
+    VmState* vm = setup_vm();
+    Program* prog = compile_program(vm, rules);
+    ASSERT(prog != NULL, "Expected program to compile");
+    ASSERT(run_program(vm, prog) == INTR_OK, "Expected program to run");
+
+    for (int i = 0; i < 1000; i++) {
+        Val args[] = { MK_NUM_VAL(i), MK_NUM_VAL(1) };
+        Val result;
+        IntrResult res = call_global(vm, "add", 2, args, &result);
+        ASSERT(res == INTR_OK, "Expected call to succeed");
+        ASSERT(IS_NUM(result) && UNWRAP_NUM(result) == i + 1, "Expected sum of arguments");
+    }
+    ASSERT(vm->top == vm->stack, "Expected empty stack after calls");
+
+    teardown_vm(vm);
+    END_TEST();
+}
+
+void test_api_should_return_strings() {
+    BEGIN_TEST();
+
+    VmState* vm = setup_vm();
+    Program* prog = compile_program(vm, rules);
+    run_program(vm, prog);
+
+    Val args[] = { MK_OBJ_VAL((Obj*)cp_str(vm, "lox", 3)) };
+    Val result;
+    call_global(vm, "greet", 1, args, &result);
+    ASSERT(IS_STR(result), "Expected a string result");
+    ASSERT(strcmp(UNWRAP_STR_CHARS(result), "hi lox") == 0, "Expected concatenated string");
+
+    teardown_vm(vm);
+    END_TEST();
+}
+
+void test_api_should_call_natives_from_script() {
+    BEGIN_TEST();
+
+    VmState* vm = setup_vm();
+    Program* prog = compile_program(vm, rules);
+    run_program(vm, prog);
+
+    Val args[] = { MK_NUM_VAL(3) };
+    Val result;
+    call_global(vm, "twice", 1, args, &result);
+    ASSERT(UNWRAP_NUM(result) == 12, "Expected native to be called twice");
+
+    teardown_vm(vm);
+    END_TEST();
+}
+
+void test_api_should_report_errors_and_recover() {
+    BEGIN_TEST();
+
+    VmState* vm = setup_vm();
+    ASSERT(compile_program(vm, "fun (") == NULL, "Expected compile error");
+
+    Program* prog = compile_program(vm, rules);
+    run_program(vm, prog);
+
+    ASSERT(call_global(vm, "broken", 0, NULL, NULL) == INTR_RUN_ERR, "Expected native error");
+    ASSERT(call_global(vm, "missing", 0, NULL, NULL) == INTR_RUN_ERR, "Expected undefined function error");
+    Val args[] = { MK_NUM_VAL(1), MK_NUM_VAL(2) };
+    ASSERT(call_global(vm, "add", 1, args, NULL) == INTR_RUN_ERR, "Expected arity error");
+
+    Val result;
+    ASSERT(call_global(vm, "add", 2, args, &result) == INTR_OK, "Expected VM to recover after errors");
+    ASSERT(UNWRAP_NUM(result) == 3, "Expected sum after recovering");
+
+    teardown_vm(vm);
+    END_TEST();
+}
+
+void test_api_should_print_to_vm_output() {
+    BEGIN_TEST();
+
+    VmState* vm = setup_vm();
+    char* buf = NULL;
+    size_t size = 0;
+    vm->out = open_memstream(&buf, &size);
+
+    interpret(vm, "print 1 + 2;");
+    fclose(vm->out);
+    ASSERT(strcmp(buf, "3\n") == 0, "Expected print output in the VM output stream");
+    free(buf);
+
+    teardown_vm(vm);
+    END_TEST();
+}
+
+void test_api_should_keep_natives_after_reset() {
+    BEGIN_TEST();
+
+    VmState* vm = setup_vm();
+    ASSERT(interpret(vm, "var leftover = 1; var double = nil;") == INTR_OK, "Expected first script to run");
+    reset_vm(vm);
+
+    Val result;
+    ASSERT(call_global(vm, "leftover", 0, NULL, &result) == INTR_RUN_ERR, "Expected globals to be dropped");
+
+    Program* prog = compile_program(vm, rules);
+    run_program(vm, prog);
+    Val args[] = { MK_NUM_VAL(1) };
+    ASSERT(call_global(vm, "twice", 1, args, &result) == INTR_OK, "Expected natives to survive reset");
+    ASSERT(UNWRAP_NUM(result) == 4, "Expected native result after reset");
+
+    teardown_vm(vm);
+    END_TEST();
+}
+
+void test_api_should_intern_strings_only_when_needed() {
+    BEGIN_TEST();
+
+    VmState* vm = setup_vm();
+    char* buf = NULL;
+    size_t size = 0;
+    vm->out = open_memstream(&buf, &size);
+
+    interpret(vm, "var s = \"run\" + \"time\"; var m = Map(); m[\"ke\" + \"y\"] = 1;\n"
+                  "print s == \"runtime\"; print s == \"run\"; print m[\"k\" + \"ey\"];");
+    fclose(vm->out);
+    ASSERT(strcmp(buf, "true\nfalse\n1\n") == 0, "Expected runtime strings to compare by value");
+    free(buf);
+
+    Val s;
+    dict_get(&vm->globals, cp_str(vm, "s", 1), &s);
+    ASSERT(!UNWRAP_STR(s)->interned, "Expected the concatenation to stay un-interned");
+    ASSERT(dict_get_str(&vm->strings, "runtime", 7, calc_str_hash("runtime", 7)) != UNWRAP_STR(s),
+           "Expected the concatenation to stay out of the intern table");
+    ObjStr* key = dict_get_str(&vm->strings, "key", 3, calc_str_hash("key", 3));
+    ASSERT(key != NULL && key->interned, "Expected the map key to be interned");
+
+    teardown_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_api() {
+    BEGIN_SUITE();
+
+    test_api_should_call_global_many_times();
+    test_api_should_return_strings();
+    test_api_should_call_natives_from_script();
+    test_api_should_report_errors_and_recover();
+    test_api_should_print_to_vm_output();
+    test_api_should_keep_natives_after_reset();
+    test_api_should_intern_strings_only_when_needed();
+
+    END_SUITE();
+}
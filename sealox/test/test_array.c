@@ -0,0 +1,97 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+#include "../src/array.h"
+
+void test_array_should_index_and_grow() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "var a = [1, \"x\", nil]; a[2] = [true]; push(a, 4);\n"
+        "print a; print len(a); print a[2][0]; print pop(a); print len(a);\n", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "[1, x, [true], 4]\n4\ntrue\n4\n3\n") == 0, "Expected array ops to work");
+    free(out);
+
+    out = run_captured(vm, "var a = [1]; print a[1];", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected an out of bounds error");
+    ASSERT(strstr(out, "out of bounds") != NULL, "Expected the bounds in the message");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_array_kernels_should_match_scalar_loops() {
+    BEGIN_TEST();
+
+    // odd lengths exercise the scalar tails
+    for (int n = 1; n < 20; n++) {
+        double a[20];
+        double b[20];
+        double sum = 0;
+        double dot = 0;
+        double min = 1e9;
+        double max = -1e9;
+        for (int i = 0; i < n; i++) {
+            a[i] = (i * 7 % 11) - 5;
+            b[i] = i * 0.5;
+            sum += a[i];
+            dot += a[i] * b[i];
+            min = a[i] < min ? a[i] : min;
+            max = a[i] > max ? a[i] : max;
+        }
+        // small integers, so the order of the adds doesn't matter
+        ASSERT(f64_sum(a, n) == sum, "Expected the sum");
+        ASSERT(f64_dot(a, b, n) == dot, "Expected the dot product");
+        ASSERT(f64_min(a, n) == min, "Expected the min");
+        ASSERT(f64_max(a, n) == max, "Expected the max");
+
+        f64_axpy(2, a, b, n);
+        for (int i = 0; i < n; i++) {
+            ASSERT(b[i] == i * 0.5 + 2 * a[i], "Expected y += alpha * x");
+        }
+    }
+
+    END_TEST();
+}
+
+void test_array_should_sort() {
+    BEGIN_TEST();
+
+    // both the insertion sort and the radix sort
+    int sizes[] = { 10, 1000 };
+    for (int s = 0; s < 2; s++) {
+        int n = sizes[s];
+        double* a = (double*)malloc(sizeof(double) * n);
+        uint32_t x = 42;
+        for (int i = 0; i < n; i++) {
+            x = x * 1664525 + 1013904223;
+            a[i] = ((double)x - 2147483648.0) / 1000;
+        }
+        a[0] = -0.0;
+        a[1] = 0.0;
+
+        f64_sort(a, n);
+        for (int i = 1; i < n; i++) {
+            ASSERT(a[i - 1] <= a[i], "Expected ascending order");
+        }
+        free(a);
+    }
+
+    END_TEST();
+}
+
+void run_all_test_array() {
+    BEGIN_SUITE();
+
+    test_array_should_index_and_grow();
+    test_array_kernels_should_match_scalar_loops();
+    test_array_should_sort();
+
+    END_SUITE();
+}
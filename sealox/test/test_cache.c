@@ -0,0 +1,126 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+static const char* sites =
+    "fun one(x) { return x + 1; }\n"
+    "fun other(x) { return x + 2; }\n"
+    "fun two(a, b) { return a + b; }\n"
+    "fun call(f) { return f(1); }\n";
+
+static Val neg_native(VmState* vm, int argc, Val* args) {
+    return MK_NUM_VAL(-UNWRAP_NUM(args[0]));
+}
+
+static Val global(VmState* vm, const char* name) {
+    Val val = MK_NIL_VAL;
+    dict_get(&vm->globals, cp_str(vm, name, (int)strlen(name)), &val);
+    return val;
+}
+
+// the cache of the only call site of call
+static CallCache* call_site(VmState* vm) {
+    return &UNWRAP_CLOSURE(global(vm, "call"))->fn->ops.call_caches[0];
+}
+
+static double call_with(VmState* vm, const char* name, IntrResult* res) {
+    Val arg = global(vm, name);
+    Val result = MK_NIL_VAL;
+    *res = call_global(vm, "call", 1, &arg, &result);
+    return *res == INTR_OK ? UNWRAP_NUM(result) : 0;
+}
+
+void test_cache_should_hit_the_cached_callee() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    ASSERT(interpret(vm, (char*)sites) == INTR_OK, "Expected the script to run");
+
+    IntrResult res;
+    ASSERT(call_with(vm, "one", &res) == 2, "Expected the first call to miss and run");
+    CallCache* cache = call_site(vm);
+    ASSERT(cache->closure == UNWRAP_CLOSURE(global(vm, "one")), "Expected the callee to be cached");
+    ASSERT(call_with(vm, "one", &res) == 2, "Expected the hit to run the callee");
+    ASSERT(cache->closure == UNWRAP_CLOSURE(global(vm, "one")), "Expected the callee to stay cached");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_cache_should_replace_the_callee_on_a_miss() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    define_native(vm, "neg", 1, neg_native);
+    ASSERT(interpret(vm, (char*)sites) == INTR_OK, "Expected the script to run");
+
+    IntrResult res;
+    call_with(vm, "one", &res);
+    ASSERT(call_with(vm, "other", &res) == 3, "Expected the miss to run the new callee");
+    CallCache* cache = call_site(vm);
+    ASSERT(cache->closure == UNWRAP_CLOSURE(global(vm, "other")) && cache->native == NULL,
+           "Expected the new callee to replace the cached one");
+    ASSERT(call_with(vm, "neg", &res) == -1, "Expected the miss to run the native");
+    ASSERT(cache->closure == NULL && cache->native == UNWRAP_NATIVE_FN(global(vm, "neg")),
+           "Expected the native to replace the closure");
+    ASSERT(call_with(vm, "one", &res) == 2, "Expected the closure again after the native");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_cache_should_check_arity_at_a_cached_site() {
+    BEGIN_TEST();
+
+    char* buf = NULL;
+    size_t size = 0;
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    vm->err = open_memstream(&buf, &size);
+    ASSERT(interpret(vm, (char*)sites) == INTR_OK, "Expected the script to run");
+
+    IntrResult res;
+    call_with(vm, "one", &res);
+    call_with(vm, "two", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected an arity error");
+    fflush(vm->err);
+    ASSERT(strstr(buf, "Expected 2, but received 1") != NULL, "Expected the arity in the message");
+    CallCache* cache = call_site(vm);
+    ASSERT(cache->closure == UNWRAP_CLOSURE(global(vm, "one")), "Expected the failed call to keep the cache");
+    ASSERT(call_with(vm, "one", &res) == 2 && res == INTR_OK, "Expected the hit to run after the error");
+
+    fclose(vm->err);
+    free(buf);
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_cache_should_grow_with_the_sites() {
+    BEGIN_TEST();
+
+    Ops ops;
+    init_ops(&ops);
+    for (int i = 0; i < 1000; i++) {
+        ASSERT(append_call_cache(&ops) == i, "Expected the index of the call site");
+        ASSERT(append_prop_cache(&ops) == i, "Expected the index of the property site");
+    }
+    ASSERT(ops.call_cache_capacity >= 1000 && ops.call_cache_capacity < 2048, "Expected the capacity to double");
+    ASSERT(ops.prop_caches[999].slot == -1 && ops.prop_caches[999].shape == NULL, "Expected an empty cache");
+    free_ops(&ops);
+
+    END_TEST();
+}
+
+void run_all_test_cache() {
+    BEGIN_SUITE();
+
+    test_cache_should_hit_the_cached_callee();
+    test_cache_should_replace_the_callee_on_a_miss();
+    test_cache_should_check_arity_at_a_cached_site();
+    test_cache_should_grow_with_the_sites();
+
+    END_SUITE();
+}
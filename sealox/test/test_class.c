@@ -0,0 +1,118 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+#include "../src/class.h"
+
+void test_class_should_run_methods() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    IntrResult res;
+    char* out = run_captured(vm,
+        "class A { init(n) { this.n = n; } get() { return this.n; } name() { return \"A\"; } }\n"
+        "class B < A { name() { return \"B\" + super.name(); } }\n"
+        "var b = B(2); print b.get(); print b.name();\n"
+        "var m = b.get; b.n = 3; print m();\n"
+        "b.get = \"field\"; print b.get;\n", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "2\nBA\n3\nfield\n") == 0, "Expected methods, super calls and fields");
+
+    free(out);
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_class_should_share_shapes() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    Val val;
+    interpret(vm, "class P {} var a = P(); a.x = 1; a.y = 2; var b = P(); b.x = 3; b.y = 4;"
+                  "var c = P(); c.y = 5; c.x = 6;");
+    dict_get(&vm->globals, cp_str(vm, "a", 1), &val);
+    ObjInstance* a = UNWRAP_INSTANCE(val);
+    dict_get(&vm->globals, cp_str(vm, "b", 1), &val);
+    ObjInstance* b = UNWRAP_INSTANCE(val);
+    dict_get(&vm->globals, cp_str(vm, "c", 1), &val);
+    ObjInstance* c = UNWRAP_INSTANCE(val);
+
+    ASSERT(a->shape == b->shape, "Expected the same shape for the same fields in the same order");
+    ASSERT(a->shape != c->shape, "Expected another shape for another field order");
+    ASSERT(a->shape->field_count == 2, "Expected two fields");
+    ASSERT(shape_find(a->shape, cp_str(vm, "y", 1)) == 1, "Expected y at index 1");
+    ASSERT(shape_find(c->shape, cp_str(vm, "y", 1)) == 0, "Expected y at index 0");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_class_should_add_fields_through_the_cache() {
+    BEGIN_TEST();
+
+    // the second P and the third Q add their fields through the cached
+    // transitions, the Q in between sets a field it already has
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    IntrResult res;
+    char* out = run_captured(vm,
+        "class P { init(x, y) { this.x = x; this.y = y; } }\n"
+        "var a = P(1, 2); var b = P(3, 4); b.x = 5; print a.x + a.y; print b.x + b.y;\n"
+        "class Q {} fun set(q, x) { q.x = x; return q; }\n"
+        "var q = set(Q(), 1); var r = Q(); r.x = 0; set(r, 2); var s = set(Q(), 3);\n"
+        "print q.x; print r.x; print s.x; s.y = 4; print s.y;\n", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "3\n9\n1\n2\n3\n4\n") == 0, "Expected the added and set fields");
+    free(out);
+    destroy_vm(vm);
+
+    vm = create_vm();
+    Val val;
+    interpret(vm, "class P { init(x) { this.x = x; } } var a = P(1); var b = P(2);");
+    dict_get(&vm->globals, cp_str(vm, "a", 1), &val);
+    ObjInstance* a = UNWRAP_INSTANCE(val);
+    dict_get(&vm->globals, cp_str(vm, "b", 1), &val);
+    ObjInstance* b = UNWRAP_INSTANCE(val);
+    ASSERT(a->shape == b->shape, "Expected the cached transition to the same shape");
+    ASSERT(UNWRAP_NUM(b->fields[0]) == 2, "Expected the field of the cached add");
+    destroy_vm(vm);
+
+    END_TEST();
+}
+
+void test_class_should_report_errors() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    IntrResult res;
+    char* out = run_captured(vm, "class A {} print A().x;", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected a runtime error");
+    ASSERT(strstr(out, "Undefined property 'x'") != NULL, "Expected the property in the message");
+    free(out);
+
+    out = run_captured(vm, "var a = 1; a.x = 2;", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected a runtime error");
+    ASSERT(strstr(out, "Only instances have fields") != NULL, "Expected the field error");
+    free(out);
+
+    out = run_captured(vm, "print this;", &res);
+    ASSERT(res == INTR_COMP_ERR, "Expected a compile error");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_class() {
+    BEGIN_SUITE();
+
+    test_class_should_run_methods();
+    test_class_should_share_shapes();
+    test_class_should_add_fields_through_the_cache();
+    test_class_should_report_errors();
+
+    END_SUITE();
+}
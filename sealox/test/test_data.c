@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+
+// script strings can't hold quotes, so the documents are lines of a file
+static char* run_lines(VmState* vm, const char* path, const char* body, IntrResult* res) {
+    char program[512];
+    snprintf(program, sizeof(program),
+        "var r = open_lines(\"%s\"); var line = next_line(r);\n"
+        "while (line != nil) { %s line = next_line(r); }", path, body);
+    return run_captured(vm, program, res);
+}
+
+void test_data_json_should_build_values() {
+    BEGIN_TEST();
+
+    char path[TEMP_PATH_SIZE];
+    temp_file(path,
+        "{\"name\": \"sealox\", \"tags\": [1, 2.5, -3e2, true, false, null], \"nested\": {\"a\": []}}\n"
+        "  42 \n"
+        "[0, -0.5, 10, 0e1, 1.5E+2]\n"
+        "[\"q\\\"\\\\ \\u00e9\\ud83d\\ude00\", \"a string that is long enough to cross \\\" the end of a block\"]\n");
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_lines(vm, path, "var v = json_parse(line); if (v != 42 and len(v) == 3 and v[0] != \"q\") "
+                                    "{ print v[\"tags\"]; print v[\"nested\"]; } else { print v; }", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "[1, 2.5, -300, true, false, nil]\n{a: []}\n42\n[0, -0.5, 10, 0, 150]\n"
+                       "[q\"\\ \xc3\xa9\xf0\x9f\x98\x80, a string that is long enough to cross \" the end of a block]\n") == 0,
+           "Expected the documents to be parsed");
+    free(out);
+
+    destroy_vm(vm);
+    unlink(path);
+    END_TEST();
+}
+
+void test_data_json_should_reject_invalid_documents() {
+    BEGIN_TEST();
+
+    const char* docs[] = {"[1,]", "{\"a\" 1}", "[1 2]", "\"abc", "tru", "{\"a\": 1} x", "[", "\"\\x\"", "[\"\\ud800\"]",
+                          "[01]", "1.", "-01", "[1.e5]", ".5"};
+    VmState* vm = create_vm();
+    for (int i = 0; i < (int)(sizeof(docs) / sizeof(docs[0])); i++) {
+        char path[TEMP_PATH_SIZE];
+        char contents[64];
+        snprintf(contents, sizeof(contents), "%s\n", docs[i]);
+        temp_file(path, contents);
+        IntrResult res;
+        char* out = run_lines(vm, path, "json_parse(line);", &res);
+        ASSERT(res == INTR_RUN_ERR, "Expected an invalid document to fail");
+        ASSERT(strstr(out, "Invalid JSON at byte") != NULL, "Expected the offset in the message");
+        free(out);
+        unlink(path);
+    }
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_data_csv_should_read_rows() {
+    BEGIN_TEST();
+
+    char path[TEMP_PATH_SIZE];
+    temp_file(path, "id,name,score\r\n1,\"Smith, J\",3.5\r\n\r\n2,\"say \"\"hi\"\"\",-4e1\n"
+                    "3,\"multi\nline\",\n\"007\",,x\n4,last");
+    VmState* vm = create_vm();
+    // many rows per collection, so that the rows are traced while they grow
+    vm->gc.nursery_size = 1024;
+    char program[128];
+    snprintf(program, sizeof(program), "var rows = csv_rows(\"%s\"); print rows; print rows[1][2] + 1;", path);
+    IntrResult res;
+    char* out = run_captured(vm, program, &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "[[id, name, score], [1, Smith, J, 3.5], [2, say \"hi\", -40], [3, multi\nline, ], "
+                       "[007, , x], [4, last]]\n4.5\n") == 0, "Expected the rows of the file");
+    free(out);
+
+    destroy_vm(vm);
+    unlink(path);
+    END_TEST();
+}
+
+void run_all_test_data() {
+    BEGIN_SUITE();
+
+    test_data_json_should_build_values();
+    test_data_json_should_reject_invalid_documents();
+    test_data_csv_should_read_rows();
+
+    END_SUITE();
+}
@@ -148,6 +148,159 @@ void test_dict_should_get_str() {
     END_TEST();
 }
 
+static ObjStr* numbered_key(int i) {
+    char* chars = (char*)malloc(16);
+    int length = snprintf(chars, 16, "key%d", i);
+    return alloc_str_no_gc(chars, length);
+}
+
+void test_dict_should_shrink_when_mostly_empty() {
+    BEGIN_TEST();
+
+    Dict dict;
+    dict_init(&dict);
+
+    ObjStr* keys[1000];
+    for (int i = 0; i < 1000; i++) {
+        keys[i] = numbered_key(i);
+        dict_put(&dict, keys[i], MK_NUM_VAL(i));
+    }
+    ASSERT(!dict_shrink(&dict), "Expected a full dict to keep its capacity");
+    for (int i = 10; i < 1000; i++) {
+        dict_del(&dict, keys[i]);
+    }
+    ASSERT(dict.size == 10, "Expected ten entries");
+    ASSERT(dict_shrink(&dict), "Expected the dict to shrink");
+    ASSERT(dict.capacity <= 32, "Expected a small capacity");
+    ASSERT(dict.count == 10, "Expected the tombstones to be dropped");
+
+    Val val;
+    for (int i = 0; i < 10; i++) {
+        ASSERT(dict_get(&dict, keys[i], &val) && UNWRAP_NUM(val) == i, "Expected the entries to be kept");
+    }
+    for (int i = 0; i < 1000; i++) {
+        free(keys[i]->chars);
+        free(keys[i]);
+    }
+    dict_free(&dict);
+    END_TEST();
+}
+
+void test_dict_should_not_grow_from_tombstones() {
+    BEGIN_TEST();
+
+    Dict dict;
+    dict_init(&dict);
+
+    for (int i = 0; i < 5000; i++) {
+        ObjStr* key = numbered_key(i);
+        dict_put(&dict, key, MK_NIL_VAL);
+        dict_del(&dict, key);
+        free(key->chars);
+        free(key);
+    }
+    ASSERT(dict.size == 0, "Expected no entries");
+    ASSERT(dict.capacity <= 16, "Expected the tombstones to be dropped instead of growing");
+
+    dict_free(&dict);
+    END_TEST();
+}
+
+void test_vdict_should_put_and_get_any_hashable_key() {
+    BEGIN_TEST();
+
+    ValDict dict;
+    vdict_init(&dict);
+
+    ObjStr* str = alloc_str_no_gc("key", 3);
+    Val keys[] = { MK_NIL_VAL, MK_BOOL_VAL(true), MK_BOOL_VAL(false), MK_NUM_VAL(1), MK_OBJ_VAL((Obj*)str) };
+    for (int i = 0; i < 5; i++) {
+        ASSERT(vdict_put(&dict, keys[i], MK_NUM_VAL(i)), "Expected a new key");
+    }
+    ASSERT(!vdict_put(&dict, MK_NUM_VAL(1), MK_NUM_VAL(10)), "Expected an existing key");
+    ASSERT(dict.size == 5, "Expected five entries");
+
+    Val val;
+    ASSERT(vdict_get(&dict, MK_NIL_VAL, &val) && UNWRAP_NUM(val) == 0, "Expected nil as a key");
+    ASSERT(vdict_get(&dict, MK_NUM_VAL(1), &val) && UNWRAP_NUM(val) == 10, "Expected the updated value");
+    ASSERT(!vdict_get(&dict, MK_NUM_VAL(2), &val), "Expected no entry");
+    ASSERT(!is_hashable(MK_NUM_VAL(0.0 / 0.0)), "Expected NaN to not be hashable");
+
+    vdict_free(&dict);
+    END_TEST();
+}
+
+void test_vdict_should_reuse_tombstones() {
+    BEGIN_TEST();
+
+    ValDict dict;
+    vdict_init(&dict);
+
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < 50; i++) {
+            vdict_put(&dict, MK_NUM_VAL(i), MK_NUM_VAL(round));
+        }
+        for (int i = 0; i < 50; i++) {
+            ASSERT(vdict_del(&dict, MK_NUM_VAL(i)), "Expected to delete the key");
+        }
+    }
+    ASSERT(dict.size == 0, "Expected no entries");
+    ASSERT(dict.capacity <= 256, "Expected the tombstones to be reused");
+
+    vdict_free(&dict);
+    END_TEST();
+}
+
+void test_vdict_should_stay_bounded_under_churn() {
+    BEGIN_TEST();
+
+    ValDict dict;
+    vdict_init(&dict);
+
+    // every key is new, so no tombstone is ever reused
+    for (int i = 0; i < 100000; i++) {
+        vdict_put(&dict, MK_NUM_VAL(i), MK_NUM_VAL(i));
+        if (i >= 10) {
+            ASSERT(vdict_del(&dict, MK_NUM_VAL(i - 10)), "Expected to delete the key");
+        }
+    }
+    ASSERT(dict.size == 10, "Expected ten entries");
+    ASSERT(dict.capacity <= 64, "Expected the tombstones to be dropped instead of growing");
+
+    Val val;
+    for (int i = 100000 - 10; i < 100000; i++) {
+        ASSERT(vdict_get(&dict, MK_NUM_VAL(i), &val) && UNWRAP_NUM(val) == i, "Expected the entries to be kept");
+    }
+
+    vdict_free(&dict);
+    END_TEST();
+}
+
+void test_vdict_should_shrink_when_mostly_empty() {
+    BEGIN_TEST();
+
+    ValDict dict;
+    vdict_init(&dict);
+
+    for (int i = 0; i < 1000; i++) {
+        vdict_put(&dict, MK_NUM_VAL(i), MK_NUM_VAL(i));
+    }
+    int peak = dict.capacity;
+    for (int i = 10; i < 1000; i++) {
+        vdict_del(&dict, MK_NUM_VAL(i));
+    }
+    ASSERT(peak >= 1024, "Expected the dict to grow");
+    ASSERT(dict.capacity <= 32, "Expected the dict to shrink");
+
+    Val val;
+    for (int i = 0; i < 10; i++) {
+        ASSERT(vdict_get(&dict, MK_NUM_VAL(i), &val) && UNWRAP_NUM(val) == i, "Expected the entries to be kept");
+    }
+
+    vdict_free(&dict);
+    END_TEST();
+}
+
 void run_all_test_dict() {
     BEGIN_SUITE();
 
@@ -159,6 +312,12 @@ void run_all_test_dict() {
     test_dict_should_put_and_get_multiple_distinct();
     test_dict_should_put_and_get_multiple_conflicting();
     test_dict_should_get_str();
+    test_dict_should_shrink_when_mostly_empty();
+    test_dict_should_not_grow_from_tombstones();
+    test_vdict_should_put_and_get_any_hashable_key();
+    test_vdict_should_reuse_tombstones();
+    test_vdict_should_stay_bounded_under_churn();
+    test_vdict_should_shrink_when_mostly_empty();
 
     END_SUITE();
 }
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+
+void test_fiber_should_pass_values_through_resume_and_yield() {
+    BEGIN_TEST();
+
+    JitMode modes[] = {JIT_OFF, JIT_ALWAYS};
+    for (int m = 0; m < 2; m++) {
+        VmState* vm = create_vm();
+        vm->jit_mode = modes[m];
+        IntrResult res;
+        char* out = run_captured(vm,
+            "fun gen() { for (var i = 0; i < 3; i = i + 1) { print yield(i * 10); } return \"end\"; }\n"
+            "var g = Fiber(gen);\n"
+            "print resume(g, \"dropped\"); print resume(g, \"a\"); print resume(g, \"b\");\n"
+            "print fiber_done(g); print resume(g, \"c\"); print fiber_done(g);\n", &res);
+        ASSERT(res == INTR_OK, "Expected the script to run");
+        ASSERT(strcmp(out, "0\na\n10\nb\n20\nfalse\nc\nend\ntrue\n") == 0, "Expected the values to go back and forth");
+        free(out);
+
+        out = run_captured(vm, "resume(g);", &res);
+        ASSERT(res == INTR_RUN_ERR, "Expected a fiber that is done to fail");
+        ASSERT(strstr(out, "Cannot resume a fiber that is done") != NULL, "Expected the reason");
+        free(out);
+
+        destroy_vm(vm);
+    }
+    END_TEST();
+}
+
+void test_fiber_should_run_spawned_fibers_in_turns() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "fun worker(name, n) { fun body() { for (var i = 0; i < n; i = i + 1) { print name; yield(); } } return body; }\n"
+        "spawn(worker(\"a\", 3)); spawn(worker(\"b\", 2));\n"
+        "print \"main\"; yield(); print \"main again\";\n", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    // the queued fibers run before the script returns
+    ASSERT(strcmp(out, "main\na\nb\nmain again\na\nb\na\n") == 0, "Expected the fibers to take turns");
+    free(out);
+
+    out = run_captured(vm, "var f = spawn(worker(\"c\", 1)); resume(f);", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected a queued fiber not to be resumed");
+    ASSERT(strstr(out, "in the run queue") != NULL, "Expected the reason");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_fiber_should_recover_from_errors() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "fun bad() { yield(1); return nil + 1; }\n"
+        "fun outer() { var g = Fiber(bad); resume(g); resume(g); }\n"
+        "var f = Fiber(outer); spawn(outer); resume(f);\n", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected the error of the fiber to fail the script");
+    ASSERT(vm->fiber == vm->root && vm->top == vm->stack, "Expected to be back on an empty root");
+    free(out);
+
+    out = run_captured(vm, "print fiber_done(f); var g = Fiber(outer); print g;", &res);
+    ASSERT(res == INTR_OK, "Expected the VM to run scripts again");
+    ASSERT(strcmp(out, "true\n<fiber>\n") == 0, "Expected the fiber waiting for the failed one to be done");
+    ASSERT(vm->run_queue == NULL, "Expected the run queue to be dropped");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_fiber_should_keep_the_values_of_suspended_fibers() {
+    BEGIN_TEST();
+
+    JitMode modes[] = {JIT_OFF, JIT_ALWAYS};
+    for (int m = 0; m < 2; m++) {
+        VmState* vm = create_vm();
+        vm->jit_mode = modes[m];
+        IntrResult res;
+        char* out = run_captured(vm,
+            "fun keep() { var a = [0]; var b = [0]; while (true) { var got = yield(a[0]); a = b; b = [got]; } }\n"
+            "var gens = []; for (var i = 0; i < 50; i = i + 1) { var g = Fiber(keep); resume(g); push(gens, g); }\n", &res);
+        ASSERT(res == INTR_OK, "Expected the script to run");
+        free(out);
+        // the fibers are old, and their stacks only hold young values after the switches
+        gc_minor(vm);
+
+        out = run_captured(vm, "for (var i = 0; i < 50; i = i + 1) { resume(gens[i], i); }", &res);
+        gc_minor(vm);
+        free(out);
+        // and switches while a cycle marks
+        vm->gc.threshold = 0;
+        out = run_captured(vm,
+            "var sum = 0; for (var i = 0; i < 50; i = i + 1) { sum = sum + resume(gens[i], [i]); }\n"
+            "var more = 0; for (var i = 0; i < 50; i = i + 1) { more = more + resume(gens[i], 0)[0]; } print sum; print more;", &res);
+        ASSERT(res == INTR_OK, "Expected the script to run");
+        ASSERT(strcmp(out, "1225\n1225\n") == 0, "Expected the values on the stacks of the fibers to survive");
+        free(out);
+
+        destroy_vm(vm);
+    }
+    END_TEST();
+}
+
+void run_all_test_fiber() {
+    BEGIN_SUITE();
+
+    test_fiber_should_pass_values_through_resume_and_yield();
+    test_fiber_should_run_spawned_fibers_in_turns();
+    test_fiber_should_recover_from_errors();
+    test_fiber_should_keep_the_values_of_suspended_fibers();
+
+    END_SUITE();
+}
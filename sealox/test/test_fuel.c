@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+static VmState* quiet_vm(char** out, size_t* size) {
+    VmState* vm = create_vm();
+    vm->out = open_memstream(out, size);
+    vm->err = vm->out;
+    return vm;
+}
+
+// run with the given fuel per slice, returns the number of pauses
+static int run_slices(VmState* vm, const char* program, int64_t fuel, IntrResult* res) {
+    vm->fuel = fuel;
+    *res = interpret(vm, (char*)program);
+    int pauses = 0;
+    while (*res == INTR_PAUSED) {
+        pauses++;
+        vm->fuel = fuel;
+        *res = continue_run(vm, NULL);
+    }
+    vm->fuel = INT64_MAX;
+    return pauses;
+}
+
+void test_fuel_should_pause_loops_and_calls() {
+    BEGIN_TEST();
+
+    JitMode modes[] = {JIT_OFF, JIT_ALWAYS};
+    for (int m = 0; m < 2; m++) {
+        char* out = NULL;
+        size_t size = 0;
+        VmState* vm = quiet_vm(&out, &size);
+        vm->jit_mode = modes[m];
+        IntrResult res;
+        int pauses = run_slices(vm, "var i = 0; while (i < 10000) { i = i + 1; } print i;", 100, &res);
+        ASSERT(res == INTR_OK, "Expected the script to finish");
+        ASSERT(pauses >= 99 && pauses <= 101, "Expected a pause per 100 iterations");
+
+        pauses = run_slices(vm,
+            "fun depth(n) { if (n == 0) return 0; return depth(n - 1) + 1; }\n"
+            "class A { init() { this.n = 0; } step() { this.n = this.n + 1; return this; } }\n"
+            "print depth(50); print A().step().step().n;", 10, &res);
+        ASSERT(res == INTR_OK, "Expected the script to finish");
+        ASSERT(pauses >= 5, "Expected calls to use up fuel");
+
+        fflush(vm->out);
+        ASSERT(strcmp(out, "10000\n50\n2\n") == 0, "Expected the paused runs to go on where they were");
+        fclose(vm->out);
+        destroy_vm(vm);
+        free(out);
+    }
+    END_TEST();
+}
+
+void test_fuel_should_time_slice_vms() {
+    BEGIN_TEST();
+
+    char* out[2] = {NULL, NULL};
+    size_t size[2];
+    VmState* vms[2];
+    IntrResult res[2];
+    for (int i = 0; i < 2; i++) {
+        vms[i] = quiet_vm(&out[i], &size[i]);
+        interpret(vms[i], "fun count(n) { var sum = 0; for (var i = 0; i < n; i = i + 1) { sum = sum + i; } return sum; }");
+        vms[i]->fuel = 50;
+    }
+    // one of them runs away
+    res[0] = interpret(vms[0], "while (true) {}");
+    Val arg = MK_NUM_VAL(1000);
+    res[1] = call_global(vms[1], "count", 1, &arg, NULL);
+
+    Val sum = MK_NIL_VAL;
+    int slices = 0;
+    while (res[1] == INTR_PAUSED) {
+        ASSERT(res[0] == INTR_PAUSED, "Expected the endless loop to pause");
+        for (int i = 0; i < 2; i++) {
+            vms[i]->fuel = 50;
+        }
+        res[0] = continue_run(vms[0], NULL);
+        res[1] = continue_run(vms[1], &sum);
+        slices++;
+    }
+    ASSERT(res[1] == INTR_OK && UNWRAP_NUM(sum) == 499500, "Expected the paused call to return its result");
+    ASSERT(slices >= 19, "Expected the call to take many slices");
+
+    // the host gives up on the endless one, and the VM is usable again
+    reset_vm(vms[0]);
+    ASSERT(vms[0]->paused == RUN_NONE && vms[0]->top == vms[0]->stack, "Expected the paused run to be dropped");
+    vms[0]->fuel = INT64_MAX;
+    ASSERT(interpret(vms[0], "print 1;") == INTR_OK, "Expected the VM to run scripts again");
+
+    for (int i = 0; i < 2; i++) {
+        fclose(vms[i]->out);
+        destroy_vm(vms[i]);
+        free(out[i]);
+    }
+    END_TEST();
+}
+
+void test_fuel_should_pause_callbacks_and_fibers() {
+    BEGIN_TEST();
+
+    char* out = NULL;
+    size_t size = 0;
+    VmState* vm = quiet_vm(&out, &size);
+    IntrResult res;
+    int pauses = run_slices(vm,
+        "fun spin(n) { var i = 0; while (i < n) { i = i + 1; } return i; }\n"
+        "var p = pipe_fds();\n"
+        "fun on_read(fd) { read_fd(fd); close_fd(fd); print spin(500); }\n"
+        "on_readable(p[0], on_read); write_fd(p[1], \"x\");\n"
+        "fun task() { print spin(300); yield(); print spin(200); }\n"
+        "spawn(task); spawn(task);\n", 100, &res);
+    ASSERT(res == INTR_OK, "Expected the program to finish");
+    ASSERT(pauses >= 15, "Expected the fibers and the callback to pause");
+    ASSERT(vm->loop.count == 0, "Expected the callback to run");
+
+    fflush(vm->out);
+    ASSERT(strcmp(out, "300\n300\n200\n200\n500\n") == 0, "Expected the fibers and the callback to go on");
+    fclose(vm->out);
+    destroy_vm(vm);
+    free(out);
+    END_TEST();
+}
+
+void run_all_test_fuel() {
+    BEGIN_SUITE();
+
+    test_fuel_should_pause_loops_and_calls();
+    test_fuel_should_time_slice_vms();
+    test_fuel_should_pause_callbacks_and_fibers();
+
+    END_SUITE();
+}
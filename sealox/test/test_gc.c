@@ -0,0 +1,245 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+static int count_objects(VmState* vm) {
+    int count = 0;
+    for (Obj* obj = vm->objects; obj != NULL; obj = obj->next) {
+        count++;
+    }
+    for (Obj* obj = vm->gc.young; obj != NULL; obj = obj->next) {
+        count++;
+    }
+    return count;
+}
+
+static VmState* quiet_vm(char** buf, size_t* size) {
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    vm->out = open_memstream(buf, size);
+    vm->err = vm->out;
+    return vm;
+}
+
+void test_gc_should_free_unreachable_objects() {
+    BEGIN_TEST();
+
+    char* out = NULL;
+    size_t size = 0;
+    VmState* vm = quiet_vm(&out, &size);
+    interpret(vm, "class P { init(x) { this.x = x; } }\n"
+                  "var keep = [P(1), P(2)];\n"
+                  "for (var i = 0; i < 1000; i = i + 1) { var p = P(i); var a = [p, \"s\" + \"t\"]; }\n");
+    int before = count_objects(vm);
+    gc_collect(vm);
+    int after = count_objects(vm);
+    ASSERT(after < before - 2000, "Expected the garbage of the loop to be freed");
+
+    interpret(vm, "print keep[0].x + keep[1].x;");
+    fflush(vm->out);
+    ASSERT(strcmp(out, "3\n") == 0, "Expected the globals to survive");
+
+    fclose(vm->out);
+    destroy_vm(vm);
+    free(out);
+    END_TEST();
+}
+
+void test_gc_should_not_keep_interned_strings_alive() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    // map keys are interned
+    interpret(vm, "var k = \"ke\" + \"pt\"; var d = \"dro\" + \"pped\"; var m = Map();\n"
+                  "m[k] = 1; m[d] = 2; d = nil; m = nil;");
+    gc_collect(vm);
+
+    ObjStr* kept = cp_str(vm, "kept", 4);
+    Val val;
+    dict_get(&vm->globals, cp_str(vm, "k", 1), &val);
+    ASSERT(UNWRAP_STR(val) == kept, "Expected the reachable string to stay interned");
+    int count = 0;
+    for (Obj* obj = vm->objects; obj != NULL; obj = obj->next) {
+        if (obj->type == OBJ_STR && ((ObjStr*)obj)->length == 7
+                && memcmp(((ObjStr*)obj)->chars, "dropped", 7) == 0) {
+            count++;
+        }
+    }
+    ASSERT(count == 0, "Expected the unreachable string to be freed");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_gc_should_shrink_the_intern_table() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    interpret(vm, "var s = \"\"; var m;\n"
+                  "for (var i = 0; i < 20000; i = i + 1) { s = \"k\" + s; m = Map(); m[s] = i; }");
+    int peak = vm->strings.capacity;
+    ASSERT(peak < 65536, "Expected dead strings to leave the table while running");
+
+    interpret(vm, "s = nil;");
+    gc_collect(vm);
+    ASSERT(vm->strings.size < 100, "Expected the dead strings to be pruned");
+    ASSERT(vm->strings.capacity <= 256, "Expected the table to shrink");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_gc_should_keep_objects_stored_while_marking() {
+    BEGIN_TEST();
+
+    char* out = NULL;
+    size_t size = 0;
+    VmState* vm = quiet_vm(&out, &size);
+    // a cycle is in progress all the time, and makes little progress per slice
+    vm->gc.threshold = 0;
+    vm->gc.slice_work = 16;
+    IntrResult res = interpret(vm,
+        "class Box { init() { this.items = []; this.map = Map(); } }\n"
+        "var box = Box();\n"
+        "fun counter() { var n = \"\"; fun inc() { n = n + \"x\"; return n; } return inc; }\n"
+        "var inc = counter();\n"
+        "var last;\n"
+        "for (var i = 0; i < 2000; i = i + 1) {\n"
+        "  var s = \"v\" + \"\" + \"al\";\n"
+        "  push(box.items, [s]);\n"
+        "  box.map[i] = Box();\n"
+        "  box.field = s + \"!\";\n"
+        "  last = inc();\n"
+        "}\n");
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(vm->gc.pause_count > 100, "Expected the script to run during a cycle");
+    gc_collect(vm);
+
+    interpret(vm,
+        "var t = 0;\n"
+        "for (var i = 0; i < len(box.items); i = i + 1) { t = t + len(box.items[i][0]); }\n"
+        "print t; print len(box.map[1999].items); print box.field; print len(last);\n");
+    fflush(vm->out);
+    ASSERT(strcmp(out, "6000\n0\nval!\n2000\n") == 0, "Expected every stored object to survive");
+
+    fclose(vm->out);
+    destroy_vm(vm);
+    free(out);
+    END_TEST();
+}
+
+void test_gc_should_keep_objects_moved_into_traced_ones() {
+    BEGIN_TEST();
+
+    char* out = NULL;
+    size_t size = 0;
+    VmState* vm = quiet_vm(&out, &size);
+    // the gray stack is traced last in first out, so the flat array of
+    // boxes is traced before the list, which is traced one node at a time
+    interpret(vm,
+        "var list; var boxes = [];\n"
+        "for (var i = 0; i < 10000; i = i + 1) { list = [list, [i]]; }\n"
+        "for (var i = 0; i < 50; i = i + 1) { push(boxes, []); }\n"
+        "var roots = [list, boxes]; list = nil; boxes = nil;\n"
+        "fun node(i) { var n = roots[0]; for (var j = 0; j < i; j = j + 1) { n = n[0]; } return n; }\n");
+    vm->gc.threshold = 0;
+    vm->gc.slice_work = GC_SLICE_WORK;
+    // move values out of the far end of the list into black boxes
+    interpret(vm,
+        "for (var i = 0; i < 300; i = i + 1) { var junk = [i]; }\n"
+        "for (var i = 0; i < 50; i = i + 1) {\n"
+        "  var n = node(9999 - i); push(roots[1][i], n[1]); n[1] = nil;\n"
+        "}\n");
+    ASSERT(vm->gc.phase == GC_MARK, "Expected the values to move while marking");
+    gc_collect(vm);
+
+    interpret(vm,
+        "var t = 0;\n"
+        "for (var i = 0; i < 50; i = i + 1) { t = t + roots[1][i][0][0]; }\n"
+        "print t;\n");
+    fflush(vm->out);
+    ASSERT(strcmp(out, "1225\n") == 0, "Expected the moved objects to survive");
+
+    fclose(vm->out);
+    destroy_vm(vm);
+    free(out);
+    END_TEST();
+}
+
+void test_gc_should_keep_young_objects_stored_into_old_ones() {
+    BEGIN_TEST();
+
+    JitMode modes[] = {JIT_OFF, JIT_ALWAYS};
+    for (int m = 0; m < 2; m++) {
+        char* out = NULL;
+        size_t size = 0;
+        VmState* vm = quiet_vm(&out, &size);
+        vm->jit_mode = modes[m];
+        interpret(vm,
+            "class Box {}\n"
+            "var box = Box(); box.val = nil; var items = [];\n"
+            "fun hold() { var held; fun set(v) { held = v; } fun get() { return held; } box.set = set; box.get = get; }\n"
+            "hold();\n");
+        gc_minor(vm);
+        ASSERT(vm->gc.young == NULL, "Expected everything to be tenured");
+
+        // the old objects are the only way to the young ones
+        vm->gc.nursery_size = SIZE_MAX;
+        interpret(vm,
+            "for (var i = 0; i < 1000; i = i + 1) {\n"
+            "  box.val = [i]; push(items, [i]); box.set([i]);\n"
+            "}\n");
+        ASSERT(vm->gc.young != NULL, "Expected young objects");
+        int before = count_objects(vm);
+        gc_minor(vm);
+        ASSERT(vm->gc.young == NULL, "Expected the nursery to be empty");
+        ASSERT(count_objects(vm) < before - 1900, "Expected the young garbage to be freed");
+
+        interpret(vm, "print box.val[0] + len(items) + items[999][0] + box.get()[0];");
+        fflush(vm->out);
+        ASSERT(strcmp(out, "3997\n") == 0, "Expected the remembered objects to survive");
+
+        fclose(vm->out);
+        destroy_vm(vm);
+        free(out);
+    }
+    END_TEST();
+}
+
+void test_gc_should_record_pauses() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    interpret(vm, "for (var i = 0; i < 100; i = i + 1) { var a = [i]; }");
+    gc_collect(vm);
+    gc_collect(vm);
+
+    ASSERT(vm->gc.cycles >= 2, "Expected two cycles");
+    // the start of a cycle is a pause of its own
+    ASSERT(vm->gc.pause_count >= 4, "Expected the pauses to be recorded");
+    uint64_t total = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        total += vm->gc.pauses[i];
+    }
+    ASSERT(total == vm->gc.pause_count, "Expected every pause in the histogram");
+    ASSERT(gc_pause_percentile(vm, 0.5) <= gc_pause_percentile(vm, 0.99), "Expected ordered percentiles");
+    ASSERT(gc_pause_percentile(vm, 0.99) <= vm->gc.max_pause_ns, "Expected percentiles below the max");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_gc() {
+    BEGIN_SUITE();
+
+    test_gc_should_free_unreachable_objects();
+    test_gc_should_not_keep_interned_strings_alive();
+    test_gc_should_shrink_the_intern_table();
+    test_gc_should_keep_objects_stored_while_marking();
+    test_gc_should_keep_objects_moved_into_traced_ones();
+    test_gc_should_keep_young_objects_stored_into_old_ones();
+    test_gc_should_record_pauses();
+
+    END_SUITE();
+}
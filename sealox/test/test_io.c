@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+
+void test_io_should_read_lines() {
+    BEGIN_TEST();
+
+    char path[TEMP_PATH_SIZE];
+    temp_file(path, "first\r\n\nthe third line is long enough to be a view\nlast");
+    VmState* vm = create_vm();
+    char program[256];
+    snprintf(program, sizeof(program),
+        "var r = open_lines(\"%s\"); var n = 0; var line = next_line(r); var third;\n"
+        "while (line != nil) { n = n + 1; print len(line); if (n == 3) third = line; line = next_line(r); }\n"
+        "print n; print next_line(r); r = nil;", path);
+    IntrResult res;
+    char* out = run_captured(vm, program, &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "5\n0\n42\n4\n4\nnil\n") == 0, "Expected every line without its line break");
+    free(out);
+
+    // the line keeps the mapping alive
+    Val third;
+    dict_get(&vm->globals, cp_str(vm, "third", 5), &third);
+    ASSERT(UNWRAP_STR(third)->owner != NULL && UNWRAP_STR(third)->owner->type == OBJ_LINES,
+           "Expected long lines to be views of the file");
+    gc_collect(vm);
+    out = run_captured(vm, "print third;", &res);
+    ASSERT(strcmp(out, "the third line is long enough to be a view\n") == 0, "Expected the line to survive");
+    free(out);
+
+    destroy_vm(vm);
+    unlink(path);
+    END_TEST();
+}
+
+void test_io_should_report_missing_and_empty_files() {
+    BEGIN_TEST();
+
+    char path[TEMP_PATH_SIZE];
+    temp_file(path, "");
+    VmState* vm = create_vm();
+    char program[128];
+    snprintf(program, sizeof(program), "print next_line(open_lines(\"%s\"));", path);
+    IntrResult res;
+    char* out = run_captured(vm, program, &res);
+    ASSERT(res == INTR_OK && strcmp(out, "nil\n") == 0, "Expected no lines in an empty file");
+    free(out);
+
+    out = run_captured(vm, "open_lines(\"/nonexistent/file\");", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected an error for a missing file");
+    ASSERT(strstr(out, "/nonexistent/file") != NULL, "Expected the path in the message");
+    free(out);
+
+    destroy_vm(vm);
+    unlink(path);
+    END_TEST();
+}
+
+void run_all_test_io() {
+    BEGIN_SUITE();
+
+    test_io_should_read_lines();
+    test_io_should_report_missing_and_empty_files();
+
+    END_SUITE();
+}
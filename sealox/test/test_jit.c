@@ -0,0 +1,110 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+static const char* script =
+    "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+    "print fib(15);\n"
+    "fun counter() { var c = 0; fun inc() { c = c + 1; return c; } return inc; }\n"
+    "var inc = counter(); inc(); print inc();\n"
+    "var s = \"\"; for (var i = 0; i < 3; i = i + 1) { s = s + \"x\"; } print s;\n"
+    "var nan = 0 / 0; print nan == nan; print nan < 1; print !nil; print -2 * 3;\n"
+    "print clock() >= 0;\n";
+
+/*
+ * Run the script with the given JIT mode and return its output.
+ */
+static char* run_with_jit(JitMode mode, const char* program, IntrResult* res) {
+    char* buf = NULL;
+    size_t size = 0;
+    VmState* vm = create_vm();
+    vm->jit_mode = mode;
+    vm->out = open_memstream(&buf, &size);
+    vm->err = vm->out;
+
+    *res = interpret(vm, (char*)program);
+
+    fclose(vm->out);
+    destroy_vm(vm);
+    return buf;
+}
+
+void test_jit_should_match_interpreter() {
+    BEGIN_TEST();
+    if (!jit_supported()) {
+        END_TEST();
+        return;
+    }
+
+    IntrResult res;
+    char* expected = run_with_jit(JIT_OFF, script, &res);
+    ASSERT(res == INTR_OK, "Expected script to run in the interpreter");
+    char* actual = run_with_jit(JIT_ALWAYS, script, &res);
+    ASSERT(res == INTR_OK, "Expected script to run compiled");
+    ASSERT(strcmp(expected, actual) == 0, "Expected the same output with and without the JIT");
+
+    free(expected);
+    free(actual);
+    END_TEST();
+}
+
+void test_jit_should_report_errors() {
+    BEGIN_TEST();
+    if (!jit_supported()) {
+        END_TEST();
+        return;
+    }
+
+    const char* program =
+        "fun bad(a) { return a - \"x\"; }\n"
+        "fun wrap(a) { return bad(a) + 1; }\n"
+        "print wrap(1);\n";
+    IntrResult res;
+    char* expected = run_with_jit(JIT_OFF, program, &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected a runtime error in the interpreter");
+    char* actual = run_with_jit(JIT_ALWAYS, program, &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected a runtime error in compiled code");
+    ASSERT(strcmp(expected, actual) == 0, "Expected the same error report and stack trace");
+
+    free(expected);
+    free(actual);
+    END_TEST();
+}
+
+void test_jit_should_compile_hot_loops() {
+    BEGIN_TEST();
+    if (!jit_supported()) {
+        END_TEST();
+        return;
+    }
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_ON;
+    Program* prog = compile_program(vm,
+        "fun sum(n) { var s = 0; for (var i = 0; i < n; i = i + 1) { s = s + i; } return s; }\n");
+    run_program(vm, prog);
+
+    // the back edges alone make the function hot
+    Val args[] = { MK_NUM_VAL(2 * JIT_THRESHOLD) };
+    Val result;
+    ASSERT(call_global(vm, "sum", 1, args, &result) == INTR_OK, "Expected call to succeed");
+    ASSERT(UNWRAP_NUM(result) == (2.0 * JIT_THRESHOLD - 1) * JIT_THRESHOLD, "Expected sum of the loop");
+
+    Val sum;
+    dict_get(&vm->globals, cp_str(vm, "sum", 3), &sum);
+    ASSERT(UNWRAP_CLOSURE(sum)->fn->jit != NULL, "Expected the hot function to be compiled");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_jit() {
+    BEGIN_SUITE();
+
+    test_jit_should_match_interpreter();
+    test_jit_should_report_errors();
+    test_jit_should_compile_hot_loops();
+
+    END_SUITE();
+}
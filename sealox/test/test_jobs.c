@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+#include "../src/jobs.h"
+
+#define SCRIPTS 8
+#define LINES 200
+
+static char* read_all(FILE* file) {
+    long size = ftell(file);
+    char* buf = (char*)malloc(size + 1);
+    rewind(file);
+    buf[fread(buf, 1, size, file)] = '\0';
+    return buf;
+}
+
+// run_jobs writes to stdout and stderr, so both go to files meanwhile
+static bool run_jobs_captured(int n_jobs, const char** files, int n_files, char** out, char** err) {
+    fflush(stdout);
+    fflush(stderr);
+    FILE* out_file = tmpfile();
+    FILE* err_file = tmpfile();
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+    dup2(fileno(out_file), STDOUT_FILENO);
+    dup2(fileno(err_file), STDERR_FILENO);
+
+    bool ok = run_jobs(n_jobs, JIT_OFF, files, n_files);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    fseek(out_file, 0, SEEK_END);
+    fseek(err_file, 0, SEEK_END);
+    *out = read_all(out_file);
+    *err = read_all(err_file);
+    fclose(out_file);
+    fclose(err_file);
+    return ok;
+}
+
+void test_jobs_should_write_each_script_whole() {
+    BEGIN_TEST();
+
+    char paths[SCRIPTS][TEMP_PATH_SIZE];
+    const char* files[SCRIPTS];
+    for (int i = 0; i < SCRIPTS; i++) {
+        char program[128];
+        // each line tells the script and the line apart
+        snprintf(program, sizeof(program), "for (var i = 0; i < %d; i = i + 1) print %d + i;\n",
+                 LINES, i * 1000);
+        temp_file(paths[i], program);
+        files[i] = paths[i];
+    }
+
+    char* out;
+    char* err;
+    ASSERT(run_jobs_captured(4, files, SCRIPTS, &out, &err), "Expected the scripts to pass");
+
+    // the lines of a script follow each other, the scripts come in any order
+    bool seen[SCRIPTS] = {false};
+    char* line = out;
+    for (int i = 0; i < SCRIPTS; i++) {
+        int script = atoi(line) / 1000;
+        ASSERT(script >= 0 && script < SCRIPTS && !seen[script], "Expected the output of another script");
+        seen[script] = true;
+        for (int j = 0; j < LINES; j++) {
+            char expected[32];
+            int len = snprintf(expected, sizeof(expected), "%d\n", script * 1000 + j);
+            ASSERT(strncmp(line, expected, len) == 0, "Expected the next line of the same script");
+            line += len;
+        }
+    }
+    ASSERT(*line == '\0', "Expected nothing after the scripts");
+    ASSERT(strstr(err, "8 scripts (0 failed) on 4 jobs") != NULL, "Expected the report");
+
+    free(out);
+    free(err);
+    for (int i = 0; i < SCRIPTS; i++) {
+        unlink(paths[i]);
+    }
+    END_TEST();
+}
+
+void test_jobs_should_reset_the_vm_between_scripts() {
+    BEGIN_TEST();
+
+    char define[TEMP_PATH_SIZE];
+    char use[TEMP_PATH_SIZE];
+    char after[TEMP_PATH_SIZE];
+    temp_file(define, "var leak = \"leak\";\nclass Leak {}\nprint \"defined\";\n");
+    temp_file(use, "print leak;\n");
+    temp_file(after, "class Leak { init() { this.x = 1; } }\nprint Leak().x;\n");
+    const char* files[] = {define, use, after, "/tmp/sealox_jobs_missing"};
+
+    char* out;
+    char* err;
+    // one job, so every script runs on the VM of the one before
+    ASSERT(!run_jobs_captured(1, files, 4, &out, &err), "Expected the failures to fail the run");
+    ASSERT(strcmp(out, "defined\n1\n") == 0, "Expected the output of the scripts that passed");
+    ASSERT(strstr(err, "Unable to read undefined variable 'leak'") != NULL,
+           "Expected the global of the last script to be gone");
+    ASSERT(strstr(err, "Unable to read file \"/tmp/sealox_jobs_missing\"") != NULL, "Expected the read error");
+    ASSERT(strstr(err, "runtime error") != NULL && strstr(err, "read error") != NULL,
+           "Expected the status of each script");
+    ASSERT(strstr(err, "4 scripts (2 failed) on 1 jobs") != NULL, "Expected the failures to be counted");
+
+    free(out);
+    free(err);
+    unlink(define);
+    unlink(use);
+    unlink(after);
+    END_TEST();
+}
+
+void run_all_test_jobs() {
+    BEGIN_SUITE();
+
+    test_jobs_should_write_each_script_whole();
+    test_jobs_should_reset_the_vm_between_scripts();
+
+    END_SUITE();
+}
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+
+void test_loop_should_multiplex_connections() {
+    BEGIN_TEST();
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/sealox_loop_%d.sock", (int)getpid());
+    unlink(path);
+    char program[1024];
+    snprintf(program, sizeof(program),
+        "var server = listen_unix(\"%s\"); var accepted = 0; var echoed = 0;\n"
+        "fun on_client(fd) { var s = read_fd(fd); if (s == nil) close_fd(fd); else write_fd(fd, s); }\n"
+        "fun on_accept(fd) {\n"
+        "  var c = accept_fd(fd);\n"
+        "  if (c != nil) { on_readable(c, on_client); accepted = accepted + 1; if (accepted == 10) close_fd(server); }\n"
+        "}\n"
+        "fun on_echo(fd) { var s = read_fd(fd); if (len(s) > 0) { echoed = echoed + len(s); close_fd(fd); } }\n"
+        "on_readable(server, on_accept);\n"
+        "for (var i = 0; i < 10; i = i + 1) { var c = connect_unix(\"%s\"); write_fd(c, \"ping\"); on_readable(c, on_echo); }\n"
+        "print \"registered\";\n", path, path);
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm, program, &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "registered\n") == 0, "Expected the script to finish before the callbacks");
+    free(out);
+
+    out = run_captured(vm, "print accepted; print echoed;", &res);
+    ASSERT(strcmp(out, "10\n40\n") == 0, "Expected every connection to be served");
+    ASSERT(vm->loop.count == 0, "Expected no callbacks to be left");
+    free(out);
+
+    destroy_vm(vm);
+    unlink(path);
+    END_TEST();
+}
+
+void test_loop_should_keep_callbacks_alive() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "var p = pipe_fds();\n"
+        "fun watch() { var msg = \"got \"; fun on_read(fd) { print msg + read_fd(fd); close_fd(fd); } on_readable(p[0], on_read); }\n", &res);
+    free(out);
+
+    // the closure is only reachable from the loop
+    Val result;
+    ASSERT(call_global(vm, "watch", 0, NULL, &result) == INTR_OK, "Expected the callback to be registered");
+    gc_collect(vm);
+    out = run_captured(vm, "write_fd(p[1], \"it\");", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out, "got it\n") == 0, "Expected the callback to survive a collection");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_loop_should_stop_on_errors() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "var p = pipe_fds();\n"
+        "fun boom(fd) { return nil + 1; }\n"
+        "fun other(fd) { print \"not called\"; }\n"
+        "on_readable(p[0], boom); on_writable(p[1], other); unwatch(p[1]); on_writable(p[1], nil);\n"
+        "var q = pipe_fds(); on_readable(q[0], other);\n"
+        "write_fd(p[1], \"x\");\n", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected the failing callback to fail the script");
+    ASSERT(strstr(out, "in boom()") != NULL, "Expected the callback in the trace");
+    ASSERT(strstr(out, "not called") == NULL, "Expected the other callbacks to be dropped");
+    ASSERT(vm->loop.count == 0, "Expected no callbacks to be left");
+    free(out);
+
+    out = run_captured(vm, "on_readable(0, 1);", &res);
+    ASSERT(res == INTR_RUN_ERR && strstr(out, "Expected a function") != NULL, "Expected a callback to be checked");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_loop() {
+    BEGIN_SUITE();
+
+    test_loop_should_multiplex_connections();
+    test_loop_should_keep_callbacks_alive();
+    test_loop_should_stop_on_errors();
+
+    END_SUITE();
+}
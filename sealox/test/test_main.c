@@ -3,6 +3,26 @@
 
 int main() {
     run_all_test_dict();
+    run_all_test_api();
+    run_all_test_jit();
+    run_all_test_aot();
+    run_all_test_class();
+    run_all_test_array();
+    run_all_test_gc();
+    run_all_test_str();
+    run_all_test_sink();
+    run_all_test_num();
+    run_all_test_io();
+    run_all_test_data();
+    run_all_test_loop();
+    run_all_test_fiber();
+    run_all_test_fuel();
+    run_all_test_profile();
+    run_all_test_opstats();
+    run_all_test_perfctr();
+    run_all_test_cache();
+    run_all_test_quicken();
+    run_all_test_jobs();
 
     printf("ALL PASSED\n");
     return 0;
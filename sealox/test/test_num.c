@@ -0,0 +1,134 @@
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/num.h"
+
+static uint64_t next_rand(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// random bits, small integers, short decimals and values near ties
+static double rand_num(uint64_t* state, int i) {
+    uint64_t bits = next_rand(state);
+    double num;
+    switch (i % 4) {
+        case 0:
+            memcpy(&num, &bits, sizeof(num));
+            return num;
+        case 1:
+            return (double)(int64_t)(bits % 20000000) - 10000000;
+        case 2:
+            return (double)(bits % 1000000) * pow(10, (int)(next_rand(state) % 40) - 20);
+        default:
+            return ldexp((double)(bits >> 11), (int)(next_rand(state) % 2100) - 1100);
+    }
+}
+
+void test_num_should_format_like_printf() {
+    BEGIN_TEST();
+
+    double special[] = {0.0, -0.0, INFINITY, -INFINITY, NAN, 1e-5, 1e-4, 123456, 999999, 999999.5,
+                        1e6, 0.1 + 0.2, 5e-324, 1.7976931348623157e308, -0.0001, 5.5, 0.125};
+    char buf[NUM_BUF_SIZE];
+    char expected[64];
+    for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+        num_to_str(special[i], buf);
+        snprintf(expected, sizeof(expected), "%g", special[i]);
+        ASSERT(strcmp(buf, expected) == 0, "Expected the output of %g");
+    }
+
+    uint64_t state = 88172645463325252ull;
+    for (int i = 0; i < 200000; i++) {
+        double num = rand_num(&state, i);
+        int len = num_to_str(num, buf);
+        snprintf(expected, sizeof(expected), "%g", num);
+        ASSERT(strcmp(buf, expected) == 0 && len == (int)strlen(expected), "Expected the output of %g");
+    }
+
+    END_TEST();
+}
+
+void test_num_should_parse_like_strtod() {
+    BEGIN_TEST();
+
+    const char* cases[] = {
+        "0", "0.0", "1", "3.14159", "100", "0.1", "1e308", "1.7976931348623157e308",
+        "1.7976931348623159e308", "2.2250738585072014e-308", "4.9e-324", "2.4703282292062327e-324",
+        "2.4703282292062328e-324", "9007199254740993", "123456789012345678901234567890",
+        "00000.000001", "1e-400", "1e400", "18446744073709551615", "-7.2057594037927933e16",
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        double num;
+        double expected = strtod(cases[i], NULL);
+        ASSERT(str_to_num(cases[i], (int)strlen(cases[i]), &num), "Expected a number");
+        ASSERT(memcmp(&num, &expected, sizeof(num)) == 0, "Expected the result of strtod");
+    }
+
+    uint64_t state = 88172645463325252ull;
+    char buf[64];
+    for (int i = 0; i < 200000; i++) {
+        double num = rand_num(&state, i);
+        if (!isfinite(num)) {
+            continue;
+        }
+        int len = snprintf(buf, sizeof(buf), "%.*g", (int)(next_rand(&state) % 19) + 1, num);
+        double parsed;
+        double expected = strtod(buf, NULL);
+        ASSERT(str_to_num(buf, len, &parsed), "Expected a number");
+        ASSERT(memcmp(&parsed, &expected, sizeof(parsed)) == 0, "Expected the result of strtod");
+    }
+
+    const char* invalid[] = {"", "-", ".", "1e", "1e+", "abc", "1x", "--1", "1.5.2"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        double num;
+        ASSERT(!str_to_num(invalid[i], (int)strlen(invalid[i]), &num), "Expected no number");
+    }
+
+    END_TEST();
+}
+
+void test_num_should_ignore_the_locale() {
+    BEGIN_TEST();
+
+    // any locale with a decimal comma will do, if one is installed
+    const char* names[] = {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "nl_NL.UTF-8"};
+    const char* found = NULL;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]) && found == NULL; i++) {
+        found = setlocale(LC_NUMERIC, names[i]);
+    }
+    if (found == NULL || strcmp(localeconv()->decimal_point, ",") != 0) {
+        setlocale(LC_NUMERIC, "C");
+        END_TEST();
+        return;
+    }
+
+    char buf[NUM_BUF_SIZE];
+    // subnormals and long literals take the fallbacks
+    num_to_str(4.9406564584124654e-324, buf);
+    ASSERT(strcmp(buf, "4.94066e-324") == 0, "Expected a point in the subnormal");
+    num_to_str(0.5, buf);
+    ASSERT(strcmp(buf, "0.5") == 0, "Expected a point in the fast path");
+    const char* longer = "0.12345678901234567890123";
+    double num;
+    ASSERT(str_to_num(longer, (int)strlen(longer), &num) && num == 0.12345678901234568,
+           "Expected the digits after the point");
+    setlocale(LC_NUMERIC, "C");
+
+    END_TEST();
+}
+
+void run_all_test_num() {
+    BEGIN_SUITE();
+
+    test_num_should_format_like_printf();
+    test_num_should_parse_like_strtod();
+    test_num_should_ignore_the_locale();
+
+    END_SUITE();
+}
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+static const char* program =
+    "fun inc(x) { return x + 1; }\n"
+    "var s = 0; for (var i = 0; i < 10; i = i + 1) { s = inc(s); }\n";
+
+static ObjFunc* global_fn(VmState* vm, const char* name) {
+    Val val;
+    ObjStr* key = cp_str(vm, (char*)name, (int)strlen(name));
+    ASSERT(dict_get(&vm->globals, key, &val) && IS_CLOSURE(val), "Expected the function");
+    return UNWRAP_CLOSURE(val)->fn;
+}
+
+void test_opstats_should_count_ops_and_calls() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    ASSERT(interpret(vm, "var warm = 1;") == INTR_OK, "Expected the script to run");
+    ASSERT(vm->opstats == NULL, "Expected nothing to be counted by default");
+
+    start_opstats(vm, true);
+    ASSERT(interpret(vm, (char*)program) == INTR_OK, "Expected the script to run");
+    OpStats* stats = vm->opstats;
+    ASSERT(stats->counts[OP_CALL] == 10, "Expected a count per call");
+    // each of the two adds quickens once
+    ASSERT(stats->counts[OP_ADD] == 2 && stats->counts[OP_ADD_NUM] == 18, "Expected the quickened ops to count");
+    // back to the increment and from there to the condition
+    ASSERT(stats->counts[OP_LOOP] == 20, "Expected two per iteration");
+    ASSERT(stats->cycles[OP_CALL] > 0, "Expected the calls to be timed");
+    ASSERT(global_fn(vm, "inc")->calls == 10, "Expected the calls of the function");
+
+    // compiled code still counts its calls
+    start_opstats(vm, false);
+    vm->jit_mode = JIT_ALWAYS;
+    ASSERT(interpret(vm, "for (var i = 0; i < 5; i = i + 1) { inc(i); }") == INTR_OK, "Expected the script to run");
+    ASSERT(global_fn(vm, "inc")->calls == 5, "Expected the calls to start from zero");
+    ASSERT(vm->opstats->cycles[OP_CALL] == 0, "Expected nothing to be timed");
+
+    char* out = NULL;
+    size_t size = 0;
+    FILE* file = open_memstream(&out, &size);
+    write_opstats_json(vm, file);
+    fclose(file);
+    ASSERT(strstr(out, "{\"fn\": \"inc\", \"line\": 1, \"calls\": 5}") != NULL, "Expected the calls in the JSON");
+    free(out);
+
+    out = NULL;
+    file = open_memstream(&out, &size);
+    print_opstats(vm, file);
+    fclose(file);
+    ASSERT(strstr(out, "calls of 2 functions") != NULL && strstr(out, "inc:1") != NULL, "Expected the calls in the table");
+    free(out);
+
+    stop_opstats(vm);
+    ASSERT(interpret(vm, "inc(1);") == INTR_OK && vm->opstats == NULL, "Expected the counting to stop");
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_opstats() {
+    BEGIN_SUITE();
+
+    test_opstats_should_count_ops_and_calls();
+
+    END_SUITE();
+}
@@ -0,0 +1,165 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+#include "../src/perfctr.h"
+
+static VmPhase seen_phase;
+
+static Val phase_native(VmState* vm, int argc, Val* args) {
+    seen_phase = vm->phase;
+    return MK_NIL_VAL;
+}
+
+static double cpu_ms() {
+    return clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+void test_perfctr_should_track_the_phase() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    define_native(vm, "phase", 0, phase_native);
+    ASSERT(vm->phase == PHASE_HOST, "Expected the host to start");
+    ASSERT(interpret(vm, "fun f() { phase(); } f();") == INTR_OK, "Expected the script to run");
+    ASSERT(seen_phase == PHASE_RUN, "Expected natives to run in the run phase");
+    ASSERT(vm->phase == PHASE_HOST, "Expected the phase to go back to the host");
+    ASSERT(interpret(vm, "f(1);") == INTR_RUN_ERR && vm->phase == PHASE_HOST, "Expected failed runs to go back too");
+    ASSERT(interpret(vm, "f(;") == INTR_COMP_ERR && vm->phase == PHASE_HOST, "Expected failed compiles to go back too");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_perfctr_should_charge_phases_and_functions() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res = interpret(vm,
+        "fun hot(n) { var s = 0; for (var i = 0; i < n; i = i + 1) { s = s + i; } return s; }\n");
+    ASSERT(res == INTR_OK, "Expected the function to compile");
+    if (!start_perfctr(vm, 1000)) {
+        // e.g. not allowed in a container
+        ASSERT(errno != 0, "Expected the reason");
+        destroy_vm(vm);
+        END_TEST();
+        return;
+    }
+    ASSERT(!start_perfctr(vm, 1000), "Expected one at a time");
+
+    double start = cpu_ms();
+    Val arg = MK_NUM_VAL(20000);
+    while (cpu_ms() - start < 300 && res == INTR_OK) {
+        res = call_global(vm, "hot", 1, &arg, NULL);
+    }
+    stop_perfctr();
+    ASSERT(res == INTR_OK, "Expected the counted calls to run");
+
+    // the CPU time is there where the CPU has no counters
+    uint64_t run = 0;
+    uint64_t host = 0;
+    Counter counter = perfctr_phase(PHASE_RUN, CTR_CYCLES, &run) ? CTR_CYCLES : CTR_TASK_CLOCK;
+    ASSERT(perfctr_phase(PHASE_RUN, counter, &run) && perfctr_phase(PHASE_HOST, counter, &host), "Expected the counter");
+    ASSERT(run > 0 && run > host, "Expected most of it in the run phase");
+
+    char* out = NULL;
+    size_t size = 0;
+    FILE* file = open_memstream(&out, &size);
+    print_perfctr(vm, file);
+    fclose(file);
+    ASSERT(strstr(out, "  run ") != NULL && strstr(out, "  hot:1 ") != NULL, "Expected the phases and the function");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_perfctr_should_count_across_fiber_switches() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    // deeper on the root than a fiber has frames, and fibers end all the time
+    IntrResult res = interpret(vm,
+        "fun body() { yield(); return 1; }\n"
+        "fun churn(n) {\n"
+        "    if (n > 0) return churn(n - 1);\n"
+        "    for (var i = 0; i < 100; i = i + 1) { var f = Fiber(body); resume(f); resume(f); }\n"
+        "    return 0;\n"
+        "}\n");
+    ASSERT(res == INTR_OK, "Expected the functions to compile");
+    if (!start_perfctr(vm, 10000)) {
+        destroy_vm(vm);
+        END_TEST();
+        return;
+    }
+
+    Val arg = MK_NUM_VAL(MAX_FRAMES - 8);
+    double start = cpu_ms();
+    while (cpu_ms() - start < 300 && res == INTR_OK) {
+        res = call_global(vm, "churn", 1, &arg, NULL);
+    }
+    stop_perfctr();
+    ASSERT(res == INTR_OK, "Expected the counted calls to run");
+
+    char* out = NULL;
+    size_t size = 0;
+    FILE* file = open_memstream(&out, &size);
+    print_perfctr(vm, file);
+    fclose(file);
+    ASSERT(strstr(out, "[unknown]") == NULL, "Expected every counted frame to be known");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_perfctr_should_name_freed_functions() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    if (!start_perfctr(vm, 1000)) {
+        destroy_vm(vm);
+        END_TEST();
+        return;
+    }
+    IntrResult res = interpret(vm,
+        "fun gone(n) { var s = 0; for (var i = 0; i < n; i = i + 1) { s = s + i; } return s; }\n");
+    Val arg = MK_NUM_VAL(20000);
+    double start = cpu_ms();
+    while (cpu_ms() - start < 300 && res == INTR_OK) {
+        res = call_global(vm, "gone", 1, &arg, NULL);
+    }
+    ASSERT(res == INTR_OK, "Expected the counted calls to run");
+    // the function is garbage from here on
+    interpret(vm, "gone = nil;");
+    gc_collect(vm);
+    gc_collect(vm);
+    stop_perfctr();
+
+    char* out = NULL;
+    size_t size = 0;
+    FILE* file = open_memstream(&out, &size);
+    print_perfctr(vm, file);
+    fclose(file);
+    ASSERT(strstr(out, "[unknown]") == NULL && strstr(out, "  gone:1 ") != NULL,
+           "Expected the freed function to be known");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_perfctr() {
+    BEGIN_SUITE();
+
+    test_perfctr_should_track_the_phase();
+    test_perfctr_should_charge_phases_and_functions();
+    test_perfctr_should_count_across_fiber_switches();
+    test_perfctr_should_name_freed_functions();
+
+    END_SUITE();
+}
@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+#include "../src/profile.h"
+
+static double cpu_ms() {
+    return clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+void test_profile_should_fold_the_sampled_stacks() {
+    BEGIN_TEST();
+
+    JitMode modes[] = {JIT_OFF, JIT_ON};
+    for (int m = 0; m < 2; m++) {
+        VmState* vm = create_vm();
+        vm->jit_mode = modes[m];
+        IntrResult res = interpret(vm,
+            "fun hot(n) { var s = 0; for (var i = 0; i < n; i = i + 1) { s = s + i; } return s; }\n"
+            "fun outer() { return hot(20000); }\n");
+        ASSERT(res == INTR_OK, "Expected the functions to compile");
+
+        ASSERT(start_profile(vm, 1000), "Expected the profile to start");
+        ASSERT(!start_profile(vm, 1000), "Expected one profile at a time");
+        // samples are taken per CPU time
+        double start = cpu_ms();
+        while (cpu_ms() - start < 300 && res == INTR_OK) {
+            res = call_global(vm, "outer", 0, NULL, NULL);
+        }
+        stop_profile();
+        ASSERT(res == INTR_OK, "Expected the profiled script to run");
+
+        char* out = NULL;
+        size_t size = 0;
+        FILE* file = open_memstream(&out, &size);
+        ASSERT(write_profile(vm, file), "Expected the profile to be written");
+        fclose(file);
+
+        int samples = 0;
+        int hot = 0;
+        for (char* line = strtok(out, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+            char* count = strrchr(line, ' ');
+            ASSERT(count != NULL && atoi(count + 1) > 0, "Expected a count per stack");
+            samples += atoi(count + 1);
+            if (strncmp(line, "outer:2;hot:1 ", 14) == 0) {
+                hot += atoi(count + 1);
+            }
+        }
+        // the kernel may sample at its tick rate, less often than asked for
+        ASSERT(samples >= 10, "Expected a sample per few ms");
+        ASSERT(hot * 2 > samples, "Expected most samples in the loop");
+        free(out);
+        destroy_vm(vm);
+    }
+    END_TEST();
+}
+
+void test_profile_should_name_freed_and_compiled_functions() {
+    BEGIN_TEST();
+
+    JitMode modes[] = {JIT_OFF, JIT_ALWAYS};
+    for (int m = 0; m < 2; m++) {
+        VmState* vm = create_vm();
+        vm->jit_mode = modes[m];
+        ASSERT(start_profile(vm, 1000), "Expected the profile to start");
+        IntrResult res = interpret(vm,
+            "fun gone(n) {\n"
+            "    var s = 0;\n"
+            "    for (var i = 0; i < n; i = i + 1) {\n"
+            "        s = s + i;\n"
+            "    }\n"
+            "    return s;\n"
+            "}\n");
+        Val arg = MK_NUM_VAL(20000);
+        double start = cpu_ms();
+        while (cpu_ms() - start < 300 && res == INTR_OK) {
+            res = call_global(vm, "gone", 1, &arg, NULL);
+        }
+        ASSERT(res == INTR_OK, "Expected the profiled script to run");
+        // the function is garbage from here on
+        interpret(vm, "gone = nil;");
+        gc_collect(vm);
+        gc_collect(vm);
+        stop_profile();
+
+        char* out = NULL;
+        size_t size = 0;
+        FILE* file = open_memstream(&out, &size);
+        ASSERT(write_profile(vm, file), "Expected the profile to be written");
+        fclose(file);
+
+        ASSERT(strstr(out, "[unknown]") == NULL, "Expected the freed function to be known");
+        int samples = 0;
+        int loop = 0;
+        for (char* line = strtok(out, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+            int count = atoi(strrchr(line, ' ') + 1);
+            samples += count;
+            // not the line of the entry, where compiled code left its pc
+            if (strncmp(line, "gone:3 ", 7) == 0 || strncmp(line, "gone:4 ", 7) == 0) {
+                loop += count;
+            }
+        }
+        ASSERT(samples >= 10, "Expected a sample per few ms");
+        ASSERT(loop * 2 > samples, "Expected most samples on the lines of the loop");
+        free(out);
+        destroy_vm(vm);
+    }
+    END_TEST();
+}
+
+void test_profile_should_sample_across_fiber_switches() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    // deeper on the root than a fiber has frames, and fibers end all the time
+    IntrResult res = interpret(vm,
+        "fun body() { yield(); return 1; }\n"
+        "fun churn(n) {\n"
+        "    if (n > 0) return churn(n - 1);\n"
+        "    for (var i = 0; i < 100; i = i + 1) { var f = Fiber(body); resume(f); resume(f); }\n"
+        "    return 0;\n"
+        "}\n");
+    ASSERT(res == INTR_OK, "Expected the functions to compile");
+
+    ASSERT(start_profile(vm, 10000), "Expected the profile to start");
+    Val arg = MK_NUM_VAL(MAX_FRAMES - 8);
+    double start = cpu_ms();
+    while (cpu_ms() - start < 300 && res == INTR_OK) {
+        res = call_global(vm, "churn", 1, &arg, NULL);
+    }
+    stop_profile();
+    ASSERT(res == INTR_OK, "Expected the profiled script to run");
+
+    char* out = NULL;
+    size_t size = 0;
+    FILE* file = open_memstream(&out, &size);
+    ASSERT(write_profile(vm, file), "Expected the profile to be written");
+    fclose(file);
+    ASSERT(strstr(out, "[unknown]") == NULL, "Expected every sampled frame to be known");
+    free(out);
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_profile() {
+    BEGIN_SUITE();
+
+    test_profile_should_fold_the_sampled_stacks();
+    test_profile_should_name_freed_and_compiled_functions();
+    test_profile_should_sample_across_fiber_switches();
+
+    END_SUITE();
+}
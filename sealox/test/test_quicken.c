@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+static const char* ops =
+    "fun add(a, b) {\n"
+    "    return a + b;\n"
+    "}\n"
+    "fun less(a, b) { return a < b; }\n"
+    "var ab = \"ab\"; var cd = \"cd\";\n";
+
+// globals are rooted, unlike strings made here
+static Val global(VmState* vm, const char* name) {
+    Val val = MK_NIL_VAL;
+    dict_get(&vm->globals, cp_str(vm, name, (int)strlen(name)), &val);
+    return val;
+}
+
+static ObjFunc* global_fn(VmState* vm, const char* name) {
+    return UNWRAP_CLOSURE(global(vm, name))->fn;
+}
+
+// the position of the op, before the op rewrote itself
+static int site_of(ObjFunc* fn, uint8_t op) {
+    for (int pos = 0; pos < fn->ops.count; pos += op_length(&fn->ops, pos)) {
+        if (fn->ops.ops[pos] == op) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+static IntrResult call2(VmState* vm, const char* name, Val a, Val b, Val* result) {
+    Val args[] = {a, b};
+    return call_global(vm, name, 2, args, result);
+}
+
+static VmState* setup_vm(char** err, size_t* size) {
+    VmState* vm = create_vm();
+    vm->jit_mode = JIT_OFF;
+    vm->err = open_memstream(err, size);
+    ASSERT(interpret(vm, (char*)ops) == INTR_OK, "Expected the script to run");
+    return vm;
+}
+
+void test_quicken_should_follow_the_operand_types() {
+    BEGIN_TEST();
+
+    char* err = NULL;
+    size_t size = 0;
+    VmState* vm = setup_vm(&err, &size);
+    uint8_t* add = global_fn(vm, "add")->ops.ops;
+    int site = site_of(global_fn(vm, "add"), OP_ADD);
+    ASSERT(site >= 0, "Expected the generic op before the first run");
+
+    Val result;
+    ASSERT(call2(vm, "add", MK_NUM_VAL(1), MK_NUM_VAL(2), &result) == INTR_OK
+           && UNWRAP_NUM(result) == 3, "Expected the sum");
+    ASSERT(add[site] == OP_ADD_NUM, "Expected the number op after numbers");
+
+    ASSERT(call2(vm, "add", global(vm, "ab"), global(vm, "cd"), &result) == INTR_OK && IS_STR(result)
+           && strcmp(UNWRAP_STR(result)->chars, "abcd") == 0, "Expected the concatenation");
+    ASSERT(add[site] == OP_ADD_STR, "Expected the string op after strings");
+
+    ASSERT(call2(vm, "add", MK_NUM_VAL(3), MK_NUM_VAL(4), &result) == INTR_OK
+           && UNWRAP_NUM(result) == 7, "Expected the sum after strings");
+    ASSERT(add[site] == OP_ADD_NUM, "Expected the number op again");
+    ASSERT(size == 0, "Expected no errors");
+
+    fclose(vm->err);
+    free(err);
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_quicken_should_report_errors_after_deoptimizing() {
+    BEGIN_TEST();
+
+    char* err = NULL;
+    size_t size = 0;
+    VmState* vm = setup_vm(&err, &size);
+    uint8_t* add = global_fn(vm, "add")->ops.ops;
+    int site = site_of(global_fn(vm, "add"), OP_ADD);
+    uint8_t* less = global_fn(vm, "less")->ops.ops;
+    int less_site = site_of(global_fn(vm, "less"), OP_LESS);
+
+    Val result;
+    call2(vm, "add", MK_NUM_VAL(1), MK_NUM_VAL(2), &result);
+    Val str = global(vm, "ab");
+    ASSERT(call2(vm, "add", MK_NUM_VAL(1), str, &result) == INTR_RUN_ERR, "Expected a runtime error");
+    fflush(vm->err);
+    ASSERT(strstr(err, "Operands must be numbers\n[line 2] in add()\n") != NULL,
+           "Expected the error of the generic op at the line of the op");
+    ASSERT(add[site] == OP_ADD, "Expected the generic op after the error");
+    ASSERT(call2(vm, "add", MK_NUM_VAL(2), MK_NUM_VAL(2), &result) == INTR_OK
+           && UNWRAP_NUM(result) == 4, "Expected the sum after the error");
+
+    call2(vm, "less", MK_NUM_VAL(1), MK_NUM_VAL(2), &result);
+    ASSERT(less[less_site] == OP_LESS_NUM, "Expected the number comparison");
+    ASSERT(call2(vm, "less", str, str, &result) == INTR_RUN_ERR, "Expected a runtime error");
+    fflush(vm->err);
+    ASSERT(strstr(err, "Operands must be numbers\n[line 4] in less()\n") != NULL,
+           "Expected the error of the generic comparison");
+    ASSERT(less[less_site] == OP_LESS, "Expected the generic comparison after the error");
+
+    fclose(vm->err);
+    free(err);
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_quicken() {
+    BEGIN_SUITE();
+
+    test_quicken_should_follow_the_operand_types();
+    test_quicken_should_report_errors_after_deoptimizing();
+
+    END_SUITE();
+}
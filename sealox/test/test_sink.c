@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "tests.h"
+#include "../src/sealox.h"
+
+void test_sink_should_collect_output_in_memory() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    sink_free(&vm->sink);
+    sink_init_mem(&vm->sink);
+    // more than the initial buffer
+    interpret(vm, "for (var i = 0; i < 20000; i = i + 1) { print \"line \" + \"of output\"; }\nprint [1, true, nil];");
+
+    size_t size;
+    char* out = sink_take(&vm->sink, &size);
+    ASSERT(size == 20000 * 15 + 15, "Expected all of the output");
+    ASSERT(strcmp(out + size - 15, "[1, true, nil]\n") == 0, "Expected the output in order");
+    free(out);
+
+    interpret(vm, "print 1;");
+    out = sink_take(&vm->sink, &size);
+    ASSERT(strcmp(out, "1\n") == 0, "Expected only the output since the last take");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_sink_should_write_to_fds() {
+    BEGIN_TEST();
+
+    char path[] = "/tmp/sealox_sinkXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT(fd >= 0, "Expected a temporary file");
+    VmState* vm = create_vm();
+    sink_free(&vm->sink);
+    sink_init_fd(&vm->sink, fd);
+    interpret(vm,
+        "var s = \"0123456789abcdef\";\n"
+        "for (var i = 0; i < 13; i = i + 1) { s = s + s; }\n"
+        "print \"a\"; print s; print \"b\";\n");
+    destroy_vm(vm);
+
+    // a single print bigger than the buffer
+    size_t expected = 2 + 16 * 8192 + 1 + 2;
+    ASSERT(lseek(fd, 0, SEEK_END) == (off_t)expected, "Expected all of the output in the file");
+    char head[4] = {0};
+    char tail[4] = {0};
+    pread(fd, head, 3, 0);
+    pread(fd, tail, 3, expected - 3);
+    ASSERT(strcmp(head, "a\n0") == 0 && strcmp(tail, "\nb\n") == 0, "Expected the output in order");
+    close(fd);
+    unlink(path);
+
+    END_TEST();
+}
+
+void test_sink_should_flush_before_errors() {
+    BEGIN_TEST();
+
+    char* buf = NULL;
+    size_t size = 0;
+    VmState* vm = create_vm();
+    vm->out = open_memstream(&buf, &size);
+    vm->err = vm->out;
+    interpret(vm, "print 1; print 2; print -nil;");
+    fclose(vm->out);
+    ASSERT(strncmp(buf, "1\n2\nOperand", 11) == 0, "Expected the output before the error");
+    free(buf);
+
+    sink_free(&vm->sink);
+    sink_init_null(&vm->sink);
+    vm->out = NULL;
+    ASSERT(interpret(vm, "for (var i = 0; i < 10000; i = i + 1) { print i; }") == INTR_OK,
+           "Expected the null sink to drop the output");
+    ASSERT(vm->sink.count == 0, "Expected the null sink to copy nothing");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_sink_should_flush_the_stream_of_files() {
+    BEGIN_TEST();
+
+    char path[] = "/tmp/sealox_sinkXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT(fd >= 0, "Expected a temporary file");
+    FILE* file = fdopen(dup(fd), "w");
+    // held back by stdio until flushed
+    setvbuf(file, NULL, _IOFBF, 1 << 16);
+    Sink sink;
+    sink_init_file(&sink, file);
+    SINK_LIT(&sink, "out\n");
+    ASSERT(sink_flush(&sink), "Expected the flush to succeed");
+
+    char buf[8] = {0};
+    ASSERT(pread(fd, buf, sizeof(buf) - 1, 0) == 4 && strcmp(buf, "out\n") == 0,
+           "Expected the output in the file before the stream is closed");
+    sink_free(&sink);
+    fclose(file);
+    close(fd);
+    unlink(path);
+
+    END_TEST();
+}
+
+void run_all_test_sink() {
+    BEGIN_SUITE();
+
+    test_sink_should_collect_output_in_memory();
+    test_sink_should_write_to_fds();
+    test_sink_should_flush_before_errors();
+    test_sink_should_flush_the_stream_of_files();
+
+    END_SUITE();
+}
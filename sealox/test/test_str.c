@@ -0,0 +1,101 @@
+#include <string.h>
+#include "test_common.h"
+#include "tests.h"
+#include "test_util.h"
+#include "../src/sealox.h"
+
+static ObjStr* global_str(VmState* vm, const char* name) {
+    Val val;
+    dict_get(&vm->globals, cp_str(vm, name, strlen(name)), &val);
+    return UNWRAP_STR(val);
+}
+
+void test_str_natives_should_slice_and_search() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "var s = \"name,qualified.name.of.a.field,,x\";\n"
+        "var parts = split(s, \",\");\n"
+        "print parts; print sub(s, 5, 14); print find(s, \"of\"); print find(s, \"to\");\n"
+        "print byte(s, 0); print join(parts, \"; \"); print sub(s, 5, 14) == \"qualified\";\n", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    ASSERT(strcmp(out,
+        "[name, qualified.name.of.a.field, , x]\nqualified\n20\n-1\n110\n"
+        "name; qualified.name.of.a.field; ; x\ntrue\n") == 0, "Expected the natives to work");
+    free(out);
+
+    out = run_captured(vm, "print sub(\"abc\", 2, 4);", &res);
+    ASSERT(res == INTR_RUN_ERR, "Expected an out of bounds error");
+    ASSERT(strstr(out, "[0, 3]") != NULL, "Expected the bounds in the message");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_str_slices_should_share_bytes() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "var s = \"0123456789abcdefghijklmnopqrstuvwxyz\";\n"
+        "var long = sub(s, 2, 30); var inner = sub(long, 4, 24); var short = sub(s, 0, 3);\n"
+        "var m = Map(); var key = sub(s, 10, 36); m[key] = true;\n", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    free(out);
+
+    ObjStr* s = global_str(vm, "s");
+    ObjStr* inner = global_str(vm, "inner");
+    ASSERT(global_str(vm, "long")->owner == (Obj*)s, "Expected the slice to share the bytes");
+    ASSERT(inner->owner == (Obj*)s && inner->chars == s->chars + 6, "Expected slices of slices to share the root");
+    ASSERT(global_str(vm, "short")->owner == NULL, "Expected short slices to be copied");
+    ObjStr* key = global_str(vm, "key");
+    ASSERT(key->interned && key->owner == NULL, "Expected interned slices to own their bytes");
+
+    // the slice keeps its parent alive
+    out = run_captured(vm, "s = nil; long = nil;", &res);
+    free(out);
+    gc_collect(vm);
+    out = run_captured(vm, "print inner; print key;", &res);
+    ASSERT(strcmp(out, "6789abcdefghijklmnop\nabcdefghijklmnopqrstuvwxyz\n") == 0, "Expected the slices to survive");
+    free(out);
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void test_str_sub_should_not_pin_big_strings() {
+    BEGIN_TEST();
+
+    VmState* vm = create_vm();
+    IntrResult res;
+    char* out = run_captured(vm,
+        "var s = \"0123456789abcdef\";\n"
+        "for (var i = 0; i < 13; i = i + 1) { s = s + s; }\n"
+        "var piece = sub(s, 100, 200); var half = sub(s, 0, len(s) / 2); var lines = split(s, \"f\");\n", &res);
+    ASSERT(res == INTR_OK, "Expected the script to run");
+    free(out);
+
+    ASSERT(global_str(vm, "piece")->owner == NULL, "Expected a small piece of a big string to be copied");
+    ASSERT(global_str(vm, "half")->owner == (Obj*)global_str(vm, "s"), "Expected a big piece to be a slice");
+    Val lines;
+    dict_get(&vm->globals, cp_str(vm, "lines", 5), &lines);
+    ObjStr* line = UNWRAP_STR(UNWRAP_ARRAY(lines)->vals.vals[0]);
+    ASSERT(line->length == 15 && line->owner == NULL, "Expected short pieces to be copied");
+
+    destroy_vm(vm);
+    END_TEST();
+}
+
+void run_all_test_str() {
+    BEGIN_SUITE();
+
+    test_str_natives_should_slice_and_search();
+    test_str_slices_should_share_bytes();
+    test_str_sub_should_not_pin_big_strings();
+
+    END_SUITE();
+}
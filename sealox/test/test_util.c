@@ -0,0 +1,26 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "test_util.h"
+
+char* run_captured(VmState* vm, const char* program, IntrResult* res) {
+    char* buf = NULL;
+    size_t size = 0;
+    vm->out = open_memstream(&buf, &size);
+    vm->err = vm->out;
+
+    *res = interpret(vm, (char*)program);
+
+    fclose(vm->out);
+    return buf;
+}
+
+void temp_file(char* path, const char* contents) {
+    strcpy(path, "/tmp/sealox_test_XXXXXX");
+    int fd = mkstemp(path);
+    ASSERT(fd >= 0, "Expected a temporary file");
+    size_t length = strlen(contents);
+    ASSERT(write(fd, contents, length) == (ssize_t)length, "Expected the contents to be written");
+    close(fd);
+}
@@ -0,0 +1,14 @@
+#ifndef test_util_h
+#define test_util_h
+
+#include "../src/sealox.h"
+
+// big enough for the path of any temp_file
+#define TEMP_PATH_SIZE 32
+
+// run program on vm, its output and errors are returned, to be freed by the caller
+char* run_captured(VmState* vm, const char* program, IntrResult* res);
+// a temporary file with the given contents, to be unlinked by the caller
+void temp_file(char* path, const char* contents);
+
+#endif
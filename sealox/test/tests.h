@@ -2,5 +2,25 @@
 #define tests_h
 
 void run_all_test_dict();
+void run_all_test_api();
+void run_all_test_jit();
+void run_all_test_aot();
+void run_all_test_class();
+void run_all_test_array();
+void run_all_test_gc();
+void run_all_test_str();
+void run_all_test_sink();
+void run_all_test_num();
+void run_all_test_io();
+void run_all_test_data();
+void run_all_test_loop();
+void run_all_test_fiber();
+void run_all_test_fuel();
+void run_all_test_profile();
+void run_all_test_opstats();
+void run_all_test_perfctr();
+void run_all_test_cache();
+void run_all_test_quicken();
+void run_all_test_jobs();
 
 #endif